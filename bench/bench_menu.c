@@ -0,0 +1,2271 @@
+/*-------------------------------------------------------------------------
+ *
+ * bench_menu.c
+ *	  benchmark of menu driver with synthetic menu trees and event streams
+ *
+ * Builds menubar with tree of pulldown menus of specified shape (depth,
+ * fan-out, label length, share of CJK and emoji chars), and sends stream
+ * of key and mouse events to st_menu_driver. The stream is generated from
+ * seed, or it is read from file (one event per line: "c alt" or
+ * "c alt y x bstate" for mouse events, or binary log created by
+ * st_menu_record_start). ncurses writes to temporary file
+ * (default) or to pseudo terminal. For every event the latency of
+ * st_menu_driver and doupdate, the number of allocations (glibc only)
+ * and the number of bytes sent to terminal are measured.
+ *
+ * Usage: bench_menu [options]
+ *
+ *   -d depth      depth of menu tree (default 3)
+ *   -f fanout     number of items of every menu (default 8)
+ *   -l length     number of chars of labels (default 12)
+ *   -c percent    share of CJK chars in labels (default 0)
+ *   -e percent    share of emoji chars in labels (default 0)
+ *   -n events     number of generated events (default 10000)
+ *   -s seed       seed of generator (default 1)
+ *   -r file       replay events from file
+ *   -w file       write events to file
+ *   -S style      menu style (default ST_MENU_STYLE_MC)
+ *   -R rows       terminal rows (default 30)
+ *   -C cols       terminal columns (default 100)
+ *   -p            use pseudo terminal instead of temporary file
+ *   -g            use grid backend (nothing is sent to terminal)
+ *   -b            bytes per draw function (doupdate after every draw function)
+ *   -j            JSON output
+ *   -W            warm-up - send all events once before measuring
+ *   -z            fail when driver allocated memory (use with -W)
+ *   -k step       page step of pulldown menus (PageUp, PageDown keys), default
+ *                 is height of menu
+ *   -t            display scroll position on right border of pulldown menus
+ *   -M rows       pulldown menus with more items are wrapped to columns of
+ *                 rows items (max_rows of config)
+ *   -x interval   every interval events resize terminal and change style
+ *   -O file       copy output sent to terminal to file (not with -p)
+ *   -P            command palette - events are typed queries (1 .. 4 chars
+ *                 closed by escape), the palette is posted before query
+ *   -G            check grid backend - after every event the menu is posted by
+ *                 grid and ncurses backends, and the cells of grid are compared
+ *                 with ncurses screen (desktop is filled by text)
+ *   -L chunk      loading - pulldown menus of menubar are deferred, and their
+ *                 items are pushed by second thread in chunks of chunk items
+ *                 (nothing is pushed to last pulldown menu)
+ *   -F items      filter - first pulldown menu of menubar has items items and
+ *                 type-ahead filter, and it is opened before events. Events
+ *                 are typed queries (1 .. 4 chars), backspaces and escapes
+ *                 (escape is used only when query is not empty)
+ *   -K            check shortcuts - before events the texts of shortcuts from
+ *                 table are assigned to item of separate menu, and the keys
+ *                 are sent to driver (rejected texts with key, that should
+ *                 not to activate item). Items in submenu of disabled item
+ *                 should not be activated. Shortcuts of measured menu are
+ *                 enabled.
+ *   -B            check command bar - before events the command bar with three
+ *                 sets is posted (without menu), and it gets events function
+ *                 keys (with Alt) and mouse clicks. The selected commands are
+ *                 compared with commands found by sequential search. The set
+ *                 is switched every 16 events, and the switch should not to
+ *                 allocate memory. The terminal is reduced in second half of
+ *                 events.
+ *   -Y file       write precompiled tables of menu to file (variable
+ *                 bench_menu_precompiled)
+ *   -y            create menu from precompiled tables (bench_menu must be
+ *                 built with BENCH_PRECOMPILED and tables written by -Y)
+ *   -E interval   edit - every interval events other item than item under
+ *                 cursor is removed and inserted back, an item is inserted
+ *                 before item under cursor and removed, and item under cursor
+ *                 is replaced by same item (outside of measuring). It fails,
+ *                 when cursor is moved to other item, or when replace created
+ *                 window (window of menu should be reused)
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <fcntl.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "st_curses.h"
+#include "st_panel.h"
+#include "st_menu.h"
+
+typedef struct
+{
+	int		c;
+	bool	alt;
+	MEVENT	mevent;
+} BENCH_EVENT;
+
+typedef struct
+{
+	int		depth;
+	int		fanout;
+	int		label_length;
+	int		cjk_percent;
+	int		emoji_percent;
+	int		nevents;
+	unsigned int seed;
+	char   *replay_file;
+	char   *write_file;
+	int		style;
+	int		rows;
+	int		cols;
+	bool	use_pty;
+	bool	use_grid;
+	bool	draw_stats;
+	bool	json;
+	bool	warmup;
+	bool	zero_allocs;
+	bool	palette;
+	bool	check_grid;
+	bool	check_shortcuts;
+	bool	check_cmdbar;
+	int		loading_chunk;
+	int		filter_items;
+	int		edit_interval;
+	int		rebuild_interval;
+	int		page_step;
+	int		max_rows;
+	bool	scroll_thumb;
+	char   *dump_file;
+	char   *precompile_file;
+	bool	use_precompiled;
+} BENCH_OPTIONS;
+
+typedef struct
+{
+	int		fd;
+	bool	use_pty;
+	long	total;
+	FILE   *dump;					/* copy of output or NULL */
+} BENCH_OUTPUT;
+
+/*
+ * Producer of items of one deferred pulldown menu
+ */
+typedef struct
+{
+	struct ST_MENU *submenu;
+	ST_MENU_ITEM *items;				/* pushed items or NULL */
+	int		chunk;
+	bool	started;
+	pthread_t thread;
+} BENCH_LOADER;
+
+/*
+ * Location of item in menu templates
+ */
+typedef struct
+{
+	ST_MENU_ITEM *items;				/* template of menu with item */
+	int		offset;
+	int		parent_code;				/* code of item with submenu, 0 for menubar */
+} BENCH_ITEM_REF;
+
+#ifdef BENCH_PRECOMPILED
+
+extern ST_MENU_PRECOMPILED bench_menu_precompiled;
+
+#endif
+
+static unsigned int seed;
+
+static BENCH_ITEM_REF *item_refs = NULL;
+static int nitem_refs = 0;
+
+static BENCH_LOADER *loaders = NULL;
+static int nloaders = 0;
+
+static const char *stats_names[ST_MENU_STATS_COUNT] = {
+	"driver", "menubar", "pulldown", "shadow", "cmdbar"
+};
+
+/*
+ * Allocations counter. glibc allows to replace malloc, and all
+ * allocations (st_menu, ncurses, libc) are counted.
+ */
+#ifdef __GLIBC__
+
+#define HAVE_ALLOC_COUNTER
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long alloc_count = 0;
+
+void *
+malloc(size_t size)
+{
+	alloc_count += 1;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	alloc_count += 1;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	alloc_count += 1;
+	return __libc_realloc(ptr, size);
+}
+
+#else
+
+static long alloc_count = -1;
+
+#endif
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned int
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 8) & 0xffffff;
+}
+
+static int
+encode_utf8(wchar_t ucs, char *str)
+{
+	if (ucs < 0x80)
+	{
+		str[0] = ucs;
+		return 1;
+	}
+	else if (ucs < 0x800)
+	{
+		str[0] = 0xc0 | (ucs >> 6);
+		str[1] = 0x80 | (ucs & 0x3f);
+		return 2;
+	}
+	else if (ucs < 0x10000)
+	{
+		str[0] = 0xe0 | (ucs >> 12);
+		str[1] = 0x80 | ((ucs >> 6) & 0x3f);
+		str[2] = 0x80 | (ucs & 0x3f);
+		return 3;
+	}
+
+	str[0] = 0xf0 | (ucs >> 18);
+	str[1] = 0x80 | ((ucs >> 12) & 0x3f);
+	str[2] = 0x80 | ((ucs >> 6) & 0x3f);
+	str[3] = 0x80 | (ucs & 0x3f);
+
+	return 4;
+}
+
+/*
+ * Returns label with first char as accelerator
+ */
+static char *
+random_label(BENCH_OPTIONS *opts)
+{
+	char   *result = malloc(opts->label_length * 4 + 2);
+	char   *ptr = result;
+	int		i;
+
+	*ptr++ = '~';
+
+	for (i = 0; i < opts->label_length; i++)
+	{
+		int		kind = next_random() % 100;
+		wchar_t	ucs;
+
+		if (i == 0 || kind >= opts->cjk_percent + opts->emoji_percent)
+			ucs = (i == 0 ? 'A' : 'a') + next_random() % 26;
+		else if (kind < opts->cjk_percent)
+			ucs = 0x4e00 + next_random() % 0x5000;
+		else
+			ucs = 0x1f600 + next_random() % 0x50;
+
+		ptr += encode_utf8(ucs, ptr);
+
+		if (i == 0)
+			*ptr++ = '~';
+	}
+
+	*ptr = '\0';
+
+	return result;
+}
+
+/*
+ * Creates menu with fanout items, every item has submenu
+ * until depth is reached.
+ */
+static ST_MENU_ITEM *
+build_menu(BENCH_OPTIONS *opts, int level, int *code, int *nitems)
+{
+	ST_MENU_ITEM *items;
+	int		i;
+
+	items = calloc(opts->fanout + 1, sizeof(ST_MENU_ITEM));
+
+	for (i = 0; i < opts->fanout; i++)
+	{
+		ST_MENU_ITEM *item = &items[i];
+
+		*nitems += 1;
+
+		/* every fifth item of pulldown menu is separator */
+		if (level > 0 && i % 5 == 4)
+		{
+			item->text = "--";
+			item->code = -1;
+			continue;
+		}
+
+		item->text = random_label(opts);
+		item->code = (*code)++;
+
+		if (level > 0 && i % 3 == 0)
+			item->shortcut = "Ctrl-X";
+
+		if (level + 1 < opts->depth)
+			item->submenu = build_menu(opts, level + 1, code, nitems);
+	}
+
+	return items;
+}
+
+static void
+free_menu(ST_MENU_ITEM *items)
+{
+	ST_MENU_ITEM *item;
+
+	for (item = items; item->text; item++)
+	{
+		if (item->code != -1)
+			free(item->text);
+		if (item->submenu)
+			free_menu(item->submenu);
+	}
+
+	free(items);
+}
+
+/*
+ * Stores location of items in templates (used by edits)
+ */
+static void
+index_menu(ST_MENU_ITEM *items, int parent_code)
+{
+	int		i;
+
+	for (i = 0; items[i].text; i++)
+	{
+		int		code = items[i].code;
+
+		if (code > 0 && code < nitem_refs)
+		{
+			item_refs[code].items = items;
+			item_refs[code].offset = i;
+			item_refs[code].parent_code = parent_code;
+		}
+
+		if (items[i].submenu)
+			index_menu(items[i].submenu, code);
+	}
+}
+
+/*
+ * Returns true, when the item under cursor has code
+ */
+static bool
+cursor_is_on(struct ST_MENU *menu, int code)
+{
+	ST_MENU_ITEM *item;
+	bool		activated;
+
+	/* the draw sets selected item to item under cursor */
+	st_menu_post(menu);
+	item = st_menu_selected_item(&activated);
+
+	return item && item->code == code;
+}
+
+/*
+ * Removes other item than item under cursor and inserts it back (the remove
+ * is first change of menu, that doesn't own its items yet), inserts item
+ * before item under cursor and removes it, and replaces item under cursor
+ * by same item. The cursor should to stay on same item, and the replace of
+ * item by item of same size should not to create window again. Returns
+ * number of failed checks.
+ */
+static long
+edit_menu(struct ST_MENU *menu)
+{
+	static ST_MENU_ITEM inserted = {"~I~nserted item", 0, NULL, 0, 0, 0, NULL};
+	ST_MENU_ITEM *item;
+	BENCH_ITEM_REF *ref;
+	struct ST_MENU *edited;
+	ST_MENU_TRACE_COUNTERS counters;
+	bool		activated;
+	long		windows;
+	long		errors = 0;
+	int			code;
+	int			other;
+	int			nitems = 0;
+	int			i;
+
+	st_menu_post(menu);
+	item = st_menu_selected_item(&activated);
+
+	if (!item || item->code <= 0 || item->code >= nitem_refs)
+		return 0;
+
+	code = item->code;
+	ref = &item_refs[code];
+
+	edited = ref->parent_code ? st_menu_get_submenu(menu, ref->parent_code) : menu;
+	if (!edited)
+		return 0;
+
+	while (ref->items[nitems].text)
+		nitems++;
+
+	/* last item of menu cannot be removed */
+	if (nitems > 1)
+	{
+		/* prefer item without submenu, the submenu tree is created again */
+		other = ref->offset > 0 ? 0 : 1;
+		for (i = 0; i < nitems; i++)
+			if (i != ref->offset && !ref->items[i].submenu)
+			{
+				other = i;
+				break;
+			}
+
+		if (!st_menu_remove_item(edited, other))
+			errors += 1;
+		else if (!cursor_is_on(menu, code))
+			errors += 1;
+
+		if (!st_menu_insert_item(edited, other, &ref->items[other]))
+			errors += 1;
+		else if (!cursor_is_on(menu, code))
+			errors += 1;
+	}
+
+	if (!st_menu_insert_item(edited, ref->offset, &inserted))
+		errors += 1;
+	else if (!cursor_is_on(menu, code))
+		errors += 1;
+
+	if (!st_menu_remove_item(edited, ref->offset))
+		errors += 1;
+	else if (!cursor_is_on(menu, code))
+		errors += 1;
+
+	st_menu_trace_get_counters(&counters);
+	windows = counters.windows;
+
+	/* item with submenu gets new submenu */
+	if (!st_menu_replace_item(edited, ref->offset, &ref->items[ref->offset]))
+		errors += 1;
+	else if (!ref->items[ref->offset].submenu)
+	{
+		st_menu_trace_get_counters(&counters);
+		if (counters.windows != windows)
+			errors += 1;
+	}
+
+	if (!cursor_is_on(menu, code))
+		errors += 1;
+
+	doupdate();
+
+	return errors;
+}
+
+/*
+ * Pushes items of pulldown menu in chunks. Small delay allows to apply
+ * some chunks by driver before next chunk is pushed.
+ */
+static void *
+loader_thread(void *data)
+{
+	BENCH_LOADER *loader = (BENCH_LOADER *) data;
+	struct timespec delay = {0, 100000};
+	int		nitems = 0;
+	int		i;
+
+	if (loader->items)
+		while (loader->items[nitems].text)
+			nitems++;
+
+	for (i = 0; i < nitems; i += loader->chunk)
+	{
+		int		n = nitems - i < loader->chunk ? nitems - i : loader->chunk;
+
+		nanosleep(&delay, NULL);
+		st_menu_push_items(loader->submenu, loader->items + i, n, i + n == nitems);
+	}
+
+	if (nitems == 0)
+		st_menu_push_items(loader->submenu, NULL, 0, true);
+
+	return NULL;
+}
+
+/*
+ * Fill function of deferred pulldown menu - starts producer thread
+ */
+static void
+loader_fill(struct ST_MENU *submenu, int code, void *data)
+{
+	BENCH_LOADER *loader = (BENCH_LOADER *) data;
+
+	(void) code;
+
+	loader->submenu = submenu;
+
+	if (pthread_create(&loader->thread, NULL, loader_thread, loader) != 0)
+	{
+		fprintf(stderr, "cannot to create thread\n");
+		exit(1);
+	}
+
+	loader->started = true;
+}
+
+/*
+ * Declares pulldown menus of menubar as deferred
+ */
+static void
+loaders_set(BENCH_OPTIONS *opts, struct ST_MENU *menu, ST_MENU_ITEM *menubar)
+{
+	int		i;
+
+	if (!loaders)
+	{
+		while (menubar[nloaders].text)
+			nloaders++;
+
+		loaders = calloc(nloaders, sizeof(BENCH_LOADER));
+	}
+
+	for (i = 0; i < nloaders; i++)
+	{
+		if (!menubar[i].submenu)
+			continue;
+
+		loaders[i].items = i + 1 < nloaders ? menubar[i].submenu : NULL;
+		loaders[i].chunk = opts->loading_chunk;
+
+		st_menu_set_deferred(menu, menubar[i].code, loader_fill, &loaders[i]);
+	}
+}
+
+/*
+ * Waits on producers. It should be called before menu is freed.
+ */
+static void
+loaders_join(void)
+{
+	int		i;
+
+	for (i = 0; i < nloaders; i++)
+	{
+		if (loaders[i].started)
+		{
+			pthread_join(loaders[i].thread, NULL);
+			loaders[i].started = false;
+		}
+	}
+}
+
+/*
+ * Generates mix of navigation keys, accelerators and mouse clicks
+ */
+static void
+generate_events(BENCH_OPTIONS *opts, BENCH_EVENT *events)
+{
+	int		i;
+
+	for (i = 0; i < opts->nevents; i++)
+	{
+		BENCH_EVENT *ev = &events[i];
+		int		kind = next_random() % 100;
+
+		memset(ev, 0, sizeof(BENCH_EVENT));
+
+		if (kind < 26)
+			ev->c = KEY_DOWN;
+		else if (kind < 36)
+			ev->c = KEY_UP;
+		else if (kind < 38)
+			ev->c = KEY_NPAGE;
+		else if (kind < 40)
+			ev->c = KEY_PPAGE;
+		else if (kind < 52)
+			ev->c = KEY_RIGHT;
+		else if (kind < 60)
+			ev->c = KEY_LEFT;
+		else if (kind < 65)
+			ev->c = KEY_HOME;
+		else if (kind < 70)
+			ev->c = KEY_END;
+		else if (kind < 74)
+			ev->c = ST_MENU_ESCAPE;
+		else if (kind < 78)
+			ev->c = '\n';
+		else if (kind < 90)
+		{
+			ev->c = 'a' + next_random() % 26;
+			ev->alt = next_random() % 3 == 0;
+		}
+		else
+		{
+			/* mouse click - press and release on same position */
+			ev->c = KEY_MOUSE;
+			ev->mevent.y = next_random() % (next_random() % 4 == 0 ? opts->rows : 2 + opts->fanout);
+			ev->mevent.x = next_random() % opts->cols;
+			ev->mevent.bstate = BUTTON1_PRESSED;
+
+			if (i + 1 < opts->nevents)
+			{
+				events[i + 1] = *ev;
+				events[i + 1].mevent.bstate = BUTTON1_RELEASED;
+				i += 1;
+			}
+		}
+	}
+}
+
+/*
+ * Generates queries of filter. Every query has 1 .. 4 chars, and then
+ * some chars are removed by backspace. Escape cancels not empty query
+ * (escape closes menu, when query is empty).
+ */
+static void
+generate_filter_events(BENCH_OPTIONS *opts, BENCH_EVENT *events)
+{
+	int		i = 0;
+
+	while (i < opts->nevents)
+	{
+		int		length = 1 + next_random() % 4;
+		int		nremoved = next_random() % (length + 1);
+		int		j;
+
+		for (j = 0; j < length && i < opts->nevents; j++)
+		{
+			memset(&events[i], 0, sizeof(BENCH_EVENT));
+			events[i++].c = 'a' + next_random() % 26;
+		}
+
+		for (j = 0; j < nremoved && i < opts->nevents; j++)
+		{
+			memset(&events[i], 0, sizeof(BENCH_EVENT));
+			events[i++].c = KEY_BACKSPACE;
+		}
+
+		if (nremoved < length && i < opts->nevents)
+		{
+			memset(&events[i], 0, sizeof(BENCH_EVENT));
+			events[i++].c = ST_MENU_ESCAPE;
+		}
+	}
+}
+
+/*
+ * Generates queries of command palette. Every query has 1 .. 4 chars, and
+ * it is closed by escape.
+ */
+static void
+generate_palette_events(BENCH_OPTIONS *opts, BENCH_EVENT *events)
+{
+	int		i = 0;
+
+	while (i < opts->nevents)
+	{
+		int		length = 1 + next_random() % 4;
+		int		j;
+
+		for (j = 0; j < length && i < opts->nevents; j++)
+		{
+			memset(&events[i], 0, sizeof(BENCH_EVENT));
+			events[i++].c = 'a' + next_random() % 26;
+		}
+
+		if (i < opts->nevents)
+		{
+			memset(&events[i], 0, sizeof(BENCH_EVENT));
+			events[i++].c = ST_MENU_ESCAPE;
+		}
+	}
+}
+
+static int
+read_events(char *filename, BENCH_EVENT **events)
+{
+	FILE   *f;
+	char	line[256];
+	int		size = 1024;
+	int		n = 0;
+
+	f = fopen(filename, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "cannot to open file \"%s\"\n", filename);
+		exit(1);
+	}
+
+	*events = malloc(size * sizeof(BENCH_EVENT));
+
+	/* binary log created by st_menu_record_start */
+	if (st_menu_replay_start(f))
+	{
+		BENCH_EVENT	ev;
+
+		memset(&ev, 0, sizeof(BENCH_EVENT));
+
+		while (st_menu_replay_next(&ev.c, &ev.alt, &ev.mevent, false))
+		{
+			if (n == size)
+			{
+				size *= 2;
+				*events = realloc(*events, size * sizeof(BENCH_EVENT));
+			}
+
+			(*events)[n++] = ev;
+		}
+
+		fclose(f);
+
+		return n;
+	}
+
+	rewind(f);
+
+	while (fgets(line, sizeof(line), f))
+	{
+		BENCH_EVENT *ev;
+		int		alt;
+		unsigned long bstate = 0;
+		int		fields;
+
+		if (*line == '#' || *line == '\n')
+			continue;
+
+		if (n == size)
+		{
+			size *= 2;
+			*events = realloc(*events, size * sizeof(BENCH_EVENT));
+		}
+
+		ev = &(*events)[n];
+		memset(ev, 0, sizeof(BENCH_EVENT));
+
+		fields = sscanf(line, "%d %d %d %d %lu",
+						&ev->c, &alt, &ev->mevent.y, &ev->mevent.x, &bstate);
+		if (fields != 2 && fields != 5)
+		{
+			fprintf(stderr, "broken event \"%s\"\n", line);
+			exit(1);
+		}
+
+		ev->alt = alt;
+		ev->mevent.bstate = bstate;
+		n += 1;
+	}
+
+	fclose(f);
+
+	return n;
+}
+
+static void
+write_events(char *filename, BENCH_EVENT *events, int n)
+{
+	FILE   *f;
+	int		i;
+
+	f = fopen(filename, "w");
+	if (!f)
+	{
+		fprintf(stderr, "cannot to open file \"%s\"\n", filename);
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		if (events[i].c == KEY_MOUSE)
+			fprintf(f, "%d %d %d %d %lu\n",
+					events[i].c, events[i].alt,
+					events[i].mevent.y, events[i].mevent.x,
+					(unsigned long) events[i].mevent.bstate);
+		else
+			fprintf(f, "%d %d\n", events[i].c, events[i].alt);
+	}
+
+	fclose(f);
+}
+
+/*
+ * Returns number of bytes written by ncurses until now. The temporary
+ * file is truncated, the pseudo terminal is drained. The output of one
+ * event should be smaller than buffer of pseudo terminal. It is used
+ * as counter for st_menu_stats_enable too.
+ */
+static long
+output_counter(void *data)
+{
+	BENCH_OUTPUT *output = (BENCH_OUTPUT *) data;
+
+	if (output->use_pty)
+	{
+		char	buffer[4096];
+		ssize_t	bytes;
+
+		while ((bytes = read(output->fd, buffer, sizeof(buffer))) > 0)
+			output->total += bytes;
+	}
+	else
+	{
+		off_t	size = lseek(output->fd, 0, SEEK_CUR);
+
+		if (output->dump)
+		{
+			char	buffer[4096];
+			off_t	pos = 0;
+			ssize_t	bytes;
+
+			while (pos < size &&
+				   (bytes = pread(output->fd, buffer, sizeof(buffer), pos)) > 0)
+			{
+				fwrite(buffer, 1, bytes, output->dump);
+				pos += bytes;
+			}
+		}
+
+		output->total += size;
+
+		if (ftruncate(output->fd, 0) != 0 || lseek(output->fd, 0, SEEK_SET) != 0)
+		{
+			fprintf(stderr, "cannot to truncate output file\n");
+			exit(1);
+		}
+	}
+
+	return output->total;
+}
+
+/*
+ * Translate line drawing chars to unicode like grid backend does it
+ */
+static wchar_t
+acs_wchar(chtype ch)
+{
+	chtype	acs[] = {ACS_HLINE, ACS_VLINE, ACS_ULCORNER, ACS_URCORNER,
+					 ACS_LLCORNER, ACS_LRCORNER, ACS_LTEE, ACS_RTEE};
+	wchar_t	wch[] = {0x2500, 0x2502, 0x250C, 0x2510,
+					 0x2514, 0x2518, 0x251C, 0x2524};
+	int		i;
+
+	for (i = 0; i < (int) (sizeof(acs) / sizeof(chtype)); i++)
+		if ((ch & A_CHARTEXT) == (acs[i] & A_CHARTEXT))
+			return wch[i];
+
+	return (wchar_t) (ch & A_CHARTEXT);
+}
+
+/*
+ * Read cell of ncurses window in format of grid cell
+ */
+static void
+screen_cell(WINDOW *win, int y, int x, ST_MENU_CELL *cell)
+{
+	cchar_t	cch;
+	wchar_t	wch[CCHARW_MAX + 1];
+	attr_t	attr;
+	short	cpn;
+
+	cell->ch = L' ';
+	cell->attr = A_NORMAL;
+	cell->cpn = 0;
+
+	if (mvwin_wch(win, y, x, &cch) != ERR &&
+		getcchar(&cch, wch, &attr, &cpn, NULL) != ERR)
+	{
+		cell->ch = attr & A_ALTCHARSET ? acs_wchar(wch[0]) : wch[0];
+		cell->attr = attr & ~A_COLOR;
+		cell->cpn = cpn;
+	}
+}
+
+/*
+ * Desktop content is visible in shadows
+ */
+static void
+desktop_fill(void)
+{
+	int		maxy, maxx;
+	int		y, x;
+
+	getmaxyx(stdscr, maxy, maxx);
+
+	for (y = 0; y < maxy; y++)
+	{
+		if (y % 7 == 3)
+		{
+			mvwhline(stdscr, y, 0, ACS_HLINE, maxx);
+			continue;
+		}
+
+		for (x = 0; x < maxx; x++)
+			mvwaddch(stdscr, y, x, ('a' + (x + y) % 26) | (y % 5 == 1 ? A_BOLD : 0));
+	}
+
+	wnoutrefresh(stdscr);
+}
+
+/*
+ * Post menu by grid and ncurses backends, and compare cells of grid
+ * with ncurses screen. The desktop is copied to grid before, because
+ * the application should draw all visible objects. Returns number of
+ * different cells.
+ */
+static long
+grid_check(struct ST_MENU *menu)
+{
+	ST_MENU_CELL *cells;
+	int		rows, cols;
+	int		y, x;
+	long	diffs = 0;
+	static long reported = 0;
+
+	desktop_fill();
+
+	st_menu_post(menu);
+	doupdate();
+
+	st_menu_grid_init(0, 0);
+	st_menu_set_backend(ST_MENU_BACKEND_GRID);
+
+	cells = st_menu_grid_cells(&rows, &cols);
+
+	for (y = 0; y < rows; y++)
+		for (x = 0; x < cols; x++)
+			screen_cell(stdscr, y, x, &cells[y * cols + x]);
+
+	st_menu_post(menu);
+
+	st_menu_set_backend(ST_MENU_BACKEND_NCURSES);
+
+	for (y = 0; y < rows; y++)
+		for (x = 0; x < cols; x++)
+		{
+			ST_MENU_CELL *cell = &cells[y * cols + x];
+			ST_MENU_CELL screen;
+
+			screen_cell(curscr, y, x, &screen);
+
+			/* second cell of wide char */
+			if (cell->ch == 0 && x > 0 && cells[y * cols + x - 1].ch == screen.ch)
+				screen.ch = 0;
+
+			if (cell->ch != screen.ch || cell->attr != screen.attr || cell->cpn != screen.cpn)
+			{
+				diffs += 1;
+
+				if (reported++ < 10)
+					fprintf(stderr, "cell %d,%d: grid U+%04X attr %lx pair %d, screen U+%04X attr %lx pair %d\n",
+							y, x,
+							(unsigned int) cell->ch, (unsigned long) cell->attr, cell->cpn,
+							(unsigned int) screen.ch, (unsigned long) screen.attr, screen.cpn);
+			}
+		}
+
+	return diffs;
+}
+
+/*
+ * Texts of shortcuts and keys. The key of rejected text should not to
+ * activate item.
+ */
+static const struct
+{
+	char   *text;
+	int		c;
+	bool	alt;
+	bool	accepted;
+} shortcut_tests[] = {
+	{"^S", 19, false, true},
+	{"^s", 19, false, true},
+	{"C-x", 24, false, true},
+	{"Ctrl+K", 11, false, true},
+	{"Ctrl-Shift-K", 11, false, true},
+	{"ctrl+shift+k", 11, false, true},
+	{"^@", 0, false, true},
+	{"Ctrl+Space", 0, false, true},
+	{"M-x", 'x', true, true},
+	{"Alt+x", 'x', true, true},
+	{"Alt-Shift-x", 'X', true, true},
+	{"M-S-x", 'X', true, true},
+	{"M-+", '+', true, true},
+	{"F1", KEY_F(1), false, true},
+	{"f12", KEY_F(12), false, true},
+	{"F13", KEY_F(13), false, true},
+	{"F63", KEY_F(63), false, true},
+	{"S-F1", KEY_F(13), false, true},
+	{"Shift+F12", KEY_F(24), false, true},
+	{"Ctrl+F1", KEY_F(25), false, true},
+	{"C-S-F12", KEY_F(48), false, true},
+	{"Alt+F4", KEY_F(4), true, true},
+	{"M-C-F2", KEY_F(26), true, true},
+	{"Del", KEY_DC, false, true},
+	{"Delete", KEY_DC, false, true},
+	{"Shift+Del", KEY_SDC, false, true},
+	{"Ins", KEY_IC, false, true},
+	{"S-Ins", KEY_SIC, false, true},
+	{"Shift+Tab", KEY_BTAB, false, true},
+	{"M-Backspace", KEY_BACKSPACE, true, true},
+	{"Alt+Space", ' ', true, true},
+	{"C-x q", 24, false, false},
+	{"C-x q", 'q', false, false},
+	{"F0", KEY_F(0), false, false},
+	{"F64", KEY_F(64), false, false},
+	{"F1x", KEY_F(1), false, false},
+	{"S-F13", KEY_F(25), false, false},
+	{"Ctrl+", '+', false, false},
+	{"Ctrl+", '+', true, false},
+	{"+", '+', false, false},
+	{"x", 'x', false, false},
+	{"S-x", 'X', false, false},
+	{"C-1", '1', false, false},
+	{"C-Del", KEY_DC, false, false},
+	{"S-Space", ' ', false, false},
+	{"Hyper+x", 'x', true, false},
+	{NULL, 0, false, false}
+};
+
+/*
+ * Returns code of item activated by key, or 0
+ */
+static int
+shortcut_activated(struct ST_MENU *menu, int c, bool alt)
+{
+	ST_MENU_ITEM *item;
+	bool		activated;
+
+	st_menu_driver(menu, c, alt, NULL);
+	item = st_menu_selected_item(&activated);
+
+	return activated && item ? item->code : 0;
+}
+
+/*
+ * Checks parsing and dispatching of shortcuts. The submenu of disabled
+ * item is before enabled item with same shortcut. Returns number of
+ * failed checks.
+ */
+static long
+check_shortcuts(ST_MENU_CONFIG *config)
+{
+	ST_MENU_ITEM disabled_items[] = {
+		{"~O~pen", 3, "F12", 0, 0, 0, NULL},
+		{"~C~lose", 4, "F11", 0, 0, 0, NULL},
+		{NULL, -1, NULL, 0, 0, 0, NULL}
+	};
+	ST_MENU_ITEM items[] = {
+		{"~T~ested", 1, NULL, 0, 0, 0, NULL},
+		{"~Q~uit", 2, "F11", 0, 0, 0, NULL},
+		{NULL, -1, NULL, 0, 0, 0, NULL}
+	};
+	ST_MENU_ITEM menubar[] = {
+		{"~D~isabled", 10, NULL, 0, 0, ST_MENU_OPTION_DISABLED, disabled_items},
+		{"~F~ile", 11, NULL, 0, 0, 0, items},
+		{NULL, -1, NULL, 0, 0, 0, NULL}
+	};
+	struct ST_MENU *menu;
+	long		errors = 0;
+	int			code;
+	int			i;
+
+	menu = st_menu_new_menubar(config, menubar);
+	st_menu_set_focus(menu, ST_MENU_FOCUS_FULL);
+	st_menu_post(menu);
+
+	/* shortcuts are disabled by default */
+	if (shortcut_activated(menu, KEY_F(11), false) != 0)
+	{
+		fprintf(stderr, "shortcut F11 is used, when shortcuts are disabled\n");
+		errors += 1;
+	}
+
+	st_menu_set_shortcuts_enabled(menu, true);
+
+	for (i = 0; shortcut_tests[i].text; i++)
+	{
+		st_menu_set_shortcut(menu, 1, shortcut_tests[i].text);
+
+		code = shortcut_activated(menu, shortcut_tests[i].c, shortcut_tests[i].alt);
+		if (code != (shortcut_tests[i].accepted ? 1 : 0))
+		{
+			fprintf(stderr, "shortcut \"%s\" %s by key %d%s (activated %d)\n",
+					shortcut_tests[i].text,
+					shortcut_tests[i].accepted ? "is not activated" : "is activated",
+					shortcut_tests[i].c, shortcut_tests[i].alt ? " with Alt" : "", code);
+			errors += 1;
+		}
+	}
+
+	/* item in submenu of disabled item is skipped, next item is used */
+	if ((code = shortcut_activated(menu, KEY_F(12), false)) != 0)
+	{
+		fprintf(stderr, "shortcut F12 of item of disabled submenu activated %d\n", code);
+		errors += 1;
+	}
+
+	if ((code = shortcut_activated(menu, KEY_F(11), false)) != 2)
+	{
+		fprintf(stderr, "shortcut F11 activated %d instead of 2\n", code);
+		errors += 1;
+	}
+
+	/* only shortcuts with Alt are used in ST_MENU_FOCUS_ALT_MOUSE focus */
+	st_menu_set_focus(menu, ST_MENU_FOCUS_ALT_MOUSE);
+	st_menu_set_shortcut(menu, 2, "Alt+F11");
+
+	if ((code = shortcut_activated(menu, KEY_F(11), false)) != 0 ||
+		(code = shortcut_activated(menu, KEY_F(11), true)) != 2)
+	{
+		fprintf(stderr, "shortcut F11 in ST_MENU_FOCUS_ALT_MOUSE focus activated %d\n", code);
+		errors += 1;
+	}
+
+	st_menu_unpost(menu, true);
+	st_menu_free(menu);
+
+	return errors;
+}
+
+/*
+ * Sets of command bar. The funckey bar style doesn't allow Alt and
+ * modifiers, and it allows only one item per function key 1..12.
+ */
+static ST_CMDBAR_ITEM cmdbar_default_items[] = {
+	{"Help", false, 1, 1, 0, 0},
+	{"Menu", false, 2, 2, 0, 0},
+	{"View", false, 3, 3, 0, 0},
+	{"Edit", false, 4, 4, 0, 0},
+	{"Copy", false, 5, 5, 0, 0},
+	{"Move", false, 6, 6, 0, 0},
+	{"Mkdir", false, 7, 7, 0, 0},
+	{"Delete", false, 8, 8, 0, 0},
+	{"PullDn", false, 9, 9, 0, 0},
+	{"Quit", false, 10, 10, 0, 0},
+	{NULL, false, 0, 0, 0, 0}
+};
+
+static ST_CMDBAR_ITEM cmdbar_modifier_items[] = {
+	{"Find", false, 1, 21, 0, ST_CMDBAR_MOD_SHIFT},
+	{"Next", false, 2, 22, 0, ST_CMDBAR_MOD_SHIFT},
+	{"Prev", false, 2, 23, 0, ST_CMDBAR_MOD_CTRL},
+	{"Sort", false, 4, 24, 0, ST_CMDBAR_MOD_CTRL},
+	{"Save as", false, 12, 25, 0, ST_CMDBAR_MOD_SHIFT | ST_CMDBAR_MOD_CTRL},
+	{"Link", true, 5, 26, 0, ST_CMDBAR_MOD_SHIFT},
+	{"Symlink", true, 5, 27, 0, ST_CMDBAR_MOD_CTRL},
+	{"Mark", false, 9, 28, 0, 0},
+	{"Select", false, 9, 29, 0, 0},
+	{NULL, false, 0, 0, 0, 0}
+};
+
+static ST_CMDBAR_ITEM cmdbar_alt_items[] = {
+	{"Tree", true, 1, 31, 0, 0},
+	{"Swap", true, 2, 32, 0, 0},
+	{"Fifteen", false, 15, 33, 0, 0},
+	{"Forty", false, 40, 34, 0, 0},
+	{"Last", false, 63, 35, 0, 0},
+	{"Alt last", true, 63, 36, 0, 0},
+	{"Mouse only", false, 0, 37, 0, 0},
+	{"Alt only", true, 0, 38, 0, 0},
+	{NULL, false, 0, 0, 0, 0}
+};
+
+static ST_CMDBAR_ITEM cmdbar_funckey_wide_items[] = {
+	{"Help", false, 1, 41, 0, 0},
+	{"Rename", false, 6, 42, 0, 0},
+	{"Options", false, 11, 43, 0, 0},
+	{"Panels", false, 12, 44, 0, 0},
+	{NULL, false, 0, 0, 0, 0}
+};
+
+static ST_CMDBAR_ITEM cmdbar_funckey_sparse_items[] = {
+	{"Quit", false, 10, 51, 0, 0},
+	{"Menu", false, 2, 52, 0, 0},
+	{"Copy", false, 5, 53, 0, 0},
+	{NULL, false, 0, 0, 0, 0}
+};
+
+static const char *cmdbar_set_names[] = {NULL, "second", "third"};
+
+/*
+ * Returns function key of command bar item like ncurses reports it
+ */
+static int
+cmdbar_item_fkey(ST_CMDBAR_ITEM *item)
+{
+	return item->fkey > 0 ? item->fkey + 12 * item->modifiers : 0;
+}
+
+/*
+ * Returns item, that should be activated by function key. When more items
+ * uses same key, then first item is used.
+ */
+static ST_CMDBAR_ITEM *
+cmdbar_expected_key(ST_CMDBAR_ITEM *items, int c, bool alt)
+{
+	for (; items->text; items++)
+		if (items->fkey > 0 && KEY_F(cmdbar_item_fkey(items)) == c && items->alt == alt)
+			return items;
+
+	return NULL;
+}
+
+/*
+ * Returns item of command bar field under x position. The fields are
+ * searched sequentially, so this is reference for binary search of
+ * command bar.
+ */
+static ST_CMDBAR_ITEM *
+cmdbar_expected_field(ST_MENU_CONFIG *config, ST_CMDBAR_ITEM *items, int cols, int x)
+{
+	ST_CMDBAR_ITEM *item;
+	int		begin_x;
+
+	if (config->funckey_bar_style)
+	{
+		int		nfields = 10;
+		int		width;
+		double	extra_width;
+		double	extra_width_sum = 0;
+		int		i;
+
+		for (item = items; item->text; item++)
+			if (item->fkey > 10)
+				nfields = 12;
+
+		if (cols / nfields < 7)
+			nfields = cols / 7;
+
+		width = cols / nfields;
+		extra_width = (cols % nfields) / (nfields * 1.0);
+
+		begin_x = 0;
+		for (i = 0; i < nfields; i++)
+		{
+			int		next_begin_x = begin_x + width;
+
+			extra_width_sum += extra_width;
+			if (extra_width_sum > 1.0)
+			{
+				next_begin_x += 1;
+				extra_width_sum -= 1;
+			}
+
+			/* last field is to end of screen */
+			if (i == nfields - 1)
+				next_begin_x = cols + 1;
+
+			if (x < next_begin_x)
+			{
+				for (item = items; item->text; item++)
+					if (item->fkey == i + 1)
+						return item;
+
+				return NULL;
+			}
+
+			begin_x = next_begin_x;
+		}
+
+		return NULL;
+	}
+
+	/* first field starts on left border of screen */
+	begin_x = config->init_text_space - 1;
+
+	for (item = items; item->text; item++)
+	{
+		char	buffer[20];
+		int		length = 0;
+
+		if (item->fkey > 0)
+			length = snprintf(buffer, sizeof(buffer), "%s%s%sF%d",
+							  item->alt ? "M-" : "",
+							  item->modifiers & ST_CMDBAR_MOD_CTRL ? "C-" : "",
+							  item->modifiers & ST_CMDBAR_MOD_SHIFT ? "S-" : "",
+							  item->fkey);
+		else if (item->alt)
+			length = 2;
+
+		begin_x += (length > 0 ? length + 1 : 0) + (int) strlen(item->text) +
+				   (config->text_space != -1 ? config->text_space : 3);
+
+		if (x < begin_x)
+			return item;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the code of selected command, 0 when no command is selected, or
+ * -code when command is selected but not activated.
+ */
+static int
+cmdbar_selected(void)
+{
+	ST_CMDBAR_ITEM *item;
+	bool		activated;
+
+	item = st_menu_selected_command(&activated);
+
+	return item ? (activated ? item->code : -item->code) : 0;
+}
+
+/*
+ * Sends function keys and mouse clicks to command bar (without menu),
+ * and compares selected commands with commands found by sequential search.
+ * Every 16 events the set of command bar is switched. The switch to set,
+ * that was displayed with current width of terminal, should not allocate
+ * memory and should not to create window. In second half of events the
+ * terminal is reduced. Returns number of failed checks.
+ */
+static long
+check_cmdbar(BENCH_OPTIONS *opts, ST_MENU_CONFIG *config)
+{
+	ST_CMDBAR_ITEM *sets[3];
+	int		set_cols[3];
+	struct ST_CMDBAR *cmdbar;
+	int		active = 0;
+	long	errors = 0;
+	int		i;
+
+	if (config->funckey_bar_style)
+	{
+		sets[0] = cmdbar_default_items;
+		sets[1] = cmdbar_funckey_wide_items;
+		sets[2] = cmdbar_funckey_sparse_items;
+	}
+	else
+	{
+		sets[0] = cmdbar_default_items;
+		sets[1] = cmdbar_modifier_items;
+		sets[2] = cmdbar_alt_items;
+	}
+
+	cmdbar = st_cmdbar_new(config, sets[0]);
+	st_cmdbar_add_set(cmdbar, cmdbar_set_names[1], sets[1]);
+	st_cmdbar_add_set(cmdbar, cmdbar_set_names[2], sets[2]);
+
+	for (i = 0; i < 3; i++)
+		set_cols[i] = COLS;
+
+	st_cmdbar_post(cmdbar);
+	doupdate();
+
+	if (st_cmdbar_switch_set(cmdbar, "unknown"))
+	{
+		fprintf(stderr, "command bar switched to unknown set\n");
+		errors += 1;
+	}
+
+	for (i = 0; i < opts->nevents; i++)
+	{
+		int		kind = next_random() % 100;
+		int		code;
+		int		expected;
+
+		if (i == opts->nevents / 2)
+		{
+			resize_term(opts->rows, opts->cols * 2 / 3);
+
+			/* layout of active set is calculated again */
+			st_cmdbar_post(cmdbar);
+			set_cols[active] = COLS;
+		}
+
+		if (i % 16 == 15)
+		{
+			ST_MENU_TRACE_COUNTERS counters;
+			long	allocs = alloc_count;
+			long	windows;
+			long	trace_allocs;
+			int		set = next_random() % 3;
+
+			st_menu_trace_get_counters(&counters);
+			windows = counters.windows;
+			trace_allocs = counters.allocations;
+
+			if (!st_cmdbar_switch_set(cmdbar, cmdbar_set_names[set]))
+			{
+				fprintf(stderr, "command bar cannot to switch to set %d\n", set);
+				errors += 1;
+			}
+
+			st_menu_trace_get_counters(&counters);
+
+			if (counters.windows != windows)
+			{
+				fprintf(stderr, "switch of command bar set created window\n");
+				errors += 1;
+			}
+
+			if (set_cols[set] == COLS &&
+				(alloc_count != allocs || counters.allocations != trace_allocs))
+			{
+				fprintf(stderr, "switch of command bar set allocated memory\n");
+				errors += 1;
+			}
+
+			set_cols[set] = COLS;
+			active = set;
+
+			doupdate();
+		}
+
+		if (kind < 50)
+		{
+			int		c = KEY_F(1 + next_random() % ST_CMDBAR_MAX_FKEY);
+			bool	alt = next_random() % 3 == 0;
+			ST_CMDBAR_ITEM *item = cmdbar_expected_key(sets[active], c, alt);
+
+			st_menu_driver(NULL, c, alt, NULL);
+
+			expected = item ? item->code : 0;
+			if ((code = cmdbar_selected()) != expected)
+			{
+				fprintf(stderr, "key F%d%s activated command %d instead of %d\n",
+						c - KEY_F0, alt ? " with Alt" : "", code, expected);
+				errors += 1;
+			}
+		}
+		else
+		{
+			MEVENT	mevent;
+			ST_CMDBAR_ITEM *pressed;
+			ST_CMDBAR_ITEM *released;
+			int		y = LINES - 1 - (kind < 55 ? 1 : 0);
+			int		x = next_random() % COLS;
+			int		release_x = kind < 90 ? x : (int) (next_random() % COLS);
+
+			pressed = y == LINES - 1 ? cmdbar_expected_field(config, sets[active], COLS, x) : NULL;
+			released = y == LINES - 1 ? cmdbar_expected_field(config, sets[active], COLS, release_x) : NULL;
+
+			memset(&mevent, 0, sizeof(MEVENT));
+			mevent.y = y;
+			mevent.x = x;
+			mevent.bstate = BUTTON1_PRESSED;
+
+			st_menu_driver(NULL, KEY_MOUSE, false, &mevent);
+
+			expected = pressed ? -pressed->code : 0;
+			if ((code = cmdbar_selected()) != expected)
+			{
+				fprintf(stderr, "press on %d,%d selected command %d instead of %d\n",
+						y, x, code, expected);
+				errors += 1;
+			}
+
+			mevent.x = release_x;
+			mevent.bstate = BUTTON1_RELEASED;
+
+			st_menu_driver(NULL, KEY_MOUSE, false, &mevent);
+
+			/* the click is valid, when press and release is over same field */
+			expected = pressed && pressed == released ? pressed->code : 0;
+			if ((code = cmdbar_selected()) != expected)
+			{
+				fprintf(stderr, "click on %d,%d-%d activated command %d instead of %d\n",
+						y, x, release_x, code, expected);
+				errors += 1;
+			}
+		}
+
+		doupdate();
+	}
+
+	st_cmdbar_unpost(cmdbar);
+	st_cmdbar_free(cmdbar);
+
+	resize_term(opts->rows, opts->cols);
+
+	return errors;
+}
+
+/*
+ * Enables filter of first pulldown menu, and opens this menu
+ */
+static void
+filter_open(struct ST_MENU *menu, ST_MENU_ITEM *menubar)
+{
+	st_menu_set_filter(st_menu_get_submenu(menu, menubar[0].code), true);
+
+	st_menu_driver(menu, KEY_DOWN, false, NULL);
+	doupdate();
+}
+
+/*
+ * Palette is posted before first char of query (outside of measuring).
+ */
+static void
+palette_post(BENCH_OPTIONS *opts, struct ST_MENU *menu, BENCH_OUTPUT *output)
+{
+	if (opts->palette && !st_menu_palette_is_posted(menu))
+	{
+		st_menu_palette_post(menu);
+		doupdate();
+		output_counter(output);
+	}
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double	v1 = *(const double *) a;
+	double	v2 = *(const double *) b;
+
+	return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
+}
+
+static double
+percentile(double *sorted, int n, double p)
+{
+	int		i = (int) (p * (n - 1) + 0.5);
+
+	return sorted[i];
+}
+
+/*
+ * Loads style and sets options of pulldown menus
+ */
+static void
+load_style(BENCH_OPTIONS *opts, ST_MENU_CONFIG *config, int style)
+{
+	st_menu_load_style(config, style, 1, config->force8bit, false);
+
+	config->page_step = opts->page_step;
+	config->max_rows = opts->max_rows;
+
+	if (opts->scroll_thumb)
+		config->scroll_thumb_tag = '#';
+}
+
+/*
+ * Creates menubar from template or from precompiled tables
+ */
+static struct ST_MENU *
+new_menubar(BENCH_OPTIONS *opts, ST_MENU_CONFIG *config, ST_MENU_ITEM *menubar)
+{
+
+#ifdef BENCH_PRECOMPILED
+
+	if (opts->use_precompiled)
+		return st_menu_new_precompiled(config, config, &bench_menu_precompiled);
+
+#endif
+
+	(void) opts;
+
+	return st_menu_new_menubar(config, menubar);
+}
+
+/*
+ * Emulates resize of terminal and change of style. Menu is created again
+ * (like demo does it), and its state is restored from snapshot. The
+ * terminal is reduced by every second call.
+ */
+static struct ST_MENU *
+rebuild_menu(struct ST_MENU *menu, ST_MENU_CONFIG *config, ST_MENU_ITEM *menubar,
+			 BENCH_OPTIONS *opts, int step)
+{
+	size_t		size = st_menu_snapshot_size(menu);
+	void	   *snapshot = malloc(size);
+
+	st_menu_snapshot_write(menu, snapshot, size);
+
+	loaders_join();
+
+	st_menu_unpost(menu, true);
+	st_menu_free(menu);
+
+	if (step % 2 == 1)
+		resize_term(opts->rows * 2 / 3, opts->cols * 2 / 3);
+	else
+		resize_term(opts->rows, opts->cols);
+
+	load_style(opts, config, (opts->style + step) % (ST_MENU_LAST_STYLE + 1));
+
+	menu = new_menubar(opts, config, menubar);
+	st_menu_set_focus(menu, ST_MENU_FOCUS_FULL);
+
+	if (opts->loading_chunk > 0)
+		loaders_set(opts, menu, menubar);
+
+	st_menu_snapshot_read(menu, snapshot, size);
+	free(snapshot);
+
+	st_menu_post(menu);
+	doupdate();
+
+	return menu;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: bench_menu [-d depth] [-f fanout] [-l length] [-c cjk%%] [-e emoji%%]\n"
+			"                  [-n events] [-s seed] [-r file] [-w file] [-S style]\n"
+			"                  [-R rows] [-C cols] [-p] [-g] [-j] [-W] [-z] [-k step] [-t]\n"
+			"                  [-M rows] [-x interval] [-O file] [-P] [-G] [-K] [-B] [-L chunk]\n"
+			"                  [-F items] [-Y file] [-y] [-E interval]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	BENCH_OPTIONS opts;
+	ST_MENU_CONFIG config;
+	ST_MENU_ITEM *menubar;
+	BENCH_EVENT *events;
+	struct ST_MENU *menu;
+	SCREEN	   *screen;
+	FILE	   *output;
+	BENCH_OUTPUT output_state;
+	ST_MENU_STATS stats;
+	char		buffer[20];
+	double	   *driver_ns;
+	double	   *total_ns;
+	long		total_allocs = 0;
+	long		driver_allocs = 0;
+	long		total_bytes = 0;
+	long		max_bytes = 0;
+	long		max_allocs = 0;
+	long		grid_diffs = 0;
+	long		edit_errors = 0;
+	long		shortcut_errors = 0;
+	long		cmdbar_errors = 0;
+	int			nedits = 0;
+	int			code = 1;
+	int			nitems = 0;
+	int			nevents;
+	int			opt;
+	int			i;
+
+	opts.depth = 3;
+	opts.fanout = 8;
+	opts.label_length = 12;
+	opts.cjk_percent = 0;
+	opts.emoji_percent = 0;
+	opts.nevents = 10000;
+	opts.seed = 1;
+	opts.replay_file = NULL;
+	opts.write_file = NULL;
+	opts.style = ST_MENU_STYLE_MC;
+	opts.rows = 30;
+	opts.cols = 100;
+	opts.use_pty = false;
+	opts.use_grid = false;
+	opts.draw_stats = false;
+	opts.json = false;
+	opts.warmup = false;
+	opts.zero_allocs = false;
+	opts.palette = false;
+	opts.check_grid = false;
+	opts.check_shortcuts = false;
+	opts.check_cmdbar = false;
+	opts.loading_chunk = 0;
+	opts.filter_items = 0;
+	opts.edit_interval = 0;
+	opts.rebuild_interval = 0;
+	opts.page_step = 0;
+	opts.max_rows = 0;
+	opts.scroll_thumb = false;
+	opts.dump_file = NULL;
+	opts.precompile_file = NULL;
+	opts.use_precompiled = false;
+
+	while ((opt = getopt(argc, argv, "d:f:l:c:e:n:s:r:w:S:R:C:pgbjWzk:tM:x:O:PGKBL:E:F:Y:y")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd':
+				opts.depth = atoi(optarg);
+				break;
+			case 'f':
+				opts.fanout = atoi(optarg);
+				break;
+			case 'l':
+				opts.label_length = atoi(optarg);
+				break;
+			case 'c':
+				opts.cjk_percent = atoi(optarg);
+				break;
+			case 'e':
+				opts.emoji_percent = atoi(optarg);
+				break;
+			case 'n':
+				opts.nevents = atoi(optarg);
+				break;
+			case 's':
+				opts.seed = atoi(optarg);
+				break;
+			case 'r':
+				opts.replay_file = optarg;
+				break;
+			case 'w':
+				opts.write_file = optarg;
+				break;
+			case 'S':
+				opts.style = atoi(optarg);
+				break;
+			case 'R':
+				opts.rows = atoi(optarg);
+				break;
+			case 'C':
+				opts.cols = atoi(optarg);
+				break;
+			case 'p':
+				opts.use_pty = true;
+				break;
+			case 'g':
+				opts.use_grid = true;
+				break;
+			case 'b':
+				opts.draw_stats = true;
+				break;
+			case 'j':
+				opts.json = true;
+				break;
+			case 'W':
+				opts.warmup = true;
+				break;
+			case 'z':
+				opts.zero_allocs = true;
+				break;
+			case 'k':
+				opts.page_step = atoi(optarg);
+				break;
+			case 't':
+				opts.scroll_thumb = true;
+				break;
+			case 'M':
+				opts.max_rows = atoi(optarg);
+				break;
+			case 'x':
+				opts.rebuild_interval = atoi(optarg);
+				break;
+			case 'O':
+				opts.dump_file = optarg;
+				break;
+			case 'P':
+				opts.palette = true;
+				break;
+			case 'G':
+				opts.check_grid = true;
+				break;
+			case 'Y':
+				opts.precompile_file = optarg;
+				break;
+			case 'y':
+				opts.use_precompiled = true;
+				break;
+			case 'K':
+				opts.check_shortcuts = true;
+				break;
+			case 'B':
+				opts.check_cmdbar = true;
+				break;
+			case 'L':
+				opts.loading_chunk = atoi(optarg);
+				break;
+			case 'F':
+				opts.filter_items = atoi(optarg);
+				break;
+			case 'E':
+				opts.edit_interval = atoi(optarg);
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (opts.depth < 1 || opts.fanout < 1 || opts.label_length < 1 ||
+		opts.rows < 2 || opts.cols < 10 ||
+		opts.style < 0 || opts.style > ST_MENU_LAST_STYLE ||
+		opts.loading_chunk < 0 || opts.edit_interval < 0 ||
+		opts.filter_items < 0 || opts.page_step < 0 ||
+		opts.max_rows < 0)
+		usage();
+
+	/* pushed items are applied by driver, and producers allocate memory */
+	if (opts.loading_chunk > 0 && opts.zero_allocs)
+	{
+		fprintf(stderr, "option -z cannot be used with option -L\n");
+		exit(1);
+	}
+
+	/* changed menus are displayed first time by driver */
+	if (opts.edit_interval > 0 && opts.zero_allocs)
+	{
+		fprintf(stderr, "option -z cannot be used with option -E\n");
+		exit(1);
+	}
+
+	/* the grid is used for output, the palette is not posted again */
+	if (opts.check_grid && (opts.use_grid || opts.palette))
+	{
+		fprintf(stderr, "option -G cannot be used with options -g and -P\n");
+		exit(1);
+	}
+
+#ifndef BENCH_PRECOMPILED
+
+	if (opts.use_precompiled)
+	{
+		fprintf(stderr, "precompiled tables are not linked (build with BENCH_PRECOMPILED)\n");
+		exit(1);
+	}
+
+#endif
+
+	/* the query is lost, when menu is created again */
+	if (opts.filter_items > 0 &&
+		(opts.palette || opts.loading_chunk > 0 || opts.rebuild_interval > 0))
+	{
+		fprintf(stderr, "option -F cannot be used with options -P, -L and -x\n");
+		exit(1);
+	}
+
+	/* positions of items are not known, when items are pushed */
+	if (opts.edit_interval > 0 && opts.loading_chunk > 0)
+	{
+		fprintf(stderr, "option -E cannot be used with option -L\n");
+		exit(1);
+	}
+
+	seed = opts.seed;
+
+	menubar = build_menu(&opts, 0, &code, &nitems);
+
+	/* first pulldown menu is long and without submenus */
+	if (opts.filter_items > 0 && menubar[0].submenu)
+	{
+		BENCH_OPTIONS filter_opts = opts;
+		int			n = 0;
+
+		while (menubar[0].submenu[n].text)
+			n++;
+
+		nitems -= n;
+		free_menu(menubar[0].submenu);
+
+		filter_opts.fanout = opts.filter_items;
+		filter_opts.depth = 2;
+		menubar[0].submenu = build_menu(&filter_opts, 1, &code, &nitems);
+	}
+
+	if (opts.edit_interval > 0)
+	{
+		nitem_refs = code;
+		item_refs = calloc(nitem_refs, sizeof(BENCH_ITEM_REF));
+		index_menu(menubar, 0);
+	}
+
+	if (opts.replay_file)
+		nevents = read_events(opts.replay_file, &events);
+	else
+	{
+		nevents = opts.nevents;
+		events = malloc(nevents * sizeof(BENCH_EVENT));
+
+		if (opts.palette)
+			generate_palette_events(&opts, events);
+		else if (opts.filter_items > 0)
+			generate_filter_events(&opts, events);
+		else
+			generate_events(&opts, events);
+	}
+
+	if (opts.write_file)
+		write_events(opts.write_file, events, nevents);
+
+	if (nevents < 1)
+	{
+		fprintf(stderr, "there are not any event\n");
+		exit(1);
+	}
+
+	driver_ns = malloc(nevents * sizeof(double));
+	total_ns = malloc(nevents * sizeof(double));
+
+	if (opts.use_pty)
+	{
+		int		master_fd;
+
+		master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0)
+		{
+			fprintf(stderr, "cannot to open pseudo terminal\n");
+			exit(1);
+		}
+
+		output = fopen(ptsname(master_fd), "r+");
+		if (!output)
+		{
+			fprintf(stderr, "cannot to open pseudo terminal\n");
+			exit(1);
+		}
+
+		fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+		output_state.fd = master_fd;
+	}
+	else
+	{
+		output = tmpfile();
+		if (!output)
+		{
+			fprintf(stderr, "cannot to create temporary file\n");
+			exit(1);
+		}
+
+		output_state.fd = fileno(output);
+	}
+
+	output_state.use_pty = opts.use_pty;
+	output_state.total = 0;
+	output_state.dump = NULL;
+
+	if (opts.dump_file)
+	{
+		output_state.dump = fopen(opts.dump_file, "wb");
+		if (!output_state.dump)
+		{
+			fprintf(stderr, "cannot to open file \"%s\"\n", opts.dump_file);
+			exit(1);
+		}
+	}
+
+	snprintf(buffer, sizeof(buffer), "%d", opts.rows);
+	setenv("LINES", buffer, 1);
+	snprintf(buffer, sizeof(buffer), "%d", opts.cols);
+	setenv("COLUMNS", buffer, 1);
+
+	setlocale(LC_ALL, "");
+
+	screen = newterm(getenv("TERM") ? NULL : "xterm-256color", output, output);
+	if (!screen)
+	{
+		fprintf(stderr, "cannot to initialize terminal\n");
+		exit(1);
+	}
+
+	set_term(screen);
+	start_color();
+	cbreak();
+	noecho();
+
+	config.encoding = nl_langinfo(CODESET);
+	config.language = NULL;
+	config.force8bit = strcmp(config.encoding, "UTF-8") != 0;
+
+	load_style(&opts, &config, opts.style);
+
+	if (opts.use_grid)
+		st_menu_set_backend(ST_MENU_BACKEND_GRID);
+
+	st_menu_set_desktop_window(stdscr);
+
+	if (opts.check_shortcuts)
+		shortcut_errors = check_shortcuts(&config);
+
+	if (opts.check_cmdbar)
+		cmdbar_errors = check_cmdbar(&opts, &config);
+
+	menu = new_menubar(&opts, &config, menubar);
+	st_menu_set_focus(menu, ST_MENU_FOCUS_FULL);
+	st_menu_set_shortcuts_enabled(menu, opts.check_shortcuts);
+
+	if (opts.loading_chunk > 0)
+		loaders_set(&opts, menu, menubar);
+
+	st_menu_post(menu);
+	doupdate();
+
+	if (opts.precompile_file)
+	{
+		FILE	   *f = fopen(opts.precompile_file, "w");
+
+		if (!f || !st_menu_write_precompiled(f, menu, "bench_menu_precompiled"))
+		{
+			fprintf(stderr, "cannot to write file \"%s\"\n", opts.precompile_file);
+			exit(1);
+		}
+
+		fclose(f);
+	}
+
+	if (opts.filter_items > 0)
+		filter_open(menu, menubar);
+
+	/*
+	 * Warm-up pass displays all menus used by events stream. After this
+	 * pass the driver should not to allocate any memory.
+	 */
+	if (opts.warmup)
+	{
+		size_t		size = st_menu_snapshot_size(menu);
+		void	   *snapshot = malloc(size);
+
+		/* the measured pass starts from same state */
+		st_menu_snapshot_write(menu, snapshot, size);
+
+		for (i = 0; i < nevents; i++)
+		{
+			palette_post(&opts, menu, &output_state);
+
+			if (opts.use_grid)
+				st_menu_grid_clear();
+
+			st_menu_driver(menu, events[i].c, events[i].alt, &events[i].mevent);
+			doupdate();
+
+			/* drain pseudo terminal */
+			output_counter(&output_state);
+		}
+
+		st_menu_snapshot_read(menu, snapshot, size);
+		free(snapshot);
+
+		st_menu_post(menu);
+		doupdate();
+	}
+
+	output_counter(&output_state);
+
+	if (opts.draw_stats)
+		st_menu_stats_enable(output_counter, &output_state);
+
+	for (i = 0; i < nevents; i++)
+	{
+		BENCH_EVENT *ev = &events[i];
+		double		t1, t2, t3;
+		long		allocs;
+		long		bytes;
+
+		if (opts.rebuild_interval > 0 && i > 0 && i % opts.rebuild_interval == 0)
+		{
+			menu = rebuild_menu(menu, &config, menubar, &opts, i / opts.rebuild_interval);
+			output_counter(&output_state);
+		}
+
+		if (opts.edit_interval > 0 && i > 0 && i % opts.edit_interval == 0)
+		{
+			edit_errors += edit_menu(menu);
+			nedits += 1;
+			output_counter(&output_state);
+		}
+
+		palette_post(&opts, menu, &output_state);
+
+		allocs = alloc_count;
+		bytes = output_state.total;
+
+		t1 = now_ns();
+
+		if (opts.use_grid)
+			st_menu_grid_clear();
+
+		st_menu_driver(menu, ev->c, ev->alt, &ev->mevent);
+
+		t2 = now_ns();
+
+		/* allocations inside ncurses (doupdate) are not errors of driver */
+		driver_allocs += alloc_count - allocs;
+
+		doupdate();
+
+		t3 = now_ns();
+
+		allocs = alloc_count - allocs;
+		bytes = output_counter(&output_state) - bytes;
+
+		driver_ns[i] = t2 - t1;
+		total_ns[i] = t3 - t1;
+
+		total_allocs += allocs;
+		total_bytes += bytes;
+		max_allocs = allocs > max_allocs ? allocs : max_allocs;
+		max_bytes = bytes > max_bytes ? bytes : max_bytes;
+
+		if (opts.check_grid)
+		{
+			grid_diffs += grid_check(menu);
+			output_counter(&output_state);
+		}
+	}
+
+	st_menu_stats_get(&stats);
+	st_menu_stats_enable(NULL, NULL);
+
+	if (loaders)
+	{
+		loaders_join();
+		free(loaders);
+	}
+
+	st_menu_unpost(menu, true);
+	st_menu_free(menu);
+
+	endwin();
+	delscreen(screen);
+
+	if (output_state.dump)
+		fclose(output_state.dump);
+
+	qsort(driver_ns, nevents, sizeof(double), cmp_double);
+	qsort(total_ns, nevents, sizeof(double), cmp_double);
+
+#ifndef HAVE_ALLOC_COUNTER
+
+	total_allocs = max_allocs = driver_allocs = -nevents;
+
+#endif
+
+	if (opts.json)
+	{
+		printf("{\n");
+		printf("  \"depth\": %d, \"fanout\": %d, \"label_length\": %d,\n",
+			   opts.depth, opts.fanout, opts.label_length);
+		printf("  \"cjk_percent\": %d, \"emoji_percent\": %d, \"items\": %d,\n",
+			   opts.cjk_percent, opts.emoji_percent, nitems);
+		printf("  \"style\": %d, \"rows\": %d, \"cols\": %d, \"output\": \"%s\",\n",
+			   opts.style, opts.rows, opts.cols,
+			   opts.use_grid ? "grid" : (opts.use_pty ? "pty" : "file"));
+		printf("  \"events\": %d, \"seed\": %u,\n", nevents, opts.seed);
+		printf("  \"driver_ns\": { \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f },\n",
+			   percentile(driver_ns, nevents, 0.5), percentile(driver_ns, nevents, 0.9),
+			   percentile(driver_ns, nevents, 0.99), percentile(driver_ns, nevents, 0.999),
+			   driver_ns[nevents - 1]);
+		printf("  \"total_ns\": { \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f },\n",
+			   percentile(total_ns, nevents, 0.5), percentile(total_ns, nevents, 0.9),
+			   percentile(total_ns, nevents, 0.99), percentile(total_ns, nevents, 0.999),
+			   total_ns[nevents - 1]);
+		printf("  \"allocs_per_event\": %.2f, \"max_allocs\": %ld, \"driver_allocs\": %ld,\n",
+			   (double) total_allocs / nevents, max_allocs, driver_allocs);
+		printf("  \"bytes_per_event\": %.1f, \"max_bytes\": %ld%s\n",
+			   (double) total_bytes / nevents, max_bytes,
+			   opts.draw_stats ? "," : "");
+
+		if (opts.draw_stats)
+		{
+			printf("  \"draw\": {\n");
+			for (i = 0; i < ST_MENU_STATS_COUNT; i++)
+				printf("    \"%s\": { \"calls\": %ld, \"bytes\": %ld, \"max_bytes\": %ld }%s\n",
+					   stats_names[i],
+					   stats.items[i].calls, stats.items[i].bytes, stats.items[i].max_bytes,
+					   i + 1 < ST_MENU_STATS_COUNT ? "," : "");
+			printf("  }\n");
+		}
+
+		printf("}\n");
+	}
+	else
+	{
+		printf("menu: depth %d, fanout %d, label length %d, cjk %d%%, emoji %d%%, %d items\n",
+			   opts.depth, opts.fanout, opts.label_length,
+			   opts.cjk_percent, opts.emoji_percent, nitems);
+		printf("events: %d, output: %s\n", nevents,
+			   opts.use_grid ? "grid" : (opts.use_pty ? "pty" : "file"));
+		printf("%-10s %10s %10s %10s %10s %10s\n", "", "p50", "p90", "p99", "p99.9", "max");
+		printf("%-10s %8.2fus %8.2fus %8.2fus %8.2fus %8.2fus\n", "driver",
+			   percentile(driver_ns, nevents, 0.5) / 1000.0, percentile(driver_ns, nevents, 0.9) / 1000.0,
+			   percentile(driver_ns, nevents, 0.99) / 1000.0, percentile(driver_ns, nevents, 0.999) / 1000.0,
+			   driver_ns[nevents - 1] / 1000.0);
+		printf("%-10s %8.2fus %8.2fus %8.2fus %8.2fus %8.2fus\n", "total",
+			   percentile(total_ns, nevents, 0.5) / 1000.0, percentile(total_ns, nevents, 0.9) / 1000.0,
+			   percentile(total_ns, nevents, 0.99) / 1000.0, percentile(total_ns, nevents, 0.999) / 1000.0,
+			   total_ns[nevents - 1] / 1000.0);
+		printf("allocations: %.2f per event (max %ld), %ld in driver\n",
+			   (double) total_allocs / nevents, max_allocs, driver_allocs);
+		printf("output: %.1f bytes per event (max %ld)\n", (double) total_bytes / nevents, max_bytes);
+
+		if (opts.draw_stats)
+		{
+			printf("%-10s %10s %12s %10s %10s\n", "", "calls", "bytes", "per call", "max");
+			for (i = 0; i < ST_MENU_STATS_COUNT; i++)
+				printf("%-10s %10ld %12ld %10.1f %10ld\n",
+					   stats_names[i],
+					   stats.items[i].calls, stats.items[i].bytes,
+					   stats.items[i].calls ? (double) stats.items[i].bytes / stats.items[i].calls : 0.0,
+					   stats.items[i].max_bytes);
+		}
+	}
+
+	free_menu(menubar);
+	free(item_refs);
+	free(events);
+	free(driver_ns);
+	free(total_ns);
+
+	if (opts.check_grid && grid_diffs != 0)
+	{
+		fprintf(stderr, "grid differs from screen in %ld cells\n", grid_diffs);
+		return 1;
+	}
+
+	if (shortcut_errors != 0)
+	{
+		fprintf(stderr, "%ld checks of shortcuts failed\n", shortcut_errors);
+		return 1;
+	}
+
+	if (cmdbar_errors != 0)
+	{
+		fprintf(stderr, "%ld checks of command bar failed\n", cmdbar_errors);
+		return 1;
+	}
+
+	if (edit_errors != 0)
+	{
+		fprintf(stderr, "%ld checks of %d edits of menu failed\n", edit_errors, nedits);
+		return 1;
+	}
+
+	if (opts.zero_allocs && driver_allocs != 0)
+	{
+		if (driver_allocs < 0)
+			fprintf(stderr, "allocations are not counted on this platform\n");
+		else
+			fprintf(stderr, "driver allocated memory %ld times\n", driver_allocs);
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,502 @@
+/*-------------------------------------------------------------------------
+ *
+ * bench_unicode.c
+ *	  microbenchmark of unicode routines
+ *
+ * Compares table based lookups (display width, case folding, uppercase
+ * test) used by library with reference (interval table, binary search)
+ * implementations from unicode_ref.h. Before measuring, the results of
+ * both implementations are compared for all code points. The searching
+ * is compared with previous (restarting) implementation.
+ *
+ * Usage: bench_unicode [loops]
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "unicode.h"
+#include "unicode_ref.h"
+
+#define SAMPLE_CHARS		4096
+
+static unsigned char sample[SAMPLE_CHARS * 4 + 1];
+static int sample_offsets[SAMPLE_CHARS];
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Prepare mix of chars similar to menu labels - mostly ascii, some
+ * latin, cyrillic, CJK and emoji.
+ */
+static void
+prepare_sample(void)
+{
+	unsigned char *ptr = sample;
+	unsigned int seed = 1;
+	int		i;
+
+	for (i = 0; i < SAMPLE_CHARS; i++)
+	{
+		wchar_t		ucs;
+		int			size;
+		int			kind;
+
+		seed = seed * 1103515245 + 12345;
+		kind = (seed >> 16) % 10;
+
+		if (kind < 5)
+			ucs = 0x20 + (seed >> 8) % 0x5f;
+		else if (kind < 7)
+			ucs = 0xc0 + (seed >> 8) % 0x180;
+		else if (kind < 8)
+			ucs = 0x400 + (seed >> 8) % 0x100;
+		else if (kind < 9)
+			ucs = 0x4e00 + (seed >> 8) % 0x5000;
+		else
+			ucs = 0x1f300 + (seed >> 8) % 0x300;
+
+		sample_offsets[i] = ptr - sample;
+		unicode_to_utf8(ucs, ptr, &size);
+		ptr += size;
+	}
+
+	*ptr = '\0';
+}
+
+/*
+ * Previous implementation of utf_string_dsplen - every char is decoded.
+ */
+static int
+string_dsplen_ref(const char *s, size_t max_bytes)
+{
+	int result = 0;
+	const char *ptr = s;
+
+	while (*ptr != '\0' && max_bytes > 0)
+	{
+		int		clen = utf8charlen(*ptr);
+
+		result += ucs_wcwidth_ref(utf8_to_unicode((const unsigned char *) ptr));
+		ptr += clen;
+		max_bytes -= clen;
+	}
+
+	return result;
+}
+
+/*
+ * Previous implementation of utf8len
+ */
+static size_t
+utf8len_ref(const char *s)
+{
+	size_t len = 0;
+
+	for (; *s; ++s)
+		if ((*s & 0xC0) != 0x80)
+			++len;
+	return len;
+}
+
+/*
+ * Previous implementations of utf8_nstrstr and utf8_nstrstr_ignore_lower_case.
+ * After mismatch, the searching starts again from next char of haystack.
+ */
+static const char *
+nstrstr_ref(const char *haystack, const char *needle)
+{
+	const char *haystack_cur, *needle_cur, *needle_prev;
+	int		f1 = 0, f2 = 0;
+	int		needle_char_len = 0; /* be compiler quiet */
+
+	needle_cur = needle;
+	needle_prev = NULL;
+	haystack_cur = haystack;
+
+	while (*needle_cur != '\0')
+	{
+		if (*haystack_cur == '\0')
+			return NULL;
+
+		if (needle_prev != needle_cur)
+		{
+			needle_prev = needle_cur;
+			needle_char_len = utf8charlen(*needle_cur);
+			f1 = utf8_tofold(needle_cur);
+		}
+
+		f2 = utf8_tofold(haystack_cur);
+		if (f1 == f2)
+		{
+			needle_cur += needle_char_len;
+			haystack_cur += utf8charlen(*haystack_cur);
+		}
+		else
+		{
+			needle_cur = needle;
+			haystack_cur = haystack += utf8charlen(*haystack);
+		}
+	}
+
+	return haystack;
+}
+/*
+ * Special string searching, lower chars are case insensitive,
+ * upper chars are case sensitive.
+ */
+static const char *
+nstrstr_ignore_lower_case_ref(const char *haystack, const char *needle)
+{
+	const char *haystack_cur, *needle_cur, *needle_prev;
+	int		f1 = 0, f2 = 0;
+	bool	eq;
+
+	needle_cur = needle;
+	needle_prev = NULL;
+	haystack_cur = haystack;
+
+	while (*needle_cur != '\0')
+	{
+		int		haystack_char_len;
+		int		needle_char_len = 0;
+		bool	needle_char_is_upper =  false;
+
+		if (*haystack_cur == '\0')
+			return NULL;
+
+		haystack_char_len = utf8charlen(*haystack_cur);
+
+		if (needle_prev != needle_cur)
+		{
+			needle_prev = needle_cur;
+			needle_char_len = utf8charlen(*needle_cur);
+			needle_char_is_upper = utf8_isupper(needle_cur);
+			f1 = utf8_tofold(needle_cur);
+		}
+
+		if (needle_char_is_upper)
+		{
+			/* case sensitive */
+			if (needle_char_len == haystack_char_len)
+				eq = memcmp(haystack_cur, needle_cur, needle_char_len) == 0;
+			else
+				eq = false;
+		}
+		else
+		{
+			/* case insensitive */
+			f2 = utf8_tofold(haystack_cur);
+			eq = f1 == f2;
+		}
+
+		if (eq)
+		{
+			needle_cur += needle_char_len;
+			haystack_cur += haystack_char_len;
+		}
+		else
+		{
+			needle_cur = needle;
+			haystack_cur = haystack += utf8charlen(*haystack);
+		}
+	}
+
+	return haystack;
+}
+
+/*
+ * Generate random string from small set of chars (with different
+ * case and with chars with same fold), so matches are frequent.
+ */
+static void
+random_string(char *buffer, int nchars, unsigned int *seed)
+{
+	static const char *chars[] = {
+		"a", "A", "b", "B", "\xc3\xa1", "\xc3\x81", "k", "K", "\xe2\x84\xaa"
+	};
+	int		i;
+
+	*buffer = '\0';
+	for (i = 0; i < nchars; i++)
+	{
+		*seed = *seed * 1103515245 + 12345;
+		strcat(buffer, chars[(*seed >> 16) % 9]);
+	}
+}
+
+static int
+check_search(void)
+{
+	unsigned int seed = 1;
+	int		errors = 0;
+	int		i;
+
+	for (i = 0; i < 200000; i++)
+	{
+		char	haystack[30 * 3 + 1];
+		char	needle[6 * 3 + 1];
+
+		random_string(haystack, (seed >> 8) % 30, &seed);
+		random_string(needle, (seed >> 8) % 6, &seed);
+
+		if (utf8_nstrstr(haystack, needle) != nstrstr_ref(haystack, needle) ||
+			utf8_nstrstr_ignore_lower_case(haystack, needle) !=
+				nstrstr_ignore_lower_case_ref(haystack, needle))
+		{
+			if (errors++ < 10)
+				fprintf(stderr, "search mismatch \"%s\" \"%s\"\n", haystack, needle);
+		}
+	}
+
+	return errors;
+}
+
+static int
+check_width(void)
+{
+	wchar_t		ucs;
+	int			errors = 0;
+
+	for (ucs = 0; ucs <= 0x10ffff; ucs++)
+	{
+		unsigned char buffer[5];
+		int		size;
+
+		unicode_to_utf8(ucs, buffer, &size);
+		buffer[size] = '\0';
+
+		if (utf_dsplen((char *) buffer) != ucs_wcwidth_ref(ucs))
+		{
+			if (errors++ < 10)
+				fprintf(stderr, "width mismatch U+%04X: %d %d\n",
+						(unsigned int) ucs,
+						utf_dsplen((char *) buffer),
+						ucs_wcwidth_ref(ucs));
+		}
+	}
+
+	return errors;
+}
+
+static int
+check_case(void)
+{
+	wchar_t		ucs;
+	int			errors = 0;
+
+	for (ucs = 0; ucs <= 0x10ffff; ucs++)
+	{
+		unsigned char buffer[5];
+		int		size;
+
+		unicode_to_utf8(ucs, buffer, &size);
+		buffer[size] = '\0';
+
+		if (utf8_tofold((char *) buffer) != ucs_tofold_ref(ucs) ||
+			utf8_isupper((char *) buffer) != (ucs_isupper_ref(ucs) != 0))
+		{
+			if (errors++ < 10)
+				fprintf(stderr, "case mismatch U+%04X: %d %d\n",
+						(unsigned int) ucs,
+						utf8_tofold((char *) buffer),
+						ucs_tofold_ref(ucs));
+		}
+	}
+
+	return errors;
+}
+
+static void
+report(const char *name, const char *unit, double start, double end, long operations, long checksum)
+{
+	printf("%-28s %10.2f ns/%-5s %12.0f %ss/s   (checksum %ld)\n",
+		   name,
+		   (end - start) / operations, unit,
+		   operations / ((end - start) / 1e9), unit,
+		   checksum);
+}
+
+int
+main(int argc, char **argv)
+{
+	int		loops = argc > 1 ? atoi(argv[1]) : 2000;
+	double	start, end;
+	long	checksum;
+	int		i, j;
+
+	if (check_width() != 0)
+	{
+		fprintf(stderr, "table and reference widths are different\n");
+		return 1;
+	}
+
+	if (check_case() != 0)
+	{
+		fprintf(stderr, "table and reference case folding are different\n");
+		return 1;
+	}
+
+	if (check_search() != 0)
+	{
+		fprintf(stderr, "searching returns different results\n");
+		return 1;
+	}
+
+	prepare_sample();
+
+	checksum = 0;
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < SAMPLE_CHARS; j++)
+			checksum += ucs_wcwidth_ref(utf8_to_unicode(sample + sample_offsets[j]));
+	end = now_ns();
+	report("utf_dsplen (bisection)", "char", start, end, (long) loops * SAMPLE_CHARS, checksum);
+
+	checksum = 0;
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < SAMPLE_CHARS; j++)
+			checksum += utf_dsplen((char *) sample + sample_offsets[j]);
+	end = now_ns();
+	report("utf_dsplen (two-stage table)", "char", start, end, (long) loops * SAMPLE_CHARS, checksum);
+
+	checksum = 0;
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < SAMPLE_CHARS; j++)
+			checksum += ucs_tofold_ref(utf8_to_unicode(sample + sample_offsets[j]));
+	end = now_ns();
+	report("utf8_tofold (bisection)", "char", start, end, (long) loops * SAMPLE_CHARS, checksum);
+
+	checksum = 0;
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < SAMPLE_CHARS; j++)
+			checksum += utf8_tofold((char *) sample + sample_offsets[j]);
+	end = now_ns();
+	report("utf8_tofold (table)", "char", start, end, (long) loops * SAMPLE_CHARS, checksum);
+
+	checksum = 0;
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < SAMPLE_CHARS; j++)
+			checksum += ucs_isupper_ref(utf8_to_unicode(sample + sample_offsets[j]));
+	end = now_ns();
+	report("utf8_isupper (bisection)", "char", start, end, (long) loops * SAMPLE_CHARS, checksum);
+
+	checksum = 0;
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		for (j = 0; j < SAMPLE_CHARS; j++)
+			checksum += utf8_isupper((char *) sample + sample_offsets[j]);
+	end = now_ns();
+	report("utf8_isupper (table)", "char", start, end, (long) loops * SAMPLE_CHARS, checksum);
+
+	/* typical menu labels */
+	{
+		const char *labels[] = {
+			"File listing", "Quick view", "Compare directories",
+			"Edit highlighting group file", "Switch panels on/off",
+			"Nastavení", "Ukončit", "Файл", "ファイル", "Open \xf0\x9f\x93\x82 folder"
+		};
+		int		nlabels = sizeof(labels) / sizeof(char *);
+		size_t	lengths[10];
+
+		for (j = 0; j < nlabels; j++)
+		{
+			lengths[j] = strlen(labels[j]);
+
+			if (string_dsplen_ref(labels[j], lengths[j]) != utf_string_dsplen(labels[j], lengths[j]) ||
+				utf8len_ref(labels[j]) != utf8len((char *) labels[j]))
+			{
+				fprintf(stderr, "different result for label \"%s\"\n", labels[j]);
+				return 1;
+			}
+		}
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops * 100; i++)
+			for (j = 0; j < nlabels; j++)
+				checksum += string_dsplen_ref(labels[j], lengths[j]);
+		end = now_ns();
+		report("utf_string_dsplen (decode)", "label", start, end, (long) loops * 100 * nlabels, checksum);
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops * 100; i++)
+			for (j = 0; j < nlabels; j++)
+				checksum += utf_string_dsplen(labels[j], lengths[j]);
+		end = now_ns();
+		report("utf_string_dsplen (ascii)", "label", start, end, (long) loops * 100 * nlabels, checksum);
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops * 100; i++)
+			for (j = 0; j < nlabels; j++)
+				checksum += utf8len_ref(labels[j]);
+		end = now_ns();
+		report("utf8len (bytewise)", "label", start, end, (long) loops * 100 * nlabels, checksum);
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops * 100; i++)
+			for (j = 0; j < nlabels; j++)
+				checksum += utf8len((char *) labels[j]);
+		end = now_ns();
+		report("utf8len (word at time)", "label", start, end, (long) loops * 100 * nlabels, checksum);
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops * 100; i++)
+			for (j = 0; j < nlabels; j++)
+				checksum += nstrstr_ref(labels[j], "DIR") != NULL;
+		end = now_ns();
+		report("utf8_nstrstr (restart)", "label", start, end, (long) loops * 100 * nlabels, checksum);
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops * 100; i++)
+			checksum += utf8_nstrstr_batch("DIR", false, labels, nlabels, NULL);
+		end = now_ns();
+		report("utf8_nstrstr_batch (kmp)", "label", start, end, (long) loops * 100 * nlabels, checksum);
+	}
+
+	/* worst case for restarting search */
+	{
+		char	haystack[1024 + 1];
+		const char *needle = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab";
+
+		memset(haystack, 'A', 1024);
+		haystack[1024] = '\0';
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops; i++)
+			checksum += nstrstr_ref(haystack, needle) != NULL;
+		end = now_ns();
+		report("utf8_nstrstr (restart)", "kB", start, end, (long) loops, checksum);
+
+		checksum = 0;
+		start = now_ns();
+		for (i = 0; i < loops; i++)
+			checksum += utf8_nstrstr(haystack, needle) != NULL;
+		end = now_ns();
+		report("utf8_nstrstr (kmp)", "kB", start, end, (long) loops, checksum);
+	}
+
+	return 0;
+}
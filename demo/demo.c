@@ -69,6 +69,10 @@ get_event(MEVENT *mevent, bool *alt)
 
 	*alt = false;
 
+	/* replayed events (see ST_MENU_REPLAY) are used before live events */
+	if (st_menu_replay_next(&c, alt, mevent, true))
+		return c;
+
 repeat:
 
 #if defined(NCURSES_WIDECHAR) && (defined(HAVE_NCURSESW_CURSES_H) || defined(HAVE_NCURSESW_H))
@@ -174,6 +178,8 @@ main()
 	int		style = 1;
 	bool	xterm_mouse_mode = false;
 	char   *term_str;
+	FILE   *record_file = NULL;
+	FILE   *replay_file = NULL;
 
 	WINDOW *w1 = NULL;
 	WINDOW *w2 = NULL;
@@ -190,13 +196,13 @@ main()
 			"deserunt mollit anim id est laborum.";
 
 	ST_CMDBAR_ITEM	bottombar[] = {
-		{"Help", false, 1, 1, 0},
-		{"Menu", false, 2, 2, 0},
-		{"View", false, 3, 3, 0},
-		{"Edit", false, 4, 4, 0},
-		{"Copy", false, 5, 5, 0},
-		{"PullDn", false, 9, 99, 0},
-		{"Quit", false, 10, 100, 0},
+		{"Help", false, 1, 1, 0, 0},
+		{"Menu", false, 2, 2, 0, 0},
+		{"View", false, 3, 3, 0, 0},
+		{"Edit", false, 4, 4, 0, 0},
+		{"Copy", false, 5, 5, 0, 0},
+		{"PullDn", false, 9, 99, 0, 0},
+		{"Quit", false, 10, 100, 0, 0},
 		{NULL}
 	};
 
@@ -436,6 +442,22 @@ main()
 	/* prepare state variable for menubar */
 	menu = st_menu_new_menubar(&config, menubar);
 
+	/*
+	 * Tables with precomputed layout of menu for current style can be
+	 * generated to file specified by ST_MENU_PRECOMPILE. These tables
+	 * can be used by st_menu_new_precompiled.
+	 */
+	if (getenv("ST_MENU_PRECOMPILE"))
+	{
+		FILE   *precompiled_file = fopen(getenv("ST_MENU_PRECOMPILE"), "w");
+
+		if (precompiled_file)
+		{
+			st_menu_write_precompiled(precompiled_file, menu, "demo_menu");
+			fclose(precompiled_file);
+		}
+	}
+
 	/* default theme is Vision, mark it in menu list */
 	st_menu_enable_option(menu, 72, ST_MENU_OPTION_MARKED);
 
@@ -448,6 +470,24 @@ main()
 	/* pass desktop panel to lib to show shadows correctly */
 	st_menu_set_desktop_window(stdscr);
 
+	/*
+	 * Events passed to st_menu_driver can be recorded to file specified
+	 * by ST_MENU_RECORD, and replayed from file specified by ST_MENU_REPLAY.
+	 */
+	if (getenv("ST_MENU_RECORD"))
+	{
+		record_file = fopen(getenv("ST_MENU_RECORD"), "wb");
+		if (record_file)
+			st_menu_record_start(record_file);
+	}
+
+	if (getenv("ST_MENU_REPLAY"))
+	{
+		replay_file = fopen(getenv("ST_MENU_REPLAY"), "rb");
+		if (replay_file)
+			st_menu_replay_start(replay_file);
+	}
+
 	/* post menubar (display it) */
 	st_menu_post(menu);
 	st_cmdbar_post(cmdbar);
@@ -462,8 +502,8 @@ main()
 
 		if (c == KEY_RESIZE)
 		{
-			int		cursor_store[1024];
-			int		*refvals_store[1024];
+			unsigned char snapshot[1024];
+			size_t	snapshot_size;
 
 			getmaxyx(stdscr, maxy, maxx);
 			wbkgd(stdscr, COLOR_PAIR(1));
@@ -477,13 +517,13 @@ main()
 
 			wnoutrefresh(stdscr);
 
-			st_menu_save(menu, cursor_store, refvals_store, 1023);
+			snapshot_size = st_menu_snapshot_write(menu, snapshot, sizeof(snapshot));
 
 			st_menu_free(menu);
 			menu = st_menu_new_menubar2(&config,
 						style != ST_MENU_STYLE_FREE_DOS ? NULL : &config_b, menubar);
 
-			st_menu_load(menu, cursor_store, refvals_store);
+			st_menu_snapshot_read(menu, snapshot, snapshot_size);
 
 			st_cmdbar_free(cmdbar);
 			cmdbar = st_cmdbar_new(&config, bottombar);
@@ -505,15 +545,15 @@ main()
 		{
 			if (active_item->group == THEME_GROUP)
 			{
-				int		cursor_store[1024];
-				int	   *refvals_store[1024];
+				unsigned char snapshot[1024];
+				size_t	snapshot_size;
 				int		fcp = 2;
 				int		menu_code = active_item->code;
 				int		start_from_rgb = 200;
 
 				style = active_item->data;
 
-				st_menu_save(menu, cursor_store, refvals_store, 1023);
+				snapshot_size = st_menu_snapshot_write(menu, snapshot, sizeof(snapshot));
 
 				st_menu_free(menu);
 				st_cmdbar_free(cmdbar);
@@ -538,7 +578,7 @@ main()
 
 				menu = st_menu_new_menubar2(&config, style != ST_MENU_STYLE_FREE_DOS ? NULL : &config_b, menubar);
 
-				st_menu_load(menu, cursor_store, refvals_store);
+				st_menu_snapshot_read(menu, snapshot, snapshot_size);
 
 				cmdbar = st_cmdbar_new(&config, bottombar);
 
@@ -597,6 +637,13 @@ main()
 			doupdate();
 		}
 
+		/* Ctrl-P opens command palette */
+		if (!processed && c == 16)
+		{
+			st_menu_palette_post(menu);
+			doupdate();
+		}
+
 		/* q is common command for exit (when it is not used like accelerator */
 		if (!processed && (c == 'q'))
 		{
@@ -625,6 +672,15 @@ main()
 	st_menu_unpost(menu, true);
 	st_menu_free(menu);
 
+	if (record_file)
+	{
+		st_menu_record_stop();
+		fclose(record_file);
+	}
+
+	if (replay_file)
+		fclose(replay_file);
+
 	if (requested_exit)
 		printf("exiting...\n");
 	else if (active_item)
@@ -3,6 +3,7 @@
 #define _ST_MENU_H
 
 #include <stdbool.h>
+#include <wchar.h>
 #include "st_curses.h"
 
 #define ST_MENU_STYLE_MCB			0
@@ -70,7 +71,7 @@ typedef struct st_ST_MENU_ITEM
 {
 	char   *text;						/* text of menu item, possible specify accelerator by ~ */
 	int		code;						/* code of menu item (optional) */
-	char   *shortcut;					/* shortcut text, only printed (optional) */
+	char   *shortcut;					/* shortcut text, like "^S", "M-x", "F2" (optional) */
 	int		data;						/* allow to assign some value to menu item (optional) */
 	char	group;						/* specify semantics of data value (optional) */
 	int		options;					/* locked, marked, ... (optional) */
@@ -119,10 +120,47 @@ typedef struct
 	int		switch_tag_1;			/* symbol used for switch 1 */
 	int		scroll_up_tag;			/* symbol used for possibility to scroll up */
 	int		scroll_down_tag;		/* symbol used for possibility to scroll down */
+	int		scroll_thumb_tag;		/* symbol used for scroll position, 0 when it is not displayed */
+	int		page_step;				/* rows moved by page up/down, 0 for height of menu */
+	int		max_rows;				/* longer pulldown menu is wrapped to columns, 0 disables it */
 } ST_MENU_CONFIG;
 
 struct ST_MENU;
 
+/*
+ * Case folded accelerator of menu item
+ */
+typedef struct
+{
+	char	*c;							/* case folded accelerator (not zero terminated) */
+	int		length;						/* length of c in bytes */
+	int		row;						/* row of menu item (from 1) */
+} ST_MENU_ACCELERATOR;
+
+/*
+ * Precomputed layout of menubar or pulldown menu. These tables are
+ * generated by st_menu_write_precompiled for specified config, and they
+ * are used by st_menu_new_precompiled.
+ */
+typedef struct st_ST_MENU_PRECOMPILED
+{
+	ST_MENU_ITEM *menu_items;
+	unsigned int config_hash;			/* fingerprint of config used for layout */
+	int		screen_cols;				/* stdscr cols used for layout of menubar or 0 */
+	int		nitems;						/* number of menu items */
+	int		rows;						/* rows of pulldown menu window */
+	int		cols;						/* columns of pulldown menu window */
+	int		shortcut_x_pos;
+	int		item_x_pos;
+	int		cursor_row;					/* first or default row */
+	int		begin_y;					/* ideal position of pulldown menu */
+	int		begin_x;
+	int	   *bar_fields_x_pos;			/* positions of menubar fields (nitems + 1) or NULL */
+	int		naccelerators;
+	ST_MENU_ACCELERATOR *accelerators;
+	struct st_ST_MENU_PRECOMPILED **submenus;	/* nitems fields */
+} ST_MENU_PRECOMPILED;
+
 typedef struct
 {
 	char	   *text;				/* text of command bar field */
@@ -130,10 +168,84 @@ typedef struct
 	int			fkey;				/* Func key number */
 	int			code;				/* code of command bar item */
 	int			option;				/* locked, marked, ... (optional) */
+	int			modifiers;			/* Shift, Ctrl modifiers of fkey 1..12 (optional) */
 } ST_CMDBAR_ITEM;
 
+#define ST_CMDBAR_MOD_SHIFT			1		/* Shift+Fx is reported as F(x + 12) */
+#define ST_CMDBAR_MOD_CTRL			2		/* Ctrl+Fx is reported as F(x + 24) */
+
+#define ST_CMDBAR_MAX_FKEY			63		/* highest function key reported by ncurses */
+
 struct ST_CMDBAR;
 
+#define ST_MENU_BACKEND_NCURSES		0		/* output to ncurses windows */
+#define ST_MENU_BACKEND_GRID		1		/* output to in-memory grid of cells */
+
+/*
+ * Cell of grid backend. Line drawing chars are translated to unicode
+ * and have A_ALTCHARSET attribute. Second cell of wide char has ch 0.
+ */
+typedef struct
+{
+	wchar_t		ch;
+	attr_t		attr;
+	short		cpn;
+} ST_MENU_CELL;
+
+#define ST_MENU_STATS_DRIVER		0		/* st_menu_driver (with nested draw functions) */
+#define ST_MENU_STATS_MENUBAR		1		/* menubar_draw */
+#define ST_MENU_STATS_PULLDOWN		2		/* pulldownmenu_draw */
+#define ST_MENU_STATS_SHADOW		3		/* pulldownmenu_draw_shadow */
+#define ST_MENU_STATS_CMDBAR		4		/* cmdbar_draw */
+
+#define ST_MENU_STATS_COUNT			5
+
+typedef struct
+{
+	long		calls;				/* number of calls */
+	long		bytes;				/* bytes sent to terminal */
+	long		last_bytes;			/* bytes sent by last call */
+	long		max_bytes;			/* maximal bytes sent by one call */
+} ST_MENU_STATS_ITEM;
+
+typedef struct
+{
+	ST_MENU_STATS_ITEM	items[ST_MENU_STATS_COUNT];
+} ST_MENU_STATS;
+
+/*
+ * Trace points. Draw functions, driver, accelerator lookup, update_panels
+ * and menu construction have BEGIN and END records.
+ */
+#define ST_MENU_TRACE_DRIVER		0		/* value: key code, result */
+#define ST_MENU_TRACE_ACCEL_LOOKUP	1		/* value: key code, found row or -1 */
+#define ST_MENU_TRACE_MENUBAR_DRAW	2		/* value: 0, number of items */
+#define ST_MENU_TRACE_PULLDOWN_DRAW	3		/* value: is top, painted rows */
+#define ST_MENU_TRACE_SHADOW_DRAW	4		/* value: 0, rows of shadow window */
+#define ST_MENU_TRACE_CMDBAR_DRAW	5		/* value: 0, number of items */
+#define ST_MENU_TRACE_UPDATE_PANELS	6
+#define ST_MENU_TRACE_MENU_NEW		7		/* value: is menubar, number of items */
+
+#define ST_MENU_TRACE_BEGIN			0
+#define ST_MENU_TRACE_END			1
+
+typedef struct
+{
+	long long	timestamp;				/* CLOCK_MONOTONIC in ns */
+	short		event;
+	short		phase;
+	int			value;					/* event specific value */
+} ST_MENU_TRACE_RECORD;
+
+typedef struct
+{
+	long		allocations;			/* allocations done by library */
+	long		redraws;				/* calls of draw functions */
+	long		rows_painted;			/* painted rows of menubar, pulldown menus and command bar */
+	long		driver_calls;			/* calls of st_menu_driver */
+	long		windows;				/* windows created by library */
+} ST_MENU_TRACE_COUNTERS;
+
 extern int st_menu_load_style(ST_MENU_CONFIG *config, int style, int start_from_cpn, bool force8bit, bool force_ascii_art);
 extern int st_menu_load_style_rgb(ST_MENU_CONFIG *config, int style, int start_from_cpn, int *start_from_rgb, bool force8bit, bool force_ascii_art);
 
@@ -141,6 +253,8 @@ extern void st_menu_set_desktop_window(WINDOW *win);
 extern struct ST_MENU *st_menu_new(ST_MENU_CONFIG *config, ST_MENU_ITEM *items, int begin_y, int begin_x, char *title);
 extern struct ST_MENU *st_menu_new_menubar(ST_MENU_CONFIG *config, ST_MENU_ITEM *items);
 extern struct ST_MENU *st_menu_new_menubar2(ST_MENU_CONFIG *barcfg, ST_MENU_CONFIG *pdcfg, ST_MENU_ITEM *items);
+extern struct ST_MENU *st_menu_new_precompiled(ST_MENU_CONFIG *barcfg, ST_MENU_CONFIG *pdcfg, ST_MENU_PRECOMPILED *precompiled);
+extern bool st_menu_write_precompiled(FILE *fp, struct ST_MENU *menu, const char *name);
 
 extern void st_menu_post(struct ST_MENU *menu);
 extern void st_menu_unpost(struct ST_MENU *menu, bool close_active_submenu);
@@ -149,6 +263,15 @@ extern void st_menu_free(struct ST_MENU *menu);
 extern void st_menu_save(struct ST_MENU *menu, int *cursor_rows, int **refvals, int max_items);
 extern void st_menu_load(struct ST_MENU *menu, int *cursor_rows, int **refvals);
 
+extern size_t st_menu_snapshot_size(struct ST_MENU *menu);
+extern size_t st_menu_snapshot_write(struct ST_MENU *menu, void *buffer, size_t size);
+extern bool st_menu_snapshot_read(struct ST_MENU *menu, const void *buffer, size_t size);
+
+extern bool st_menu_record_start(FILE *fp);
+extern void st_menu_record_stop(void);
+extern bool st_menu_replay_start(FILE *fp);
+extern bool st_menu_replay_next(int *c, bool *alt, MEVENT *mevent, bool real_speed);
+
 extern int st_menu_get_focus(struct ST_MENU *menu);
 
 extern ST_MENU_ITEM *st_menu_selected_item(bool *activated);
@@ -162,6 +285,22 @@ extern bool st_menu_reset_all_options(struct ST_MENU *menu, int option);
 extern void st_menu_set_focus(struct ST_MENU *menu, int focus);
 
 extern bool st_menu_set_shortcut(struct ST_MENU *menu, int code, char *shortcut);
+extern void st_menu_set_shortcuts_enabled(struct ST_MENU *menu, bool enabled);
+
+extern struct ST_MENU *st_menu_get_submenu(struct ST_MENU *menu, int code);
+extern bool st_menu_insert_item(struct ST_MENU *menu, int position, ST_MENU_ITEM *item);
+extern bool st_menu_remove_item(struct ST_MENU *menu, int position);
+extern bool st_menu_replace_item(struct ST_MENU *menu, int position, ST_MENU_ITEM *item);
+
+extern bool st_menu_set_deferred(struct ST_MENU *menu, int code, void (*fill)(struct ST_MENU *submenu, int code, void *data), void *data);
+extern bool st_menu_push_items(struct ST_MENU *submenu, ST_MENU_ITEM *items, int nitems, bool last);
+extern bool st_menu_process_pending(struct ST_MENU *menu);
+
+extern void st_menu_palette_post(struct ST_MENU *menu);
+extern void st_menu_palette_unpost(struct ST_MENU *menu);
+extern bool st_menu_palette_is_posted(struct ST_MENU *menu);
+
+extern bool st_menu_set_filter(struct ST_MENU *menu, bool enabled);
 
 extern bool st_menu_set_ref_option(struct ST_MENU *menu, int code, int option, int *refvalue);
 
@@ -169,7 +308,26 @@ extern struct ST_CMDBAR *st_cmdbar_new(ST_MENU_CONFIG *config, ST_CMDBAR_ITEM *c
 extern void st_cmdbar_post(struct ST_CMDBAR *cmdbar);
 extern void st_cmdbar_unpost(struct ST_CMDBAR *cmdbar);
 extern void st_cmdbar_free(struct ST_CMDBAR *cmdbar);
+extern void st_cmdbar_add_set(struct ST_CMDBAR *cmdbar, const char *name, ST_CMDBAR_ITEM *cmdbar_items);
+extern bool st_cmdbar_switch_set(struct ST_CMDBAR *cmdbar, const char *name);
 
 extern void st_menu_set_direct_color(bool direct_color);
 
+extern void st_menu_stats_enable(long (*counter)(void *data), void *data);
+extern void st_menu_stats_get(ST_MENU_STATS *stats);
+extern void st_menu_stats_reset(void);
+extern long st_menu_stats_fd_counter(void *data);
+
+extern bool st_menu_trace_set_callback(void (*callback)(const ST_MENU_TRACE_RECORD *record, void *data), void *data);
+extern bool st_menu_trace_set_buffer(ST_MENU_TRACE_RECORD *buffer, int size);
+extern int st_menu_trace_read(ST_MENU_TRACE_RECORD *records, int max);
+extern void st_menu_trace_get_counters(ST_MENU_TRACE_COUNTERS *counters);
+extern void st_menu_trace_reset_counters(void);
+
+extern void st_menu_set_backend(int backend);
+extern void st_menu_grid_init(int rows, int cols);
+extern void st_menu_grid_clear(void);
+extern ST_MENU_CELL *st_menu_grid_cells(int *rows, int *cols);
+extern void st_menu_grid_free(void);
+
 #endif
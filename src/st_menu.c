@@ -2,9 +2,14 @@
 
 #include <ctype.h>
 #include "st_panel.h"
+#include "st_menu_backend.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 #include <wchar.h>
+#include <wctype.h>
 
 #ifdef HAVE_LIBUNISTRING
 
@@ -21,6 +26,20 @@
 
 #endif
 
+#include "unicode_ascii.h"
+
+/*
+ * Items can be pushed to deferred submenu from other threads. Without
+ * C11 atomics the items should be pushed from thread of driver.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+#define ST_MENU_ATOMIC_CHUNKS
+
+#endif
+
 
 /*
  * This window is main application window. It is used for taking content
@@ -28,22 +47,220 @@
  */
 static WINDOW *desktop_win = NULL;
 
+#define ST_MENU_LABEL_HIGHLIGHT			1
+
+/*
+ * Label of menu item decoded to displayed chars. The text of label is
+ * decoded only once (when menu is created), and then these arrays are
+ * used for layout and drawing. Special chars (~ and _) are not stored.
+ */
 typedef struct
 {
-	char	*c;
-	int		length;
-	int		row;
-} ST_MENU_ACCELERATOR;
+	int			nchars;					/* number of displayed chars */
+	wchar_t	   *codes;					/* code points of chars */
+	signed char *widths;				/* display widths of chars */
+	int		   *offsets;				/* byte offsets of chars in text */
+	unsigned char *lengths;				/* length of chars in bytes */
+	unsigned char *flags;				/* ST_MENU_LABEL_HIGHLIGHT, nchars + 1 fields */
+	int			width;					/* display width of label */
+	int			shortcut_width;			/* display width of shortcut */
+	int			accel_offset;			/* byte offset of accelerator or -1 */
+	bool		is_extern_accel;
+} ST_MENU_LABEL;
+
+/*
+ * Item of hash table of shortcuts. The key is code of key shifted
+ * left with alt flag in lowest bit, -1 for unused field.
+ */
+typedef struct
+{
+	int			key;
+	struct ST_MENU *menu;						/* menu that holds item */
+	int			offset;							/* offset of item in menu */
+} ST_MENU_SHORTCUT;
+
+/*
+ * Command palette. The labels of all selectable items of menu tree are
+ * folded to keys (one key per displayed char), and the keys are mapped to
+ * small ids. For every id there is list of entries, that contains this char
+ * (posting list) with positions of its occurrences, so first char of query
+ * doesn't need to scan labels. Every entry has 64bit mask of its ids too.
+ * The index is built when palette is posted first time, and again only
+ * after change of items.
+ *
+ * The entries matched by query of length n are stored in level n. Two
+ * alignments of query are searched: leftmost (it decides if query is
+ * matched), and preferred (it prefers consecutive chars and chars on begin
+ * of words, but it can fail). Only end positions of alignments are stored,
+ * so appended char is searched only after these positions, and removed
+ * char just returns to previous level.
+ */
+#define ST_MENU_PALETTE_MAX_QUERY		64
+#define ST_MENU_PALETTE_MAX_RESULTS		15
+#define ST_MENU_PALETTE_MAX_IDS			65536
+#define ST_MENU_PALETTE_MAX_CHARS		65535	/* only begin of longer labels is searched */
+
+typedef struct
+{
+	struct ST_MENU *menu;						/* menu that holds item */
+	int			offset;							/* offset of item in menu */
+	int			start;							/* first key in ids */
+	int			nkeys;
+	int			words;							/* first word in words */
+	int			nwords;
+	uint64_t	mask;							/* bits of ids */
+	int			path;							/* offset of breadcrumb in paths */
+} ST_MENU_PALETTE_ENTRY;
+
+typedef struct
+{
+	int			entry;
+	int			score;							/* score of entry for one char query */
+	unsigned short first;						/* first occurrence of char */
+	unsigned short preferred;					/* first occurrence on begin of word */
+	unsigned char first_score;
+	unsigned char preferred_score;
+} ST_MENU_PALETTE_POSTING;
+
+typedef struct
+{
+	int			entry;
+	int			score;							/* score of better alignment */
+	int			leftmost;						/* last char of leftmost alignment */
+	int			leftmost_score;
+	int			preferred;						/* last char of preferred alignment or -1 */
+	int			preferred_score;
+} ST_MENU_PALETTE_MATCH;
+
+typedef struct
+{
+	ST_MENU_PALETTE_MATCH *matches;				/* in order of menu tree */
+	int			count;
+	int			capacity;
+} ST_MENU_PALETTE_LEVEL;
+
+typedef struct
+{
+	bool		is_valid;						/* index is built for current items */
+	bool		is_posted;
+	ST_MENU_PALETTE_ENTRY *entries;
+	int			nentries;
+	int			entries_capacity;
+	unsigned short *ids;						/* ids of folded chars of labels */
+	unsigned char *word_starts;					/* char is first char of word */
+	int		   *words;							/* positions of first chars of words */
+	int			nwords;
+	int			nkeys;
+	int			keys_capacity;
+	int			max_nkeys;
+	unsigned int *id_keys;						/* hash table of ids of non ASCII keys */
+	unsigned short *id_values;
+	int			id_table_size;					/* power of 2 */
+	int			nids;
+	int		   *postings_start;					/* nids + 1 fields */
+	ST_MENU_PALETTE_POSTING *postings;
+	char	   *paths;							/* zero terminated breadcrumbs */
+	int			paths_size;
+	int			paths_capacity;
+	bool	   *positions;						/* matched chars of drawn entry */
+	char		query[ST_MENU_PALETTE_MAX_QUERY * 4 + 1];	/* typed text */
+	int			query_offsets[ST_MENU_PALETTE_MAX_QUERY + 1];
+	int			query_ids[ST_MENU_PALETTE_MAX_QUERY];
+	int			query_length;					/* number of chars */
+	ST_MENU_PALETTE_LEVEL levels[ST_MENU_PALETTE_MAX_QUERY + 1];
+	int			results[ST_MENU_PALETTE_MAX_RESULTS];
+	int			result_scores[ST_MENU_PALETTE_MAX_RESULTS];
+	int			nresults;
+	int			cursor;
+	int			mouse_row;						/* result where button1 was pressed */
+	WINDOW	   *window;
+	PANEL	   *panel;
+	int			rows;
+	int			cols;
+	int			screen_rows;					/* size of screen used by layout */
+	int			screen_cols;
+} ST_MENU_PALETTE;
+
+/*
+ * Type-ahead filter of pulldown menu. The labels are folded to keys (same
+ * keys like keys of command palette) when filter is used first time, and
+ * again after change of items. The items matched by query of length n are
+ * stored in level n with position of first occurrence of query. Longer
+ * query cannot be found before this position, so appended char is searched
+ * only in items of previous level, and removed char returns to previous
+ * level. The items without some char of query are rejected by 64bit masks
+ * of keys without scanning of label.
+ */
+#define ST_MENU_FILTER_MAX_QUERY		32
+
+typedef struct
+{
+	int			offset;							/* offset of item in menu */
+	int			pos;							/* first occurrence of query in label */
+} ST_MENU_FILTER_MATCH;
+
+typedef struct
+{
+	ST_MENU_FILTER_MATCH *matches;
+	int			count;
+	int			capacity;
+} ST_MENU_FILTER_LEVEL;
+
+typedef struct
+{
+	bool		is_valid;						/* keys of labels are valid */
+	unsigned int *keys;							/* folded chars of labels */
+	int			keys_capacity;
+	int		   *starts;							/* nitems + 1 fields */
+	uint64_t   *masks;							/* masks of keys of labels */
+	int			starts_capacity;
+	char		query[ST_MENU_FILTER_MAX_QUERY * 4 + 1];	/* typed text */
+	int			query_offsets[ST_MENU_FILTER_MAX_QUERY + 1];
+	unsigned int query_keys[ST_MENU_FILTER_MAX_QUERY];
+	int			query_length;					/* number of chars */
+	ST_MENU_FILTER_LEVEL levels[ST_MENU_FILTER_MAX_QUERY + 1];
+} ST_MENU_FILTER;
+
+#define ST_MENU_FILL_NONE			0		/* fill function was not called yet */
+#define ST_MENU_FILL_LOADING		1		/* waiting for last pushed items */
+#define ST_MENU_FILL_DONE			2
+
+/*
+ * Items pushed to deferred submenu. The chunks are pushed to lock-free
+ * stack, and the driver takes all chunks together.
+ */
+typedef struct st_ST_MENU_CHUNK
+{
+	struct st_ST_MENU_CHUNK *next;
+	int			nitems;
+	bool		last;
+	ST_MENU_ITEM items[];
+} ST_MENU_CHUNK;
+
+#ifdef ST_MENU_ATOMIC_CHUNKS
+
+typedef _Atomic(ST_MENU_CHUNK *) ST_MENU_CHUNK_STACK;
+
+#else
+
+typedef ST_MENU_CHUNK *ST_MENU_CHUNK_STACK;
+
+#endif
 
 struct ST_MENU
 {
 	ST_MENU_ITEM	   *menu_items;
 	WINDOW	   *draw_area;
+	WINDOW	   *clip_area;						/* cached subwindow for clipped draw area */
 	WINDOW	   *window;
 	PANEL	   *panel;
 	WINDOW	   *shadow_window;
 	PANEL	   *shadow_panel;
 	int			first_row;						/* first visible row */
+	int			page_rows;						/* number of visible rows (from last draw) */
+	int			ncolumns;						/* number of columns of pulldown menu */
+	int			column_rows;					/* rows of column of multi-column menu */
+	int			column_width;					/* width of column of multi-column menu */
 	int			cursor_row;
 	int			mouse_row;						/* mouse row where button1 was pressed */
 	int		   *options;						/* state options, initially copyied from menu */
@@ -62,24 +279,62 @@ struct ST_MENU
 	int			focus;							/* identify possible event filtering */
 	char	   *title;
 	bool		is_menubar;
+	bool		is_precompiled;					/* accelerators and positions are static */
+	ST_MENU_LABEL *labels;						/* decoded texts of menu items */
 	struct ST_MENU	*active_submenu;
 	struct ST_MENU	**submenus;
+	struct ST_MENU	*parent_menu;					/* menu with item of this submenu */
+	int			parent_offset;					/* offset of this item */
+	ST_MENU_SHORTCUT *shortcuts;				/* hash of shortcuts of menu tree (top menu only) */
+	int			shortcuts_size;					/* power of 2 */
+	bool		shortcuts_enabled;				/* shortcuts are dispatched (top menu only) */
+	bool		shortcuts_is_valid;				/* hash of shortcuts is built for current items */
+	ST_MENU_CONFIG *submenu_config;				/* config used for new submenus */
+	bool		owns_items;						/* menu_items is own copy */
+	int			items_capacity;					/* allocated size of arrays of items */
+	void	  (*fill)(struct ST_MENU *submenu, int code, void *data);	/* fill function of deferred submenu */
+	void	   *fill_data;
+	int			fill_code;						/* code of item of deferred submenu */
+	int			fill_state;						/* ST_MENU_FILL_NONE, _LOADING or _DONE */
+	int			nplaceholders;					/* items replaced by first pushed items */
+	ST_MENU_CHUNK_STACK pending;				/* pushed items */
+	struct ST_MENU *next_loading;				/* list of loading deferred submenus */
+	ST_MENU_PALETTE *palette;					/* command palette (top menu only) */
+	ST_MENU_FILTER *filter;						/* type-ahead filter (pulldown menu only) */
 };
 
-struct ST_CMDBAR
+/*
+ * Set of command bar items with layout calculated for some width of screen.
+ */
+typedef struct
 {
+	char	   *name;						/* NULL for set passed to st_cmdbar_new */
 	ST_CMDBAR_ITEM	   *cmdbar_items;
-	WINDOW	   *window;
-	PANEL	   *panel;
-	ST_MENU_CONFIG *config;
+	int			cols;						/* width of screen used by layout */
 	int			nitems;
 	int		   *positions;
 	char	  **labels;
 	ST_CMDBAR_ITEM	   **ordered_items;
+	ST_CMDBAR_ITEM	   *fkey_items[2][ST_CMDBAR_MAX_FKEY + 1];	/* [alt][fkey] dispatch table */
+} ST_CMDBAR_SET;
+
+struct ST_CMDBAR
+{
+	WINDOW	   *window;
+	PANEL	   *panel;
+	ST_MENU_CONFIG *config;
+	int			nsets;
+	ST_CMDBAR_SET *sets;
+	ST_CMDBAR_SET *set;						/* active set */
+	ST_CMDBAR_SET *drawn_set;				/* state of last draw */
+	ST_CMDBAR_ITEM *drawn_marked;
+	int			drawn_cols;
 };
 
 static struct ST_CMDBAR   *active_cmdbar = NULL;
 
+static struct ST_MENU	   *loading_menus = NULL;
+
 static ST_MENU_ITEM		   *selected_item = NULL;
 static ST_CMDBAR_ITEM	   *selected_command = NULL;
 static int					selected_options = 0;
@@ -88,20 +343,76 @@ static int				   *selected_refval = NULL;
 static bool			press_accelerator = false;
 static bool			button1_clicked = false;
 static bool			press_enter = false;
+static bool			press_shortcut = false;
 
 static bool			command_was_activated = false;
 
+/*
+ * Output statistics. When counter is assigned, then doupdate is called
+ * after every draw function and after st_menu_driver, and the increase
+ * of bytes written to terminal is assigned to this function.
+ */
+static long		  (*stats_counter)(void *data) = NULL;
+static void		   *stats_counter_data = NULL;
+static long			stats_last_bytes = 0;
+static ST_MENU_STATS stats;
+
+/*
+ * Tracing. The trace points can be removed by ST_MENU_NO_TRACE. Else the
+ * records are passed to callback or stored to ring buffer, when one of
+ * these is assigned. The counters are updated always.
+ */
+#ifndef ST_MENU_NO_TRACE
+
+static bool			trace_active = false;
+static void		  (*trace_callback)(const ST_MENU_TRACE_RECORD *record, void *data) = NULL;
+static void		   *trace_callback_data = NULL;
+static ST_MENU_TRACE_RECORD *trace_buffer = NULL;
+static int			trace_buffer_size = 0;
+static long			trace_write_pos = 0;
+static long			trace_read_pos = 0;
+static ST_MENU_TRACE_COUNTERS trace_counters;
+
+static void trace_event(int event, int phase, int value);
+
+#define TRACE(event, phase, value) \
+	do { if (trace_active) trace_event((event), (phase), (value)); } while (0)
+
+#define TRACE_COUNT(counter, n)		(trace_counters.counter += (n))
+
+#else
+
+#define TRACE(event, phase, value)	((void) 0)
+#define TRACE_COUNT(counter, n)		((void) 0)
+
+#endif
+
 static inline int char_length(ST_MENU_CONFIG *config, const char *c);
 static inline int char_width(ST_MENU_CONFIG *config, char *c);
 static inline int str_width(ST_MENU_CONFIG *config, char *str);
 static inline char *chr_casexfrm(ST_MENU_CONFIG *config, char *str);
 static inline int wchar_to_utf8(ST_MENU_CONFIG *config, char *str, int n, wchar_t wch);
+static inline wchar_t char_code(ST_MENU_CONFIG *config, const char *c);
 
 static bool _st_menu_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent, bool is_top, bool is_nested_pulldown, bool *unpost_submenu);
 static void _st_menu_free(struct ST_MENU *menu);
-
-static int menutext_displaywidth(ST_MENU_CONFIG *config, char *text, char **accelerator, bool *extern_accel);
-static void pulldownmenu_content_size(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items,
+static bool menu_process_pending(struct ST_MENU *menu);
+static bool loading_menus_drain(void);
+static void deferred_release(struct ST_MENU *menu);
+static void palette_draw(struct ST_MENU *menu);
+static bool palette_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent);
+static void palette_free(ST_MENU_PALETTE *palette);
+static int pulldownmenu_rows(struct ST_MENU *menu, ST_MENU_FILTER_MATCH **matches);
+static int filter_find_row(ST_MENU_FILTER_MATCH *matches, int nrows, int cursor_row);
+static void filter_update_cursor(struct ST_MENU *menu);
+static int pulldownmenu_enabled_row(struct ST_MENU *menu, ST_MENU_FILTER_MATCH *matches, int nrows, int v, int dir);
+static bool pulldownmenu_column_move(struct ST_MENU *menu, ST_MENU_FILTER_MATCH *matches, int nrows, int dir);
+static bool filter_driver(struct ST_MENU *menu, int c, bool alt);
+static void filter_set_length(struct ST_MENU *menu, int n);
+static void filter_free(ST_MENU_FILTER *filter);
+
+static void label_decode(ST_MENU_CONFIG *config, ST_MENU_LABEL *label, ST_MENU_ITEM *menu_item, bool is_menubar);
+static void pulldownmenu_content_size(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items, ST_MENU_LABEL *labels,
 										int *rows, int *columns, int *shortcut_x_pos, int *item_x_pos,
 										ST_MENU_ACCELERATOR *accelerators, int *naccelerators, int *first_row);
 
@@ -109,9 +420,12 @@ static void pulldownmenu_draw_shadow(struct ST_MENU *menu);
 static void menubar_draw(struct ST_MENU *menu);
 static void pulldownmenu_draw(struct ST_MENU *menu, bool is_top);
 static void cmdbar_draw(struct ST_CMDBAR *cmdbar);
+static void cmdbar_update(struct ST_CMDBAR *cmdbar);
 static bool cmdbar_driver(struct ST_CMDBAR *cmdbar, int c, bool alt, MEVENT *mevent);
 
 static void subtract_correction(WINDOW *s, int *y, int *x);
+static void stats_flush(int kind);
+static void traced_update_panels(void);
 
 /*
  * Generic functions
@@ -133,6 +447,8 @@ safe_malloc(size_t size)
 {
 	void *ptr = malloc(size);
 
+	TRACE_COUNT(allocations, 1);
+
 	if (!ptr)
 	{
 		endwin();
@@ -145,6 +461,23 @@ safe_malloc(size_t size)
 	return ptr;
 }
 
+static void *
+safe_realloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+
+	TRACE_COUNT(allocations, 1);
+
+	if (!ptr)
+	{
+		endwin();
+		printf("FATAL: Out of memory\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
 static void
 adjust_dimension(int size, int begin_pos, int min_pos, int max_size, int shadow_size,
 				 int *adjusted_size, int *adjusted_begin_pos,
@@ -211,6 +544,10 @@ char_length(ST_MENU_CONFIG *config, const char *c)
 {
 	int		result;
 
+	/* fast path, ascii char has one byte everytime */
+	if ((*c & 0x80) == 0)
+		return 1;
+
 	if (!config->force8bit)
 	{
 		/*
@@ -245,6 +582,10 @@ char_length(ST_MENU_CONFIG *config, const char *c)
 static inline int
 char_width(ST_MENU_CONFIG *config, char *c)
 {
+	/* fast path, printable ascii char has width 1 */
+	if (*c >= 0x20 && *c < 0x7f)
+		return 1;
+
 	if (!config->force8bit)
 #ifdef HAVE_LIBUNISTRING
 
@@ -265,89 +606,114 @@ char_width(ST_MENU_CONFIG *config, char *c)
 static inline int
 str_width(ST_MENU_CONFIG *config, char *str)
 {
-	if (!config->force8bit)
+	size_t	len = strlen(str);
+	size_t	ascii;
+
+	if (config->force8bit)
+		return len;
+
+	/*
+	 * The width of printable ascii prefix is same as its length,
+	 * decode only the rest of string.
+	 */
+	ascii = utf8_ascii_prefix(str, len);
+	if (ascii == len)
+		return len;
+
 #ifdef HAVE_LIBUNISTRING
 
-		return u8_strwidth((const uint8_t *) str, config->encoding);
+	return ascii + u8_strwidth((const uint8_t *) str + ascii, config->encoding);
 
 #else
 
-		return utf_string_dsplen((const char *) str, strlen(str));
+	return ascii + utf_string_dsplen((const char *) str + ascii, len - ascii);
 
 #endif
 
-	return strlen(str);
 }
 
 /*
- * Transform string to simply compareable case insensitive string
+ * Transform string to simply compareable case insensitive string. The result
+ * is stored to passed buffer (it is not zero terminated). Returns length of
+ * result. This function doesn't allocate memory, so it can be used in driver.
  */
-static inline char *
-chr_casexfrm(ST_MENU_CONFIG *config, char *str)
+static int
+chr_casexfrm_buf(ST_MENU_CONFIG *config, char *str, char *buffer, int size)
 {
-	char	buffer[20];
-	char   *result;
-
 	if (!config->force8bit)
 	{
 #ifdef HAVE_LIBUNISTRING
 
 		size_t	length;
+		char   *result;
 
-		length = sizeof(buffer);
+		length = size;
 		result = u8_casexfrm((const uint8_t *) str,
 								char_length(config, str),
 									config->language, NULL,
 									buffer, &length);
-		if (result == buffer)
+		if (!result)
+			return 0;
+
+		/* u8_casexfrm allocates result when buffer is not enough */
+		if (result != buffer)
 		{
-			result = strdup(buffer);
-			if (!result)
-			{
-				endwin();
-				printf("FATAL: out of memory\n");
-				exit(1);
-			}
+			length = length < (size_t) size ? length : (size_t) size;
+			memcpy(buffer, result, length);
+			free(result);
 		}
 
+		return strnlen(buffer, length);
+
 #else
 
 		char buffer2[10];
 		int chrl = utf8charlen(*str);
 		int	fold;
 
+		(void) size;
+
 		strncpy(buffer2, str, chrl);
 		buffer2[chrl] = '\0';
 
 		fold  = utf8_tofold((const char *) buffer2);
 
 		memcpy(buffer, &fold, sizeof(int));
-		buffer[sizeof(int)] = '\0';
 
-		result = strdup(buffer);
-		if (!result)
-		{
-			endwin();
-			printf("FATAL: out of memory\n");
-			exit(1);
-		}
+		return strnlen(buffer, sizeof(int));
 
 #endif
 	}
-	else
-	{
-		buffer[0] = tolower(str[0]);
-		buffer[1] = '\0';
 
-		result = strdup(buffer);
-		if (!result)
-		{
-			endwin();
-			printf("FATAL: out of memory\n");
-			exit(1);
-		}
+	buffer[0] = tolower(str[0]);
+
+	return buffer[0] != '\0' ? 1 : 0;
+}
+
+/*
+ * Returns allocated transformed string. It is used for preparing
+ * accelerators, when menu is created.
+ */
+static inline char *
+chr_casexfrm(ST_MENU_CONFIG *config, char *str)
+{
+	char	buffer[64];
+	char   *result;
+	int		length;
+
+	length = chr_casexfrm_buf(config, str, buffer, sizeof(buffer) - 1);
+	buffer[length] = '\0';
+
+	result = strdup(buffer);
+	if (!result)
+	{
+		endwin();
+		printf("FATAL: out of memory\n");
+		exit(1);
 	}
 
+	TRACE_COUNT(allocations, 1);
+
 	return result;
 }
 
@@ -383,6 +749,33 @@ wchar_to_utf8(ST_MENU_CONFIG *config, char *str, int n, wchar_t wch)
 	return result;
 }
 
+/*
+ * Returns code point of multibyte char (or byte, when force8bit is used)
+ */
+static inline wchar_t
+char_code(ST_MENU_CONFIG *config, const char *c)
+{
+	if ((*c & 0x80) == 0 || config->force8bit)
+		return (unsigned char) *c;
+
+#ifdef HAVE_LIBUNISTRING
+
+	{
+		ucs4_t		uc;
+
+		u8_mbtouc(&uc, (const uint8_t *) c, 4);
+
+		return (wchar_t) uc;
+	}
+
+#else
+
+	return utf8_to_unicode((const unsigned char *) c);
+
+#endif
+
+}
+
 /*
  * Workhorse for st_menu_save
  */
@@ -529,2661 +922,7059 @@ st_menu_load(struct ST_MENU *menu, int *cursor_rows, int **refvals)
 
 
 /*
- * Returns display length of some text. ~ char is ignored.
- * ~~ is used as ~.
+ * Snapshot of menu state is compact binary blob. It starts by magic
+ * "STMS" and format version. Then the state of menubar (or pulldown menu)
+ * follows. Numbers are stored as variable length integers (7 bits per byte,
+ * little endian groups), signed numbers are zigzag encoded, so the format
+ * doesn't depend on endianity and size of int.
+ *
+ * menu:	flags, [cursor ref], [first row ref], [active submenu ref],
+ *			number of items, items
+ * item:	ref, options, size of submenu state in bytes, submenu state
+ * ref:		code, position
+ *
+ * Items are identified by code, so the snapshot can be loaded to menu with
+ * added or removed items. The item on saved position is used, when it has
+ * same code, so the items with duplicate codes (or without code) are restored
+ * correctly in not changed menu. Only items with changed options or with
+ * submenu are stored. The size of submenu state is stored in fixed 5 bytes
+ * (not minimal varint), so it can be written after submenu state. The
+ * reference values are not stored (pointers have not any sense outside
+ * process).
  */
-static int
-menutext_displaywidth(ST_MENU_CONFIG *config, char *text, char **accelerator, bool *extern_accel)
-{
-	int		result = 0;
-	bool	_extern_accel = false;
-	char   *_accelerator = NULL;
-	bool	first_char = true;
-	int		bytes;
+#define ST_MENU_SNAPSHOT_MAGIC			"STMS"
+#define ST_MENU_SNAPSHOT_VERSION		2
 
-	while (*text != '\0')
-	{
-		if (*text == '~' || (*text == '_' && first_char))
-		{
-			/*
-			 * ~~ or __ disable effect of special chars ~ and _. ~x~ defines
-			 * internal accelerator (inside menu item text). _x_ defines
-			 * external accelerator (displayed before menu item text) _ has this
-			 * effect only when it is first char of menu item text.
-			 */
-			if (text[1] == *text)
-			{
-				result += 1;
-				text += 2;
-			}
-			else
-			{
-				if (*text == '_')
-					_extern_accel = true;
+#define SNAPSHOT_SIZE_BYTES				5
 
-				text += 1;
-				if (_accelerator == NULL)
-					_accelerator = text;
+#define SNAPSHOT_HAS_CURSOR				1
+#define SNAPSHOT_HAS_FIRST_ROW			2
+#define SNAPSHOT_HAS_ACTIVE_SUBMENU		4
 
-				/* eat second '_' */
-				if (_extern_accel)
-					text += 1;
-			}
+#define REF_OPTIONS_MASK	(ST_MENU_OPTION_MARKED_REF | ST_MENU_OPTION_SWITCH2_REF | ST_MENU_OPTION_SWITCH3_REF)
 
-			first_char = false;
-			continue;
-		}
+typedef struct
+{
+	unsigned char *data;				/* NULL, when only size is calculated */
+	size_t		size;
+	size_t		pos;
+} SNAPSHOT_BUFFER;
+
+static void
+snapshot_put_uint64(SNAPSHOT_BUFFER *buf, uint64_t value)
+{
+	do
+	{
+		unsigned char byte = value & 0x7f;
 
-		bytes = char_length(config, text);
-		result += char_width(config, text);
-		text += bytes;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
 
-		first_char = false;
+		if (buf->data && buf->pos < buf->size)
+			buf->data[buf->pos] = byte;
+
+		buf->pos += 1;
 	}
+	while (value);
+}
 
-	if (extern_accel)
-		*extern_accel = _extern_accel;
-	if (accelerator)
-		*accelerator = _accelerator;
+static void
+snapshot_put_uint(SNAPSHOT_BUFFER *buf, unsigned int value)
+{
+	snapshot_put_uint64(buf, value);
+}
 
-	return result;
+static void
+snapshot_put_int(SNAPSHOT_BUFFER *buf, int value)
+{
+	snapshot_put_uint(buf, ((unsigned int) value << 1) ^ (unsigned int) (value < 0 ? -1 : 0));
 }
 
 /*
- * Collect display info about pulldown menu
+ * Write value as varint of fixed size on position pos (before current
+ * position). It is readable by snapshot_get_uint.
  */
 static void
-pulldownmenu_content_size(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items,
-								int *rows, int *columns, int *shortcut_x_pos, int *item_x_pos,
-								ST_MENU_ACCELERATOR *accelerators, int *naccelerators,
-								int *first_row)
+snapshot_patch_uint(SNAPSHOT_BUFFER *buf, size_t pos, unsigned int value)
 {
-	char	*accelerator;
-	bool	has_extern_accel = false;
-	int	max_text_width = 0;
-	int max_shortcut_width = 0;
-	int		naccel = 0;
-	int		default_row = -1;
+	int		i;
 
-	*rows = 0;
-	*columns = 0;
-	*shortcut_x_pos = 0;
-	*first_row = -1;
+	if (!buf->data || pos + SNAPSHOT_SIZE_BYTES > buf->size)
+		return;
 
-	*naccelerators = 0;
+	for (i = 0; i < SNAPSHOT_SIZE_BYTES; i++)
+	{
+		buf->data[pos + i] = (value & 0x7f) | (i + 1 < SNAPSHOT_SIZE_BYTES ? 0x80 : 0);
+		value >>= 7;
+	}
+}
 
-	while (menu_items->text)
+/*
+ * Items are stored by code and position
+ */
+static void
+snapshot_put_item_ref(SNAPSHOT_BUFFER *buf, struct ST_MENU *menu, int idx)
+{
+	snapshot_put_int(buf, menu->menu_items[idx].code);
+	snapshot_put_uint(buf, idx);
+}
+
+static bool
+snapshot_get_uint(SNAPSHOT_BUFFER *buf, unsigned int *value)
+{
+	unsigned int result = 0;
+	int		shift = 0;
+
+	while (buf->pos < buf->size && shift < 35)
 	{
-		bool	extern_accel;
+		unsigned char byte = buf->data[buf->pos++];
 
-		*rows += 1;
-		if (*menu_items->text && strncmp(menu_items->text, "--", 2) != 0)
+		result |= (unsigned int) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
 		{
-			int text_width = 0;
-			int shortcut_width = 0;
+			*value = result;
+			return true;
+		}
 
-			if (*first_row == -1)
-				*first_row = *rows;
+		shift += 7;
+	}
 
-			text_width = menutext_displaywidth(config, menu_items->text, &accelerator, &extern_accel);
+	return false;
+}
 
-			if (extern_accel)
-				has_extern_accel = true;
+static bool
+snapshot_get_uint64(SNAPSHOT_BUFFER *buf, uint64_t *value)
+{
+	uint64_t	result = 0;
+	int		shift = 0;
 
-			if (accelerator != NULL)
-			{
-				accelerators[naccel].c = chr_casexfrm(config, accelerator);
-				accelerators[naccel].length = strlen(accelerators[naccel].c);
-				accelerators[naccel++].row = *rows;
-			}
+	while (buf->pos < buf->size && shift < 70)
+	{
+		unsigned char byte = buf->data[buf->pos++];
 
-			if (menu_items->shortcut)
-				shortcut_width = str_width(config, menu_items->shortcut);
+		result |= (uint64_t) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			*value = result;
+			return true;
+		}
 
-			if (menu_items->submenu)
-				shortcut_width += shortcut_width > 0 ? 2 : 1;
+		shift += 7;
+	}
 
-			if (menu_items->options & ST_MENU_OPTION_DEFAULT && default_row == -1)
-				default_row = *rows;
+	return false;
+}
 
-			/*
-			 * left alligned shortcuts are used by MC style
-			 */
-			if (config->left_alligned_shortcuts)
-			{
-				max_text_width = max_int(max_text_width, 1 + text_width + 2);
-				max_shortcut_width = max_int(max_shortcut_width, shortcut_width);
-			}
-			else
-				*columns = max_int(*columns,
-											1 + text_width + 1
-											  + (config->extra_inner_space ? 2 : 0)
-											  + (shortcut_width > 0 ? shortcut_width + 4 : 0));
-		}
+static bool
+snapshot_get_int(SNAPSHOT_BUFFER *buf, int *value)
+{
+	unsigned int uvalue;
 
-		menu_items += 1;
-	}
+	if (!snapshot_get_uint(buf, &uvalue))
+		return false;
 
-	if (config->left_alligned_shortcuts)
+	*value = (int) (uvalue >> 1) ^ -((int) (uvalue & 1));
+
+	return true;
+}
+
+/*
+ * Returns true, when item should be saved to snapshot
+ */
+static bool
+snapshot_item_is_changed(struct ST_MENU *menu, int i)
+{
+	return menu->submenus[i] ||
+		   (menu->options[i] & ~REF_OPTIONS_MASK) != (menu->menu_items[i].options & ~REF_OPTIONS_MASK);
+}
+
+/*
+ * Workhorse for st_menu_snapshot_write. The space for size of nested
+ * submenu state is reserved, and the size is written after submenu state.
+ */
+static void
+_snapshot_write(struct ST_MENU *menu, SNAPSHOT_BUFFER *buf)
+{
+	int		flags = 0;
+	int		nchanged = 0;
+	int		i;
+
+	if (menu->cursor_row >= 1 && menu->cursor_row <= menu->nitems)
+		flags |= SNAPSHOT_HAS_CURSOR;
+	if (menu->first_row > 1 && menu->first_row <= menu->nitems)
+		flags |= SNAPSHOT_HAS_FIRST_ROW;
+	if (menu->active_submenu)
+		flags |= SNAPSHOT_HAS_ACTIVE_SUBMENU;
+
+	snapshot_put_uint(buf, flags);
+
+	if (flags & SNAPSHOT_HAS_CURSOR)
+		snapshot_put_item_ref(buf, menu, menu->cursor_row - 1);
+	if (flags & SNAPSHOT_HAS_FIRST_ROW)
+		snapshot_put_item_ref(buf, menu, menu->first_row - 1);
+
+	if (flags & SNAPSHOT_HAS_ACTIVE_SUBMENU)
 	{
-		*columns = max_text_width + (max_shortcut_width > 0 ? max_shortcut_width + 1 : 0);
-		*shortcut_x_pos = max_text_width;
+		for (i = 0; i < menu->nitems; i++)
+			if (menu->submenus[i] == menu->active_submenu)
+			{
+				snapshot_put_item_ref(buf, menu, i);
+				break;
+			}
 	}
-	else
-		*shortcut_x_pos = -1;
 
-	*naccelerators = naccel;
+	for (i = 0; i < menu->nitems; i++)
+		if (snapshot_item_is_changed(menu, i))
+			nchanged += 1;
 
-	/*
-	 * When external accelerators are used, move content to right
-	 */
-	if (has_extern_accel)
+	snapshot_put_uint(buf, nchanged);
+
+	for (i = 0; i < menu->nitems; i++)
 	{
-		*columns += config->extern_accel_text_space + 1;
-		if (*shortcut_x_pos != -1)
-			*shortcut_x_pos += config->extern_accel_text_space + 1;
-		*item_x_pos = config->extern_accel_text_space + 1;
-	}
-	else
-		*item_x_pos = 1;
+		if (!snapshot_item_is_changed(menu, i))
+			continue;
 
-	if (default_row != -1)
-		*first_row = default_row;
+		snapshot_put_item_ref(buf, menu, i);
+		snapshot_put_uint(buf, menu->options[i] & ~REF_OPTIONS_MASK);
+
+		if (menu->submenus[i])
+		{
+			size_t		size_pos = buf->pos;
+
+			buf->pos += SNAPSHOT_SIZE_BYTES;
+			_snapshot_write(menu->submenus[i], buf);
+
+			snapshot_patch_uint(buf, size_pos,
+								(unsigned int) (buf->pos - size_pos - SNAPSHOT_SIZE_BYTES));
+		}
+		else
+			snapshot_put_uint(buf, 0);
+	}
 }
 
 /*
- * Draw menubar
+ * Returns index of item with code. The item on saved position is used,
+ * when it has this code. Else the item is searched by code. Items are
+ * stored in same order like in menu, so searching starts after previous
+ * found item. Returns -1, when item is not found.
  */
-static void
-menubar_draw(struct ST_MENU *menu)
+static int
+snapshot_find_item(struct ST_MENU *menu, int code, unsigned int pos, int *start)
 {
-	ST_MENU_ITEM	   *menu_item = menu->menu_items;
-	ST_MENU_CONFIG	*config = menu->config;
-	bool	has_focus;
-	bool	has_accelerators;
 	int		i;
 
-	selected_item = NULL;
-	selected_options = 0;
-	selected_refval = NULL;
+	if (pos < (unsigned int) menu->nitems && menu->menu_items[pos].code == code)
+	{
+		*start = pos + 1;
+		return pos;
+	}
 
-	/* do nothing when content is invisible */
-	if (menu->focus == ST_MENU_FOCUS_NONE)
-		return;
+	for (i = 0; i < menu->nitems; i++)
+	{
+		int		idx = (*start + i) % menu->nitems;
 
-	show_panel(menu->panel);
-	top_panel(menu->panel);
+		if (menu->menu_items[idx].code == code)
+		{
+			*start = idx + 1;
+			return idx;
+		}
+	}
 
-	update_panels();
+	return -1;
+}
 
-	has_focus = menu->focus == ST_MENU_FOCUS_FULL;
-	has_accelerators = menu->focus == ST_MENU_FOCUS_FULL || 
-								menu->focus == ST_MENU_FOCUS_ALT_MOUSE;
+/*
+ * Reads reference to item (code and position)
+ */
+static bool
+snapshot_get_item_ref(SNAPSHOT_BUFFER *buf, int *code, unsigned int *pos)
+{
+	return snapshot_get_int(buf, code) && snapshot_get_uint(buf, pos);
+}
 
-	if (has_focus)
-		wbkgd(menu->window, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
+/*
+ * Workhorse for st_menu_snapshot_read
+ */
+static bool
+_snapshot_read(struct ST_MENU *menu, SNAPSHOT_BUFFER *buf)
+{
+	unsigned int flags;
+	unsigned int nchanged;
+	int		code;
+	unsigned int pos;
+	int		start = 0;
+	int		idx;
+	unsigned int i;
+
+	if (!snapshot_get_uint(buf, &flags))
+		return false;
+
+	if (flags & SNAPSHOT_HAS_CURSOR)
+	{
+		if (!snapshot_get_item_ref(buf, &code, &pos))
+			return false;
+		if ((idx = snapshot_find_item(menu, code, pos, &start)) != -1)
+			menu->cursor_row = idx + 1;
+	}
+
+	if (flags & SNAPSHOT_HAS_FIRST_ROW)
+	{
+		if (!snapshot_get_item_ref(buf, &code, &pos))
+			return false;
+		start = 0;
+		if ((idx = snapshot_find_item(menu, code, pos, &start)) != -1)
+			menu->first_row = idx + 1;
+	}
 	else
-		wbkgd(menu->window, COLOR_PAIR(config->menu_unfocused_cpn) | config->menu_unfocused_attr);
+		menu->first_row = 1;
 
-	werase(menu->window);
+	menu->active_submenu = NULL;
 
-	i = 0;
-	while (menu_item->text)
+	if (flags & SNAPSHOT_HAS_ACTIVE_SUBMENU)
 	{
-		char	*text = menu_item->text;
-		bool	highlight = false;
-		bool	is_cursor_row = menu->cursor_row == i + 1 && has_focus;
-		bool	is_disabled = menu->options[i] & ST_MENU_OPTION_DISABLED;
-		int		current_pos;
+		if (!snapshot_get_item_ref(buf, &code, &pos))
+			return false;
+		start = 0;
+		if ((idx = snapshot_find_item(menu, code, pos, &start)) != -1)
+			menu->active_submenu = menu->submenus[idx];
+	}
 
-		/* bar_fields_x_pos holds x positions of menubar items */
-		current_pos = menu->bar_fields_x_pos[i];
+	/* not saved items have default options */
+	for (idx = 0; idx < menu->nitems; idx++)
+		menu->options[idx] = (menu->options[idx] & REF_OPTIONS_MASK) |
+							 (menu->menu_items[idx].options & ~REF_OPTIONS_MASK);
 
-		if (is_cursor_row)
-		{
-			wmove(menu->window, 0, current_pos - 1);
-			wattron(menu->window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
-			waddstr(menu->window, " ");
+	if (!snapshot_get_uint(buf, &nchanged))
+		return false;
 
-			selected_item = menu_item;
-		}
-		else
-			wmove(menu->window, 0, current_pos);
+	start = 0;
+	for (i = 0; i < nchanged; i++)
+	{
+		unsigned int options;
+		unsigned int submenu_size;
 
-		if (is_disabled)
-			wattron(menu->window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+		if (!snapshot_get_item_ref(buf, &code, &pos) ||
+			!snapshot_get_uint(buf, &options) ||
+			!snapshot_get_uint(buf, &submenu_size) ||
+			submenu_size > buf->size - buf->pos)
+			return false;
+
+		idx = snapshot_find_item(menu, code, pos, &start);
 
-		while (*text)
+		if (idx != -1)
+			menu->options[idx] = (menu->options[idx] & REF_OPTIONS_MASK) |
+								 (options & ~REF_OPTIONS_MASK);
+
+		if (submenu_size > 0)
 		{
-			/* there are not external accelerators */
-			if (*text == '~')
+			/* state of removed submenu is skipped */
+			if (idx != -1 && menu->submenus[idx])
 			{
-				if (text[1] == '~')
-				{
-					waddstr(menu->window, "~");
-					text += 2;
-					continue;
-				}
+				SNAPSHOT_BUFFER		subbuf;
 
-				if (!is_disabled && has_accelerators)
-				{
-					if (!highlight)
-					{
-						wattron(menu->window,
-							COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
-									   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr) );
-					}
-					else
-					{
-						wattroff(menu->window,
-							COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
-									   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
-						if (is_cursor_row)
-							wattron(menu->window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
-					}
+				subbuf.data = buf->data + buf->pos;
+				subbuf.size = submenu_size;
+				subbuf.pos = 0;
 
-					highlight = !highlight;
-				}
-				text += 1;
+				if (!_snapshot_read(menu->submenus[idx], &subbuf))
+					return false;
 			}
-			else
-			{
-				int chlen = char_length(config, text);
 
-				waddnstr(menu->window, text, chlen);
-				text += chlen;
-			}
+			buf->pos += submenu_size;
 		}
+	}
 
-		if (is_cursor_row)
-		{
-			waddstr(menu->window, " ");
-			wattroff(menu->window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
-		}
+	return true;
+}
 
-		if (is_disabled)
-			wattroff(menu->window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+/*
+ * Returns size of buffer necessary for snapshot of menu state
+ */
+size_t
+st_menu_snapshot_size(struct ST_MENU *menu)
+{
+	SNAPSHOT_BUFFER		buf = {NULL, 0, 0};
 
-		menu_item += 1;
-		i += 1;
-	}
+	buf.pos = strlen(ST_MENU_SNAPSHOT_MAGIC) + 1;
+	_snapshot_write(menu, &buf);
 
-	wnoutrefresh(menu->window);
+	return buf.pos;
+}
 
+/*
+ * Write snapshot of menu state (cursors, options, active submenus) to buffer.
+ * Returns number of written bytes or 0 when buffer is too small.
+ */
+size_t
+st_menu_snapshot_write(struct ST_MENU *menu, void *buffer, size_t size)
+{
+	SNAPSHOT_BUFFER		buf;
+	size_t		magic_len = strlen(ST_MENU_SNAPSHOT_MAGIC);
 
-	if (menu->active_submenu)
-		pulldownmenu_draw(menu->active_submenu, true);
-}
+	if (size < magic_len + 1)
+		return 0;
 
-#ifdef DEBUG_PIPE
+	buf.data = buffer;
+	buf.size = size;
 
-static void
-debug_print_size(WINDOW *window, char *name)
-{
-	int		rows, cols;
-	int		y, x;
+	memcpy(buf.data, ST_MENU_SNAPSHOT_MAGIC, magic_len);
+	buf.data[magic_len] = ST_MENU_SNAPSHOT_VERSION;
+	buf.pos = magic_len + 1;
 
-	getbegyx(window, y, x);
-	getmaxyx(window, rows, cols);
+	_snapshot_write(menu, &buf);
 
-	fprintf(debug_pipe, "window \"%s\" y: %d, x: %d, rows: %d. cols: %d\n", name, y, x, rows, cols);
+	return buf.pos <= size ? buf.pos : 0;
 }
 
-#endif
-
 /*
- * adjust pulldown position - move panels from ideal position to any position
- * where can be fully displayed.
+ * Restore menu state from snapshot. Returns false, when snapshot is
+ * broken or has unsupported format. In this case the menu state can be
+ * restored only partially.
  */
-static void
-pulldownmenu_ajust_position(struct ST_MENU *menu, int maxy, int maxx)
+bool
+st_menu_snapshot_read(struct ST_MENU *menu, const void *buffer, size_t size)
 {
-	ST_MENU_CONFIG	*config = menu->config;
+	SNAPSHOT_BUFFER		buf;
+	size_t		magic_len = strlen(ST_MENU_SNAPSHOT_MAGIC);
 
-	int		rows, cols;
-	int		new_y, new_x;
-	int		y, x;
+	if (size < magic_len + 1 ||
+		memcmp(buffer, ST_MENU_SNAPSHOT_MAGIC, magic_len) != 0 ||
+		((const unsigned char *) buffer)[magic_len] != ST_MENU_SNAPSHOT_VERSION)
+		return false;
 
-	getbegyx(menu->window, y, x);
-	getmaxyx(menu->window, rows, cols);
-	subtract_correction(menu->window, &y, &x);
+	buf.data = (unsigned char *) buffer;
+	buf.size = size;
+	buf.pos = magic_len + 1;
 
-	/*
-	 * Hypothesis: when panel is moved, then assigned windows is moved
-	 * to and possibly reduced (when terminal is smaller). But when terminal
-	 * grows, then size of assigned window grows too, more than was original
-	 * size. So we should to recheck size of assigned window, and fix it, when
-	 * it is bigger than should be.
-	 */
-	if (rows != menu->rows || cols != menu->cols)
-	{
-		int		new_rows = y + menu->rows <= maxy ? menu->rows : maxy - y + 1;
-		int		new_cols = x + menu->cols <= maxx ? menu->cols : maxx - x + 1;
+	return _snapshot_read(menu, &buf);
+}
 
-		if (new_rows != rows || new_cols != cols)
-			wresize(menu->window, new_rows, new_cols);
-	}
+/*
+ * Event log - the events passed to st_menu_driver can be recorded to file,
+ * and later replayed. The format is:
+ *
+ * log:		"STMR", version byte, records
+ * record:	size of record in bytes (one byte), delay from previous event
+ *			in microseconds, key code, flags, when flags has RECORD_MOUSE,
+ *			then mouse id, x, y and bstate
+ *
+ * Numbers are stored like in snapshot (varints, signed values are zigzag
+ * encoded). The bstate is stored as 64-bit varint, because mmask_t can be
+ * 64-bit type.
+ */
+#define ST_MENU_RECORD_MAGIC			"STMR"
+#define ST_MENU_RECORD_VERSION			1
 
-#ifdef DEBUG_PIPE
+#define RECORD_ALT						1
+#define RECORD_MOUSE					2
 
-	debug_print_size(menu->window, "menu window");
+#define RECORD_MAX_SIZE					64
 
-#endif
+static FILE	   *record_fp = NULL;
+static long long record_last_us = 0;
+static FILE	   *replay_fp = NULL;
 
-	/*
-	 * Previous issue is same for shadow window. But with different timing.
-	 * Visibility of shadow needs one row and one column more. The begin of
-	 * shadow window should be in relation to begin of menu window.
-	 */
-	if (config->shadow_width > 0)
-	{
-		int		srows, scols;
+static long long
+current_time_us(void)
+{
+	struct timespec ts;
 
-		/* panel move can move shadow window. Force correct position now */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-		getmaxyx(menu->shadow_window, srows, scols);
-		mvwin(menu->shadow_window, y+1 , x+config->shadow_width);
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-		if (srows != menu->rows || scols != menu->cols)
-		{
-			int		new_srows, new_scols;
+static void
+record_event(int c, bool alt, MEVENT *mevent)
+{
+	unsigned char	data[RECORD_MAX_SIZE];
+	SNAPSHOT_BUFFER		buf;
+	long long	now = current_time_us();
+	long long	delay = now - record_last_us;
+	bool		is_mouse = c == KEY_MOUSE && mevent;
 
-			new_srows = y + 1 + menu->rows <= maxy ? menu->rows :  maxy - y - 1;
-			new_scols = x + config->shadow_width + menu->cols <= maxx ? menu->cols : maxx - x - config->shadow_width;
+	buf.data = data;
+	buf.size = sizeof(data);
+	buf.pos = 0;
 
-			wresize(menu->shadow_window, new_srows, new_scols);
-		}
+	snapshot_put_uint(&buf, delay < 0 ? 0 : (delay > 0xffffffffLL ? 0xffffffff : (unsigned int) delay));
+	snapshot_put_int(&buf, c);
+	snapshot_put_uint(&buf, (alt ? RECORD_ALT : 0) | (is_mouse ? RECORD_MOUSE : 0));
+
+	if (is_mouse)
+	{
+		snapshot_put_int(&buf, mevent->id);
+		snapshot_put_int(&buf, mevent->x);
+		snapshot_put_int(&buf, mevent->y);
+		snapshot_put_uint64(&buf, (uint64_t) mevent->bstate);
 	}
 
-#ifdef DEBUG_PIPE
+	putc((int) buf.pos, record_fp);
+	fwrite(data, 1, buf.pos, record_fp);
 
-	debug_print_size(menu->shadow_window, "menu shadow window");
+	/* events are slow, and the log should be complete after crash */
+	fflush(record_fp);
 
-#endif
+	record_last_us = now;
+}
 
-	if (menu->ideal_x_pos + menu->cols > maxx)
-	{
-		new_x = maxx - menu->cols;
-		if (new_x < 0)
-			new_x = 0;
-	}
-	else
-		new_x = menu->ideal_x_pos;
+/*
+ * Start recording of events passed to st_menu_driver to file. Returns
+ * false, when header cannot be written.
+ */
+bool
+st_menu_record_start(FILE *fp)
+{
+	size_t		magic_len = strlen(ST_MENU_RECORD_MAGIC);
 
-	if (menu->ideal_y_pos + menu->rows > maxy)
-	{
-		new_y = maxy - menu->rows;
-		if (new_y < 1)
-			new_y = 1;
-	}
-	else
-		new_y = menu->ideal_y_pos;
+	if (fwrite(ST_MENU_RECORD_MAGIC, 1, magic_len, fp) != magic_len ||
+		putc(ST_MENU_RECORD_VERSION, fp) == EOF)
+		return false;
 
-	if (new_y != y || new_x != x)
-	{
-		int result;
+	record_fp = fp;
+	record_last_us = current_time_us();
 
-		result = move_panel(menu->panel, new_y, new_x);
+	return true;
+}
 
-		/*
-		 * This is maybe ugly hack. move_panel fails when
-		 * attached window cannot be displayed. So we can try
-		 * resize attached window first.
-		 */
-		if (result != OK)
-		{
-			WINDOW *pw = panel_window(menu->panel);
+/*
+ * Stop recording. The file is flushed, but not closed.
+ */
+void
+st_menu_record_stop(void)
+{
+	if (record_fp)
+		fflush(record_fp);
 
-			wresize(pw, maxy - new_y, menu->cols);
-			replace_panel(menu->panel, pw);
-		}
+	record_fp = NULL;
+}
 
-		result = move_panel(menu->panel, new_y, new_x);
+/*
+ * Start replaying of events from file. Returns false, when file
+ * has not expected header.
+ */
+bool
+st_menu_replay_start(FILE *fp)
+{
+	char		header[sizeof(ST_MENU_RECORD_MAGIC)];
+	size_t		magic_len = strlen(ST_MENU_RECORD_MAGIC);
 
-		/*
-		 * move_panel fails when it cannot be displayed completly.
-		 * This is problem for shadow window because is n char right,
-		 * over left border. So we have to create new window with
-		 * different sizes.
-		 * Don't try move shadow panel, when a move of menu panel
-		 * failed.
-		 */
-		if (result == OK && menu->shadow_panel)
-		{
-			int		new_rows, new_cols;
-			int		smaxy, smaxx;
+	if (fread(header, 1, magic_len, fp) != magic_len ||
+		memcmp(header, ST_MENU_RECORD_MAGIC, magic_len) != 0 ||
+		getc(fp) != ST_MENU_RECORD_VERSION)
+		return false;
 
-			new_cols = menu->cols - (new_x == menu->ideal_x_pos ? 0 : config->shadow_width);
-			new_rows = menu->rows - (maxy >= new_y + menu->rows + 1 ? 0 : 1);
+	replay_fp = fp;
 
-			getmaxyx(menu->shadow_window, smaxy, smaxx);
+	return true;
+}
 
-			if (new_cols <= smaxx || new_rows <= smaxy)
-			{
-				WINDOW   *new_shadow_window;
+/*
+ * Returns next recorded event. When real_speed is true, then waits
+ * recorded delay before return. Returns false on end of log (or on
+ * broken record), then replaying is stopped.
+ */
+bool
+st_menu_replay_next(int *c, bool *alt, MEVENT *mevent, bool real_speed)
+{
+	unsigned char	data[RECORD_MAX_SIZE];
+	SNAPSHOT_BUFFER		buf;
+	unsigned int	delay;
+	unsigned int	flags;
+	int				size;
 
-				new_shadow_window = newwin(new_rows, new_cols, new_y + 1, new_x + config->shadow_width);
+	if (!replay_fp)
+		return false;
 
-				/* There are no other possibility to resize panel */
-				replace_panel(menu->shadow_panel, new_shadow_window);
+	size = getc(replay_fp);
 
-				delwin(menu->shadow_window);
-				menu->shadow_window = new_shadow_window;
+	if (size == EOF || size > RECORD_MAX_SIZE ||
+		fread(data, 1, size, replay_fp) != (size_t) size)
+	{
+		replay_fp = NULL;
+		return false;
+	}
 
-				wbkgd(menu->shadow_window, COLOR_PAIR(config->menu_shadow_cpn) | config->menu_shadow_attr);
+	buf.data = data;
+	buf.size = size;
+	buf.pos = 0;
 
-				wnoutrefresh(menu->shadow_window);
-			}
+	if (!snapshot_get_uint(&buf, &delay) ||
+		!snapshot_get_int(&buf, c) ||
+		!snapshot_get_uint(&buf, &flags))
+	{
+		replay_fp = NULL;
+		return false;
+	}
 
-			move_panel(menu->shadow_panel, new_y + 1, new_x + config->shadow_width);
+	*alt = flags & RECORD_ALT;
+
+	if (flags & RECORD_MOUSE)
+	{
+		int		id, x, y;
+		uint64_t	bstate;
+
+		if (!snapshot_get_int(&buf, &id) ||
+			!snapshot_get_int(&buf, &x) ||
+			!snapshot_get_int(&buf, &y) ||
+			!snapshot_get_uint64(&buf, &bstate))
+		{
+			replay_fp = NULL;
+			return false;
 		}
+
+		memset(mevent, 0, sizeof(MEVENT));
+		mevent->id = id;
+		mevent->x = x;
+		mevent->y = y;
+		mevent->bstate = (mmask_t) bstate;
 	}
 
-	if (menu->active_submenu)
-		pulldownmenu_ajust_position(menu->active_submenu, maxy, maxx);
+	if (real_speed && delay > 0)
+		napms(delay / 1000);
 
-	update_panels();
+	return true;
 }
 
 /*
- * Draw shadow
+ * Decode text of menu item to arrays of displayed chars. ~ char is
+ * ignored, ~~ is used as ~. ~x~ defines internal accelerator (inside
+ * menu item text), and these chars are marked as highlighted. _x_
+ * defines external accelerator (displayed before menu item text). _ has
+ * this effect only when it is first char of pulldown menu item text.
  */
 static void
-pulldownmenu_draw_shadow(struct ST_MENU *menu)
+label_decode(ST_MENU_CONFIG *config, ST_MENU_LABEL *label, ST_MENU_ITEM *menu_item, bool is_menubar)
 {
-	ST_MENU_CONFIG	*config = menu->config;
-
-	if (menu->shadow_window)
-	{
-		int		smaxy, smaxx;
-		int		i, j;
-		int		wmaxy, wmaxx;
-		attr_t	shadow_attr;
-
-		shadow_attr = config->menu_shadow_attr | A_DIM;
-
-		getmaxyx(menu->shadow_window, smaxy, smaxx);
+	char   *text = menu_item->text;
+	char   *ptr = text;
+	size_t	len = strlen(text);
+	bool	highlight = false;
+	bool	first_char = true;
+	char   *buffer;
 
-		show_panel(menu->shadow_panel);
-		top_panel(menu->shadow_panel);
+	/* one byte is at least one char, so len is good enough limit */
+	buffer = safe_malloc((len + 1) * (sizeof(wchar_t) + sizeof(int) + 3));
 
-		/* desktop_win must be global */
-		werase(menu->shadow_window);
+	label->codes = (wchar_t *) buffer;
+	label->offsets = (int *) (buffer + (len + 1) * sizeof(wchar_t));
+	label->widths = (signed char *) (buffer + (len + 1) * (sizeof(wchar_t) + sizeof(int)));
+	label->lengths = (unsigned char *) label->widths + (len + 1);
+	label->flags = label->lengths + (len + 1);
 
-		if (desktop_win)
-			overwrite(desktop_win, menu->shadow_window);
-		if (active_cmdbar)
-			overwrite(active_cmdbar->window, menu->shadow_window);
+	label->nchars = 0;
+	label->width = 0;
+	label->accel_offset = -1;
+	label->is_extern_accel = !is_menubar && *text == '_' && text[1] != '_';
 
-		wmaxy = smaxy - 1;
-		wmaxx = smaxx - config->shadow_width;
+	while (*ptr != '\0')
+	{
+		int		n = label->nchars;
 
-		for (i = 0; i <= smaxy; i++)
-			for (j = 0; j <= smaxx; j++)
+		if (*ptr == '~' || (!is_menubar && *ptr == '_' && (first_char || highlight)))
+		{
+			if (ptr[1] != *ptr)
 			{
+				highlight = !highlight;
+				ptr += 1;
 
-				if (i < wmaxy && j < wmaxx)
-					continue;
+				if (label->accel_offset == -1)
+					label->accel_offset = ptr - text;
 
-				if (mvwinch(menu->shadow_window, i, j) & A_ALTCHARSET)
-					mvwchgat(menu->shadow_window, i, j, 1,
-								shadow_attr | A_ALTCHARSET,
-								config->menu_shadow_cpn,
-								NULL);
-				else
-					mvwchgat(menu->shadow_window, i, j, 1,
-								shadow_attr,
-								config->menu_shadow_cpn,
-								NULL);
+				first_char = false;
+				continue;
 			}
 
-		wnoutrefresh(menu->shadow_window);
+			/* ~~ or __ are displayed as one char */
+			label->offsets[n] = ptr - text;
+			label->codes[n] = *ptr;
+			label->widths[n] = 1;
+			label->lengths[n] = 1;
+			ptr += 2;
+		}
+		else
+		{
+			label->offsets[n] = ptr - text;
+			label->codes[n] = char_code(config, ptr);
+			label->widths[n] = char_width(config, ptr);
+			label->lengths[n] = char_length(config, ptr);
+			ptr += label->lengths[n];
+		}
+
+		label->flags[n] = highlight ? ST_MENU_LABEL_HIGHLIGHT : 0;
+		label->width += label->widths[n];
+		label->nchars += 1;
+
+		first_char = false;
 	}
 
-	if (menu->active_submenu)
-		pulldownmenu_draw_shadow(menu->active_submenu);
+	/* highlighting after last char is stored too */
+	label->flags[label->nchars] = highlight ? ST_MENU_LABEL_HIGHLIGHT : 0;
+
+	label->shortcut_width = menu_item->shortcut ? str_width(config, menu_item->shortcut) : 0;
 }
 
 /*
- * Early search of selected refval items. Is necessary to
- * change state before next drawing.
+ * Release memory used by decoded label
  */
 static void
-searching_selected_refval_items(struct ST_MENU *menu)
+label_free(ST_MENU_LABEL *label)
 {
-	ST_MENU_ITEM	   *menu_items = menu->menu_items;
-	int		row = 1;
+	/* all arrays are allocated together */
+	free(label->codes);
+}
 
-	while (menu_items->text != NULL)
-	{
-		int		offset = menu_items - menu->menu_items;
+/*
+ * Decode labels of all menu items
+ */
+static ST_MENU_LABEL *
+labels_decode(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items, int nitems, bool is_menubar)
+{
+	ST_MENU_LABEL *labels;
+	int		i;
 
-		if (IS_REF_OPTION(menu->options[offset]))
-		{
-			if (menu->cursor_row == row)
-			{
-				selected_item = menu_items;
-				selected_options = menu->options[offset];
-				selected_refval= menu->refvals[offset];
-			}
-		}
+	labels = safe_malloc(sizeof(ST_MENU_LABEL) * (nitems + 1));
 
-		menu_items += 1;
-		row += 1;
-	}
+	for (i = 0; i < nitems; i++)
+		label_decode(config, &labels[i], &menu_items[i], is_menubar);
 
-	if (menu->active_submenu)
-		searching_selected_refval_items(menu->active_submenu);
+	return labels;
 }
 
 /*
- * pulldown menu bar draw
+ * Returns number of columns of pulldown menu. The menu with more items
+ * than max_rows is wrapped to more columns.
  */
-static void
-pulldownmenu_draw(struct ST_MENU *menu, bool is_top)
+static int
+pulldownmenu_ncolumns(ST_MENU_CONFIG *config, int nitems)
 {
-	bool	draw_box = menu->config->draw_box;
-	ST_MENU_ITEM	   *menu_items = menu->menu_items;
-	ST_MENU_CONFIG	*config = menu->config;
-	WINDOW	   *draw_area = menu->draw_area;
-	WINDOW	   *loc_draw_area = NULL;
-	int		row = 1;
-	int		maxy, maxx;
-	int		dmaxy, dmaxx, dy, dx;
-	int		text_min_x, text_max_x;
-	int		*options = menu->options;
-	bool	force_ascii_art = config->force_ascii_art;
-	int		max_draw_rows = menu->rows;
-	int		i;
+	if (config->max_rows > 0 && nitems > config->max_rows)
+		return (nitems + config->max_rows - 1) / config->max_rows;
 
-	selected_item = NULL;
+	return 1;
+}
 
-	if (is_top)
-	{
-		int	stdscr_maxy, stdscr_maxx;
+/*
+ * Collect display info about pulldown menu. When accelerators is NULL,
+ * then accelerators are not collected. Long menu is wrapped to columns,
+ * and then rows are rows of column.
+ */
+static void
+pulldownmenu_content_size(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items, ST_MENU_LABEL *labels,
+								int *rows, int *columns, int *shortcut_x_pos, int *item_x_pos,
+								ST_MENU_ACCELERATOR *accelerators, int *naccelerators,
+								int *first_row)
+{
+	bool	has_extern_accel = false;
+	int	max_text_width = 0;
+	int max_shortcut_width = 0;
+	int		naccel = 0;
+	int		default_row = -1;
+	int		ncolumns;
 
-		/* adjust positions of pulldown menus */
-		getmaxyx(stdscr, stdscr_maxy, stdscr_maxx);
-		pulldownmenu_ajust_position(menu, stdscr_maxy, stdscr_maxx);
+	*rows = 0;
+	*columns = 0;
+	*shortcut_x_pos = 0;
+	*first_row = -1;
 
-		/* Draw shadows of window and all nested active pull down menu */
-		pulldownmenu_draw_shadow(menu);
-	}
+	*naccelerators = 0;
 
-	show_panel(menu->panel);
-	top_panel(menu->panel);
+	while (menu_items->text)
+	{
+		ST_MENU_LABEL *label = labels++;
 
-	update_panels();
+		*rows += 1;
+		if (*menu_items->text && strncmp(menu_items->text, "--", 2) != 0)
+		{
+			int text_width = label->width;
+			int shortcut_width = label->shortcut_width;
 
-	/* clean menu background */
-	werase(menu->window);
+			if (*first_row == -1)
+				*first_row = *rows;
 
-	/*
-	 * Now, we would to check if is possible to draw complete draw area on
-	 * screen, and if draw area is good enough for all menu's items.
-	 */
-	getmaxyx(stdscr, maxy, maxx);
-	getmaxyx(draw_area, dmaxy, dmaxx);
-	getbegyx(draw_area, dy, dx);
+			if (label->is_extern_accel)
+				has_extern_accel = true;
 
-	subtract_correction(draw_area, &dy, &dx);
+			if (label->accel_offset != -1 && accelerators)
+			{
+				accelerators[naccel].c = chr_casexfrm(config, menu_items->text + label->accel_offset);
+				accelerators[naccel].length = strlen(accelerators[naccel].c);
+				accelerators[naccel++].row = *rows;
+			}
 
-	if (dy + dmaxy > maxy || dmaxy < menu->rows )
-	{
-		dmaxy = min_int(maxy - dy, dmaxy);
-		max_draw_rows = draw_box ? (dmaxy - 2) : dmaxy;
+			if (menu_items->submenu)
+				shortcut_width += shortcut_width > 0 ? 2 : 1;
 
-		loc_draw_area = subwin(menu->window, dmaxy, dmaxx, dy, dx);
-		draw_area = loc_draw_area;
+			if (menu_items->options & ST_MENU_OPTION_DEFAULT && default_row == -1)
+				default_row = *rows;
+
+			/*
+			 * left alligned shortcuts are used by MC style
+			 */
+			if (config->left_alligned_shortcuts)
+			{
+				max_text_width = max_int(max_text_width, 1 + text_width + 2);
+				max_shortcut_width = max_int(max_shortcut_width, shortcut_width);
+			}
+			else
+				*columns = max_int(*columns,
+											1 + text_width + 1
+											  + (config->extra_inner_space ? 2 : 0)
+											  + (shortcut_width > 0 ? shortcut_width + 4 : 0));
+		}
 
-		if (menu->cursor_row < menu->first_row)
-			menu->first_row = menu->cursor_row;
+		menu_items += 1;
+	}
 
-		if (menu->cursor_row > menu->first_row + max_draw_rows - 1)
-			menu->first_row = menu->cursor_row - max_draw_rows + 1;
+	if (config->left_alligned_shortcuts)
+	{
+		*columns = max_text_width + (max_shortcut_width > 0 ? max_shortcut_width + 1 : 0);
+		*shortcut_x_pos = max_text_width;
 	}
 	else
-		menu->first_row = 1;
+		*shortcut_x_pos = -1;
 
-	getmaxyx(draw_area, maxy, maxx);
+	*naccelerators = naccel;
 
-	/* be compiler quiet */
-	(void) maxy;
+	/*
+	 * When external accelerators are used, move content to right
+	 */
+	if (has_extern_accel)
+	{
+		*columns += config->extern_accel_text_space + 1;
+		if (*shortcut_x_pos != -1)
+			*shortcut_x_pos += config->extern_accel_text_space + 1;
+		*item_x_pos = config->extern_accel_text_space + 1;
+	}
+	else
+		*item_x_pos = 1;
 
-	if (draw_box)
+	if (default_row != -1)
+		*first_row = default_row;
+
+	/* long menu is wrapped to columns of same width */
+	ncolumns = pulldownmenu_ncolumns(config, *rows);
+	if (ncolumns > 1)
 	{
-		if (!force_ascii_art)
-			box(draw_area, 0, 0);
-		else
-			wborder(draw_area, '|', '|','-','-','+','+','+','+');
+		*rows = (*rows + ncolumns - 1) / ncolumns;
+		*columns *= ncolumns;
 	}
+}
 
-	text_min_x = (draw_box ? 1 : 0) + (config->extra_inner_space ? 1 : 0);
-	text_max_x = maxx - (draw_box ? 1 : 0) - (config->extra_inner_space ? 1 : 0);
+/*
+ * Set layout of columns of pulldown menu from its items and from its
+ * dimensions. The items are placed to columns from top to bottom.
+ */
+static void
+pulldownmenu_set_columns(struct ST_MENU *menu)
+{
+	ST_MENU_CONFIG *config = menu->config;
+
+	menu->ncolumns = pulldownmenu_ncolumns(config, menu->nitems);
+	menu->column_rows = (menu->nitems + menu->ncolumns - 1) / menu->ncolumns;
+	menu->column_width = (menu->cols - (config->draw_box ? 2 : 0)
+									 - (config->wide_vborders ? 2 : 0)) / menu->ncolumns;
+}
+
+#ifndef ST_MENU_NO_TRACE
 
-	/* skip first firt_row rows from menu */
-	for (i = 1; i < menu->first_row; i++)
-		if (menu_items->text != NULL)
-			menu_items += 1;
+/*
+ * Pass trace record to callback or store it to ring buffer. When
+ * ring buffer is full, then oldest records are overwritten.
+ */
+static void
+trace_event(int event, int phase, int value)
+{
+	ST_MENU_TRACE_RECORD record;
+	struct timespec ts;
 
-	while (menu_items->text != NULL)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	record.timestamp = (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	record.event = event;
+	record.phase = phase;
+	record.value = value;
+
+	if (trace_callback)
+		trace_callback(&record, trace_callback_data);
+
+	if (trace_buffer)
 	{
-		int		offset = menu_items - menu->menu_items;
-		bool	has_submenu = menu_items->submenu ? true : false;
-		bool	is_disabled = false;
-		bool	is_marked = false;
-		int		mark_tag;
+		trace_buffer[trace_write_pos % trace_buffer_size] = record;
+		trace_write_pos += 1;
 
-		if (options)
-		{
-			int		option = options[offset];
+		if (trace_write_pos - trace_read_pos > trace_buffer_size)
+			trace_read_pos = trace_write_pos - trace_buffer_size;
+	}
+}
 
-			is_disabled = option & ST_MENU_OPTION_DISABLED;
+#endif
 
-			if (option & ST_MENU_OPTION_MARKED)
-			{
-				mark_tag = config->mark_tag;
-				is_marked = true;
-			}
-			else if (option & ST_MENU_OPTION_MARKED_REF)
-			{
-				int   *refval = menu->refvals[offset];
+static void
+traced_update_panels(void)
+{
+	TRACE(ST_MENU_TRACE_UPDATE_PANELS, ST_MENU_TRACE_BEGIN, 0);
 
-				if (*refval == menu_items->data)
-				{
-					is_marked = true;
-					mark_tag = config->mark_tag;
-				}
-			}
-			else if (option & ST_MENU_OPTION_SWITCH2_REF)
-			{
-				int   *refval = menu->refvals[offset];
+	update_panels();
 
-				is_marked = true;
-				mark_tag = (*refval == 1) ? config->switch_tag_1 : config->switch_tag_0;
-			}
-			else if (option & ST_MENU_OPTION_SWITCH3_REF)
-			{
-				int   *refval = menu->refvals[offset];
+	TRACE(ST_MENU_TRACE_UPDATE_PANELS, ST_MENU_TRACE_END, 0);
+}
 
-				is_marked = true;
-				switch (*refval)
-				{
-					case 1:
-						mark_tag = config->switch_tag_1;
-						break;
-					case 0:
-						mark_tag = config->switch_tag_0;
-						break;
-					default:
-						mark_tag = config->switch_tag_n1;
-						break;
-				}
-			}
-		}
+/*
+ * Sends pending changes to terminal and assigns written bytes
+ * to specified function. Bytes written outside of instrumented
+ * functions are not counted when kind is -1.
+ */
+static void
+stats_flush(int kind)
+{
+	long	bytes;
 
-		if (*menu_items->text == '\0' || strncmp(menu_items->text, "--", 2) == 0)
-		{
-			if (draw_box)
-			{
-				wmove(draw_area, row, 0);
-				if (!force_ascii_art)
-					waddch(draw_area, ACS_LTEE);
-				else
-					waddch(draw_area, '|');
-			}
-			else
-				wmove(draw_area, row - 1, 0);
+	if (!stats_counter)
+		return;
 
-			for(i = 0; i < maxx - 1 - (draw_box ? 1 : -1); i++)
-			{
-				if (!force_ascii_art)
-					waddch(draw_area, ACS_HLINE);
-				else
-					waddch(draw_area, '-');
-			}
+	doupdate();
 
-			if (draw_box)
-			{
-				if (!force_ascii_art)
-					waddch(draw_area, ACS_RTEE);
-				else
-					waddch(draw_area, '|');
-			}
-		}
-		else
-		{
-			char	*text = menu_items->text;
-			bool	highlight = false;
-			bool	is_cursor_row = menu->cursor_row == offset + 1;
-			bool	first_char = true;
-			bool	is_extern_accel;
-			int		text_y = -1;
-			int		text_x = -1;
+	bytes = stats_counter(stats_counter_data);
 
-			if (is_cursor_row)
-			{
-				mvwchgat(draw_area, row - (draw_box ? 0 : 1), text_min_x, text_max_x - text_min_x,
-						config->cursor_attr, config->cursor_cpn, NULL);
-				wattron(draw_area, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+	if (kind >= 0)
+	{
+		ST_MENU_STATS_ITEM *item = &stats.items[kind];
+		long	diff = bytes - stats_last_bytes;
+
+		item->calls += 1;
+		item->bytes += diff;
+		item->last_bytes = diff;
+		if (diff > item->max_bytes)
+			item->max_bytes = diff;
+	}
 
-				selected_item = menu_items;
-			}
+	stats_last_bytes = bytes;
+}
 
-			if (is_disabled)
-				wattron(draw_area, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+/*
+ * Draw menubar
+ */
+static void
+menubar_draw(struct ST_MENU *menu)
+{
+	ST_MENU_ITEM	   *menu_item = menu->menu_items;
+	ST_MENU_CONFIG	*config = menu->config;
+	bool	has_focus;
+	bool	has_accelerators;
+	int		i, j, k;
 
-			is_extern_accel = (*text == '_' && text[1] != '_');
+	selected_item = NULL;
+	selected_options = 0;
+	selected_refval = NULL;
 
-			if (menu->item_x_pos != 1 && !is_extern_accel)
-			{
-				wmove(draw_area, row - (draw_box ? 0 : 1), text_min_x + 1 + menu->item_x_pos);
-			}
-			else
-				wmove(draw_area, row - (draw_box ? 0 : 1), text_min_x + 1);
+	/* do nothing when content is invisible */
+	if (menu->focus == ST_MENU_FOCUS_NONE)
+		return;
 
-			while (*text)
-			{
-				if (*text == '~' || (*text == '_' && (first_char || highlight)))
-				{
-					if (text[1] == *text)
-					{
-						waddnstr(draw_area, text, 1);
-						text += 2;
-						first_char = false;
-						continue;
-					}
+	TRACE(ST_MENU_TRACE_MENUBAR_DRAW, ST_MENU_TRACE_BEGIN, 0);
+	TRACE_COUNT(redraws, 1);
+	TRACE_COUNT(rows_painted, 1);
 
-					if (!is_disabled)
-					{
-						if (!highlight)
-						{
-							wattron(draw_area,
-								COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
-										   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
-						}
-						else
-						{
-							wattroff(draw_area,
-								COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
-										   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
-							if (is_cursor_row)
-								wattron(draw_area, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+	show_panel(menu->panel);
+	top_panel(menu->panel);
 
-							if (is_extern_accel)
-							{
-								int		y, x;
+	traced_update_panels();
 
-								getyx(draw_area, y, x);
-								wmove(draw_area, y, x + config->extern_accel_text_space);
-							}
-						}
+	has_focus = menu->focus == ST_MENU_FOCUS_FULL;
+	has_accelerators = menu->focus == ST_MENU_FOCUS_FULL || 
+								menu->focus == ST_MENU_FOCUS_ALT_MOUSE;
 
-						highlight = !highlight;
-					}
-					text += 1;
-				}
-				else
-				{
-					int chlen = char_length(config, text);
+	if (has_focus)
+		wbkgd(menu->window, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
+	else
+		wbkgd(menu->window, COLOR_PAIR(config->menu_unfocused_cpn) | config->menu_unfocused_attr);
 
-					/* Save initial position of text. This first char, when is not
-					 * external accelerator used, or first char after highlighted char
-					 * when extern accelerator is used.
-					 */
-					if (text_y == -1 && text_x == -1)
-					{
-						if (!is_extern_accel || !highlight)
-							getyx(draw_area, text_y, text_x);
-					}
+	st_menu_backend->erase_window(menu->window);
 
-					waddnstr(draw_area, text, chlen);
-					text += chlen;
-				}
+	i = 0;
+	while (menu_item->text)
+	{
+		char	*text = menu_item->text;
+		ST_MENU_LABEL *label = &menu->labels[i];
+		bool	highlight = false;
+		bool	is_cursor_row = menu->cursor_row == i + 1 && has_focus;
+		bool	is_disabled = menu->options[i] & ST_MENU_OPTION_DISABLED;
+		int		current_pos;
 
-				first_char = false;
-			}
+		/* bar_fields_x_pos holds x positions of menubar items */
+		current_pos = menu->bar_fields_x_pos[i];
 
-			if (menu_items->shortcut != NULL)
+		if (is_cursor_row)
+		{
+			wmove(menu->window, 0, current_pos - 1);
+			wattron(menu->window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+			st_menu_backend->put_str(menu->window, " ", 1);
+
+			selected_item = menu_item;
+		}
+		else
+			wmove(menu->window, 0, current_pos);
+
+		if (is_disabled)
+			wattron(menu->window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+
+		/* there are not external accelerators */
+		for (j = 0; j <= label->nchars; j = k)
+		{
+			bool	is_highlighted = label->flags[j] & ST_MENU_LABEL_HIGHLIGHT;
+			int		bytes;
+
+			if (is_highlighted != highlight && !is_disabled && has_accelerators)
 			{
-				if (menu->shortcut_x_pos != -1)
+				if (!highlight)
 				{
-					wmove(draw_area, row - (draw_box ? 0 : 1), menu->shortcut_x_pos + (draw_box ? 1 : 0));
+					wattron(menu->window,
+						COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
+								   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr) );
 				}
 				else
 				{
-					int dspl = str_width(config, menu_items->shortcut);
-
-					wmove(draw_area,
-							  row - (draw_box ? 0 : 1),
-							  text_max_x - dspl - 1 - (has_submenu ? 2 : 0));
+					wattroff(menu->window,
+						COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
+								   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
+					if (is_cursor_row)
+						wattron(menu->window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
 				}
 
-				waddstr(draw_area, menu_items->shortcut);
+				highlight = !highlight;
 			}
 
-			if (has_submenu)
-			{
-				mvwprintw(draw_area,
-								row - (draw_box ? 0 : 1),
-								text_max_x - 2,
-									"%lc", config->submenu_tag);
-			}
+			if (j == label->nchars)
+				break;
 
-			if (is_marked)
-			{
-				mvwprintw(draw_area,
-								row - (draw_box ? 0 : 1),
-								text_x - 1,
-									"%lc", mark_tag);
-			}
+			/* chars with same attributes, that are neighbours in text, are written together */
+			bytes = label->lengths[j];
+			for (k = j + 1;
+				 k < label->nchars && label->flags[k] == label->flags[j] &&
+				 label->offsets[k] == label->offsets[k - 1] + label->lengths[k - 1];
+				 k++)
+				bytes += label->lengths[k];
 
-			if (is_cursor_row)
-				wattroff(draw_area, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+			st_menu_backend->put_str(menu->window, text + label->offsets[j], bytes);
+		}
 
-			if (is_disabled)
-				wattroff(draw_area, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+		if (is_cursor_row)
+		{
+			st_menu_backend->put_str(menu->window, " ", 1);
+			wattroff(menu->window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
 		}
 
-		menu_items += 1;
-		row += 1;
+		if (is_disabled)
+			wattroff(menu->window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
 
-		if (row > max_draw_rows)
-			break;
+		menu_item += 1;
+		i += 1;
 	}
 
-	if (draw_box)
-	{
-		if (menu->first_row > 1)
-			mvwprintw(draw_area, 1, maxx - 1, "%lc", config->scroll_up_tag);
-
-		if (menu->first_row + max_draw_rows - 1 < menu->nitems)
-			mvwprintw(draw_area, maxy - 2, maxx - 1, "%lc", config->scroll_down_tag);
-	}
+	st_menu_backend->flush(menu->window);
 
-	if (loc_draw_area)
-	{
-		wnoutrefresh(loc_draw_area);
-		delwin(loc_draw_area);
-	}
+	stats_flush(ST_MENU_STATS_MENUBAR);
 
-	wnoutrefresh(menu->window);
+	TRACE(ST_MENU_TRACE_MENUBAR_DRAW, ST_MENU_TRACE_END, menu->nitems);
 
 	if (menu->active_submenu)
-		pulldownmenu_draw(menu->active_submenu, false);
+		pulldownmenu_draw(menu->active_submenu, true);
 }
 
-/*
- * Sets desktop window - it is used to draw shadow. The window
- * should be panelized.
- */
-void
-st_menu_set_desktop_window(WINDOW *win)
-{
-	desktop_win = win;
-}
+#ifdef DEBUG_PIPE
 
-/*
- * Show menu - pull down or menu bar.
- */
-void
-st_menu_post(struct ST_MENU *menu)
+static void
+debug_print_size(WINDOW *window, char *name)
 {
-	curs_set(0);
-	noecho();
+	int		rows, cols;
+	int		y, x;
 
-	menu->mouse_row = -1;
+	getbegyx(window, y, x);
+	getmaxyx(window, rows, cols);
 
-	/* show menu */
-	if (menu->is_menubar)
-		menubar_draw(menu);
-	else
-		pulldownmenu_draw(menu, true);
+	fprintf(debug_pipe, "window \"%s\" y: %d, x: %d, rows: %d. cols: %d\n", name, y, x, rows, cols);
 }
 
+#endif
+
 /*
- * Hide menu. When close_active_submenu is true, then the path
- * of active submenu is destroyed - it doesn't rememeber opened
- * submenus.
+ * adjust pulldown position - move panels from ideal position to any position
+ * where can be fully displayed.
  */
-void
-st_menu_unpost(struct ST_MENU *menu, bool close_active_submenu)
+static void
+pulldownmenu_ajust_position(struct ST_MENU *menu, int maxy, int maxx)
 {
-	/* hide active submenu */
-	if (menu->active_submenu)
-	{
-		st_menu_unpost(menu->active_submenu, close_active_submenu);
-		if (close_active_submenu)
-			menu->active_submenu = NULL;
-	}
-
-	menu->mouse_row = -1;
-
-	hide_panel(menu->panel);
-	if (menu->shadow_panel)
-		hide_panel(menu->shadow_panel);
+	ST_MENU_CONFIG	*config = menu->config;
 
-	update_panels();
-}
+	int		rows, cols;
+	int		new_y, new_x;
+	int		y, x;
 
-/*
- * Allow to set focus level for menu objects. This allow to
- * redirect events to some else where focus is not full.
- */
-void
-st_menu_set_focus(struct ST_MENU *menu, int focus)
-{
-	menu->focus = focus;
-}
+	getbegyx(menu->window, y, x);
+	getmaxyx(menu->window, rows, cols);
+	subtract_correction(menu->window, &y, &x);
 
-/*
- * The coordinates of subwin are not "correctly" refreshed, when
- * parent panel is moved. Maybe it is bug in ncurses, maybe not.
- * The new coordinates are calculated from parent and offset to parent
- * and difference between new and old coordinates is applyed on
- * x, y points.
- */
-static void
-add_correction(WINDOW *s, int *y, int *x)
-{
-	WINDOW *p = wgetparent(s);
 	/*
-	 * Note: function is_subwin is unknown on some
-	 * older ncurses implementations. Don't use it.
+	 * Hypothesis: when panel is moved, then assigned windows is moved
+	 * to and possibly reduced (when terminal is smaller). But when terminal
+	 * grows, then size of assigned window grows too, more than was original
+	 * size. So we should to recheck size of assigned window, and fix it, when
+	 * it is bigger than should be.
 	 */
-	if (p)
+	if (rows != menu->rows || cols != menu->cols)
 	{
-		int	py, px, sy, sx, oy, ox;
-		int fix_y, fix_x;
+		int		new_rows = y + menu->rows <= maxy ? menu->rows : maxy - y + 1;
+		int		new_cols = x + menu->cols <= maxx ? menu->cols : maxx - x + 1;
 
-		getbegyx(p, py, px);
-		getbegyx(s, sy, sx);
-		getparyx(s, oy, ox);
+		if (new_rows != rows || new_cols != cols)
+			wresize(menu->window, new_rows, new_cols);
+	}
 
-		fix_y = sy - (py + oy);
-		fix_x = sx - (px + ox);
+#ifdef DEBUG_PIPE
 
-		*y += fix_y;
-		*x += fix_x;
-	}
-}
+	debug_print_size(menu->window, "menu window");
+
+#endif
 
-/*
- * It is correction for window begxy, begx when panel contained
- * this window was moved.
- */
-static void
-subtract_correction(WINDOW *s, int *y, int *x)
-{
-	WINDOW *p = wgetparent(s);
 	/*
-	 * Note: function is_subwin is unknown on some
-	 * older ncurses implementations. Don't use it.
+	 * Previous issue is same for shadow window. But with different timing.
+	 * Visibility of shadow needs one row and one column more. The begin of
+	 * shadow window should be in relation to begin of menu window.
 	 */
-	if (p)
+	if (config->shadow_width > 0)
 	{
-		int	py, px, sy, sx, oy, ox;
-		int fix_y, fix_x;
-
-		getbegyx(p, py, px);
-		getbegyx(s, sy, sx);
-		getparyx(s, oy, ox);
-
-		fix_y = sy - (py + oy);
-		fix_x = sx - (px + ox);
-
-		*y -= fix_y;
-		*x -= fix_x;
-	}
-}
+		int		srows, scols;
 
-/*
- * Handle any outer event - pressed key, or mouse event. This driver
- * doesn't handle shortcuts - shortcuts are displayed only.
- * is_top is true, when _st_menu_driver is called first time, when
- * it is called recursivly, then it is false. Only in top call, the
- * draw routines can be called.
- * when unpost_submenu is true, then driver should to unpost active
- * subwindow of current menu. This info is propagated back - the nested
- * element tell to owner, close me.
- */
-static bool
-_st_menu_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent,
-					bool is_top, bool is_nested_pulldown,
-					bool *unpost_submenu)
-{
-	ST_MENU_CONFIG	*config;
+		/* panel move can move shadow window. Force correct position now */
 
-	int		cursor_row;				/* number of active menu item */
-	bool	is_menubar;				/* true, when processed object is menu bar */
-	int		first_row = -1;			/* number of row of first enabled item */
-	int		last_row = -1;			/* last menu item */
-	int		mouse_row = -1;			/* item number selected by mouse */
-	int		search_row = -1;		/* code menu selected by accelerator */
-	bool	found_row = false;		/* we found new active menu item (row var will be valid) */
-	bool	post_menu = false;			/* when it is true, then assiciated pulldown menu will be posted */
-	int		row;
-	bool	processed = false;
-	ST_MENU_ITEM	   *menu_items;
+		getmaxyx(menu->shadow_window, srows, scols);
+		mvwin(menu->shadow_window, y+1 , x+config->shadow_width);
 
-	/* reset globals */
-	selected_item = NULL;
-	press_accelerator = false;
-	press_enter = false;
-	button1_clicked = false;
+		if (srows != menu->rows || scols != menu->cols)
+		{
+			int		new_srows, new_scols;
 
-	*unpost_submenu = false;
+			new_srows = y + 1 + menu->rows <= maxy ? menu->rows :  maxy - y - 1;
+			new_scols = x + config->shadow_width + menu->cols <= maxx ? menu->cols : maxx - x - config->shadow_width;
 
-	/* maybe only cmdbar is used */
-	if (!menu)
-		goto post_process;
+			wresize(menu->shadow_window, new_srows, new_scols);
+		}
+	}
 
-	config = menu->config;
-	cursor_row = menu->cursor_row;		/* number of active menu item */
-	is_menubar = menu->is_menubar;		/* true, when processed object is menu bar */
+#ifdef DEBUG_PIPE
 
-	/* Focus filter */
-	if ((menu->focus == ST_MENU_FOCUS_MOUSE_ONLY && c != KEY_MOUSE) ||
-		(menu->focus == ST_MENU_FOCUS_ALT_MOUSE && c != KEY_MOUSE && !alt) ||
-		(menu->focus == ST_MENU_FOCUS_NONE))
-		goto post_process;
+	debug_print_size(menu->shadow_window, "menu shadow window");
 
-#if NCURSES_MOUSE_VERSION > 1
+#endif
 
-	/* use mouse wheel only with FULL FOCUS */
-	if (c == KEY_MOUSE &&
-		(mevent->bstate & BUTTON4_PRESSED || mevent->bstate & BUTTON5_PRESSED) &&
-		menu->focus != ST_MENU_FOCUS_FULL)
-		goto post_process;
+	if (menu->ideal_x_pos + menu->cols > maxx)
+	{
+		new_x = maxx - menu->cols;
+		if (new_x < 0)
+			new_x = 0;
+	}
+	else
+		new_x = menu->ideal_x_pos;
 
-#endif
+	if (menu->ideal_y_pos + menu->rows > maxy)
+	{
+		new_y = maxy - menu->rows;
+		if (new_y < 1)
+			new_y = 1;
+	}
+	else
+		new_y = menu->ideal_y_pos;
 
-	/*
-	 * Propagate event to nested active object first. When nested object would be
-	 * closed, close it. When nested object read event, go to end
-	 */
-	if (menu->active_submenu)
+	if (new_y != y || new_x != x)
 	{
-		bool	_is_nested_pulldown = is_nested_pulldown ? true : (is_menubar ? false : true);
-		bool	unpost_submenu_loc = false;
+		int result;
 
-		/*
-		 * Key right is used in pulldown menu for access to nested menu.
-		 * When nested menu is active already, then there is not any
-		 * work on this level. KEY_RIGHT can buble to menubar and can
-		 * be processed there.
-		 */
-		if (!is_menubar && c == KEY_RIGHT)
-			goto post_process;
+		result = move_panel(menu->panel, new_y, new_x);
 
 		/*
-		 * Submenu cannot be top object. When now is not menu bar, then now should be
-		 * pulldown menu, and nested object should be nested pulldown menu.
+		 * This is maybe ugly hack. move_panel fails when
+		 * attached window cannot be displayed. So we can try
+		 * resize attached window first.
 		 */
-		processed = _st_menu_driver(menu->active_submenu, c, alt, mevent,
-												false, _is_nested_pulldown, &unpost_submenu_loc);
-
-		if (unpost_submenu_loc)
+		if (result != OK)
 		{
-			st_menu_unpost(menu->active_submenu, false);
-			menu->active_submenu = NULL;
+			WINDOW *pw = panel_window(menu->panel);
+
+			wresize(pw, maxy - new_y, menu->cols);
+			replace_panel(menu->panel, pw);
 		}
 
-		/*
-		 * When we close some object, then we did some work on this
-		 * level, and we should not do more work here.
-		 */
-		if (processed)
-			goto post_process;
-	}
-
-	/*
-	 * The checks of events, that can unpost this level menu. For unposting top
-	 * object is responsible the user.
-	 */
-	if (!is_top)
-	{
-		if (c == ST_MENU_ESCAPE)
-		{
-			*unpost_submenu = true;
-
-			/*
-			 * escape should to close all opened objects, so we cannot to
-			 * returns true (processed) due we are in top object.
-			 */
-			return false;
-		}
+		result = move_panel(menu->panel, new_y, new_x);
 
 		/*
-		 * Unpost menu (close) when mouse click outside menu window. Mouse position
-		 * event is processed specially. We want to close only submenu, or we want
-		 * to swith to other bar menu item.
+		 * move_panel fails when it cannot be displayed completly.
+		 * This is problem for shadow window because is n char right,
+		 * over left border. So we have to create new window with
+		 * different sizes.
+		 * Don't try move shadow panel, when a move of menu panel
+		 * failed.
 		 */
-		if (c == KEY_MOUSE &&
-			mevent->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED
-
-#if NCURSES_MOUSE_VERSION > 1
-
-							  | REPORT_MOUSE_POSITION
-
-#endif
-		  ))
+		if (result == OK && menu->shadow_panel)
 		{
-			int		y = mevent->y;
-			int		x = mevent->x;
+			int		new_rows, new_cols;
+			int		smaxy, smaxx;
 
-			/*
-			 * For some styles, the window is different than draw_area. The
-			 * draw_area is subwindow of window. When main window is moved
-			 * due moving panel (see adjust position), then subwindow has not
-			 * expected coordinates. Following routine calculate fix between
-			 * current draw_area coordinates and expected coordinates. Then
-			 * apply this fix on mouse position.
-			 */
-			add_correction(menu->draw_area, &y, &x);
+			new_cols = menu->cols - (new_x == menu->ideal_x_pos ? 0 : config->shadow_width);
+			new_rows = menu->rows - (maxy >= new_y + menu->rows + 1 ? 0 : 1);
 
-			if (!is_menubar && !wenclose(menu->draw_area, y, x))
-			{
+			getmaxyx(menu->shadow_window, smaxy, smaxx);
 
-#if NCURSES_MOUSE_VERSION > 1
+			/* don't create new window, when size is not changed */
+			if ((new_cols <= smaxx || new_rows <= smaxy) &&
+				(new_cols != smaxx || new_rows != smaxy))
+			{
+				WINDOW   *new_shadow_window;
 
-				if (mevent->bstate & REPORT_MOUSE_POSITION)
-				{
-					/*
-					 * We want to ignore move movement outside menu's window. Without
-					 * it the behaviour is too sensitive, and it is not user friendly.
-					 * But we need to close submenus, and we want to allow usage of
-					 * bar menu. For these case we should to allow sending event to
-					 * upper objects.
-					 */
-					if (is_nested_pulldown)
-						return false;
-					else
-						/* true when we are not in menu bar position */
-						return y != 0;
-				}
-				else
-				{
-					*unpost_submenu = true;
-					return false;
-				}
+				new_shadow_window = newwin(new_rows, new_cols, new_y + 1, new_x + config->shadow_width);
+				TRACE_COUNT(windows, 1);
 
-#else
+				/* There are no other possibility to resize panel */
+				replace_panel(menu->shadow_panel, new_shadow_window);
 
-				*unpost_submenu = true;
-				return false;
+				delwin(menu->shadow_window);
+				menu->shadow_window = new_shadow_window;
 
-#endif
+				wbkgd(menu->shadow_window, COLOR_PAIR(config->menu_shadow_cpn) | config->menu_shadow_attr);
 
+				wnoutrefresh(menu->shadow_window);
 			}
-		}
 
-		/*
-		 * Nested submenu can be unposted by pressing key left
-		 */
-		if (c == KEY_LEFT && is_nested_pulldown)
-		{
-			*unpost_submenu = true;
-			return true;
+			move_panel(menu->shadow_panel, new_y + 1, new_x + config->shadow_width);
 		}
 	}
 
-	if (c == KEY_MOUSE)
-	{
-
-#if NCURSES_MOUSE_VERSION > 1
+	if (menu->active_submenu)
+		pulldownmenu_ajust_position(menu->active_submenu, maxy, maxx);
 
-		if (mevent->bstate & BUTTON5_PRESSED)
-		{
-				c = KEY_DOWN;
-		}
-		else if (mevent->bstate & BUTTON4_PRESSED)
-		{
-			c = KEY_UP;
-		}
-		else
+	traced_update_panels();
+}
 
-#endif
+/*
+ * Draw shadow
+ */
+static void
+pulldownmenu_draw_shadow(struct ST_MENU *menu)
+{
+	ST_MENU_CONFIG	*config = menu->config;
 
-		if (mevent->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED
+	if (menu->shadow_window)
+	{
+		int		smaxy, smaxx;
+		int		i, j;
+		int		wmaxy, wmaxx;
+		attr_t	shadow_attr;
 
-#if NCURSES_MOUSE_VERSION > 1
+		TRACE(ST_MENU_TRACE_SHADOW_DRAW, ST_MENU_TRACE_BEGIN, 0);
+		TRACE_COUNT(redraws, 1);
 
-		 | REPORT_MOUSE_POSITION
+		shadow_attr = config->menu_shadow_attr | A_DIM;
 
-#endif
-		  ))
-		{
-			if (is_menubar)
-			{
-				/*
-				 * On menubar level we can process mouse event if row is zero, or
-				 * we can check if mouse is positioned inside draw area or active
-				 * submenu. If not, then we should to unpost active submenu.
-				 */
-				if (mevent->y == 0)
-				{
-					int		i = 0;
-					int		chars_before;
+		getmaxyx(menu->shadow_window, smaxy, smaxx);
 
-					/*
-					 * How much chars before active item and following item
-					 * specify range of menubar item.
-					 */
-					chars_before = (config->text_space != -1) ? (config->text_space / 2) : 1;
+		show_panel(menu->shadow_panel);
+		top_panel(menu->shadow_panel);
 
-					menu_items = menu->menu_items;
-					while (menu_items->text)
-					{
-						int		minx, maxx;
+		/* desktop_win must be global */
+		st_menu_backend->shadow_background(menu->shadow_window,
+										   desktop_win,
+										   active_cmdbar ? active_cmdbar->window : NULL);
 
-						/* first menubar field get mouse from left corner */
-						minx = i > 0 ? (menu->bar_fields_x_pos[i] - chars_before) : 0;
+		wmaxy = smaxy - 1;
+		wmaxx = smaxx - config->shadow_width;
 
-						/* last menubar field get mouse to right corner */
-						maxx = i + 1 < menu->nitems ? menu->bar_fields_x_pos[i + 1] - chars_before : mevent->x + 1;
+		for (i = 0; i <= smaxy; i++)
+			for (j = 0; j <= smaxx; j++)
+			{
 
-						/* transform possitions to target menu code */
-						if (mevent->x >= minx && mevent->x < maxx)
-						{
-							mouse_row = i + 1;
-							break;
-						}
+				if (i < wmaxy && j < wmaxx)
+					continue;
 
-						menu_items += 1;
-						i = i + 1;
-					}
-				}
+				if (st_menu_backend->get_ch(menu->shadow_window, i, j) & A_ALTCHARSET)
+					st_menu_backend->change_attr(menu->shadow_window, i, j, 1,
+								shadow_attr | A_ALTCHARSET,
+								config->menu_shadow_cpn);
+				else
+					st_menu_backend->change_attr(menu->shadow_window, i, j, 1,
+								shadow_attr,
+								config->menu_shadow_cpn);
 			}
-			else
-			{
-				int		row_loc, col_loc;
 
-				row_loc = mevent->y;
-				col_loc = mevent->x;
+		st_menu_backend->flush(menu->shadow_window);
 
-				/* fix mouse coordinates, if draw_area has "wrong" coordinates */
-				add_correction(menu->draw_area, &row_loc, &col_loc);
+		stats_flush(ST_MENU_STATS_SHADOW);
 
-				/* calculate row from transformed mouse event */
-				if (wmouse_trafo(menu->draw_area, &row_loc, &col_loc, false))
-						mouse_row = row_loc + 1 - (config->draw_box ? 1:0) + (menu->first_row - 1);
-			}
-		}
+		TRACE(ST_MENU_TRACE_SHADOW_DRAW, ST_MENU_TRACE_END, smaxy);
 	}
-	else
-		/* there are no mouse event, reset prev mouse row */
-		menu->mouse_row = -1;
 
-	/*
-	 * Try to check if key is accelerator. This check should be on last level.
-	 * So don't do it if submenu is active.
-	 */
-	if (c != KEY_MOUSE
-			&& c != KEY_HOME && c != KEY_END
-			&& c != KEY_UP && c != KEY_DOWN
-			&& c != KEY_LEFT && c != KEY_RIGHT)
+	if (menu->active_submenu)
+		pulldownmenu_draw_shadow(menu->active_submenu);
+}
+
+/*
+ * Early search of selected refval items. Is necessary to
+ * change state before next drawing.
+ */
+static void
+searching_selected_refval_items(struct ST_MENU *menu)
+{
+	int		offset = menu->cursor_row - 1;
+
+	/* only item under cursor can be selected */
+	if (offset >= 0 && offset < menu->nitems && IS_REF_OPTION(menu->options[offset]))
 	{
+		selected_item = &menu->menu_items[offset];
+		selected_options = menu->options[offset];
+		selected_refval= menu->refvals[offset];
+	}
 
-		/*
-		 * accelerator can be alt accelerator for menuber or non alt, and
-		 * the menu should not to have active submenu.
-		 */
-		if ((!alt && !menu->active_submenu) ||
-				(alt && is_menubar))
-		{
-			char		buffer[20];
-			char	   *pressed;
-			int			i;
-			int			l_pressed;
+	if (menu->active_submenu)
+		searching_selected_refval_items(menu->active_submenu);
+}
 
-			l_pressed = wchar_to_utf8(config, buffer, 20, (wchar_t) c);
-			buffer[l_pressed] = '\0';
+/*
+ * pulldown menu bar draw
+ */
+static void
+pulldownmenu_draw(struct ST_MENU *menu, bool is_top)
+{
+	bool	draw_box = menu->config->draw_box;
+	ST_MENU_ITEM	   *menu_items = menu->menu_items;
+	ST_MENU_CONFIG	*config = menu->config;
+	WINDOW	   *draw_area = menu->draw_area;
+	WINDOW	   *loc_draw_area = NULL;
+	int		row = 1;
+	int		maxy, maxx;
+	int		dmaxy, dmaxx, dy, dx;
+	int		text_min_x, text_max_x;
+	int		*options = menu->options;
+	bool	force_ascii_art = config->force_ascii_art;
+	int		max_draw_rows = menu->rows;
+	int		painted_rows = 0;
+	ST_MENU_FILTER_MATCH *matches;
+	int		nrows;
+	int		cursor_row;
+	int		column_rows;
+	int		layout_rows;
+	int		column_x = 0;
+	int		i, j, k, v;
 
-			pressed = chr_casexfrm(config, (char *) buffer);
-			l_pressed = strlen(pressed);
+	selected_item = NULL;
 
-			for (i = 0; i < menu->naccelerators; i++)
+	TRACE(ST_MENU_TRACE_PULLDOWN_DRAW, ST_MENU_TRACE_BEGIN, is_top);
+	TRACE_COUNT(redraws, 1);
+
+	if (is_top)
+	{
+		int	stdscr_maxy, stdscr_maxx;
+
+		/* adjust positions of pulldown menus */
+		getmaxyx(stdscr, stdscr_maxy, stdscr_maxx);
+		pulldownmenu_ajust_position(menu, stdscr_maxy, stdscr_maxx);
+
+		/* Draw shadows of window and all nested active pull down menu */
+		pulldownmenu_draw_shadow(menu);
+	}
+
+	show_panel(menu->panel);
+	top_panel(menu->panel);
+
+	traced_update_panels();
+
+	/* clean menu background */
+	st_menu_backend->erase_window(menu->window);
+
+	/*
+	 * Now, we would to check if is possible to draw complete draw area on
+	 * screen, and if draw area is good enough for all menu's items.
+	 */
+	getmaxyx(stdscr, maxy, maxx);
+	getmaxyx(draw_area, dmaxy, dmaxx);
+	getbegyx(draw_area, dy, dx);
+
+	subtract_correction(draw_area, &dy, &dx);
+
+	/* when filter is active, then only matched items are displayed */
+	nrows = pulldownmenu_rows(menu, &matches);
+	cursor_row = matches ? filter_find_row(matches, nrows, menu->cursor_row) : menu->cursor_row;
+
+	/*
+	 * Items of multi-column menu are placed to columns from top to bottom,
+	 * and the rows of all columns are scrolled together.
+	 */
+	column_rows = menu->ncolumns > 1 ? menu->column_rows : max_int(nrows, 1);
+	layout_rows = min_int(nrows, column_rows);
+
+	if (cursor_row != -1)
+		cursor_row = (cursor_row - 1) % column_rows + 1;
+
+	if (dy + dmaxy > maxy || dmaxy < menu->rows )
+	{
+		dmaxy = min_int(maxy - dy, dmaxy);
+		max_draw_rows = draw_box ? (dmaxy - 2) : dmaxy;
+
+		/*
+		 * The clipped subwindow is cached, and it is created again only
+		 * when its geometry should be changed. Usually it is created when
+		 * menu is displayed first time.
+		 */
+		if (menu->clip_area)
+		{
+			int		cy, cx, crows, ccols;
+
+			getbegyx(menu->clip_area, cy, cx);
+			getmaxyx(menu->clip_area, crows, ccols);
+
+			subtract_correction(menu->clip_area, &cy, &cx);
+
+			if (cy != dy || cx != dx || crows != dmaxy || ccols != dmaxx)
 			{
-				if (menu->accelerators[i].length == l_pressed &&
-					memcmp(menu->accelerators[i].c, pressed, l_pressed) == 0)
+				delwin(menu->clip_area);
+				menu->clip_area = NULL;
+			}
+		}
+
+		if (!menu->clip_area)
+		{
+			menu->clip_area = subwin(menu->window, dmaxy, dmaxx, dy, dx);
+
+			TRACE_COUNT(allocations, 1);
+			TRACE_COUNT(windows, 1);
+		}
+
+		loc_draw_area = menu->clip_area;
+		draw_area = loc_draw_area;
+
+		if (cursor_row != -1)
+		{
+			if (cursor_row < menu->first_row)
+				menu->first_row = cursor_row;
+
+			if (cursor_row > menu->first_row + max_draw_rows - 1)
+				menu->first_row = cursor_row - max_draw_rows + 1;
+		}
+
+		/* rows of all columns are skipped, so first row cannot be after last page */
+		menu->first_row = max_int(min_int(menu->first_row, layout_rows - max_draw_rows + 1), 1);
+	}
+	else
+	{
+		menu->first_row = 1;
+		max_draw_rows = layout_rows;
+	}
+
+	menu->page_rows = max_draw_rows;
+
+	getmaxyx(draw_area, maxy, maxx);
+
+	/* be compiler quiet */
+	(void) maxy;
+
+	if (draw_box)
+	{
+		if (!force_ascii_art)
+			st_menu_backend->draw_border(draw_area, 0, 0, 0, 0, 0, 0, 0, 0);
+		else
+			st_menu_backend->draw_border(draw_area, '|', '|', '-', '-', '+', '+', '+', '+');
+	}
+
+	text_min_x = (draw_box ? 1 : 0) + (config->extra_inner_space ? 1 : 0);
+	text_max_x = maxx - (draw_box ? 1 : 0) - (config->extra_inner_space ? 1 : 0);
+
+	/* first first_row - 1 rows of every column are skipped */
+	for (v = menu->first_row - 1; v < nrows; v++)
+	{
+		int		offset = matches ? matches[v].offset : v;
+		int		column = v / column_rows;
+		bool	has_submenu;
+		bool	is_disabled = false;
+		bool	is_marked = false;
+		int		mark_tag;
+
+		row = v % column_rows - menu->first_row + 2;
+
+		/* hidden rows are skipped, the drawing continues by first visible row of column */
+		if (row < 1 || row > max_draw_rows)
+		{
+			v = (row < 1 ? column : column + 1) * column_rows + menu->first_row - 2;
+			continue;
+		}
+
+		if (menu->ncolumns > 1)
+		{
+			column_x = column * menu->column_width;
+			text_min_x = (draw_box ? 1 : 0) + column_x + (config->extra_inner_space ? 1 : 0);
+			text_max_x = text_min_x + menu->column_width - (config->extra_inner_space ? 2 : 0);
+		}
+
+		menu_items = &menu->menu_items[offset];
+		has_submenu = menu_items->submenu ? true : false;
+
+		if (options)
+		{
+			int		option = options[offset];
+
+			is_disabled = option & ST_MENU_OPTION_DISABLED;
+
+			if (option & ST_MENU_OPTION_MARKED)
+			{
+				mark_tag = config->mark_tag;
+				is_marked = true;
+			}
+			else if (option & ST_MENU_OPTION_MARKED_REF)
+			{
+				int   *refval = menu->refvals[offset];
+
+				if (*refval == menu_items->data)
 				{
-					/* check if row is enabled */
-					search_row = menu->accelerators[i].row;
-					if (menu->options[search_row - 1] & ST_MENU_OPTION_DISABLED)
-						/* revert back, found accelerator is for disabled menu item */
-						search_row = -1;
-					else
+					is_marked = true;
+					mark_tag = config->mark_tag;
+				}
+			}
+			else if (option & ST_MENU_OPTION_SWITCH2_REF)
+			{
+				int   *refval = menu->refvals[offset];
+
+				is_marked = true;
+				mark_tag = (*refval == 1) ? config->switch_tag_1 : config->switch_tag_0;
+			}
+			else if (option & ST_MENU_OPTION_SWITCH3_REF)
+			{
+				int   *refval = menu->refvals[offset];
+
+				is_marked = true;
+				switch (*refval)
+				{
+					case 1:
+						mark_tag = config->switch_tag_1;
+						break;
+					case 0:
+						mark_tag = config->switch_tag_0;
+						break;
+					default:
+						mark_tag = config->switch_tag_n1;
 						break;
 				}
 			}
+		}
+
+		if (*menu_items->text == '\0' || strncmp(menu_items->text, "--", 2) == 0)
+		{
+			/* separator of multi-column menu is limited by its column */
+			if (menu->ncolumns > 1)
+				wmove(draw_area, row - (draw_box ? 0 : 1), (draw_box ? 1 : 0) + column_x);
+			else if (draw_box)
+			{
+				wmove(draw_area, row, 0);
+				if (!force_ascii_art)
+					st_menu_backend->put_ch(draw_area, ACS_LTEE);
+				else
+					st_menu_backend->put_ch(draw_area, '|');
+			}
+			else
+				wmove(draw_area, row - 1, 0);
+
+			for(i = 0; i < (menu->ncolumns > 1 ? menu->column_width : maxx - 1 - (draw_box ? 1 : -1)); i++)
+			{
+				if (!force_ascii_art)
+					st_menu_backend->put_ch(draw_area, ACS_HLINE);
+				else
+					st_menu_backend->put_ch(draw_area, '-');
+			}
+
+			if (draw_box && menu->ncolumns == 1)
+			{
+				if (!force_ascii_art)
+					st_menu_backend->put_ch(draw_area, ACS_RTEE);
+				else
+					st_menu_backend->put_ch(draw_area, '|');
+			}
+		}
+		else
+		{
+			char	*text = menu_items->text;
+			ST_MENU_LABEL *label = &menu->labels[offset];
+			bool	highlight = false;
+			bool	is_cursor_row = menu->cursor_row == offset + 1;
+			bool	is_extern_accel;
+			int		text_y = -1;
+			int		text_x = -1;
+
+			if (is_cursor_row)
+			{
+				st_menu_backend->change_attr(draw_area, row - (draw_box ? 0 : 1), text_min_x, text_max_x - text_min_x,
+						config->cursor_attr, config->cursor_cpn);
+				wattron(draw_area, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+
+				selected_item = menu_items;
+			}
+
+			if (is_disabled)
+				wattron(draw_area, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+
+			is_extern_accel = label->is_extern_accel;
+
+			if (menu->item_x_pos != 1 && !is_extern_accel)
+			{
+				wmove(draw_area, row - (draw_box ? 0 : 1), text_min_x + 1 + menu->item_x_pos);
+			}
+			else
+				wmove(draw_area, row - (draw_box ? 0 : 1), text_min_x + 1);
+
+			for (j = 0; j <= label->nchars; j = k)
+			{
+				bool	is_highlighted = label->flags[j] & ST_MENU_LABEL_HIGHLIGHT;
+				int		bytes;
+
+				if (is_highlighted != highlight)
+				{
+					if (!is_disabled)
+					{
+						if (!highlight)
+						{
+							wattron(draw_area,
+								COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
+										   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
+						}
+						else
+						{
+							wattroff(draw_area,
+								COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
+										   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
+							if (is_cursor_row)
+								wattron(draw_area, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+						}
+					}
+
+					if (highlight && is_extern_accel)
+					{
+						int		y, x;
+
+						getyx(draw_area, y, x);
+						wmove(draw_area, y, x + config->extern_accel_text_space);
+					}
+
+					highlight = !highlight;
+				}
+
+				if (j == label->nchars)
+					break;
+
+				/* Save initial position of text. This first char, when is not
+				 * external accelerator used, or first char after highlighted char
+				 * when extern accelerator is used.
+				 */
+				if (text_y == -1 && text_x == -1)
+				{
+					if (!is_extern_accel || !highlight)
+						getyx(draw_area, text_y, text_x);
+				}
+
+				/* chars with same attributes, that are neighbours in text, are written together */
+				bytes = label->lengths[j];
+				for (k = j + 1;
+					 k < label->nchars && label->flags[k] == label->flags[j] &&
+					 label->offsets[k] == label->offsets[k - 1] + label->lengths[k - 1];
+					 k++)
+					bytes += label->lengths[k];
+
+				st_menu_backend->put_str(draw_area, text + label->offsets[j], bytes);
+			}
+
+			if (menu_items->shortcut != NULL)
+			{
+				if (menu->shortcut_x_pos != -1)
+				{
+					wmove(draw_area, row - (draw_box ? 0 : 1), menu->shortcut_x_pos + (draw_box ? 1 : 0) + column_x);
+				}
+				else
+				{
+					int dspl = label->shortcut_width;
+
+					wmove(draw_area,
+							  row - (draw_box ? 0 : 1),
+							  text_max_x - dspl - 1 - (has_submenu ? 2 : 0));
+				}
+
+				st_menu_backend->put_str(draw_area, menu_items->shortcut, -1);
+			}
+
+			if (has_submenu)
+			{
+				wmove(draw_area, row - (draw_box ? 0 : 1), text_max_x - 2);
+				st_menu_backend->put_wch(draw_area, config->submenu_tag);
+			}
+
+			if (is_marked)
+			{
+				wmove(draw_area, row - (draw_box ? 0 : 1), text_x - 1);
+				st_menu_backend->put_wch(draw_area, mark_tag);
+			}
+
+			if (is_cursor_row)
+				wattroff(draw_area, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+
+			if (is_disabled)
+				wattroff(draw_area, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+		}
+
+		painted_rows += 1;
+	}
+
+	if (draw_box)
+	{
+		int		hidden_rows = layout_rows - max_draw_rows;
+
+		if (menu->first_row > 1)
+		{
+			wmove(draw_area, 1, maxx - 1);
+			st_menu_backend->put_wch(draw_area, config->scroll_up_tag);
+		}
+
+		if (menu->first_row + max_draw_rows - 1 < layout_rows)
+		{
+			wmove(draw_area, maxy - 2, maxx - 1);
+			st_menu_backend->put_wch(draw_area, config->scroll_down_tag);
+		}
+
+		/* position of scrolled content is displayed between scroll tags */
+		if (config->scroll_thumb_tag && hidden_rows > 0 && maxy > 4)
+		{
+			int		track = maxy - 4;
+
+			wmove(draw_area, 2 + (min_int(menu->first_row - 1, hidden_rows) * (track - 1) + hidden_rows / 2) / hidden_rows,
+				  maxx - 1);
+			st_menu_backend->put_wch(draw_area, config->scroll_thumb_tag);
+		}
+
+		/* query of filter is displayed in bottom border */
+		if (matches)
+		{
+			ST_MENU_FILTER *filter = menu->filter;
+			int		start;
+
+			/* only end of long query is displayed */
+			for (start = 0; start < filter->query_length; start++)
+				if (str_width(config, filter->query + filter->query_offsets[start]) <= maxx - 6)
+					break;
+
+			wmove(draw_area, maxy - 1, 2);
+			st_menu_backend->put_str(draw_area, " ", -1);
+			st_menu_backend->put_str(draw_area, filter->query + filter->query_offsets[start], -1);
+			st_menu_backend->put_str(draw_area, " ", -1);
+		}
+	}
+
+	if (loc_draw_area)
+		st_menu_backend->flush(loc_draw_area);
+
+	st_menu_backend->flush(menu->window);
+
+	stats_flush(ST_MENU_STATS_PULLDOWN);
+
+	TRACE_COUNT(rows_painted, painted_rows);
+	TRACE(ST_MENU_TRACE_PULLDOWN_DRAW, ST_MENU_TRACE_END, painted_rows);
+
+	if (menu->active_submenu)
+		pulldownmenu_draw(menu->active_submenu, false);
+}
+
+/*
+ * Sets desktop window - it is used to draw shadow. The window
+ * should be panelized.
+ */
+void
+st_menu_set_desktop_window(WINDOW *win)
+{
+	desktop_win = win;
+}
+
+/*
+ * Show menu - pull down or menu bar.
+ */
+void
+st_menu_post(struct ST_MENU *menu)
+{
+	curs_set(0);
+	noecho();
+
+	menu->mouse_row = -1;
+
+	/* show menu */
+	if (menu->is_menubar)
+		menubar_draw(menu);
+	else
+		pulldownmenu_draw(menu, true);
+}
+
+/*
+ * Hide menu. When close_active_submenu is true, then the path
+ * of active submenu is destroyed - it doesn't rememeber opened
+ * submenus.
+ */
+void
+st_menu_unpost(struct ST_MENU *menu, bool close_active_submenu)
+{
+	/* hide active submenu */
+	if (menu->active_submenu)
+	{
+		st_menu_unpost(menu->active_submenu, close_active_submenu);
+		if (close_active_submenu)
+			menu->active_submenu = NULL;
+	}
+
+	menu->mouse_row = -1;
+
+	/* query of filter is not remembered */
+	if (menu->filter && menu->filter->query_length > 0)
+		filter_set_length(menu, 0);
+
+	hide_panel(menu->panel);
+	if (menu->shadow_panel)
+		hide_panel(menu->shadow_panel);
+
+	traced_update_panels();
+}
+
+/*
+ * Allow to set focus level for menu objects. This allow to
+ * redirect events to some else where focus is not full.
+ */
+void
+st_menu_set_focus(struct ST_MENU *menu, int focus)
+{
+	menu->focus = focus;
+}
+
+/*
+ * Enable or disable dispatching of shortcuts of menu items. The shortcuts
+ * are displayed only by default.
+ */
+void
+st_menu_set_shortcuts_enabled(struct ST_MENU *menu, bool enabled)
+{
+	while (menu->parent_menu)
+		menu = menu->parent_menu;
+
+	menu->shortcuts_enabled = enabled;
+}
+
+/*
+ * The coordinates of subwin are not "correctly" refreshed, when
+ * parent panel is moved. Maybe it is bug in ncurses, maybe not.
+ * The new coordinates are calculated from parent and offset to parent
+ * and difference between new and old coordinates is applyed on
+ * x, y points.
+ */
+static void
+add_correction(WINDOW *s, int *y, int *x)
+{
+	WINDOW *p = wgetparent(s);
+	/*
+	 * Note: function is_subwin is unknown on some
+	 * older ncurses implementations. Don't use it.
+	 */
+	if (p)
+	{
+		int	py, px, sy, sx, oy, ox;
+		int fix_y, fix_x;
+
+		getbegyx(p, py, px);
+		getbegyx(s, sy, sx);
+		getparyx(s, oy, ox);
+
+		fix_y = sy - (py + oy);
+		fix_x = sx - (px + ox);
+
+		*y += fix_y;
+		*x += fix_x;
+	}
+}
+
+/*
+ * It is correction for window begxy, begx when panel contained
+ * this window was moved.
+ */
+static void
+subtract_correction(WINDOW *s, int *y, int *x)
+{
+	WINDOW *p = wgetparent(s);
+	/*
+	 * Note: function is_subwin is unknown on some
+	 * older ncurses implementations. Don't use it.
+	 */
+	if (p)
+	{
+		int	py, px, sy, sx, oy, ox;
+		int fix_y, fix_x;
+
+		getbegyx(p, py, px);
+		getbegyx(s, sy, sx);
+		getparyx(s, oy, ox);
+
+		fix_y = sy - (py + oy);
+		fix_x = sx - (px + ox);
+
+		*y -= fix_y;
+		*x -= fix_x;
+	}
+}
+
+/*
+ * Returns length of prefix when str starts with one of prefixes
+ * (case insensitive), else returns 0.
+ */
+static int
+shortcut_prefix(const char *str, const char **prefixes)
+{
+	while (*prefixes)
+	{
+		size_t	length = strlen(*prefixes);
+
+		if (strncasecmp(str, *prefixes, length) == 0 && str[length] != '\0')
+			return length;
+
+		prefixes += 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse text of shortcut like "^S", "F2", "M-x", "Alt+Del", "Ctrl+Shift+K"
+ * to code of key and alt flag. Returns false for shortcuts that cannot be
+ * handled by driver (key sequences like "C-x q", unknown names, printable
+ * chars without Alt).
+ */
+static bool
+parse_shortcut(const char *str, int *c, bool *alt)
+{
+	static const char *ctrl_prefixes[] = {"Ctrl+", "Ctrl-", "C-", NULL};
+	static const char *alt_prefixes[] = {"Alt+", "Alt-", "M-", NULL};
+	static const char *shift_prefixes[] = {"Shift+", "Shift-", "S-", NULL};
+	static const struct
+	{
+		const char *name;
+		int		key;
+		int		shift_key;
+	} names[] = {
+		{"Space", ' ', 0},
+		{"Tab", '\t', KEY_BTAB},
+		{"Enter", 10, 0},
+		{"Backspace", KEY_BACKSPACE, 0},
+		{"Ins", KEY_IC, KEY_SIC},
+		{"Insert", KEY_IC, KEY_SIC},
+		{"Del", KEY_DC, KEY_SDC},
+		{"Delete", KEY_DC, KEY_SDC},
+		{"Home", KEY_HOME, KEY_SHOME},
+		{"End", KEY_END, KEY_SEND},
+		{"PgUp", KEY_PPAGE, KEY_SPREVIOUS},
+		{"PageUp", KEY_PPAGE, KEY_SPREVIOUS},
+		{"PgDn", KEY_NPAGE, KEY_SNEXT},
+		{"PageDown", KEY_NPAGE, KEY_SNEXT},
+		{"Up", KEY_UP, 0},
+		{"Down", KEY_DOWN, 0},
+		{"Left", KEY_LEFT, KEY_SLEFT},
+		{"Right", KEY_RIGHT, KEY_SRIGHT},
+		{NULL, 0, 0}
+	};
+	bool	ctrl = false;
+	bool	shift = false;
+	int		length;
+	int		i;
+
+	*alt = false;
+
+	if (!str)
+		return false;
+
+	if (str[0] == '^' && str[1] != '\0')
+	{
+		ctrl = true;
+		str += 1;
+	}
+
+	while (true)
+	{
+		if ((length = shortcut_prefix(str, ctrl_prefixes)) > 0)
+			ctrl = true;
+		else if ((length = shortcut_prefix(str, alt_prefixes)) > 0)
+			*alt = true;
+		else if ((length = shortcut_prefix(str, shift_prefixes)) > 0)
+			shift = true;
+		else
+			break;
+
+		str += length;
+	}
+
+	/* function keys, modifiers are mapped like ncurses does */
+	if ((str[0] == 'F' || str[0] == 'f') && isdigit((unsigned char) str[1]))
+	{
+		char   *endptr;
+		long	fkey = strtol(str + 1, &endptr, 10);
+
+		if (*endptr != '\0' || fkey < 1 || fkey > ST_CMDBAR_MAX_FKEY)
+			return false;
+
+		if (ctrl || shift)
+		{
+			if (fkey > 12)
+				return false;
+
+			fkey += (shift ? 12 : 0) + (ctrl ? 24 : 0);
+		}
+
+		*c = KEY_F(fkey);
+		return true;
+	}
+
+	/* single ASCII char */
+	if (str[0] != '\0' && str[1] == '\0' && (unsigned char) str[0] < 128)
+	{
+		int		ch = (unsigned char) str[0];
+
+		if (ctrl)
+		{
+			/* terminal doesn't distinguish Ctrl+K and Ctrl+Shift+K */
+			ch = toupper(ch);
+			if (ch < '@' || ch > '_')
+				return false;
+
+			*c = ch & 0x1f;
+		}
+		else if (!*alt && isprint(ch))
+		{
+			/* printable chars without Alt are never dispatched */
+			return false;
+		}
+		else
+			*c = shift ? toupper(ch) : ch;
+
+		return true;
+	}
+
+	for (i = 0; names[i].name; i++)
+	{
+		if (strcasecmp(str, names[i].name) == 0)
+		{
+			if (ctrl && names[i].key == ' ')
+				*c = 0;
+			else if (ctrl)
+				return false;
+			else if (shift)
+			{
+				if (!names[i].shift_key)
+					return false;
+
+				*c = names[i].shift_key;
+			}
+			else
+				*c = names[i].key;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static inline unsigned int
+shortcut_hash(int key, int size)
+{
+	return ((unsigned int) key * 2654435761u) & (size - 1);
+}
+
+static int
+shortcuts_count(struct ST_MENU *menu)
+{
+	int		count = 0;
+	int		i;
+
+	for (i = 0; i < menu->nitems; i++)
+	{
+		if (menu->menu_items[i].shortcut)
+			count += 1;
+
+		if (menu->submenus[i])
+			count += shortcuts_count(menu->submenus[i]);
+	}
+
+	return count;
+}
+
+/*
+ * Add shortcuts of menu and its submenus to hash table. Items with same
+ * shortcut are stored in order of menu tree, so first accessible item
+ * is found first.
+ */
+static void
+shortcuts_add(ST_MENU_SHORTCUT *shortcuts, int size, struct ST_MENU *menu)
+{
+	int		i;
+
+	for (i = 0; i < menu->nitems; i++)
+	{
+		int		c;
+		bool	alt;
+
+		if (parse_shortcut(menu->menu_items[i].shortcut, &c, &alt))
+		{
+			int		key = (c << 1) | (alt ? 1 : 0);
+			unsigned int h = shortcut_hash(key, size);
+
+			while (shortcuts[h].key != -1)
+				h = (h + 1) & (size - 1);
+
+			shortcuts[h].key = key;
+			shortcuts[h].menu = menu;
+			shortcuts[h].offset = i;
+		}
+
+		if (menu->submenus[i])
+			shortcuts_add(shortcuts, size, menu->submenus[i]);
+	}
+}
+
+/*
+ * Build hash table of shortcuts of whole menu tree. It is called for top
+ * menu when menu is created, and before dispatching, when some item or
+ * shortcut was changed.
+ */
+static void
+shortcuts_build(struct ST_MENU *menu)
+{
+	int		count;
+	int		size = 16;
+	int		i;
+
+	free(menu->shortcuts);
+	menu->shortcuts = NULL;
+	menu->shortcuts_size = 0;
+	menu->shortcuts_is_valid = true;
+
+	count = shortcuts_count(menu);
+	if (count == 0)
+		return;
+
+	/* load factor is less than 0.5 */
+	while (size < count * 2)
+		size <<= 1;
+
+	menu->shortcuts = safe_malloc(sizeof(ST_MENU_SHORTCUT) * size);
+	menu->shortcuts_size = size;
+
+	for (i = 0; i < size; i++)
+		menu->shortcuts[i].key = -1;
+
+	shortcuts_add(menu->shortcuts, size, menu);
+}
+
+/*
+ * Item is not accessible, when it or some parent item is disabled
+ */
+static bool
+item_is_accessible(struct ST_MENU *menu, int offset)
+{
+	while (menu)
+	{
+		if (menu->options[offset] & ST_MENU_OPTION_DISABLED)
+			return false;
+
+		offset = menu->parent_offset;
+		menu = menu->parent_menu;
+	}
+
+	return true;
+}
+
+/*
+ * Select and activate item, that is not displayed (it is used for shortcuts
+ * and command palette).
+ */
+static bool
+item_activate(struct ST_MENU *menu, int offset)
+{
+	if (!item_is_accessible(menu, offset))
+		return false;
+
+	selected_item = &menu->menu_items[offset];
+	selected_options = menu->options[offset];
+	selected_refval = menu->refvals[offset];
+	press_shortcut = true;
+
+	return true;
+}
+
+/*
+ * Search accessible menu item with shortcut for pressed key. When it is
+ * found, then it is selected and activated. Shortcuts should be enabled,
+ * and they are processed like accelerators - in full focus, or with Alt
+ * in ST_MENU_FOCUS_ALT_MOUSE focus. Printable chars without Alt are never
+ * used, so they cannot be taken from application.
+ */
+static bool
+shortcut_dispatch(struct ST_MENU *menu, int c, bool alt)
+{
+	int		key = (c << 1) | (alt ? 1 : 0);
+	unsigned int h;
+
+	if (!menu->shortcuts_enabled || c < 0)
+		return false;
+
+	if (!menu->shortcuts_is_valid)
+		shortcuts_build(menu);
+
+	if (!menu->shortcuts)
+		return false;
+
+	if (!(menu->focus == ST_MENU_FOCUS_FULL ||
+		  (menu->focus == ST_MENU_FOCUS_ALT_MOUSE && alt)))
+		return false;
+
+	/* the codes of function keys can be same like codes of some wide chars */
+	if (!alt && c >= 32 && (c < KEY_MIN || c > KEY_MAX) && iswprint(c))
+		return false;
+
+	h = shortcut_hash(key, menu->shortcuts_size);
+
+	while (menu->shortcuts[h].key != -1)
+	{
+		if (menu->shortcuts[h].key == key)
+		{
+			ST_MENU_SHORTCUT *shortcut = &menu->shortcuts[h];
+
+			/* when item is disabled, then next item with same shortcut is used */
+			if (item_activate(shortcut->menu, shortcut->offset))
+				return true;
+		}
+
+		h = (h + 1) & (menu->shortcuts_size - 1);
+	}
+
+	return false;
+}
+
+/*
+ * Postprocess for referenced values - the value is changed, when item
+ * with referenced option was activated.
+ */
+static void
+selected_refval_update(void)
+{
+	if (selected_item && (press_accelerator || press_enter || button1_clicked || press_shortcut))
+	{
+		if (IS_REF_OPTION(selected_options))
+		{
+			if (selected_refval == NULL)
+			{
+				endwin();
+				fprintf(stderr, "detected referenced option without referenced value");
+				exit(1);
+			}
+
+			if (selected_options & ST_MENU_OPTION_MARKED_REF)
+			{
+				*selected_refval = selected_item->data;
+			}
+			else if ((selected_options & ST_MENU_OPTION_SWITCH2_REF) ||
+					 (selected_options & ST_MENU_OPTION_SWITCH3_REF))
+			{
+				*selected_refval = (*selected_refval == 1) ? 0 : 1;
+			}
+		}
+	}
+}
+
+/*
+ * Handle any outer event - pressed key, or mouse event. The shortcuts
+ * are resolved by top object, when event is not processed by menu.
+ * is_top is true, when _st_menu_driver is called first time, when
+ * it is called recursivly, then it is false. Only in top call, the
+ * draw routines can be called.
+ * when unpost_submenu is true, then driver should to unpost active
+ * subwindow of current menu. This info is propagated back - the nested
+ * element tell to owner, close me.
+ */
+static bool
+_st_menu_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent,
+					bool is_top, bool is_nested_pulldown,
+					bool *unpost_submenu)
+{
+	ST_MENU_CONFIG	*config;
+
+	int		cursor_row;				/* number of active menu item */
+	bool	is_menubar;				/* true, when processed object is menu bar */
+	int		first_row = -1;			/* number of row of first enabled item */
+	int		last_row = -1;			/* last menu item */
+	int		mouse_row = -1;			/* item number selected by mouse */
+	int		search_row = -1;		/* code menu selected by accelerator */
+	bool	found_row = false;		/* we found new active menu item (row var will be valid) */
+	bool	post_menu = false;			/* when it is true, then assiciated pulldown menu will be posted */
+	int		row;
+	bool	processed = false;
+	ST_MENU_ITEM	   *menu_items;
+	ST_MENU_FILTER_MATCH *matches = NULL;	/* matched items, when filter is active */
+	int		nrows;
+	int		v;
+
+	/* reset globals */
+	selected_item = NULL;
+	press_accelerator = false;
+	press_enter = false;
+	button1_clicked = false;
+	press_shortcut = false;
+
+	*unpost_submenu = false;
+
+	/* maybe only cmdbar is used */
+	if (!menu)
+		goto post_process;
+
+	config = menu->config;
+	cursor_row = menu->cursor_row;		/* number of active menu item */
+	is_menubar = menu->is_menubar;		/* true, when processed object is menu bar */
+
+	/* Focus filter */
+	if ((menu->focus == ST_MENU_FOCUS_MOUSE_ONLY && c != KEY_MOUSE) ||
+		(menu->focus == ST_MENU_FOCUS_ALT_MOUSE && c != KEY_MOUSE && !alt) ||
+		(menu->focus == ST_MENU_FOCUS_NONE))
+		goto post_process;
+
+#if NCURSES_MOUSE_VERSION > 1
+
+	/* use mouse wheel only with FULL FOCUS */
+	if (c == KEY_MOUSE &&
+		(mevent->bstate & BUTTON4_PRESSED || mevent->bstate & BUTTON5_PRESSED) &&
+		menu->focus != ST_MENU_FOCUS_FULL)
+		goto post_process;
+
+#endif
+
+	/*
+	 * Propagate event to nested active object first. When nested object would be
+	 * closed, close it. When nested object read event, go to end
+	 */
+	if (menu->active_submenu)
+	{
+		bool	_is_nested_pulldown = is_nested_pulldown ? true : (is_menubar ? false : true);
+		bool	unpost_submenu_loc = false;
+
+		/*
+		 * Key right is used in pulldown menu for access to nested menu.
+		 * When nested menu is active already, then there is not any
+		 * work on this level. KEY_RIGHT can buble to menubar and can
+		 * be processed there.
+		 */
+		if (!is_menubar && c == KEY_RIGHT)
+			goto post_process;
+
+		/*
+		 * Submenu cannot be top object. When now is not menu bar, then now should be
+		 * pulldown menu, and nested object should be nested pulldown menu.
+		 */
+		processed = _st_menu_driver(menu->active_submenu, c, alt, mevent,
+												false, _is_nested_pulldown, &unpost_submenu_loc);
+
+		if (unpost_submenu_loc)
+		{
+			st_menu_unpost(menu->active_submenu, false);
+			menu->active_submenu = NULL;
+		}
+
+		/*
+		 * When we close some object, then we did some work on this
+		 * level, and we should not do more work here.
+		 */
+		if (processed)
+			goto post_process;
+	}
+
+	/* typed chars are appended to query of filter, escape cancels query */
+	if (menu->filter && !menu->active_submenu && filter_driver(menu, c, alt))
+	{
+		processed = true;
+		goto post_process;
+	}
+
+	nrows = is_menubar ? menu->nitems : pulldownmenu_rows(menu, &matches);
+
+	/*
+	 * Keys left and right move cursor of multi-column menu between columns.
+	 * When there is not column in this direction, or when the item under
+	 * cursor has submenu, then the keys are processed like usual.
+	 */
+	if (!is_menubar && menu->ncolumns > 1 && (c == KEY_LEFT || c == KEY_RIGHT) &&
+		pulldownmenu_column_move(menu, matches, nrows, c == KEY_RIGHT ? 1 : -1))
+	{
+		processed = true;
+		goto post_process;
+	}
+
+	/*
+	 * The checks of events, that can unpost this level menu. For unposting top
+	 * object is responsible the user.
+	 */
+	if (!is_top)
+	{
+		if (c == ST_MENU_ESCAPE)
+		{
+			*unpost_submenu = true;
+
+			/*
+			 * escape should to close all opened objects, so we cannot to
+			 * returns true (processed) due we are in top object.
+			 */
+			return false;
+		}
+
+		/*
+		 * Unpost menu (close) when mouse click outside menu window. Mouse position
+		 * event is processed specially. We want to close only submenu, or we want
+		 * to swith to other bar menu item.
+		 */
+		if (c == KEY_MOUSE &&
+			mevent->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED
+
+#if NCURSES_MOUSE_VERSION > 1
+
+							  | REPORT_MOUSE_POSITION
+
+#endif
+		  ))
+		{
+			int		y = mevent->y;
+			int		x = mevent->x;
+
+			/*
+			 * For some styles, the window is different than draw_area. The
+			 * draw_area is subwindow of window. When main window is moved
+			 * due moving panel (see adjust position), then subwindow has not
+			 * expected coordinates. Following routine calculate fix between
+			 * current draw_area coordinates and expected coordinates. Then
+			 * apply this fix on mouse position.
+			 */
+			add_correction(menu->draw_area, &y, &x);
+
+			if (!is_menubar && !wenclose(menu->draw_area, y, x))
+			{
+
+#if NCURSES_MOUSE_VERSION > 1
+
+				if (mevent->bstate & REPORT_MOUSE_POSITION)
+				{
+					/*
+					 * We want to ignore move movement outside menu's window. Without
+					 * it the behaviour is too sensitive, and it is not user friendly.
+					 * But we need to close submenus, and we want to allow usage of
+					 * bar menu. For these case we should to allow sending event to
+					 * upper objects.
+					 */
+					if (is_nested_pulldown)
+						return false;
+					else
+						/* true when we are not in menu bar position */
+						return y != 0;
+				}
+				else
+				{
+					*unpost_submenu = true;
+					return false;
+				}
+
+#else
+
+				*unpost_submenu = true;
+				return false;
+
+#endif
+
+			}
+		}
+
+		/*
+		 * Nested submenu can be unposted by pressing key left
+		 */
+		if (c == KEY_LEFT && is_nested_pulldown)
+		{
+			*unpost_submenu = true;
+			return true;
+		}
+	}
+
+	if (c == KEY_MOUSE)
+	{
+
+#if NCURSES_MOUSE_VERSION > 1
+
+		if (mevent->bstate & BUTTON5_PRESSED)
+		{
+				c = KEY_DOWN;
+		}
+		else if (mevent->bstate & BUTTON4_PRESSED)
+		{
+			c = KEY_UP;
+		}
+		else
+
+#endif
+
+		if (mevent->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED
+
+#if NCURSES_MOUSE_VERSION > 1
+
+		 | REPORT_MOUSE_POSITION
+
+#endif
+		  ))
+		{
+			if (is_menubar)
+			{
+				/*
+				 * On menubar level we can process mouse event if row is zero, or
+				 * we can check if mouse is positioned inside draw area or active
+				 * submenu. If not, then we should to unpost active submenu.
+				 */
+				if (mevent->y == 0)
+				{
+					int		i = 0;
+					int		chars_before;
+
+					/*
+					 * How much chars before active item and following item
+					 * specify range of menubar item.
+					 */
+					chars_before = (config->text_space != -1) ? (config->text_space / 2) : 1;
+
+					menu_items = menu->menu_items;
+					while (menu_items->text)
+					{
+						int		minx, maxx;
+
+						/* first menubar field get mouse from left corner */
+						minx = i > 0 ? (menu->bar_fields_x_pos[i] - chars_before) : 0;
+
+						/* last menubar field get mouse to right corner */
+						maxx = i + 1 < menu->nitems ? menu->bar_fields_x_pos[i + 1] - chars_before : mevent->x + 1;
+
+						/* transform possitions to target menu code */
+						if (mevent->x >= minx && mevent->x < maxx)
+						{
+							mouse_row = i + 1;
+							break;
+						}
+
+						menu_items += 1;
+						i = i + 1;
+					}
+				}
+			}
+			else
+			{
+				int		row_loc, col_loc;
+
+				row_loc = mevent->y;
+				col_loc = mevent->x;
+
+				/* fix mouse coordinates, if draw_area has "wrong" coordinates */
+				add_correction(menu->draw_area, &row_loc, &col_loc);
+
+				/* calculate row from transformed mouse event */
+				if (wmouse_trafo(menu->draw_area, &row_loc, &col_loc, false))
+				{
+					mouse_row = row_loc + 1 - (config->draw_box ? 1:0) + (menu->first_row - 1);
+
+					/* column of multi-column menu is calculated from x */
+					if (menu->ncolumns > 1)
+					{
+						int		x = col_loc - (config->draw_box ? 1 : 0);
+						int		column = x >= 0 ? x / menu->column_width : -1;
+
+						if (column >= 0 && column < menu->ncolumns &&
+							mouse_row >= 1 && mouse_row <= menu->column_rows)
+							mouse_row += column * menu->column_rows;
+						else
+							mouse_row = -1;
+					}
+				}
+
+				/* displayed row of filtered menu to menu item */
+				if (matches && mouse_row != -1)
+					mouse_row = mouse_row >= 1 && mouse_row <= nrows ? matches[mouse_row - 1].offset + 1 : -1;
+			}
+		}
+	}
+	else
+		/* there are no mouse event, reset prev mouse row */
+		menu->mouse_row = -1;
+
+	/*
+	 * Cursor keys of pulldown menu are processed without iteration over
+	 * items. Page up and page down move cursor and visible rows by height
+	 * of menu (or by page_step).
+	 */
+	if (!is_menubar &&
+		(c == KEY_HOME || c == KEY_END || c == KEY_UP || c == KEY_DOWN ||
+		 c == KEY_PPAGE || c == KEY_NPAGE))
+	{
+		int		step = config->page_step > 0 ? config->page_step : max_int(menu->page_rows, 1);
+		int		current;
+		int		layout_rows = menu->ncolumns > 1 ? min_int(nrows, menu->column_rows) : nrows;
+
+		if (matches)
+			current = menu->cursor_row != -1 ? filter_find_row(matches, nrows, menu->cursor_row) - 1 : -1;
+		else
+			current = menu->cursor_row - 1;
+
+		if (current < 0)
+			current = -1;
+
+		switch (c)
+		{
+			case KEY_HOME:
+				menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, 0, 1);
+				break;
+			case KEY_END:
+				menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, nrows - 1, -1);
+				break;
+			case KEY_DOWN:
+				menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, current + 1, 1);
+				if (menu->cursor_row == -1)
+					menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, 0, 1);
+				break;
+			case KEY_UP:
+				menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, current - 1, -1);
+				if (menu->cursor_row == -1)
+					menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, nrows - 1, -1);
+				break;
+			case KEY_NPAGE:
+			case KEY_PPAGE:
+				{
+					int		dir = c == KEY_NPAGE ? 1 : -1;
+					int		target = max_int(min_int(current + dir * step, nrows - 1), 0);
+
+					/* the enabled item is searched in direction of move first */
+					menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, target, dir);
+					if (menu->cursor_row == -1)
+						menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, target, -dir);
+
+					menu->first_row = max_int(min_int(menu->first_row + dir * step,
+													  layout_rows - menu->page_rows + 1), 1);
+				}
+				break;
+		}
+
+		found_row = true;
+		processed = true;
+	}
+
+	/*
+	 * Try to check if key is accelerator. This check should be on last level.
+	 * So don't do it if submenu is active.
+	 */
+	if (c != KEY_MOUSE
+			&& c != KEY_HOME && c != KEY_END
+			&& c != KEY_UP && c != KEY_DOWN
+			&& c != KEY_PPAGE && c != KEY_NPAGE
+			&& c != KEY_LEFT && c != KEY_RIGHT)
+	{
+
+		/*
+		 * accelerator can be alt accelerator for menuber or non alt, and
+		 * the menu should not to have active submenu. When menu has filter,
+		 * then chars are used for query, and only alt accelerators can be used.
+		 */
+		if ((!alt && !menu->active_submenu) ||
+				(alt && (is_menubar || (menu->filter && !menu->active_submenu))))
+		{
+			char		buffer[20];
+			char		pressed[64];
+			int			i;
+			int			l_pressed;
+
+			l_pressed = wchar_to_utf8(config, buffer, 20, (wchar_t) c);
+			buffer[l_pressed] = '\0';
+
+			TRACE(ST_MENU_TRACE_ACCEL_LOOKUP, ST_MENU_TRACE_BEGIN, c);
+
+			l_pressed = chr_casexfrm_buf(config, (char *) buffer, pressed, sizeof(pressed));
+
+			for (i = 0; i < menu->naccelerators; i++)
+			{
+				if (menu->accelerators[i].length == l_pressed &&
+					memcmp(menu->accelerators[i].c, pressed, l_pressed) == 0)
+				{
+					/* check if row is enabled */
+					search_row = menu->accelerators[i].row;
+					if (menu->options[search_row - 1] & ST_MENU_OPTION_DISABLED)
+						/* revert back, found accelerator is for disabled menu item */
+						search_row = -1;
+					else
+						break;
+				}
+			}
+
+			TRACE(ST_MENU_TRACE_ACCEL_LOOKUP, ST_MENU_TRACE_END, search_row);
+
+			/* Process key in this case only when we found accelerator */
+			if (search_row != -1)
+				processed = true;
+		}
+	}
+
+	/*
+	 * Iterate over menu items (only over matched items, when filter is active),
+	 * and try to find next or previous row, code, or mouse row.
+	 */
+	for (v = 0; !found_row && v < nrows; v++)
+	{
+		row = (matches ? matches[v].offset : v) + 1;
+		menu_items = &menu->menu_items[row - 1];
+
+		if (*menu_items->text != '\0' &&
+				(strncmp(menu_items->text, "--", 2) != 0) &&
+				((menu->options[row - 1] & ST_MENU_OPTION_DISABLED) == 0))
+		{
+			if (first_row == -1)
+				first_row = row;
+
+			if (is_menubar)
+			{
+				if (c == KEY_RIGHT && row > cursor_row) 
+				{
+					menu->cursor_row = row;
+					found_row = true;
+					processed = true;
+					break;
+				}
+				else if (c == KEY_LEFT && row == cursor_row)
+				{
+					if (last_row != -1)
+					{
+						menu->cursor_row = last_row;
+						found_row = true;
+						processed = true;
+						break;
+					}
+				}
+			}
+
+			if (mouse_row != -1 && row == mouse_row)
+			{
+				menu->cursor_row = row;
+				found_row = true;
+				processed = true;
+				post_menu = true;
+
+				if (mevent->bstate & BUTTON1_PRESSED
+
+#if NCURSES_MOUSE_VERSION > 1
+
+				|| mevent->bstate & REPORT_MOUSE_POSITION
+
+#endif
+
+				  )
+				{
+					menu->mouse_row = mouse_row;
+				}
+				else
+				{
+					/*
+					 * Fully valid release event for transformation to
+					 * clicked event is only event, when PRESSED row
+					 * and released row is same.
+					 */
+					if (mevent->bstate& BUTTON1_RELEASED &&
+							menu->mouse_row == mouse_row)
+					{
+						button1_clicked = true;
+					}
+					menu->mouse_row = -1;
+				}
+				break;
+			}
+			else if (search_row != -1 && row == search_row)
+			{
+				menu->cursor_row = row;
+				press_accelerator = true;
+
+				found_row = true;
+				post_menu = true;
+				processed = true;
+				break;
+			}
+
+			last_row = row;
+		}
+	}
+
+	/*
+	 * When rows not found, maybe we would to return back in ring
+	 * buffer of menubar items.
+	 */
+	if (!found_row && is_menubar)
+	{
+		if (c == KEY_RIGHT)
+		{
+			menu->cursor_row = first_row;
+			processed = true;
+		}
+		else if (c == KEY_LEFT)
+		{
+			menu->cursor_row = last_row;
+			processed = true;
+		}
+	}
+
+	/* when menubar is changed, unpost active pulldown submenu */
+	if (menu->active_submenu && cursor_row != menu->cursor_row)
+	{
+		st_menu_unpost(menu->active_submenu, false);
+		menu->active_submenu = NULL;
+
+		/* remember, submenu was visible */
+		post_menu = true;
+	}
+
+	/* enter has sense only on selectable menu item */
+	if ((c == 10 || c == 13) && menu->cursor_row != -1)
+		press_enter = true;
+
+	/*
+	 * Some actions can activate submenu, check it and open it, if it
+	 * is required.
+	 */
+	if (menu->cursor_row != -1 &&
+			(press_accelerator ||
+			  (c == KEY_DOWN && is_menubar) ||
+			  (c == KEY_RIGHT && !is_menubar) ||
+			  (c == 10) || (c == 13) || post_menu))
+	{
+		menu->active_submenu = menu->submenus[menu->cursor_row - 1];
+		if (menu->active_submenu)
+		{
+			/* when submenu is active, then reset accelerator and mouse flags */
+			press_accelerator = false;
+			press_enter = false;
+			button1_clicked = false;
+		}
+
+		/*
+		 * When mouse event opens or reopens submenu, then we take
+		 * this event as processed event. Valid accelerator is processed
+		 * always. Enter (c == 10) is processed always too.
+		 */
+		if (press_accelerator || c == 10 || c == 13)
+			processed = true;
+		else
+			processed = menu->active_submenu != NULL;
+	}
+
+	/*
+	 * We can set processed flag, when some mouse row was founded. That means
+	 * so mouse click was somewhere to draw area.
+	 */
+	if (mouse_row != -1)
+		processed = true;
+
+post_process:
+
+	/*
+	 * show content, only top object is can do this - nested objects
+	 * are displayed recursivly.
+	 */
+	if (is_top)
+	{
+		/* when we processed some event, then we usually got a full focus */
+		if (processed)
+			menu->focus = ST_MENU_FOCUS_FULL;
+		else
+		{
+			/*
+			 * When event was not processed by menubar, then we
+			 * we can try to sent it to command bar. But with
+			 * full focus, the menubar is hungry, and we send nothing.
+			 */
+			if (active_cmdbar)
+			{
+				if (!menu || menu->focus != ST_MENU_FOCUS_FULL)
+					processed = cmdbar_driver(active_cmdbar, c, alt, mevent);
+			}
+
+			/*
+			 * Global shortcuts are used after command bar, and they
+			 * don't change focus.
+			 */
+			if (!processed && menu && c != KEY_MOUSE)
+				processed = shortcut_dispatch(menu, c, alt);
+		}
+
+		if (processed && !press_shortcut)
+		{
+			/* try to search selected item */
+			if (menu)
+				searching_selected_refval_items(menu);
+		}
+
+		selected_refval_update();
+
+		/*
+		 * command bar should be drawed first - because it is deeper
+		 * than pulldown menu
+		 */
+		if (active_cmdbar)
+			cmdbar_update(active_cmdbar);
+
+		if (menu)
+		{
+			ST_MENU_ITEM *shortcut_item = selected_item;
+
+			if (menu->is_menubar)
+				menubar_draw(menu);
+			else
+				pulldownmenu_draw(menu, true);
+
+			/* draw routines set selected item to item under cursor */
+			if (press_shortcut)
+				selected_item = shortcut_item;
+
+			/* eat all keyboard input, when focus is full on top level */
+			if (c != KEY_MOUSE && c != KEY_RESIZE &&
+					c != ST_MENU_ESCAPE &&
+					menu->focus == ST_MENU_FOCUS_FULL)
+				processed = true;
+		}
+	}
+
+	return processed;
+}
+
+/*
+ * Pushed items of deferred submenus are applied before processing of
+ * event (they are drawn by driver), and deferred submenus opened by
+ * the event are filled after.
+ */
+static bool
+menu_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent)
+{
+	bool		aux_unpost_submenu = false;
+	bool		result;
+
+	if (loading_menus)
+		loading_menus_drain();
+
+	/* posted command palette is modal */
+	if (menu && menu->palette && menu->palette->is_posted && c != KEY_RESIZE)
+		result = palette_driver(menu, c, alt, mevent);
+	else
+	{
+		result = _st_menu_driver(menu, c, alt, mevent, true, false, &aux_unpost_submenu);
+
+		/* the palette stays over menu redrawn after resize */
+		if (menu && menu->palette && menu->palette->is_posted)
+			palette_draw(menu);
+	}
+
+	if (menu)
+		menu_process_pending(menu);
+
+	return result;
+}
+
+bool
+st_menu_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent)
+{
+	bool		result;
+
+	if (record_fp)
+		record_event(c, alt, mevent);
+
+	TRACE(ST_MENU_TRACE_DRIVER, ST_MENU_TRACE_BEGIN, c);
+	TRACE_COUNT(driver_calls, 1);
+
+	/*
+	 * We should to complete mouse click based on two
+	 * events. Mouse click is valid if press, release
+	 * was related with same command. Now, when mouse
+	 * is pressed, we don't know a related object, but
+	 * we can reset selected_command variable.
+	 */
+	if (c != KEY_MOUSE || mevent->bstate & BUTTON1_PRESSED)
+	{
+		selected_command = NULL;
+		command_was_activated = false;
+	}
+
+	/*
+	 * We would to close pulldown menus on F10 key - similar behave
+	 * like SCAPE, so we can translate F10 event to ST_MENU_ESCAPE,
+	 * when menubar can accept these keys (based on focus).
+	 */
+	if (menu && KEY_F(10) == c && menu->focus == ST_MENU_FOCUS_FULL)
+		c = ST_MENU_ESCAPE;
+
+	if (stats_counter)
+	{
+		long	start_bytes;
+
+		/* pending changes of application are not counted */
+		stats_flush(-1);
+		start_bytes = stats_last_bytes;
+
+		result = menu_driver(menu, c, alt, mevent);
+
+		/* driver's bytes are bytes of all nested draw functions */
+		stats_flush(-1);
+		stats_last_bytes = start_bytes;
+		stats_flush(ST_MENU_STATS_DRIVER);
+	}
+	else
+		result = menu_driver(menu, c, alt, mevent);
+
+	TRACE(ST_MENU_TRACE_DRIVER, ST_MENU_TRACE_END, result);
+
+	return result;
+}
+
+/*
+ * Returns fingerprint of config fields (with language and encoding) that has
+ * impact on layout of menu and on case folded accelerators. Precompiled layout can be used only
+ * with config with same fingerprint.
+ */
+static unsigned int
+config_fingerprint(ST_MENU_CONFIG *config)
+{
+	int		values[] = {
+		config->force8bit,
+		config->wide_vborders,
+		config->wide_hborders,
+		config->draw_box,
+		config->left_alligned_shortcuts,
+		config->extra_inner_space,
+		config->text_space,
+		config->init_text_space,
+		config->menu_bar_menu_offset,
+		config->extern_accel_text_space,
+		config->submenu_offset_y,
+		config->submenu_offset_x,
+		config->max_rows
+	};
+	unsigned int hash = 2166136261u;
+	const char *str;
+	size_t	i;
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(values) / sizeof(int); i++)
+	{
+		hash ^= (unsigned int) values[i];
+		hash *= 16777619u;
+	}
+
+	for (str = config->language; str && *str; str++)
+	{
+		hash ^= (unsigned char) *str;
+		hash *= 16777619u;
+	}
+
+	/* encoding has impact on widths of chars, separator keeps fields distinct */
+	hash ^= 0xffu;
+	hash *= 16777619u;
+
+	for (str = config->encoding; str && *str; str++)
+	{
+		hash ^= (unsigned char) *str;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+ * Returns ideal position of submenu of item on position i. The submenu
+ * of pulldown menu is displayed right of item, the submenu of menubar
+ * is displayed under field.
+ */
+static void
+submenu_position(struct ST_MENU *menu, int i, int *y, int *x)
+{
+	ST_MENU_CONFIG *config = menu->submenu_config;
+
+	if (menu->is_menubar)
+	{
+		*y = 1;
+		*x = menu->bar_fields_x_pos[i] + config->menu_bar_menu_offset
+										- (config->draw_box ? 1 : 0)
+										- (config->wide_vborders ? 1 : 0)
+										- (config->extra_inner_space ? 1 : 0) - 1;
+	}
+	else
+	{
+		*y = menu->ideal_y_pos + i + config->submenu_offset_y
+										+ (config->draw_box ? 1 : 0)
+										+ (config->wide_vborders ? 1 : 0);
+		*x = menu->ideal_x_pos + menu->cols + config->submenu_offset_x;
+
+		/* submenu of item of multi-column menu is right of column of item */
+		if (menu->ncolumns > 1)
+		{
+			*y -= i - i % menu->column_rows;
+			*x -= (menu->ncolumns - 1 - i / menu->column_rows) * menu->column_width;
+		}
+	}
+}
+
+/*
+ * Create windows and panels of pulldown menu for current dimensions
+ * and ideal position of menu. The panels are hidden.
+ */
+static void
+pulldownmenu_new_windows(struct ST_MENU *menu)
+{
+	ST_MENU_CONFIG *config = menu->config;
+	int		adjusted_rows, adjusted_cols;
+	int		adjusted_begin_y, adjusted_begin_x;
+	int		adjusted_shadow_rows, adjusted_shadow_cols;
+	int		adjusted_shadow_begin_y, adjusted_shadow_begin_x;
+
+	/*
+	 * We try to corect dimensions of windows, because pdcurses doesn't allow
+	 * parts of window to be out of screen.
+	 */
+	adjust_dimensions(menu->rows, menu->cols, menu->ideal_y_pos, menu->ideal_x_pos,
+					  1, 0, config->shadow_width,
+					  &adjusted_rows, &adjusted_cols,
+					  &adjusted_begin_y, &adjusted_begin_x,
+					  &adjusted_shadow_rows, &adjusted_shadow_cols,
+					  &adjusted_shadow_begin_y, &adjusted_shadow_begin_x);
+
+	/* Prepare property for menu shadow */
+	if (config->shadow_width > 0)
+	{
+		menu->shadow_window = newwin(adjusted_shadow_rows, adjusted_shadow_cols,
+									 adjusted_shadow_begin_y, adjusted_shadow_begin_x);
+		menu->shadow_panel = new_panel(menu->shadow_window);
+		TRACE_COUNT(windows, 1);
+
+		hide_panel(menu->shadow_panel);
+		wbkgd(menu->shadow_window, COLOR_PAIR(config->menu_shadow_cpn) | config->menu_shadow_attr);
+
+		wnoutrefresh(menu->shadow_window);
+	}
+	else
+	{
+		menu->shadow_window = NULL;
+		menu->shadow_panel = NULL;
+	}
+
+	menu->window = newwin(adjusted_rows, adjusted_cols, adjusted_begin_y, adjusted_begin_x);
+	TRACE_COUNT(windows, 1);
+
+	wbkgd(menu->window, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
+	wnoutrefresh(menu->window);
+
+	menu->clip_area = NULL;
+
+	/* draw area can be same like window or smaller */
+	if (config->wide_vborders || config->wide_hborders)
+	{
+		menu->draw_area = derwin(menu->window,
+			adjusted_rows - (config->wide_hborders ? 2 : 0),
+			adjusted_cols - (config->wide_vborders ? 2 : 0),
+			config->wide_hborders ? 1 : 0,
+			config->wide_vborders ? 1 : 0);
+		TRACE_COUNT(windows, 1);
+
+		wbkgd(menu->draw_area, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
+
+		wnoutrefresh(menu->draw_area);
+	}
+	else
+		menu->draw_area = menu->window;
+
+	menu->panel = new_panel(menu->window);
+	hide_panel(menu->panel);
+}
+
+/*
+ * Remove windows and panels of menu
+ */
+static void
+menu_free_windows(struct ST_MENU *menu)
+{
+	if (menu->shadow_panel)
+		del_panel(menu->shadow_panel);
+	if (menu->shadow_window)
+		delwin(menu->shadow_window);
+
+	del_panel(menu->panel);
+
+	/* pdcurses doesn't like deleting window with subwindows */
+	if (menu->clip_area)
+		delwin(menu->clip_area);
+	if (menu->window != menu->draw_area && menu->draw_area)
+		delwin(menu->draw_area);
+
+	delwin(menu->window);
+
+	menu->shadow_panel = NULL;
+	menu->shadow_window = NULL;
+	menu->panel = NULL;
+	menu->clip_area = NULL;
+	menu->draw_area = NULL;
+	menu->window = NULL;
+}
+
+/*
+ * Create state variable for pulldown menu. It based on template - a array of ST_MENU_ITEM fields.
+ * The initial position can be specified. The config (specify desplay properties) should be
+ * passed. The config can be own or preloaded from preddefined styles by function st_menu_load_style.
+ * a title is not supported yet. When precompiled layout is passed, and it was generated for
+ * same config, then the layout is not calculated.
+ */
+static struct ST_MENU *
+pulldownmenu_new(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items, int begin_y, int begin_x, char *title,
+				 ST_MENU_PRECOMPILED *precompiled)
+{
+	struct ST_MENU *menu;
+	int		rows, cols;
+	ST_MENU_ITEM *menu_item;
+	int		menu_fields = 0;
+	int		i;
+
+	TRACE(ST_MENU_TRACE_MENU_NEW, ST_MENU_TRACE_BEGIN, 0);
+
+	menu = safe_malloc(sizeof(struct ST_MENU));
+
+	/* precompiled layout can be used only for same config */
+	if (precompiled && precompiled->config_hash != config_fingerprint(config))
+		precompiled = NULL;
+
+	if (precompiled)
+		menu_items = precompiled->menu_items;
+
+	menu->menu_items = menu_items;
+	menu->config = config;
+	menu->submenu_config = config;
+	menu->title = title;
+	menu->naccelerators = 0;
+	menu->is_menubar = false;
+	menu->is_precompiled = precompiled != NULL;
+	menu->mouse_row = -1;
+	menu->first_row = 1;
+
+	if (precompiled)
+		menu_fields = precompiled->nitems;
+	else
+	{
+		/* how much items are in template */
+		menu_item = menu_items;
+		while (menu_item->text != NULL)
+		{
+			menu_fields += 1;
+			menu_item += 1;
+		}
+	}
+
+	/* preallocate good enough memory */
+	menu->submenus = safe_malloc(sizeof(struct ST_MENU) * menu_fields);
+	menu->options = safe_malloc(sizeof(int) * menu_fields);
+	menu->refvals = safe_malloc(sizeof(int*) * menu_fields);
+
+	menu->nitems = menu_fields;
+	menu->labels = labels_decode(config, menu_items, menu_fields, false);
+
+	if (precompiled)
+	{
+		rows = precompiled->rows;
+		cols = precompiled->cols;
+		begin_y = precompiled->begin_y;
+		begin_x = precompiled->begin_x;
+
+		menu->shortcut_x_pos = precompiled->shortcut_x_pos;
+		menu->item_x_pos = precompiled->item_x_pos;
+		menu->cursor_row = precompiled->cursor_row;
+		menu->accelerators = precompiled->accelerators;
+		menu->naccelerators = precompiled->naccelerators;
+	}
+	else
+	{
+		menu->accelerators = safe_malloc(sizeof(ST_MENU_ACCELERATOR) * menu_fields);
+
+		/* get pull down menu dimensions */
+		pulldownmenu_content_size(config, menu_items, menu->labels, &rows, &cols,
+								&menu->shortcut_x_pos, &menu->item_x_pos,
+								menu->accelerators, &menu->naccelerators,
+								&menu->cursor_row);
+
+		if (config->draw_box)
+		{
+			rows += 2;
+			cols += 2;
+		}
+
+		if (config->wide_vborders)
+			cols += 2;
+		if (config->wide_hborders)
+			rows += 2;
+	}
+
+	menu->ideal_y_pos = begin_y;
+	menu->ideal_x_pos = begin_x;
+	menu->rows = rows;
+	menu->cols = cols;
+
+	pulldownmenu_set_columns(menu);
+
+	/*
+	 * Initialize submenu states (nested submenus)
+	 */
+	menu_item = menu_items;
+	i = 0;
+	while (menu_item->text)
+	{
+		if (menu_item->submenu)
+		{
+			int		submenu_y, submenu_x;
+
+			submenu_position(menu, i, &submenu_y, &submenu_x);
+
+			menu->submenus[i] = 
+					pulldownmenu_new(config, menu_item->submenu,
+										submenu_y, submenu_x, NULL,
+										precompiled ? precompiled->submenus[i] : NULL);
+
+			menu->submenus[i]->parent_menu = menu;
+			menu->submenus[i]->parent_offset = i;
+		}
+		else
+			menu->submenus[i] = NULL;
+
+		menu->options[i] = menu_item->options;
+		menu->refvals[i] = NULL;
+
+		menu_item += 1;
+		i += 1;
+	}
+
+	pulldownmenu_new_windows(menu);
+
+	TRACE(ST_MENU_TRACE_MENU_NEW, ST_MENU_TRACE_END, menu_fields);
+
+	return menu;
+}
+
+struct ST_MENU *
+st_menu_new(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items, int begin_y, int begin_x, char *title)
+{
+	struct ST_MENU *menu;
+
+	menu = pulldownmenu_new(config, menu_items, begin_y, begin_x, title, NULL);
+	shortcuts_build(menu);
+
+	return menu;
+}
+
+/*
+ * Calculate x positions of menubar fields. The position after last field
+ * is stored too.
+ */
+static void
+menubar_fields_positions(ST_MENU_CONFIG *barcfg, ST_MENU_LABEL *labels, int nitems,
+						 int maxx, int *bar_fields_x_pos)
+{
+	int		aux_width = 0;
+	int		text_space;
+	int		current_pos;
+	int		i;
+
+	for (i = 0; i < nitems; i++)
+		aux_width += labels[i].width;
+
+	/*
+	 * When text_space is not defined, then try to vallign menu items
+	 */
+	if (barcfg->text_space == -1)
+	{
+		text_space = (maxx + 1 - aux_width) / (nitems + 1);
+		if (text_space < 4)
+			text_space = 4;
+		else if (text_space > 15)
+			text_space = 15;
+		current_pos = text_space;
+	}
+	else
+	{
+		text_space = barcfg->text_space;
+		current_pos = barcfg->init_text_space;
+	}
+
+	for (i = 0; i < nitems; i++)
+	{
+		bar_fields_x_pos[i] = current_pos;
+		current_pos += labels[i].width;
+		current_pos += text_space;
+	}
+
+	/* store hypotetical x bar position */
+	bar_fields_x_pos[nitems] = current_pos;
+}
+
+/*
+ * Create state variable for menubar based on template (array) of ST_MENU_ITEM
+ * or on precompiled layout.
+ */
+static struct ST_MENU *
+menubar_new(ST_MENU_CONFIG *barcfg, ST_MENU_CONFIG *pdcfg, ST_MENU_ITEM *menu_items,
+			ST_MENU_PRECOMPILED *precompiled)
+{
+	struct ST_MENU *menu;
+	int		maxy, maxx;
+	ST_MENU_ITEM *menu_item;
+	int		menu_fields = 0;
+	int		i = 0;
+	int		naccel = 0;
+
+	if (pdcfg == NULL)
+		pdcfg = barcfg;
+
+	TRACE(ST_MENU_TRACE_MENU_NEW, ST_MENU_TRACE_BEGIN, 1);
+
+	getmaxyx(stdscr, maxy, maxx);
+
+	/*
+	 * precompiled layout can be used only for same config, and when
+	 * spaces are dynamic, for same width of screen.
+	 */
+	if (precompiled &&
+		(precompiled->config_hash != config_fingerprint(barcfg) ||
+		 !precompiled->bar_fields_x_pos ||
+		 (precompiled->screen_cols != 0 && precompiled->screen_cols != maxx)))
+		precompiled = NULL;
+
+	if (precompiled)
+		menu_items = precompiled->menu_items;
+
+	menu = safe_malloc(sizeof(struct ST_MENU));
+
+	maxy = 1;
+	menu->window = newwin(maxy, maxx, 0, 0);
+	menu->panel = new_panel(menu->window);
+	TRACE_COUNT(windows, 1);
+	menu->clip_area = NULL;
+
+	/* there are not shadows */
+	menu->shadow_window = NULL;
+	menu->shadow_panel = NULL;
+
+	menu->config = barcfg;
+	menu->submenu_config = pdcfg;
+	menu->menu_items = menu_items;
+	menu->cursor_row = 1;
+	menu->first_row = 1;
+	menu->active_submenu = NULL;
+
+	menu->is_menubar = true;
+	menu->is_precompiled = precompiled != NULL;
+	menu->mouse_row = -1;
+
+	wbkgd(menu->window, COLOR_PAIR(barcfg->menu_background_cpn) | barcfg->menu_background_attr);
+
+	if (precompiled)
+		menu_fields = precompiled->nitems;
+	else
+	{
+		menu_item = menu_items;
+		while (menu_item->text)
+		{
+			menu_fields += 1;
+			menu_item += 1;
+		}
+	}
+
+	menu->labels = labels_decode(barcfg, menu_items, menu_fields, true);
+
+	menu->submenus = safe_malloc(sizeof(struct ST_MENU) * menu_fields);
+	menu->options = safe_malloc(sizeof(int) * menu_fields);
+	menu->refvals = safe_malloc(sizeof(int*) * menu_fields);
+
+	menu->nitems = menu_fields; 
+
+	if (precompiled)
+	{
+		menu->bar_fields_x_pos = precompiled->bar_fields_x_pos;
+		menu->accelerators = precompiled->accelerators;
+		menu->naccelerators = precompiled->naccelerators;
+	}
+	else
+	{
+		/*
+		 * last bar position is hypotetical - we should not to calculate length of last field
+		 * every time.
+		 */
+		menu->bar_fields_x_pos = safe_malloc(sizeof(int) * (menu_fields + 1));
+		menu->accelerators = safe_malloc(sizeof(ST_MENU_ACCELERATOR) * menu_fields);
+
+		menubar_fields_positions(barcfg, menu->labels, menu_fields, maxx, menu->bar_fields_x_pos);
+	}
+
+	/* Initialize submenu */
+	menu_item = menu_items; i = 0;
+	while (menu_item->text)
+	{
+		ST_MENU_LABEL *label = &menu->labels[i];
+
+		if (!precompiled)
+		{
+			if (label->accel_offset != -1)
+			{
+				menu->accelerators[naccel].c = chr_casexfrm(barcfg, menu_item->text + label->accel_offset);
+				menu->accelerators[naccel].length = strlen(menu->accelerators[naccel].c);
+				menu->accelerators[naccel++].row = i + 1;
+			}
+
+			menu->naccelerators = naccel;
+		}
+
+		if (menu_item->submenu)
+		{
+			int		submenu_y, submenu_x;
+
+			submenu_position(menu, i, &submenu_y, &submenu_x);
+
+			menu->submenus[i] = 
+					pulldownmenu_new(pdcfg, menu_item->submenu,
+										submenu_y, submenu_x, NULL,
+										precompiled ? precompiled->submenus[i] : NULL);
+
+			menu->submenus[i]->parent_menu = menu;
+			menu->submenus[i]->parent_offset = i;
+		}
+		else
+			menu->submenus[i] = NULL;
+
+		menu->options[i] = menu_item->options;
+		menu->refvals[i] = NULL;
+
+		menu_item += 1;
+		i += 1;
+	}
+
+	TRACE(ST_MENU_TRACE_MENU_NEW, ST_MENU_TRACE_END, menu_fields);
+
+	return menu;
+}
+
+struct ST_MENU *
+st_menu_new_menubar2(ST_MENU_CONFIG *barcfg, ST_MENU_CONFIG *pdcfg, ST_MENU_ITEM *menu_items)
+{
+	struct ST_MENU *menu;
+
+	menu = menubar_new(barcfg, pdcfg, menu_items, NULL);
+	shortcuts_build(menu);
+
+	return menu;
+}
+
+struct ST_MENU *
+st_menu_new_menubar(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items)
+{
+	return st_menu_new_menubar2(config, NULL, menu_items);
+}
+
+/*
+ * Create menubar or pulldown menu from tables generated by st_menu_write_precompiled.
+ * When the tables were generated for different config (or different width of screen
+ * for menubar with dynamic spaces), then the layout is calculated from menu items.
+ */
+struct ST_MENU *
+st_menu_new_precompiled(ST_MENU_CONFIG *barcfg, ST_MENU_CONFIG *pdcfg, ST_MENU_PRECOMPILED *precompiled)
+{
+	struct ST_MENU *menu;
+
+	if (precompiled->bar_fields_x_pos)
+		menu = menubar_new(barcfg, pdcfg, precompiled->menu_items, precompiled);
+	else
+		menu = pulldownmenu_new(pdcfg ? pdcfg : barcfg, precompiled->menu_items,
+								precompiled->begin_y, precompiled->begin_x, NULL,
+								precompiled);
+
+	shortcuts_build(menu);
+
+	return menu;
+}
+
+/*
+ * Write string as C string literal. Non ASCII chars are escaped.
+ */
+static void
+write_c_string(FILE *fp, const char *str, int length)
+{
+	int		i;
+
+	if (!str)
+	{
+		fputs("NULL", fp);
+		return;
+	}
+
+	fputc('"', fp);
+
+	for (i = 0; i < length; i++)
+	{
+		unsigned char c = (unsigned char) str[i];
+
+		/* ? is escaped due trigraphs */
+		if (c == '"' || c == '\\' || c == '?')
+			fprintf(fp, "\\%c", c);
+		else if (c < 32 || c >= 127)
+			fprintf(fp, "\\%03o", c);
+		else
+			fputc(c, fp);
+	}
+
+	fputc('"', fp);
+}
+
+/*
+ * Write tables of menu and nested submenus. Submenus are written first,
+ * so tables are defined before they are referenced. Returns id of menu.
+ */
+static int
+precompiled_write(FILE *fp, struct ST_MENU *menu, const char *name, int *counter, bool is_root)
+{
+	ST_MENU_CONFIG *config = menu->config;
+	ST_MENU_ITEM *menu_item;
+	int		   *ids;
+	int			first_row = 1;
+	int			screen_cols = 0;
+	int			id;
+	int			i;
+
+	ids = safe_malloc(sizeof(int) * (menu->nitems + 1));
+
+	for (i = 0; i < menu->nitems; i++)
+		ids[i] = menu->submenus[i] ?
+					precompiled_write(fp, menu->submenus[i], name, counter, false) : -1;
+
+	id = (*counter)++;
+
+	fprintf(fp, "static ST_MENU_ITEM %s_items_%d[] = {\n", name, id);
+
+	for (menu_item = menu->menu_items, i = 0; i < menu->nitems; menu_item++, i++)
+	{
+		fputs("\t{", fp);
+		write_c_string(fp, menu_item->text, strlen(menu_item->text));
+		fprintf(fp, ", %d, ", menu_item->code);
+		write_c_string(fp, menu_item->shortcut,
+					   menu_item->shortcut ? strlen(menu_item->shortcut) : 0);
+		fprintf(fp, ", %d, %d, %d, ", menu_item->data, menu_item->group, menu_item->options);
+
+		if (ids[i] != -1)
+			fprintf(fp, "%s_items_%d},\n", name, ids[i]);
+		else
+			fputs("NULL},\n", fp);
+	}
+
+	fputs("\t{NULL, 0, NULL, 0, 0, 0, NULL}\n};\n\n", fp);
+
+	if (menu->naccelerators > 0)
+	{
+		fprintf(fp, "static ST_MENU_ACCELERATOR %s_accelerators_%d[] = {\n", name, id);
+
+		for (i = 0; i < menu->naccelerators; i++)
+		{
+			fputs("\t{", fp);
+			write_c_string(fp, menu->accelerators[i].c, menu->accelerators[i].length);
+			fprintf(fp, ", %d, %d},\n", menu->accelerators[i].length, menu->accelerators[i].row);
+		}
+
+		fputs("};\n\n", fp);
+	}
+
+	if (menu->is_menubar)
+	{
+		fprintf(fp, "static int %s_bar_fields_x_pos_%d[] = {", name, id);
+
+		for (i = 0; i <= menu->nitems; i++)
+			fprintf(fp, "%s%d", i > 0 ? ", " : "", menu->bar_fields_x_pos[i]);
+
+		fputs("};\n\n", fp);
+
+		/* with dynamic spaces the positions depends on width of screen */
+		if (config->text_space == -1)
+			screen_cols = getmaxx(menu->window);
+	}
+	else
+	{
+		ST_MENU_ACCELERATOR *accelerators;
+		int		rows, cols, shortcut_x_pos, item_x_pos, naccelerators;
+
+		/* cursor_row holds current state, so initial row should be calculated again */
+		accelerators = safe_malloc(sizeof(ST_MENU_ACCELERATOR) * (menu->nitems + 1));
+
+		pulldownmenu_content_size(config, menu->menu_items, menu->labels, &rows, &cols,
+								  &shortcut_x_pos, &item_x_pos,
+								  accelerators, &naccelerators,
+								  &first_row);
+
+		for (i = 0; i < naccelerators; i++)
+			free(accelerators[i].c);
+
+		free(accelerators);
+	}
+
+	if (menu->nitems > 0)
+	{
+		fprintf(fp, "static ST_MENU_PRECOMPILED *%s_submenus_%d[] = {", name, id);
+
+		for (i = 0; i < menu->nitems; i++)
+		{
+			if (ids[i] != -1)
+				fprintf(fp, "%s&%s_%d", i > 0 ? ", " : "", name, ids[i]);
+			else
+				fprintf(fp, "%sNULL", i > 0 ? ", " : "");
+		}
+
+		fputs("};\n\n", fp);
+	}
+
+	if (is_root)
+		fprintf(fp, "ST_MENU_PRECOMPILED %s = {\n", name);
+	else
+		fprintf(fp, "static ST_MENU_PRECOMPILED %s_%d = {\n", name, id);
+
+	fprintf(fp, "\t.menu_items = %s_items_%d,\n", name, id);
+	fprintf(fp, "\t.config_hash = %uu,\n", config_fingerprint(config));
+	fprintf(fp, "\t.screen_cols = %d,\n", screen_cols);
+	fprintf(fp, "\t.nitems = %d,\n", menu->nitems);
+
+	if (!menu->is_menubar)
+	{
+		fprintf(fp, "\t.rows = %d,\n", menu->rows);
+		fprintf(fp, "\t.cols = %d,\n", menu->cols);
+		fprintf(fp, "\t.shortcut_x_pos = %d,\n", menu->shortcut_x_pos);
+		fprintf(fp, "\t.item_x_pos = %d,\n", menu->item_x_pos);
+		fprintf(fp, "\t.cursor_row = %d,\n", first_row);
+		fprintf(fp, "\t.begin_y = %d,\n", menu->ideal_y_pos);
+		fprintf(fp, "\t.begin_x = %d,\n", menu->ideal_x_pos);
+	}
+	else
+		fprintf(fp, "\t.bar_fields_x_pos = %s_bar_fields_x_pos_%d,\n", name, id);
+
+	fprintf(fp, "\t.naccelerators = %d,\n", menu->naccelerators);
+
+	if (menu->naccelerators > 0)
+		fprintf(fp, "\t.accelerators = %s_accelerators_%d,\n", name, id);
+
+	if (menu->nitems > 0)
+		fprintf(fp, "\t.submenus = %s_submenus_%d\n", name, id);
+
+	fputs("};\n\n", fp);
+
+	free(ids);
+
+	return id;
+}
+
+/*
+ * Write C tables with items and precomputed layout of menu (and all nested
+ * submenus). The tables are generated for config used by menu. The name is
+ * used as name of ST_MENU_PRECOMPILED variable and as prefix of other tables.
+ */
+bool
+st_menu_write_precompiled(FILE *fp, struct ST_MENU *menu, const char *name)
+{
+	int		counter = 0;
+
+	fputs("/*\n"
+		  " * Generated by st_menu_write_precompiled. Don't edit.\n"
+		  " */\n"
+		  "#include \"st_menu.h\"\n\n", fp);
+
+	precompiled_write(fp, menu, name, &counter, true);
+
+	fflush(fp);
+
+	return !ferror(fp);
+}
+
+/*
+ * Remove all objects allocated by menu and nested objects
+ * it is workhorse for st_menu_free
+ */
+static void
+_st_menu_free(struct ST_MENU *menu)
+{
+	if (menu)
+	{
+		int		i;
+
+		if (menu->submenus)
+		{
+			for (i = 0; i < menu->nitems; i++)
+				st_menu_free(menu->submenus[i]);
+
+			free(menu->submenus);
+		}
+
+		/* precompiled accelerators and positions are static */
+		if (!menu->is_precompiled)
+		{
+			for (i = 0; i < menu->naccelerators; i++)
+				free(menu->accelerators[i].c);
+
+			free(menu->accelerators);
+			free(menu->bar_fields_x_pos);
+		}
+
+		for (i = 0; i < menu->nitems; i++)
+			label_free(&menu->labels[i]);
+
+		free(menu->labels);
+
+		deferred_release(menu);
+
+		if (menu->palette)
+			palette_free(menu->palette);
+
+		if (menu->filter)
+			filter_free(menu->filter);
+
+		menu_free_windows(menu);
+
+		if (menu->owns_items)
+			free(menu->menu_items);
+
+		free(menu->options);
+		free(menu->refvals);
+		free(menu->shortcuts);
+
+		free(menu);
+	}
+}
+
+void
+st_menu_free(struct ST_MENU *menu)
+{
+	_st_menu_free(menu);
+
+	traced_update_panels();
+}
+
+/*
+ * Returns active item and info about selecting of active item
+ */
+ST_MENU_ITEM *
+st_menu_selected_item(bool *activated)
+{
+	/*
+	 * Activated can be true only when selected_item is valid
+	 */
+	if (selected_item)
+		*activated = press_accelerator || press_enter || button1_clicked || press_shortcut;
+	else
+		*activated = false;
+
+	return selected_item;
+}
+
+/*
+ * Set flag of first menu item specified by code
+ */
+bool
+st_menu_enable_option(struct ST_MENU *menu, int code, int option)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	while (menu_items->text)
+	{
+		if (menu_items->code == code)
+		{
+			menu->options[i] |= option;
+			return true;
+		}
+
+		if (menu->submenus[i])
+			if (st_menu_enable_option(menu->submenus[i], code, option))
+				return true;
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+/*
+ * Reset flag of first menu item specified by code
+ */
+bool
+st_menu_reset_option(struct ST_MENU *menu, int code, int option)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	while (menu_items->text)
+	{
+		if (menu_items->code == code)
+		{
+			menu->options[i] &= ~option;
+			return true;
+		}
+
+		if (menu->submenus[i])
+			if (st_menu_reset_option(menu->submenus[i], code, option))
+				return true;
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+/*
+ * Reset flag of first menu item specified by code
+ */
+bool
+st_menu_reset_all_options(struct ST_MENU *menu, int option)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	while (menu_items->text)
+	{
+		menu->options[i] &= ~option;
+
+		if (menu->submenus[i])
+			st_menu_reset_all_options(menu->submenus[i], option);
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+
+/*
+ * Reset flag of first menu item specified by code
+ */
+bool
+st_menu_reset_all_submenu_options(struct ST_MENU *menu, int menu_code, int option)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	while (menu_items->text)
+	{
+		if (menu->submenus[i])
+		{
+			if (menu_items->code == menu_code)
+			{
+				st_menu_reset_all_options(menu->submenus[i], option);
+				return true;
+			}
+
+			if (st_menu_reset_all_submenu_options(menu->submenus[i], menu_code, option))
+				return true;
+		}
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+/*
+ * Set flag of first menu item specified by code
+ */
+bool
+st_menu_set_option(struct ST_MENU *menu, int code, int option, bool value)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	while (menu_items->text)
+	{
+		if (menu_items->code == code)
+		{
+			if (value)
+				menu->options[i] |= option;
+			else
+				menu->options[i] &= ~option;
+
+			return true;
+		}
+
+		if (menu->submenus[i])
+			if (st_menu_set_option(menu->submenus[i], code, option, value))
+				return true;
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+/*
+ * Reduce string to expected display width. The buffer should be
+ * preallocated on good enough length - size of src.
+ */
+static void
+reduce_string(ST_MENU_CONFIG *config, int display_width, char *dest, char *src)
+{
+	int current_width = str_width(config, src);
+	int		char_count = 0;
+
+	while (src && display_width > 0)
+	{
+		if (current_width <= display_width)
+		{
+			strcpy(dest, src);
+			return;
+		}
+		else
+		{
+			int		chrlen = char_length(config, src);
+			int		dw = char_width(config, src);
+
+			if (char_count < 2)
+			{
+				memcpy(dest, src, chrlen);
+				dest += chrlen;
+				display_width -= dw;
+			}
+			else if (char_count == 2)
+			{
+				*dest++ = '~';
+				display_width -= 1;
+			}
+
+			char_count += 1;
+			current_width -= dw;
+			src += chrlen;
+		}
+	}
+
+	*dest = '\0';
+}
+
+/*
+ * Returns code of function key of command bar item. The modifiers are
+ * mapped like ncurses (xterm) does - Shift+F1 is F13, Ctrl+F1 is F25 and
+ * Ctrl+Shift+F1 is F37. Returns 0 for item without function key.
+ */
+static int
+cmdbar_fkey(ST_CMDBAR_ITEM *cmdbar_item)
+{
+	if (cmdbar_item->fkey <= 0)
+		return 0;
+
+	if (cmdbar_item->modifiers)
+	{
+		if (cmdbar_item->fkey > 12 ||
+			(cmdbar_item->modifiers & ~(ST_CMDBAR_MOD_SHIFT | ST_CMDBAR_MOD_CTRL)))
+		{
+			endwin();
+			fprintf(stderr, "modifiers can be used only with fkey between 1 and 12");
+			exit(1);
+		}
+
+		return cmdbar_item->fkey + 12 * cmdbar_item->modifiers;
+	}
+
+	return cmdbar_item->fkey;
+}
+
+/*
+ * Writes displayed key of command bar item (like "M-C-F1") to buffer.
+ * Returns length of label.
+ */
+static int
+cmdbar_key_label(ST_CMDBAR_ITEM *cmdbar_item, char *buffer, int size)
+{
+	if (cmdbar_item->fkey > 0)
+		return snprintf(buffer, size, "%s%s%sF%d",
+						cmdbar_item->alt ? "M-" : "",
+						cmdbar_item->modifiers & ST_CMDBAR_MOD_CTRL ? "C-" : "",
+						cmdbar_item->modifiers & ST_CMDBAR_MOD_SHIFT ? "S-" : "",
+						cmdbar_item->fkey);
+
+	return snprintf(buffer, size, "%s", cmdbar_item->alt ? "M-" : "");
+}
+
+/*
+ * Returns index of command bar field under x position, or -1. The
+ * positions are sorted, so binary search can be used.
+ */
+static int
+cmdbar_field_at(struct ST_CMDBAR *cmdbar, int x)
+{
+	int		offset = cmdbar->config->funckey_bar_style ? 0 : 1;
+	int		low = 1;
+	int		high = cmdbar->set->nitems + 1;
+
+	/* search first field, that starts after x */
+	while (low < high)
+	{
+		int		mid = (low + high) / 2;
+
+		if (cmdbar->set->positions[mid] - offset > x)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return low <= cmdbar->set->nitems ? low - 1 : -1;
+}
+
+/*
+ * Draw field of command bar (not in funckey bar style)
+ */
+static void
+cmdbar_draw_field(struct ST_CMDBAR *cmdbar, int i, bool marked)
+{
+	ST_MENU_CONFIG *config = cmdbar->config;
+	char	buffer[20];
+	bool	need_sep = false;
+	int		accel_prop;
+	int		text_prop;
+
+	if (marked)
+	{
+		st_menu_backend->change_attr(cmdbar->window, 0,
+					cmdbar->set->positions[i] - 1,
+					cmdbar->set->positions[i+1] - config->text_space + 1 - cmdbar->set->positions[i] + 1,
+					config->cursor_attr,
+					config->cursor_cpn);
+
+		accel_prop = COLOR_PAIR(config->cursor_accel_cpn) | config->cursor_accel_attr;
+		text_prop = COLOR_PAIR(config->cursor_cpn) | config->cursor_attr;
+	}
+	else
+	{
+
+		accel_prop = COLOR_PAIR(config->accelerator_cpn) | config->accelerator_attr;
+		text_prop = COLOR_PAIR(config->menu_unfocused_cpn) | config->menu_unfocused_attr;
+	}
+
+	wmove(cmdbar->window, 0, cmdbar->set->positions[i]);
+
+	wattron(cmdbar->window, accel_prop);
+
+	if (cmdbar_key_label(&cmdbar->set->cmdbar_items[i], buffer, sizeof(buffer)) > 0)
+	{
+		need_sep = true;
+		st_menu_backend->put_str(cmdbar->window, buffer, -1);
+	}
+
+	wattroff(cmdbar->window, accel_prop);
+
+	wattron(cmdbar->window, text_prop);
+
+	if (need_sep)
+		st_menu_backend->put_str(cmdbar->window, " ", 1);
+
+	st_menu_backend->put_str(cmdbar->window, cmdbar->set->cmdbar_items[i].text, -1);
+
+	wattroff(cmdbar->window, text_prop);
+}
+
+/*
+ * Clean area of field of command bar and draw it again.
+ */
+static void
+cmdbar_redraw_field(struct ST_CMDBAR *cmdbar, ST_CMDBAR_ITEM *cmdbar_item, bool marked)
+{
+	int		i = cmdbar_item - cmdbar->set->cmdbar_items;
+	int		x = max_int(cmdbar->set->positions[i] - 1, 0);
+	int		end_x = min_int(cmdbar->set->positions[i + 1] - 1, getmaxx(cmdbar->window));
+
+	wmove(cmdbar->window, 0, x);
+
+	while (x++ < end_x)
+		st_menu_backend->put_ch(cmdbar->window, ' ');
+
+	cmdbar_draw_field(cmdbar, i, marked);
+}
+
+/*
+ * Returns marked item of command bar - the item selected by mouse,
+ * that is not activated yet.
+ */
+static ST_CMDBAR_ITEM *
+cmdbar_marked_item(struct ST_CMDBAR *cmdbar)
+{
+	if (cmdbar->config->funckey_bar_style || command_was_activated)
+		return NULL;
+
+	if (selected_command < cmdbar->set->cmdbar_items ||
+		selected_command >= cmdbar->set->cmdbar_items + cmdbar->set->nitems)
+		return NULL;
+
+	return selected_command;
+}
+
+/*
+ * Draw command bar, when the content of command bar can be changed (set, size
+ * or marked item). When only marked item is changed, then only previously and
+ * newly marked fields are drawn.
+ */
+static void
+cmdbar_update(struct ST_CMDBAR *cmdbar)
+{
+	ST_CMDBAR_ITEM *marked = cmdbar_marked_item(cmdbar);
+	int		nfields;
+
+	if (cmdbar->drawn_set != cmdbar->set ||
+		cmdbar->drawn_cols != getmaxx(cmdbar->window) ||
+		cmdbar->config->text_space < 2)
+	{
+		cmdbar_draw(cmdbar);
+		return;
+	}
+
+	if (marked == cmdbar->drawn_marked)
+		return;
+
+	TRACE(ST_MENU_TRACE_CMDBAR_DRAW, ST_MENU_TRACE_BEGIN, 0);
+	TRACE_COUNT(redraws, 1);
+	TRACE_COUNT(rows_painted, 1);
+
+	nfields = (marked ? 1 : 0) + (cmdbar->drawn_marked ? 1 : 0);
+
+	if (cmdbar->drawn_marked)
+		cmdbar_redraw_field(cmdbar, cmdbar->drawn_marked, false);
+
+	if (marked)
+		cmdbar_redraw_field(cmdbar, marked, true);
+
+	cmdbar->drawn_marked = marked;
+
+	st_menu_backend->flush(cmdbar->window);
+
+	stats_flush(ST_MENU_STATS_CMDBAR);
+
+	TRACE(ST_MENU_TRACE_CMDBAR_DRAW, ST_MENU_TRACE_END, nfields);
+}
+
+static void
+cmdbar_draw(struct ST_CMDBAR *cmdbar)
+{
+	ST_MENU_CONFIG *config = cmdbar->config;
+	char	buffer[20];
+	int		i;
+
+	TRACE(ST_MENU_TRACE_CMDBAR_DRAW, ST_MENU_TRACE_BEGIN, 0);
+	TRACE_COUNT(redraws, 1);
+	TRACE_COUNT(rows_painted, 1);
+
+	show_panel(cmdbar->panel);
+	top_panel(cmdbar->panel);
+
+	traced_update_panels();
+
+	st_menu_backend->erase_window(cmdbar->window);
+
+	if (config->funckey_bar_style)
+	{
+		for (i = 0; i < cmdbar->set->nitems; i++)
+		{
+			wmove(cmdbar->window, 0, cmdbar->set->positions[i]);
+			wattron(cmdbar->window,
+					  COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+
+			snprintf(buffer, sizeof(buffer), "%2d", i+1);
+			st_menu_backend->put_str(cmdbar->window, buffer, -1);
+
+			wattroff(cmdbar->window,
+					  COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+
+			if (cmdbar->set->labels[i])
+				st_menu_backend->put_str(cmdbar->window, cmdbar->set->labels[i], -1);
+		}
+	}
+	else
+	{
+		for (i = 0; i < cmdbar->set->nitems; i++)
+			cmdbar_draw_field(cmdbar, i,
+							  &cmdbar->set->cmdbar_items[i] == selected_command && !command_was_activated);
+	}
+
+	cmdbar->drawn_set = cmdbar->set;
+	cmdbar->drawn_cols = getmaxx(cmdbar->window);
+	cmdbar->drawn_marked = cmdbar_marked_item(cmdbar);
+
+	st_menu_backend->flush(cmdbar->window);
+
+	stats_flush(ST_MENU_STATS_CMDBAR);
+
+	TRACE(ST_MENU_TRACE_CMDBAR_DRAW, ST_MENU_TRACE_END, cmdbar->set->nitems);
+}
+
+static bool
+cmdbar_driver(struct ST_CMDBAR *cmdbar, int c, bool alt, MEVENT *mevent)
+{
+	ST_MENU_CONFIG *config = cmdbar->config;
+
+	if (c == KEY_MOUSE &&
+		mevent->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED
+
+#if NCURSES_MOUSE_VERSION > 1
+
+						  | REPORT_MOUSE_POSITION
+
+#endif
+	  ))
+	{
+		int		y = mevent->y;
+		int		x = mevent->x;
+		int		i;
+
+		if (!wenclose(cmdbar->window, y, x))
+		{
+			command_was_activated = true;
+			return false;
+		}
+
+		i = cmdbar_field_at(cmdbar, x);
+		if (i != -1)
+		{
+			if (config->funckey_bar_style)
+			{
+				if (cmdbar->set->labels[i])
+				{
+					/*
+					 * This design is not exact, but it is good enough.
+					 * The click is valid, when press and release is over same
+					 * object.
+					 */
+					if (mevent->bstate & BUTTON1_PRESSED)
+					{
+						command_was_activated = false;
+						selected_command = cmdbar->set->ordered_items[i];
+						return true;
+					}
+					else if (mevent->bstate & BUTTON1_RELEASED)
+					{
+						if (selected_command == cmdbar->set->ordered_items[i])
+						{
+							command_was_activated = true;
+							return true;
+						}
+					}
+				}
+			}
+			else
+			{
+				if (mevent->bstate & BUTTON1_PRESSED)
+				{
+					command_was_activated = false;
+					selected_command = &cmdbar->set->cmdbar_items[i];
+					return true;
+				}
+				else if (mevent->bstate & BUTTON1_RELEASED)
+				{
+					if (selected_command == &cmdbar->set->cmdbar_items[i])
+					{
+						command_was_activated = true;
+						return true;
+					}
+				}
+			}
+		}
+
+		selected_command = NULL;
+		return true;
+	}
+	else if (c >= KEY_F(1) && c <= KEY_F(ST_CMDBAR_MAX_FKEY))
+	{
+		ST_CMDBAR_ITEM *cmdbar_item = cmdbar->set->fkey_items[alt ? 1 : 0][c - KEY_F0];
+
+		if (cmdbar_item)
+		{
+			command_was_activated = true;
+			selected_command = cmdbar_item;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+ST_CMDBAR_ITEM *
+st_menu_selected_command(bool *activated)
+{
+	*activated = selected_command != NULL && command_was_activated;
+
+	return selected_command;
+}
+
+/*
+ * Calculate layout of command bar set for width of screen maxx.
+ */
+static void
+cmdbar_set_layout(ST_MENU_CONFIG *config, ST_CMDBAR_SET *set, int maxx)
+{
+	ST_CMDBAR_ITEM *cmdbar_item;
+	int		i;
+	int		last_position;
+	int		funckey_bar_nitems;
+	int		key_label_length;
+	char	buffer[20];
+
+	set->cols = maxx;
+	memset(set->fkey_items, 0, sizeof(set->fkey_items));
+
+	set->nitems = 0;
+	funckey_bar_nitems = 10;
+
+	/*
+	 * Build dispatch table of function keys. When more items uses same
+	 * key, then first item is used.
+	 */
+	cmdbar_item = set->cmdbar_items;
+	while (cmdbar_item->text)
+	{
+		int		fkey = cmdbar_fkey(cmdbar_item);
+
+		if (fkey > ST_CMDBAR_MAX_FKEY)
+		{
+			endwin();
+			fprintf(stderr, "fkey code should be between 1 and %d", ST_CMDBAR_MAX_FKEY);
+			exit(1);
+		}
+
+		if (fkey > 0 && !set->fkey_items[cmdbar_item->alt ? 1 : 0][fkey])
+			set->fkey_items[cmdbar_item->alt ? 1 : 0][fkey] = cmdbar_item;
+
+		/* funckey bar has 12 fields, when F11 or F12 is used */
+		if (cmdbar_item->fkey > funckey_bar_nitems && cmdbar_item->fkey <= 12)
+			funckey_bar_nitems = 12;
+
+		set->nitems += 1;
+		cmdbar_item += 1;
+	}
+
+	if (config->funckey_bar_style)
+		set->nitems = funckey_bar_nitems;
+
+	set->positions = safe_malloc(sizeof(int) * (set->nitems + 1));
+	set->labels = safe_malloc(sizeof(char*) * set->nitems);
+	set->ordered_items = safe_malloc(sizeof(ST_CMDBAR_ITEM *) * set->nitems);
+	last_position = 0;
+
+	if (config->funckey_bar_style)
+	{
+		int		width = maxx / set->nitems;
+		double	extra_width = (maxx % set->nitems) / (set->nitems * 1.0);
+		double	extra_width_sum = 0;
+
+		if (width < 7)
+		{
+			/* when terminal is too thin, don't show all fields */
+			set->nitems = maxx / 7;
+
+			width = maxx / set->nitems;
+			extra_width = (maxx % set->nitems) / (set->nitems * 1.0);
+			extra_width_sum = 0;
+		}
+
+		for (i = 0; i < set->nitems; i++)
+		{
+			set->positions[i] = last_position;
+			last_position += width;
+			extra_width_sum += extra_width;
+			if (extra_width_sum > 1.0)
+			{
+				last_position += 1;
+				extra_width_sum -= 1;
+			}
+		}
+
+		set->positions[set->nitems] = maxx + 1;
+
+		cmdbar_item = set->cmdbar_items;
+		while (cmdbar_item->text)
+		{
+			int		fkey = cmdbar_item->fkey;
+			int		display_width;
+
+			if (cmdbar_item->alt || cmdbar_item->modifiers)
+			{
+				endwin();
+				fprintf(stderr, "Alt and modifiers are not supported in funckey bar style");
+				exit(1);
+			}
+
+			if (fkey < 1 || fkey > 12)
+			{
+				endwin();
+				fprintf(stderr, "fkey code should be between 1 and 12");
+				exit(1);
+			}
+
+			/* don't display keys in reduced bar */
+			if (fkey > set->nitems)
+			{
+				cmdbar_item += 1;
+				continue;
+			}
+
+			if (set->labels[fkey - 1])
+			{
+				endwin();
+				fprintf(stderr, "multiple assigned items inside funckey bar");
+				exit(1);
+			}
+
+			set->ordered_items[fkey - 1] = cmdbar_item;
+
+			display_width = set->positions[fkey] - set->positions[fkey - 1] - 2;
+			set->labels[fkey - 1] = safe_malloc(strlen(cmdbar_item->text) + 1);
+			reduce_string(config, display_width, set->labels[fkey - 1], cmdbar_item->text);
+
+			cmdbar_item += 1;
+		}
+	}
+	else
+	{
+		last_position = config->init_text_space;
+
+		for (i = 0; i < set->nitems; i++)
+		{
+			cmdbar_item = &set->cmdbar_items[i];
+
+			set->positions[i] = last_position;
+
+			key_label_length = cmdbar_key_label(cmdbar_item, buffer, sizeof(buffer));
+			if (key_label_length > 0)
+				last_position += key_label_length + 1;
+
+			last_position += str_width(config, cmdbar_item->text);
+			last_position += config->text_space != -1 ? config->text_space : 3;
+		}
+
+		set->positions[set->nitems] = last_position;
+	}
+
+}
+
+static void
+cmdbar_set_free_layout(ST_CMDBAR_SET *set)
+{
+	int		i;
+
+	for (i = 0; i < set->nitems; i++)
+		if (set->labels[i])
+			free(set->labels[i]);
+
+	free(set->labels);
+	free(set->positions);
+	free(set->ordered_items);
+}
+
+/*
+ * When the size of screen was changed, then the command bar window is moved
+ * and the layout of active set is calculated again.
+ */
+static void
+cmdbar_check_size(struct ST_CMDBAR *cmdbar)
+{
+	int		maxy, maxx;
+
+	getmaxyx(stdscr, maxy, maxx);
+
+	if (getbegy(cmdbar->window) != maxy - 1 || getmaxx(cmdbar->window) != maxx)
+	{
+		wresize(cmdbar->window, 1, maxx);
+		move_panel(cmdbar->panel, maxy - 1, 0);
+	}
+
+	if (cmdbar->set->cols != maxx)
+	{
+		cmdbar_set_free_layout(cmdbar->set);
+		cmdbar_set_layout(cmdbar->config, cmdbar->set, maxx);
+	}
+}
+
+/*
+ * Create state variable for commandbar. It based on template - a array of ST_CMDBAR_ITEM fields.
+ */
+struct ST_CMDBAR *
+st_cmdbar_new(ST_MENU_CONFIG *config, ST_CMDBAR_ITEM *cmdbar_items)
+{
+	struct ST_CMDBAR *cmdbar;
+	int		maxy, maxx, tmpy;
+
+	cmdbar = safe_malloc(sizeof(struct ST_CMDBAR));
+
+	cmdbar->config = config;
+
+	getmaxyx(stdscr, maxy, maxx);
+
+	tmpy = 1;
+	cmdbar->window = newwin(tmpy, maxx, maxy - 1, 0);
+	cmdbar->panel = new_panel(cmdbar->window);
+	TRACE_COUNT(windows, 1);
+
+	wbkgd(cmdbar->window,
+					  COLOR_PAIR(config->menu_unfocused_cpn) |
+					  config->menu_unfocused_attr);
+
+	werase(cmdbar->window);
+
+	cmdbar->nsets = 1;
+	cmdbar->sets = safe_malloc(sizeof(ST_CMDBAR_SET));
+	cmdbar->set = cmdbar->sets;
+
+	cmdbar->set->cmdbar_items = cmdbar_items;
+	cmdbar_set_layout(config, cmdbar->set, maxx);
+
+	return cmdbar;
+}
+
+/*
+ * Add named set of items to command bar. The layout is calculated now,
+ * so later switch to this set is cheap.
+ */
+void
+st_cmdbar_add_set(struct ST_CMDBAR *cmdbar, const char *name, ST_CMDBAR_ITEM *cmdbar_items)
+{
+	ST_CMDBAR_SET *set;
+	int		active = cmdbar->set - cmdbar->sets;
+
+	cmdbar->sets = safe_realloc(cmdbar->sets, sizeof(ST_CMDBAR_SET) * (cmdbar->nsets + 1));
+	cmdbar->set = &cmdbar->sets[active];
+
+	/* the address of drawn set can be changed */
+	cmdbar->drawn_set = NULL;
+
+	set = &cmdbar->sets[cmdbar->nsets++];
+	memset(set, 0, sizeof(ST_CMDBAR_SET));
+
+	set->name = safe_malloc(strlen(name) + 1);
+	strcpy(set->name, name);
+	set->cmdbar_items = cmdbar_items;
+	cmdbar_set_layout(cmdbar->config, set, getmaxx(cmdbar->window));
+}
+
+/*
+ * Activate set of items of command bar. NULL name is used for items passed
+ * to st_cmdbar_new. Posted command bar is drawn. Returns false, when the set
+ * doesn't exist.
+ */
+bool
+st_cmdbar_switch_set(struct ST_CMDBAR *cmdbar, const char *name)
+{
+	int		i;
+
+	for (i = 0; i < cmdbar->nsets; i++)
+	{
+		ST_CMDBAR_SET *set = &cmdbar->sets[i];
+
+		if (name ? set->name && strcmp(set->name, name) == 0 : !set->name)
+		{
+			if (set != cmdbar->set)
+			{
+				cmdbar->set = set;
+
+				if (active_cmdbar == cmdbar)
+				{
+					cmdbar_check_size(cmdbar);
+					cmdbar_draw(cmdbar);
+				}
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void
+st_cmdbar_post(struct ST_CMDBAR *cmdbar)
+{
+	active_cmdbar = cmdbar;
+	cmdbar_check_size(cmdbar);
+	cmdbar_draw(cmdbar);
+}
+
+void
+st_cmdbar_unpost(struct ST_CMDBAR *cmdbar)
+{
+	active_cmdbar = NULL;
+
+	hide_panel(cmdbar->panel);
+	traced_update_panels();
+}
+
+void
+st_cmdbar_free(struct ST_CMDBAR *cmdbar)
+{
+	int		i;
+
+	active_cmdbar = NULL;
+
+	del_panel(cmdbar->panel);
+	delwin(cmdbar->window);
+
+	for (i = 0; i < cmdbar->nsets; i++)
+	{
+		cmdbar_set_free_layout(&cmdbar->sets[i]);
+		free(cmdbar->sets[i].name);
+	}
+
+	free(cmdbar->sets);
+	free(cmdbar);
+
+	traced_update_panels();
+}
+
+/*
+ * Set reference to some variable for menu's option
+ */
+bool
+st_menu_set_ref_option(struct ST_MENU *menu,
+					   int code,
+					   int option,
+					   int *refvalue)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	if (!IS_REF_OPTION(option))
+	{
+		endwin();
+		fprintf(stderr, "cannot assign reference value with not reference option");
+		exit(1);
+	}
+
+	while (menu_items->text)
+	{
+		if (menu_items->code == code)
+		{
+			menu->options[i] |= option;
+			menu->refvals[i] = refvalue;
+
+			return true;
+		}
+
+		if (menu->submenus[i])
+			if (st_menu_set_ref_option(menu->submenus[i], code, option, refvalue))
+				return true;
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+static bool
+_st_menu_set_shortcut(struct ST_MENU *menu, int code, char *shortcut)
+{
+	ST_MENU_ITEM *menu_items = menu->menu_items;
+	int		i = 0;
+
+	while (menu_items->text)
+	{
+		if (menu_items->code == code)
+		{
+			menu_items->shortcut = shortcut;
+			return true;
+		}
+
+		if (menu->submenus[i])
+			if (_st_menu_set_shortcut(menu->submenus[i], code, shortcut))
+				return true;
+
+		menu_items += 1;
+		i += 1;
+	}
+
+	return false;
+}
+
+/*
+ * Set shortcut for option specified by code. The hash of shortcuts
+ * of top menu is built again before next use.
+ */
+bool
+st_menu_set_shortcut(struct ST_MENU *menu, int code, char *shortcut)
+{
+	struct ST_MENU *top = menu;
+
+	if (!_st_menu_set_shortcut(menu, code, shortcut))
+		return false;
+
+	while (top->parent_menu)
+		top = top->parent_menu;
+
+	top->shortcuts_is_valid = false;
+
+	return true;
+}
+
+/*
+ * Returns submenu of item specified by code. It is searched in whole
+ * menu tree.
+ */
+struct ST_MENU *
+st_menu_get_submenu(struct ST_MENU *menu, int code)
+{
+	int		i;
+
+	for (i = 0; i < menu->nitems; i++)
+	{
+		if (menu->submenus[i])
+		{
+			struct ST_MENU *result;
+
+			if (menu->menu_items[i].code == code)
+				return menu->submenus[i];
+
+			result = st_menu_get_submenu(menu->submenus[i], code);
+			if (result)
+				return result;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Ensure own copies of menu items and of related arrays with space for
+ * nitems items. The arrays grow geometrically, and they are never reduced
+ * (the current items are moved after reservation). Static accelerators and
+ * positions of precompiled menu are copied too.
+ */
+static void
+menu_reserve_items(struct ST_MENU *menu, int nitems)
+{
+	int		capacity;
+	int		i;
+
+	if (menu->owns_items && nitems <= menu->items_capacity)
+		return;
+
+	capacity = max_int(max_int(max_int(nitems, menu->nitems), menu->items_capacity * 2), 8);
+
+	/* one more item for terminating item */
+	if (!menu->owns_items)
+	{
+		ST_MENU_ITEM *menu_items = safe_malloc(sizeof(ST_MENU_ITEM) * (capacity + 1));
+
+		memcpy(menu_items, menu->menu_items, sizeof(ST_MENU_ITEM) * (menu->nitems + 1));
+		menu->menu_items = menu_items;
+		menu->owns_items = true;
+	}
+	else
+		menu->menu_items = safe_realloc(menu->menu_items, sizeof(ST_MENU_ITEM) * (capacity + 1));
+
+	if (menu->is_precompiled)
+	{
+		ST_MENU_ACCELERATOR *accelerators = safe_malloc(sizeof(ST_MENU_ACCELERATOR) * capacity);
+
+		for (i = 0; i < menu->naccelerators; i++)
+		{
+			accelerators[i] = menu->accelerators[i];
+			accelerators[i].c = safe_malloc(accelerators[i].length + 1);
+			memcpy(accelerators[i].c, menu->accelerators[i].c, accelerators[i].length);
+		}
+
+		menu->accelerators = accelerators;
+
+		if (menu->is_menubar)
+		{
+			int	   *bar_fields_x_pos = safe_malloc(sizeof(int) * (capacity + 1));
+
+			memcpy(bar_fields_x_pos, menu->bar_fields_x_pos, sizeof(int) * (menu->nitems + 1));
+			menu->bar_fields_x_pos = bar_fields_x_pos;
+		}
+
+		menu->is_precompiled = false;
+	}
+	else
+	{
+		menu->accelerators = safe_realloc(menu->accelerators, sizeof(ST_MENU_ACCELERATOR) * capacity);
+
+		if (menu->is_menubar)
+			menu->bar_fields_x_pos = safe_realloc(menu->bar_fields_x_pos, sizeof(int) * (capacity + 1));
+	}
+
+	menu->submenus = safe_realloc(menu->submenus, sizeof(struct ST_MENU *) * capacity);
+	menu->options = safe_realloc(menu->options, sizeof(int) * capacity);
+	menu->refvals = safe_realloc(menu->refvals, sizeof(int *) * capacity);
+	menu->labels = safe_realloc(menu->labels, sizeof(ST_MENU_LABEL) * (capacity + 1));
+
+	menu->items_capacity = capacity;
+}
+
+/*
+ * Move menu and all nested submenus. The windows are created again,
+ * because the size of windows can be reduced by position.
+ */
+static void
+menu_move(struct ST_MENU *menu, int dy, int dx)
+{
+	int		i;
+
+	if (dy == 0 && dx == 0)
+		return;
+
+	menu->ideal_y_pos += dy;
+	menu->ideal_x_pos += dx;
+
+	menu_free_windows(menu);
+	pulldownmenu_new_windows(menu);
+
+	for (i = 0; i < menu->nitems; i++)
+		if (menu->submenus[i])
+			menu_move(menu->submenus[i], dy, dx);
+}
+
+static bool
+is_selectable_item(ST_MENU_ITEM *menu_item)
+{
+	return *menu_item->text && strncmp(menu_item->text, "--", 2) != 0;
+}
+
+/*
+ * Replace nremoved items on position by ninserted items. The layout is updated
+ * incrementally - only labels and accelerators of inserted items are decoded,
+ * and the windows are created again only when dimensions of pulldown menu are
+ * changed. The cursor stays on same item when it is possible.
+ */
+static bool
+menu_change_items(struct ST_MENU *menu, int position, int nremoved,
+				  ST_MENU_ITEM *items, int ninserted)
+{
+	int		delta = ninserted - nremoved;
+	int		cursor = menu->cursor_row - 1;
+	struct ST_MENU *top = menu;
+	int		i, j;
+
+	if (position < 0 || position + nremoved > menu->nitems || menu->nitems + delta < 1)
+		return false;
+
+	/* selected item can be moved or released */
+	if (selected_item >= menu->menu_items && selected_item <= menu->menu_items + menu->nitems)
+		selected_item = NULL;
+
+	menu_reserve_items(menu, menu->nitems + delta);
+
+	for (i = position; i < position + nremoved; i++)
+	{
+		struct ST_MENU *submenu = menu->submenus[i];
+
+		if (submenu)
+		{
+			if (menu->active_submenu == submenu)
+			{
+				st_menu_unpost(submenu, true);
+				menu->active_submenu = NULL;
+			}
+
+			_st_menu_free(submenu);
+		}
+
+		label_free(&menu->labels[i]);
+	}
+
+	/* remove accelerators of removed items, and move rows of following items */
+	for (i = 0, j = 0; i < menu->naccelerators; i++)
+	{
+		ST_MENU_ACCELERATOR *accelerator = &menu->accelerators[i];
+
+		if (accelerator->row > position && accelerator->row <= position + nremoved)
+			free(accelerator->c);
+		else
+		{
+			if (accelerator->row > position + nremoved)
+				accelerator->row += delta;
+
+			menu->accelerators[j++] = *accelerator;
+		}
+	}
+
+	menu->naccelerators = j;
+
+	if (delta != 0)
+	{
+		int		nmoved = menu->nitems - position - nremoved;
+
+		/* terminating item is moved too */
+		memmove(&menu->menu_items[position + ninserted], &menu->menu_items[position + nremoved],
+				sizeof(ST_MENU_ITEM) * (nmoved + 1));
+		memmove(&menu->submenus[position + ninserted], &menu->submenus[position + nremoved],
+				sizeof(struct ST_MENU *) * nmoved);
+		memmove(&menu->options[position + ninserted], &menu->options[position + nremoved],
+				sizeof(int) * nmoved);
+		memmove(&menu->refvals[position + ninserted], &menu->refvals[position + nremoved],
+				sizeof(int *) * nmoved);
+		memmove(&menu->labels[position + ninserted], &menu->labels[position + nremoved],
+				sizeof(ST_MENU_LABEL) * nmoved);
+
+		menu->nitems += delta;
+		memset(&menu->labels[menu->nitems], 0, sizeof(ST_MENU_LABEL));
+	}
+
+	/* accelerators are sorted by row, new accelerators are inserted before following rows */
+	for (j = 0; j < menu->naccelerators; j++)
+		if (menu->accelerators[j].row > position)
+			break;
+
+	for (i = position; i < position + ninserted; i++)
+	{
+		ST_MENU_ITEM *menu_item = &menu->menu_items[i];
+		ST_MENU_LABEL *label = &menu->labels[i];
+
+		*menu_item = items[i - position];
+
+		label_decode(menu->config, label, menu_item, menu->is_menubar);
+
+		menu->submenus[i] = NULL;
+		menu->options[i] = menu_item->options;
+		menu->refvals[i] = NULL;
+
+		if (label->accel_offset != -1 &&
+			(menu->is_menubar || is_selectable_item(menu_item)))
+		{
+			memmove(&menu->accelerators[j + 1], &menu->accelerators[j],
+					sizeof(ST_MENU_ACCELERATOR) * (menu->naccelerators - j));
+
+			menu->accelerators[j].c = chr_casexfrm(menu->config, menu_item->text + label->accel_offset);
+			menu->accelerators[j].length = strlen(menu->accelerators[j].c);
+			menu->accelerators[j++].row = i + 1;
+			menu->naccelerators += 1;
+		}
+	}
+
+	if (menu->is_menubar)
+		menubar_fields_positions(menu->config, menu->labels, menu->nitems,
+								 getmaxx(menu->window), menu->bar_fields_x_pos);
+	else
+	{
+		ST_MENU_CONFIG *config = menu->config;
+		int		rows, cols;
+		int		naccelerators, default_row;
+
+		pulldownmenu_content_size(config, menu->menu_items, menu->labels, &rows, &cols,
+								  &menu->shortcut_x_pos, &menu->item_x_pos,
+								  NULL, &naccelerators, &default_row);
+
+		if (config->draw_box)
+		{
+			rows += 2;
+			cols += 2;
+		}
+
+		if (config->wide_vborders)
+			cols += 2;
+		if (config->wide_hborders)
+			rows += 2;
+
+		/* windows are created again only when size of menu is changed */
+		if (rows != menu->rows || cols != menu->cols)
+		{
+			menu->rows = rows;
+			menu->cols = cols;
+
+			menu_free_windows(menu);
+			pulldownmenu_new_windows(menu);
+		}
+
+		pulldownmenu_set_columns(menu);
+	}
+
+	/* submenus of following items can be moved */
+	for (i = 0; i < menu->nitems; i++)
+	{
+		int		submenu_y, submenu_x;
+
+		if (i >= position && i < position + ninserted && menu->menu_items[i].submenu)
+		{
+			submenu_position(menu, i, &submenu_y, &submenu_x);
+
+			menu->submenus[i] = pulldownmenu_new(menu->submenu_config, menu->menu_items[i].submenu,
+												 submenu_y, submenu_x, NULL, NULL);
+		}
+		else if (menu->submenus[i])
+		{
+			submenu_position(menu, i, &submenu_y, &submenu_x);
+
+			menu_move(menu->submenus[i],
+					  submenu_y - menu->submenus[i]->ideal_y_pos,
+					  submenu_x - menu->submenus[i]->ideal_x_pos);
+		}
+
+		if (menu->submenus[i])
+		{
+			menu->submenus[i]->parent_menu = menu;
+			menu->submenus[i]->parent_offset = i;
+		}
+	}
+
+	/* cursor should to stay on same item, or on item on same position */
+	if (cursor >= position + nremoved)
+		cursor += delta;
+	else if (cursor >= position)
+		cursor = min_int(position, menu->nitems - 1);
+
+	if (!menu->is_menubar &&
+		(cursor < 0 || !is_selectable_item(&menu->menu_items[cursor])))
+	{
+		int		start = max_int(cursor, 0);
+
+		cursor = -1;
+
+		/* search nearest selectable item forward, then backward */
+		for (j = start; j < menu->nitems && cursor == -1; j++)
+			if (is_selectable_item(&menu->menu_items[j]))
+				cursor = j;
+
+		for (j = start - 1; j >= 0 && cursor == -1; j--)
+			if (is_selectable_item(&menu->menu_items[j]))
+				cursor = j;
+	}
+
+	menu->cursor_row = cursor != -1 ? cursor + 1 : -1;
+	menu->mouse_row = -1;
+
+	if (menu->first_row > menu->nitems)
+		menu->first_row = menu->nitems;
+
+	/*
+	 * hash of shortcuts, index of command palette and keys of filter
+	 * are built again before next use
+	 */
+	while (top->parent_menu)
+		top = top->parent_menu;
+
+	top->shortcuts_is_valid = false;
+
+	if (top->palette)
+		top->palette->is_valid = false;
+
+	if (menu->filter)
+		menu->filter->is_valid = false;
+
+	traced_update_panels();
+
+	return true;
+}
+
+/*
+ * Insert item to menu on position (-1 means append). The item is copied,
+ * but its texts and submenu items should to live with menu.
+ */
+bool
+st_menu_insert_item(struct ST_MENU *menu, int position, ST_MENU_ITEM *item)
+{
+	if (!item || !item->text)
+		return false;
+
+	if (position == -1)
+		position = menu->nitems;
+
+	return menu_change_items(menu, position, 0, item, 1);
+}
+
+/*
+ * Remove item on position from menu. Last item of menu cannot be removed.
+ */
+bool
+st_menu_remove_item(struct ST_MENU *menu, int position)
+{
+	return menu_change_items(menu, position, 1, NULL, 0);
+}
+
+/*
+ * Replace item on position by new item.
+ */
+bool
+st_menu_replace_item(struct ST_MENU *menu, int position, ST_MENU_ITEM *item)
+{
+	if (!item || !item->text)
+		return false;
+
+	return menu_change_items(menu, position, 1, item, 1);
+}
+
+/*
+ * Take all pushed chunks of deferred submenu. The chunks are returned
+ * in order of pushing.
+ */
+static ST_MENU_CHUNK *
+chunks_take(struct ST_MENU *menu)
+{
+	ST_MENU_CHUNK *chunks;
+	ST_MENU_CHUNK *result = NULL;
+
+#ifdef ST_MENU_ATOMIC_CHUNKS
+
+	chunks = atomic_exchange(&menu->pending, NULL);
+
+#else
 
-			free(pressed);
+	chunks = menu->pending;
+	menu->pending = NULL;
 
-			/* Process key in this case only when we found accelerator */
-			if (search_row != -1)
-				processed = true;
-		}
-	}
+#endif
 
-	/*
-	 * Iterate over menu items, and try to find next or previous row, code, or mouse
-	 * row.
-	 */
-	menu_items = menu->menu_items; row = 1;
-	while (menu_items->text != 0)
+	/* stack returns chunks in reverse order */
+	while (chunks)
 	{
-		if (*menu_items->text != '\0' &&
-				(strncmp(menu_items->text, "--", 2) != 0) &&
-				((menu->options[row - 1] & ST_MENU_OPTION_DISABLED) == 0))
-		{
-			if (first_row == -1)
-			{
-				first_row = row;
+		ST_MENU_CHUNK *next = chunks->next;
 
-				if (c == KEY_HOME && !is_menubar)
-				{
-					menu->cursor_row = first_row;
-					found_row = true;
-					processed = true;
-					break;
-				}
-			}
+		chunks->next = result;
+		result = chunks;
+		chunks = next;
+	}
 
-			if (is_menubar)
-			{
-				if (c == KEY_RIGHT && row > cursor_row) 
-				{
-					menu->cursor_row = row;
-					found_row = true;
-					processed = true;
-					break;
-				}
-				else if (c == KEY_LEFT && row == cursor_row)
-				{
-					if (last_row != -1)
-					{
-						menu->cursor_row = last_row;
-						found_row = true;
-						processed = true;
-						break;
-					}
-				}
-			}
-			else
-			{
-				/* Is not menubar */
-				if (c == KEY_DOWN && row > cursor_row)
-				{
-					menu->cursor_row = row;
-					processed = true;
-					found_row = true;
-					break;
-				}
-				else if (c == KEY_UP && row == cursor_row)
-				{
-					if (last_row != -1)
-					{
-						menu->cursor_row = last_row;
-						found_row = true;
-						processed = true;
-						break;
-					}
-					else
-						c = KEY_END;
-				}
-			}
+	return result;
+}
 
-			if (mouse_row != -1 && row == mouse_row)
-			{
-				menu->cursor_row = row;
-				found_row = true;
-				processed = true;
-				post_menu = true;
+static void
+chunks_free(ST_MENU_CHUNK *chunks)
+{
+	while (chunks)
+	{
+		ST_MENU_CHUNK *next = chunks->next;
 
-				if (mevent->bstate & BUTTON1_PRESSED
+		free(chunks);
+		chunks = next;
+	}
+}
 
-#if NCURSES_MOUSE_VERSION > 1
+/*
+ * Remove deferred submenu from list of loading menus, and release
+ * pushed items. It is called when submenu is freed or deferred again.
+ */
+static void
+deferred_release(struct ST_MENU *menu)
+{
+	if (menu->fill_state == ST_MENU_FILL_LOADING)
+	{
+		struct ST_MENU **ptr = &loading_menus;
 
-				|| mevent->bstate & REPORT_MOUSE_POSITION
+		while (*ptr && *ptr != menu)
+			ptr = &(*ptr)->next_loading;
 
-#endif
+		if (*ptr)
+			*ptr = menu->next_loading;
 
-				  )
-				{
-					menu->mouse_row = mouse_row;
-				}
-				else
-				{
-					/*
-					 * Fully valid release event for transformation to
-					 * clicked event is only event, when PRESSED row
-					 * and released row is same.
-					 */
-					if (mevent->bstate& BUTTON1_RELEASED &&
-							menu->mouse_row == mouse_row)
-					{
-						button1_clicked = true;
-					}
-					menu->mouse_row = -1;
-				}
-				break;
-			}
-			else if (search_row != -1 && row == search_row)
-			{
-				menu->cursor_row = row;
-				press_accelerator = true;
+		menu->next_loading = NULL;
+	}
 
-				found_row = true;
-				post_menu = true;
-				processed = true;
-				break;
-			}
+	chunks_free(chunks_take(menu));
+}
 
-			last_row = row;
-		}
-		menu_items += 1;
-		row += 1;
-	}
+/*
+ * Displayed instead of placeholders, when no item was pushed to deferred
+ * submenu (menu cannot be empty).
+ */
+static ST_MENU_ITEM loading_empty_item = {"(empty)", 0, NULL, 0, 0, ST_MENU_OPTION_DISABLED, NULL};
 
-	/*
-	 * When rows not found, maybe we would to search limit points
-	 * or we would to return back in ring buffer of menu items.
-	 */
-	if (!found_row)
+/*
+ * Apply pushed items of all loading deferred submenus. First pushed items
+ * replace placeholders. Returns true, when some menu was changed.
+ */
+static bool
+loading_menus_drain(void)
+{
+	struct ST_MENU **ptr = &loading_menus;
+	bool	changed = false;
+
+	while (*ptr)
 	{
-		if (is_menubar)
+		struct ST_MENU *menu = *ptr;
+		ST_MENU_CHUNK *chunks = chunks_take(menu);
+		ST_MENU_CHUNK *chunk;
+
+		for (chunk = chunks; chunk; chunk = chunk->next)
 		{
-			if (c == KEY_RIGHT)
+			if (menu->fill_state != ST_MENU_FILL_LOADING)
+				break;
+
+			if (chunk->nitems > 0)
 			{
-				menu->cursor_row = first_row;
-				processed = true;
+				menu_change_items(menu,
+								  menu->nplaceholders > 0 ? 0 : menu->nitems,
+								  menu->nplaceholders,
+								  chunk->items, chunk->nitems);
+
+				menu->nplaceholders = 0;
+				changed = true;
 			}
-			else if (c == KEY_LEFT)
+
+			if (chunk->last)
 			{
-				menu->cursor_row = last_row;
-				processed = true;
+				if (menu->nplaceholders > 0)
+				{
+					menu_change_items(menu, 0, menu->nplaceholders, &loading_empty_item, 1);
+
+					menu->nplaceholders = 0;
+					changed = true;
+				}
+
+				menu->fill_state = ST_MENU_FILL_DONE;
 			}
 		}
-		else
+
+		chunks_free(chunks);
+
+		if (menu->fill_state != ST_MENU_FILL_LOADING)
 		{
-			if (c == KEY_END)
-			{
-				menu->cursor_row = last_row;
-				processed = true;
-			}
-			else if (c == KEY_DOWN)
-			{
-				menu->cursor_row = first_row;
-				processed = true;
-			}
+			*ptr = menu->next_loading;
+			menu->next_loading = NULL;
 		}
+		else
+			ptr = &menu->next_loading;
 	}
 
-	/* when menubar is changed, unpost active pulldown submenu */
-	if (menu->active_submenu && cursor_row != menu->cursor_row)
+	return changed;
+}
+
+/*
+ * Call fill function of displayed deferred submenus, that was not
+ * filled yet.
+ */
+static bool
+deferred_submenus_start(struct ST_MENU *menu)
+{
+	struct ST_MENU *submenu;
+	bool	started = false;
+
+	for (submenu = menu->active_submenu; submenu; submenu = submenu->active_submenu)
 	{
-		st_menu_unpost(menu->active_submenu, false);
-		menu->active_submenu = NULL;
+		if (submenu->fill && submenu->fill_state == ST_MENU_FILL_NONE &&
+			!panel_hidden(submenu->panel))
+		{
+			/* items pushed before start are not valid */
+			chunks_free(chunks_take(submenu));
 
-		/* remember, submenu was visible */
-		post_menu = true;
+			submenu->fill_state = ST_MENU_FILL_LOADING;
+			submenu->nplaceholders = submenu->nitems;
+
+			submenu->next_loading = loading_menus;
+			loading_menus = submenu;
+
+			submenu->fill(submenu, submenu->fill_code, submenu->fill_data);
+			started = true;
+		}
 	}
 
-	/* enter has sense only on selectable menu item */
-	if ((c == 10 || c == 13) && menu->cursor_row != -1)
-		press_enter = true;
+	return started;
+}
 
-	/*
-	 * Some actions can activate submenu, check it and open it, if it
-	 * is required.
-	 */
-	if (press_accelerator || 
-			  (c == KEY_DOWN && is_menubar) ||
-			  (c == KEY_RIGHT && !is_menubar) ||
-			  (c == 10) || (c == 13) || post_menu)
+/*
+ * Apply pushed items and start filling of opened deferred submenus. When
+ * some item was changed, then visible menu is drawn again.
+ */
+static bool
+menu_process_pending(struct ST_MENU *menu)
+{
+	bool	changed;
+
+	changed = loading_menus_drain();
+
+	if (menu && deferred_submenus_start(menu))
+		changed |= loading_menus_drain();
+
+	if (changed && menu && !panel_hidden(menu->panel))
 	{
-		menu->active_submenu = menu->submenus[menu->cursor_row - 1];
-		if (menu->active_submenu)
-		{
-			/* when submenu is active, then reset accelerator and mouse flags */
-			press_accelerator = false;
-			press_enter = false;
-			button1_clicked = false;
-		}
+		ST_MENU_ITEM *shortcut_item = selected_item;
 
-		/*
-		 * When mouse event opens or reopens submenu, then we take
-		 * this event as processed event. Valid accelerator is processed
-		 * always. Enter (c == 10) is processed always too.
-		 */
-		if (press_accelerator || c == 10 || c == 13)
-			processed = true;
+		if (menu->is_menubar)
+			menubar_draw(menu);
 		else
-			processed = menu->active_submenu != NULL;
+			pulldownmenu_draw(menu, true);
+
+		/* draw routines set selected item to item under cursor */
+		if (press_shortcut)
+			selected_item = shortcut_item;
 	}
 
-	/*
-	 * We can set processed flag, when some mouse row was founded. That means
-	 * so mouse click was somewhere to draw area.
-	 */
-	if (mouse_row != -1)
-		processed = true;
+	if (changed && menu && menu->palette && menu->palette->is_posted)
+		palette_draw(menu);
 
-post_process:
+	return changed;
+}
 
-	/*
-	 * show content, only top object is can do this - nested objects
-	 * are displayed recursivly.
-	 */
-	if (is_top)
-	{
-		/* when we processed some event, then we usually got a full focus */
-		if (processed)
-			menu->focus = ST_MENU_FOCUS_FULL;
-		else
-		{
-			/*
-			 * When event was not processed by menubar, then we
-			 * we can try to sent it to command bar. But with
-			 * full focus, the menubar is hungry, and we send nothing.
-			 */
-			if (active_cmdbar)
-			{
-				if (!menu || menu->focus != ST_MENU_FOCUS_FULL)
-					processed = cmdbar_driver(active_cmdbar, c, alt, mevent);
-			}
-		}
+/*
+ * Set fill function of submenu of item specified by code. The function is
+ * called by driver, when the submenu is displayed first time (or first time
+ * after next call of this function). The current items of submenu are used
+ * as placeholder until first items are pushed by st_menu_push_items.
+ */
+bool
+st_menu_set_deferred(struct ST_MENU *menu, int code,
+					 void (*fill)(struct ST_MENU *submenu, int code, void *data),
+					 void *data)
+{
+	struct ST_MENU *submenu = st_menu_get_submenu(menu, code);
 
-		if (processed)
-		{
-			/* try to search selected item */
-			if (menu)
-				searching_selected_refval_items(menu);
-		}
+	if (!submenu)
+		return false;
+
+	deferred_release(submenu);
+
+	submenu->fill = fill;
+	submenu->fill_data = data;
+	submenu->fill_code = code;
+	submenu->fill_state = ST_MENU_FILL_NONE;
+
+	return true;
+}
+
+/*
+ * Push items to deferred submenu. The items are copied (the texts are not
+ * copied), and they are appended to submenu by driver or by function
+ * st_menu_process_pending. Last chunk of items should to be marked by last
+ * flag. This function can be called from any thread, but it doesn't use
+ * safe_malloc, because trace counters are not thread safe.
+ */
+bool
+st_menu_push_items(struct ST_MENU *submenu, ST_MENU_ITEM *items, int nitems, bool last)
+{
+	ST_MENU_CHUNK *chunk;
+	int		i;
+
+	if (nitems < 0)
+		return false;
+
+	for (i = 0; i < nitems; i++)
+		if (!items[i].text)
+			return false;
+
+	chunk = malloc(sizeof(ST_MENU_CHUNK) + sizeof(ST_MENU_ITEM) * nitems);
+	if (!chunk)
+		return false;
+
+	if (nitems > 0)
+		memcpy(chunk->items, items, sizeof(ST_MENU_ITEM) * nitems);
+
+	chunk->nitems = nitems;
+	chunk->last = last;
 
-		/* postprocess for referenced values */
-		if (selected_item && (press_accelerator || press_enter || button1_clicked))
-		{
-			if (IS_REF_OPTION(selected_options))
-			{
-				if (selected_refval == NULL)
-				{
-					endwin();
-					fprintf(stderr, "detected referenced option without referenced value");
-					exit(1);
-				}
+#ifdef ST_MENU_ATOMIC_CHUNKS
 
-				if (selected_options & ST_MENU_OPTION_MARKED_REF)
-				{
-					*selected_refval = selected_item->data;
-				}
-				else if ((selected_options & ST_MENU_OPTION_SWITCH2_REF) ||
-						 (selected_options & ST_MENU_OPTION_SWITCH3_REF))
-				{
-					*selected_refval = (*selected_refval == 1) ? 0 : 1;
-				}
-			}
-		}
+	chunk->next = atomic_load(&submenu->pending);
+	while (!atomic_compare_exchange_weak(&submenu->pending, &chunk->next, chunk))
+		;
 
-		/*
-		 * command bar should be drawed first - because it is deeper
-		 * than pulldown menu
-		 */
-		if (active_cmdbar)
-			cmdbar_draw(active_cmdbar);
+#else
 
-		if (menu)
-		{
-			if (menu->is_menubar)
-				menubar_draw(menu);
-			else
-				pulldownmenu_draw(menu, true);
+	chunk->next = submenu->pending;
+	submenu->pending = chunk;
 
-			/* eat all keyboard input, when focus is full on top level */
-			if (c != KEY_MOUSE && c != KEY_RESIZE &&
-					c != ST_MENU_ESCAPE &&
-					menu->focus == ST_MENU_FOCUS_FULL)
-				processed = true;
-		}
-	}
+#endif
 
-	return processed;
+	return true;
 }
 
+/*
+ * Apply items pushed to deferred submenus. It should be called periodically
+ * (by example, when input timeouts), because the driver applies these items
+ * only when it processes some event. Returns true, when some menu was changed
+ * (and drawn again, when it is visible).
+ */
 bool
-st_menu_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent)
+st_menu_process_pending(struct ST_MENU *menu)
 {
-	bool		aux_unpost_submenu = false;
+	return menu_process_pending(menu);
+}
 
-	/*
-	 * We should to complete mouse click based on two
-	 * events. Mouse click is valid if press, release
-	 * was related with same command. Now, when mouse
-	 * is pressed, we don't know a related object, but
-	 * we can reset selected_command variable.
-	 */
-	if (c != KEY_MOUSE || mevent->bstate & BUTTON1_PRESSED)
-	{
-		selected_command = NULL;
-		command_was_activated = false;
-	}
+/*
+ * Returns true, when event is typed char. Like accelerators, codes of wide
+ * chars and codes of keys are not distinguished, and only keys with some
+ * meaning in menu are ignored.
+ */
+static bool
+is_typed_char(int c, bool alt)
+{
+	return !alt && c >= 32 && iswprint(c)
+		   && c != KEY_LEFT && c != KEY_RIGHT && c != KEY_UP && c != KEY_DOWN
+		   && c != KEY_HOME && c != KEY_END && c != KEY_PPAGE && c != KEY_NPAGE
+		   && c != KEY_BTAB && c != KEY_IC && c != KEY_DC && c != KEY_MOUSE
+		   && c != KEY_RESIZE;
+}
 
-	/*
-	 * We would to close pulldown menus on F10 key - similar behave
-	 * like SCAPE, so we can translate F10 event to ST_MENU_ESCAPE,
-	 * when menubar can accept these keys (based on focus).
-	 */
-	if (menu && KEY_F(10) == c && menu->focus == ST_MENU_FOCUS_FULL)
-		c = ST_MENU_ESCAPE;
+/*
+ * Returns key of char used by command palette. ASCII chars are folded by
+ * tolower, other chars are folded like accelerators, and the hash of
+ * folded bytes is used (with highest bit, so it cannot be ASCII char).
+ */
+static unsigned int
+palette_key(ST_MENU_CONFIG *config, char *str)
+{
+	char		buffer[64];
+	unsigned int h = 2166136261u;
+	int			length;
+	int			i;
+
+	if ((*str & 0x80) == 0 || config->force8bit)
+		return tolower((unsigned char) *str);
 
-	return _st_menu_driver(menu, c, alt, mevent, true, false, &aux_unpost_submenu);
+	length = chr_casexfrm_buf(config, str, buffer, sizeof(buffer));
+
+	for (i = 0; i < length; i++)
+		h = (h ^ (unsigned char) buffer[i]) * 16777619u;
+
+	return h | 0x80000000u;
 }
 
 /*
- * Create state variable for pulldown menu. It based on template - a array of ST_MENU_ITEM fields.
- * The initial position can be specified. The config (specify desplay properties) should be
- * passed. The config can be own or preloaded from preddefined styles by function st_menu_load_style.
- * a title is not supported yet.
+ * Returns id of key. ASCII keys are used as ids, other keys get ids from
+ * hash table. When add is false, then unknown key returns 0 (no label
+ * contains zero char). When all ids are used, then last id is shared
+ * by all next keys.
  */
-struct ST_MENU *
-st_menu_new(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items, int begin_y, int begin_x, char *title)
+static int
+palette_id(ST_MENU_PALETTE *palette, unsigned int key, bool add)
 {
-	struct ST_MENU *menu;
-	int		rows, cols;
-	int		adjusted_rows, adjusted_cols;
-	int		adjusted_begin_y, adjusted_begin_x;
-	int		adjusted_shadow_rows, adjusted_shadow_cols;
-	int		adjusted_shadow_begin_y, adjusted_shadow_begin_x;
-	ST_MENU_ITEM *menu_item;
-	int		menu_fields = 0;
-	int		i;
-
-	menu = safe_malloc(sizeof(struct ST_MENU));
+	unsigned int h;
 
-	menu->menu_items = menu_items;
-	menu->config = config;
-	menu->title = title;
-	menu->naccelerators = 0;
-	menu->is_menubar = false;
-	menu->mouse_row = -1;
-	menu->first_row = 1;
+	if (key < 128)
+		return key;
 
-	/* how much items are in template */
-	menu_item = menu_items;
-	while (menu_item->text != NULL)
+	/* the table grows only when key is added, lookup can use full table */
+	if (add && (palette->nids - 128 + 1) * 2 > palette->id_table_size)
 	{
-		menu_fields += 1;
-		menu_item += 1;
-	}
+		unsigned int *id_keys = palette->id_keys;
+		unsigned short *id_values = palette->id_values;
+		int		size = palette->id_table_size;
+		int		i;
 
-	/* preallocate good enough memory */
-	menu->accelerators = safe_malloc(sizeof(ST_MENU_ACCELERATOR) * menu_fields);
-	menu->submenus = safe_malloc(sizeof(struct ST_MENU) * menu_fields);
-	menu->options = safe_malloc(sizeof(int) * menu_fields);
-	menu->refvals = safe_malloc(sizeof(int*) * menu_fields);
+		palette->id_table_size = max_int(size * 2, 256);
+		palette->id_keys = safe_malloc(sizeof(unsigned int) * palette->id_table_size);
+		palette->id_values = safe_malloc(sizeof(unsigned short) * palette->id_table_size);
 
-	menu->nitems = menu_fields;
+		for (i = 0; i < size; i++)
+		{
+			if (id_keys[i])
+			{
+				h = (id_keys[i] * 2654435761u) & (palette->id_table_size - 1);
+
+				while (palette->id_keys[h])
+					h = (h + 1) & (palette->id_table_size - 1);
+
+				palette->id_keys[h] = id_keys[i];
+				palette->id_values[h] = id_values[i];
+			}
+		}
+
+		free(id_keys);
+		free(id_values);
+	}
+
+	/* there are not any non ASCII keys */
+	if (palette->id_table_size == 0)
+		return 0;
 
-	/* get pull down menu dimensions */
-	pulldownmenu_content_size(config, menu_items, &rows, &cols,
-							&menu->shortcut_x_pos, &menu->item_x_pos,
-							menu->accelerators, &menu->naccelerators,
-							&menu->cursor_row);
+	h = (key * 2654435761u) & (palette->id_table_size - 1);
 
-	if (config->draw_box)
+	while (palette->id_keys[h])
 	{
-		rows += 2;
-		cols += 2;
+		if (palette->id_keys[h] == key)
+			return palette->id_values[h];
+
+		h = (h + 1) & (palette->id_table_size - 1);
 	}
 
-	if (config->wide_vborders)
-		cols += 2;
-	if (config->wide_hborders)
-		rows += 2;
+	if (!add)
+		return 0;
 
-	menu->ideal_y_pos = begin_y;
-	menu->ideal_x_pos = begin_x;
-	menu->rows = rows;
-	menu->cols = cols;
+	palette->id_keys[h] = key;
+	palette->id_values[h] = min_int(palette->nids, ST_MENU_PALETTE_MAX_IDS - 1);
+	palette->nids += 1;
 
-	/*
-	 * We try to corect dimensions of windows, because pdcurses doesn't allow
-	 * parts of window to be out of screen.
-	 */
-	adjust_dimensions(rows, cols, begin_y, begin_x, 1, 0, config->shadow_width,
-					  &adjusted_rows, &adjusted_cols,
-					  &adjusted_begin_y, &adjusted_begin_x,
-					  &adjusted_shadow_rows, &adjusted_shadow_cols,
-					  &adjusted_shadow_begin_y, &adjusted_shadow_begin_x);
+	return palette->id_values[h];
+}
 
-	/* Prepare property for menu shadow */
-	if (config->shadow_width > 0)
+static inline uint64_t
+palette_id_mask(int id)
+{
+	return (uint64_t) 1 << (((unsigned int) id * 2654435761u) >> 26);
+}
+
+/*
+ * Append zero terminated breadcrumb to paths buffer. Returns its offset.
+ */
+static int
+palette_add_path(ST_MENU_PALETTE *palette, int parent, const char *text, ST_MENU_LABEL *label)
+{
+	int		parent_length = parent != -1 ? strlen(palette->paths + parent) : 0;
+	int		size = parent_length + 3 + strlen(text) + 1;
+	int		result = palette->paths_size;
+	char   *ptr;
+	int		j;
+
+	if (palette->paths_size + size > palette->paths_capacity)
 	{
-		menu->shadow_window = newwin(adjusted_shadow_rows, adjusted_shadow_cols,
-									 adjusted_shadow_begin_y, adjusted_shadow_begin_x);
-		menu->shadow_panel = new_panel(menu->shadow_window);
+		palette->paths_capacity = max_int(palette->paths_capacity * 2, palette->paths_size + size + 1024);
+		palette->paths = safe_realloc(palette->paths, palette->paths_capacity);
+	}
 
-		hide_panel(menu->shadow_panel);
-		wbkgd(menu->shadow_window, COLOR_PAIR(config->menu_shadow_cpn) | config->menu_shadow_attr);
+	ptr = palette->paths + result;
 
-		wnoutrefresh(menu->shadow_window);
+	if (parent_length > 0)
+	{
+		memcpy(ptr, palette->paths + parent, parent_length);
+		memcpy(ptr + parent_length, " > ", 3);
+		ptr += parent_length + 3;
 	}
-	else
+
+	/* label without ~ and _ marks */
+	for (j = 0; j < label->nchars; j++)
 	{
-		menu->shadow_window = NULL;
-		menu->shadow_panel = NULL;
+		memcpy(ptr, text + label->offsets[j], label->lengths[j]);
+		ptr += label->lengths[j];
 	}
 
-	menu->window = newwin(adjusted_rows, adjusted_cols, adjusted_begin_y, adjusted_begin_x);
+	*ptr++ = '\0';
 
-	wbkgd(menu->window, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
-	wnoutrefresh(menu->window);
+	palette->paths_size = ptr - palette->paths;
 
-	/*
-	 * Initialize submenu states (nested submenus)
-	 */
-	menu_item = menu_items;
-	i = 0;
-	while (menu_item->text)
+	return result;
+}
+
+/*
+ * Add selectable items of menu and its submenus to index
+ */
+static void
+palette_collect(ST_MENU_PALETTE *palette, struct ST_MENU *menu, int path)
+{
+	ST_MENU_CONFIG *config = menu->config;
+	int		i, j;
+
+	for (i = 0; i < menu->nitems; i++)
 	{
-		if (menu_item->submenu)
+		ST_MENU_ITEM *menu_item = &menu->menu_items[i];
+		ST_MENU_LABEL *label = &menu->labels[i];
+		ST_MENU_PALETTE_ENTRY *entry;
+
+		if (!is_selectable_item(menu_item))
+			continue;
+
+		if (menu->submenus[i])
 		{
-			menu->submenus[i] = 
-					st_menu_new(config, menu_item->submenu,
-										begin_y + i + config->submenu_offset_y
-										+ (config->draw_box ? 1 : 0)
-										+ (config->wide_vborders ? 1 : 0),
-										begin_x + cols + config->submenu_offset_x,
-										NULL);
+			palette_collect(palette, menu->submenus[i],
+							palette_add_path(palette, path, menu_item->text, label));
+			continue;
 		}
-		else
-			menu->submenus[i] = NULL;
 
-		menu->options[i] = menu_item->options;
-		menu->refvals[i] = NULL;
+		if (palette->nentries == palette->entries_capacity)
+		{
+			palette->entries_capacity = max_int(palette->entries_capacity * 2, 256);
+			palette->entries = safe_realloc(palette->entries,
+											sizeof(ST_MENU_PALETTE_ENTRY) * palette->entries_capacity);
+		}
 
-		menu_item += 1;
-		i += 1;
+		if (palette->nkeys + label->nchars > palette->keys_capacity)
+		{
+			palette->keys_capacity = max_int(palette->keys_capacity * 2,
+											 palette->nkeys + label->nchars + 4096);
+			palette->ids = safe_realloc(palette->ids, sizeof(unsigned short) * palette->keys_capacity);
+			palette->word_starts = safe_realloc(palette->word_starts, palette->keys_capacity);
+			palette->words = safe_realloc(palette->words, sizeof(int) * palette->keys_capacity);
+		}
+
+		entry = &palette->entries[palette->nentries++];
+
+		entry->menu = menu;
+		entry->offset = i;
+		entry->start = palette->nkeys;
+		entry->nkeys = min_int(label->nchars, ST_MENU_PALETTE_MAX_CHARS);
+		entry->words = palette->nwords;
+		entry->nwords = 0;
+		entry->mask = 0;
+		entry->path = path;
+
+		for (j = 0; j < entry->nkeys; j++)
+		{
+			unsigned int key = palette_key(config, menu_item->text + label->offsets[j]);
+
+			int		id = palette_id(palette, key, true);
+
+			palette->ids[palette->nkeys] = id;
+			palette->word_starts[palette->nkeys] = j == 0 || !iswalnum(label->codes[j - 1]);
+			palette->nkeys += 1;
+
+			if (palette->word_starts[palette->nkeys - 1])
+			{
+				palette->words[palette->nwords++] = j;
+				entry->nwords += 1;
+			}
+
+			entry->mask |= palette_id_mask(id);
+		}
+
+		palette->max_nkeys = max_int(palette->max_nkeys, entry->nkeys);
 	}
+}
 
-	/* draw area can be same like window or smaller */
-	if (config->wide_vborders || config->wide_hborders)
+/*
+ * Returns score of matched char. Chars on begin of words and consecutive
+ * chars are preferred.
+ */
+static inline int
+palette_char_score(unsigned char *word_starts, int p, int prev)
+{
+	return 1 + (word_starts[p] ? 8 : 0) + (p == prev + 1 ? 4 : 0) + (p == 0 ? 4 : 0);
+}
+
+/*
+ * Returns position of next occurrence of char after position prev (-1
+ * for begin of label), or -1. When preferred is true, then next char,
+ * first char on begin of word, or first char is used (in this order).
+ */
+static inline int
+palette_next(ST_MENU_PALETTE *palette, ST_MENU_PALETTE_ENTRY *entry,
+			 int id, int prev, bool preferred)
+{
+	unsigned short *ids = palette->ids + entry->start;
+	int		p;
+
+	if (preferred)
 	{
-		menu->draw_area = derwin(menu->window,
-			adjusted_rows - (config->wide_hborders ? 2 : 0),
-			adjusted_cols - (config->wide_vborders ? 2 : 0),
-			config->wide_hborders ? 1 : 0,
-			config->wide_vborders ? 1 : 0);
+		int	   *words = palette->words + entry->words;
+		int		w;
 
-		wbkgd(menu->draw_area, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
+		if (prev + 1 < entry->nkeys && ids[prev + 1] == id)
+			return prev + 1;
 
-		wnoutrefresh(menu->draw_area);
+		for (w = 0; w < entry->nwords; w++)
+			if (words[w] > prev && ids[words[w]] == id)
+				return words[w];
 	}
-	else
-		menu->draw_area = menu->window;
 
-	menu->panel = new_panel(menu->window);
-	hide_panel(menu->panel);
+	for (p = prev + 1; p < entry->nkeys; p++)
+		if (ids[p] == id)
+			return p;
 
-	return menu;
+	return -1;
 }
 
 /*
- * Create state variable for menubar based on template (array) of ST_MENU_ITEM
+ * Search alignment of query in label of entry. Returns score of alignment
+ * or -1, when query is not matched. When positions is not NULL, then matched
+ * chars are marked.
  */
-struct ST_MENU *
-st_menu_new_menubar2(ST_MENU_CONFIG *barcfg, ST_MENU_CONFIG *pdcfg, ST_MENU_ITEM *menu_items)
+static int
+palette_align(ST_MENU_PALETTE *palette, ST_MENU_PALETTE_ENTRY *entry, bool preferred, bool *positions)
 {
-	struct ST_MENU *menu;
-	int		maxy, maxx;
-	ST_MENU_ITEM *menu_item;
-	int		menu_fields = 0;
-	int		aux_width = 0;
-	int		text_space;
-	int		current_pos;
-	int		i = 0;
-	int		naccel = 0;
+	unsigned char *word_starts = palette->word_starts + entry->start;
+	int		prev = -2;
+	int		score = 0;
+	int		k;
 
-	if (pdcfg == NULL)
-		pdcfg = barcfg;
+	if (positions)
+		memset(positions, 0, sizeof(bool) * entry->nkeys);
 
-	getmaxyx(stdscr, maxy, maxx);
+	for (k = 0; k < palette->query_length; k++)
+	{
+		int		p = palette_next(palette, entry, palette->query_ids[k], max_int(prev, -1), preferred);
 
-	menu = safe_malloc(sizeof(struct ST_MENU));
+		if (p == -1)
+			return -1;
 
-	maxy = 1;
-	menu->window = newwin(maxy, maxx, 0, 0);
-	menu->panel = new_panel(menu->window);
+		score += palette_char_score(word_starts, p, prev);
 
-	/* there are not shadows */
-	menu->shadow_window = NULL;
-	menu->shadow_panel = NULL;
+		if (positions)
+			positions[p] = true;
+
+		prev = p;
+	}
+
+	return score;
+}
+
+/*
+ * Mark matched chars of better alignment of entry. It is used for drawing,
+ * and the result is same like result of incremental search.
+ */
+static void
+palette_mark(ST_MENU_PALETTE *palette, ST_MENU_PALETTE_ENTRY *entry, bool *positions)
+{
+	int		leftmost_score = palette_align(palette, entry, false, NULL);
+	int		preferred_score = palette_align(palette, entry, true, NULL);
+
+	palette_align(palette, entry, preferred_score > leftmost_score, positions);
+}
+
+/*
+ * Select best entries of level. Entries with same score are in order of
+ * menu tree. Level 0 contains all entries (with zero score).
+ */
+static void
+palette_select(ST_MENU_PALETTE *palette)
+{
+	ST_MENU_PALETTE_LEVEL *level = &palette->levels[palette->query_length];
+	int		i;
 
-	menu->config = barcfg;
-	menu->menu_items = menu_items;
-	menu->cursor_row = 1;
-	menu->first_row = 1;
-	menu->active_submenu = NULL;
+	palette->nresults = 0;
+	palette->cursor = 0;
+	palette->mouse_row = -1;
 
-	menu->is_menubar = true;
-	menu->mouse_row = -1;
+	if (palette->query_length == 0)
+	{
+		for (i = 0; i < palette->nentries && i < ST_MENU_PALETTE_MAX_RESULTS; i++)
+		{
+			palette->results[i] = i;
+			palette->result_scores[i] = 0;
+		}
 
-	wbkgd(menu->window, COLOR_PAIR(barcfg->menu_background_cpn) | barcfg->menu_background_attr);
+		palette->nresults = i;
+		return;
+	}
 
-	menu_item = menu_items;
-	while (menu_item->text)
+	for (i = 0; i < level->count; i++)
 	{
-		menu_fields += 1;
+		int		score = level->matches[i].score;
+		int		j;
 
-		if (barcfg->text_space == -1)
-			aux_width += menutext_displaywidth(barcfg, menu_item->text, NULL, NULL);
+		if (palette->nresults == ST_MENU_PALETTE_MAX_RESULTS &&
+			score <= palette->result_scores[ST_MENU_PALETTE_MAX_RESULTS - 1])
+			continue;
 
-		menu_item += 1;
+		if (palette->nresults < ST_MENU_PALETTE_MAX_RESULTS)
+			palette->nresults += 1;
+
+		for (j = palette->nresults - 1; j > 0 && palette->result_scores[j - 1] < score; j--)
+		{
+			palette->results[j] = palette->results[j - 1];
+			palette->result_scores[j] = palette->result_scores[j - 1];
+		}
+
+		palette->results[j] = level->matches[i].entry;
+		palette->result_scores[j] = score;
 	}
+}
 
-	/*
-	 * last bar position is hypotetical - we should not to calculate length of last field
-	 * every time.
-	 */
-	menu->bar_fields_x_pos = safe_malloc(sizeof(int) * (menu_fields + 1));
-	menu->submenus = safe_malloc(sizeof(struct ST_MENU) * menu_fields);
-	menu->accelerators = safe_malloc(sizeof(ST_MENU_ACCELERATOR) * menu_fields);
-	menu->options = safe_malloc(sizeof(int) * menu_fields);
-	menu->refvals = safe_malloc(sizeof(int*) * menu_fields);
+/*
+ * Fill level n (query has n chars). Level 1 is created from posting list
+ * of first char. Next levels are created from previous level - both
+ * alignments are extended by last char of query.
+ */
+static void
+palette_search(ST_MENU_PALETTE *palette, int n)
+{
+	ST_MENU_PALETTE_LEVEL *prev = &palette->levels[n - 1];
+	ST_MENU_PALETTE_LEVEL *level = &palette->levels[n];
+	int		id = palette->query_ids[n - 1];
+	int		count;
+	int		i;
 
-	menu->nitems = menu_fields; 
+	count = n > 1 ? prev->count : palette->postings_start[id + 1] - palette->postings_start[id];
 
-	/*
-	 * When text_space is not defined, then try to vallign menu items
-	 */
-	if (barcfg->text_space == -1)
-	{
-		text_space = (maxx + 1 - aux_width) / (menu_fields + 1);
-		if (text_space < 4)
-			text_space = 4;
-		else if (text_space > 15)
-			text_space = 15;
-		current_pos = text_space;
-	}
-	else
+	if (level->capacity < count)
 	{
-		text_space = barcfg->text_space;
-		current_pos = barcfg->init_text_space;
+		level->capacity = max_int(count, 64);
+		level->matches = safe_realloc(level->matches, sizeof(ST_MENU_PALETTE_MATCH) * level->capacity);
 	}
 
-	/* Initialize submenu */
-	menu_item = menu_items; i = 0;
-	while (menu_item->text)
+	level->count = 0;
+
+	if (n == 1)
 	{
-		char	*accelerator;
+		ST_MENU_PALETTE_POSTING *postings = palette->postings + palette->postings_start[id];
 
-		menu->bar_fields_x_pos[i] = current_pos;
-		current_pos += menutext_displaywidth(barcfg, menu_item->text, &accelerator, NULL);
-		current_pos += text_space;
-		if (menu_item->submenu)
+		for (i = 0; i < count; i++)
 		{
-			menu->submenus[i] = 
-					st_menu_new(pdcfg, menu_item->submenu,
-										1, menu->bar_fields_x_pos[i] + 
-										pdcfg->menu_bar_menu_offset
-										- (pdcfg->draw_box ? 1 : 0)
-										- (pdcfg->wide_vborders ? 1 : 0)
-										- (pdcfg->extra_inner_space ? 1 : 0) - 1, NULL);
+			ST_MENU_PALETTE_MATCH *match = &level->matches[i];
+
+			match->entry = postings[i].entry;
+			match->score = postings[i].score;
+			match->leftmost = postings[i].first;
+			match->leftmost_score = postings[i].first_score;
+			match->preferred = postings[i].preferred;
+			match->preferred_score = postings[i].preferred_score;
 		}
-		else
-			menu->submenus[i] = NULL;
 
-		if (accelerator)
-		{
-			menu->accelerators[naccel].c = chr_casexfrm(barcfg, accelerator);
-			menu->accelerators[naccel].length = strlen(menu->accelerators[naccel].c);
-			menu->accelerators[naccel++].row = i + 1;
-		}
+		level->count = count;
 
-		menu->naccelerators = naccel;
+		return;
+	}
 
-		menu->options[i] = menu_item->options;
-		menu->refvals[i] = NULL;
+	for (i = 0; i < count; i++)
+	{
+		ST_MENU_PALETTE_MATCH *pm = &prev->matches[i];
+		ST_MENU_PALETTE_ENTRY *entry = &palette->entries[pm->entry];
+		ST_MENU_PALETTE_MATCH *match;
+		unsigned char *word_starts;
+		int		p;
 
-		menu_item += 1;
-		i += 1;
-	}
+		if (!(entry->mask & palette_id_mask(id)))
+			continue;
 
-	/*
-	 * store hypotetical x bar position
-	 */
-	menu->bar_fields_x_pos[i] = current_pos;
+		word_starts = palette->word_starts + entry->start;
 
-	return menu;
-}
+		p = palette_next(palette, entry, id, pm->leftmost, false);
+		if (p == -1)
+			continue;
 
-struct ST_MENU *
-st_menu_new_menubar(ST_MENU_CONFIG *config, ST_MENU_ITEM *menu_items)
-{
-	return st_menu_new_menubar2(config, NULL, menu_items);
+		match = &level->matches[level->count++];
+
+		match->entry = pm->entry;
+		match->leftmost = p;
+		match->leftmost_score = pm->leftmost_score + palette_char_score(word_starts, p, pm->leftmost);
+		match->preferred = -1;
+		match->preferred_score = -1;
+
+		if (pm->preferred != -1)
+		{
+			/*
+			 * When both alignments ends on same char, then first occurrence
+			 * of next char is known already, and only words after it can be
+			 * preferred.
+			 */
+			if (pm->preferred == pm->leftmost)
+			{
+				if (p != pm->leftmost + 1 && !word_starts[p])
+				{
+					unsigned short *ids = palette->ids + entry->start;
+					int	   *words = palette->words + entry->words;
+					int		w;
+
+					for (w = 0; w < entry->nwords; w++)
+						if (words[w] > p && ids[words[w]] == id)
+						{
+							p = words[w];
+							break;
+						}
+				}
+			}
+			else
+				p = palette_next(palette, entry, id, pm->preferred, true);
+
+			if (p != -1)
+			{
+				match->preferred = p;
+				match->preferred_score = pm->preferred_score + palette_char_score(word_starts, p, pm->preferred);
+			}
+		}
+
+		match->score = max_int(match->leftmost_score, match->preferred_score) * 16 - entry->nkeys;
+	}
 }
 
 /*
- * Remove all objects allocated by menu and nested objects
- * it is workhorse for st_menu_free
+ * Build posting lists. Every entry is in posting list of every its char
+ * only once.
  */
 static void
-_st_menu_free(struct ST_MENU *menu)
+palette_build_postings(ST_MENU_PALETTE *palette)
 {
-	if (menu)
+	int		nids = min_int(palette->nids, ST_MENU_PALETTE_MAX_IDS);
+	int	   *last_entry = safe_malloc(sizeof(int) * nids);
+	int	   *next = safe_malloc(sizeof(int) * nids);
+	int		total = 0;
+	int		e, i;
+
+	palette->postings_start = safe_realloc(palette->postings_start, sizeof(int) * (nids + 1));
+
+	for (i = 0; i < nids; i++)
+		last_entry[i] = -1;
+
+	memset(next, 0, sizeof(int) * nids);
+
+	for (e = 0; e < palette->nentries; e++)
 	{
-		int		i;
+		ST_MENU_PALETTE_ENTRY *entry = &palette->entries[e];
 
-		if (menu->submenus)
+		for (i = 0; i < entry->nkeys; i++)
 		{
-			for (i = 0; i < menu->nitems; i++)
-				st_menu_free(menu->submenus[i]);
+			int		id = palette->ids[entry->start + i];
 
-			free(menu->submenus);
+			if (last_entry[id] != e)
+			{
+				last_entry[id] = e;
+				next[id] += 1;
+			}
 		}
+	}
 
-		for (i = 0; i < menu->naccelerators; i++)
-			free(menu->accelerators[i].c);
+	for (i = 0; i < nids; i++)
+	{
+		int		count = next[i];
+
+		palette->postings_start[i] = total;
+		next[i] = total;
+		last_entry[i] = -1;
+		total += count;
+	}
 
-		free(menu->accelerators);
+	palette->postings_start[nids] = total;
 
-		if (menu->shadow_panel)
-			del_panel(menu->shadow_panel);
-		if (menu->shadow_window)
-			delwin(menu->shadow_window);
+	palette->postings = safe_realloc(palette->postings,
+									 sizeof(ST_MENU_PALETTE_POSTING) * max_int(total, 1));
 
-		del_panel(menu->panel);
+	for (e = 0; e < palette->nentries; e++)
+	{
+		ST_MENU_PALETTE_ENTRY *entry = &palette->entries[e];
+		unsigned char *word_starts = palette->word_starts + entry->start;
 
-		/* pdcurses doesn't like deleting window with subwindows */
-		if (menu->window != menu->draw_area && menu->draw_area)
-			delwin(menu->draw_area);
+		for (i = 0; i < entry->nkeys; i++)
+		{
+			int		id = palette->ids[entry->start + i];
 
-		delwin(menu->window);
+			if (last_entry[id] != e)
+			{
+				ST_MENU_PALETTE_POSTING *posting = &palette->postings[next[id]++];
 
-		free(menu->bar_fields_x_pos);
-		free(menu->options);
-		free(menu->refvals);
+				last_entry[id] = e;
+				posting->entry = e;
+				posting->first = i;
+				posting->preferred = i;
+			}
+			else
+			{
+				ST_MENU_PALETTE_POSTING *posting = &palette->postings[next[id] - 1];
 
-		free(menu);
+				if (!word_starts[posting->preferred] && word_starts[i])
+					posting->preferred = i;
+			}
+		}
 	}
-}
 
-void
-st_menu_free(struct ST_MENU *menu)
-{
-	_st_menu_free(menu);
+	for (i = 0; i < total; i++)
+	{
+		ST_MENU_PALETTE_POSTING *posting = &palette->postings[i];
+		ST_MENU_PALETTE_ENTRY *entry = &palette->entries[posting->entry];
+		unsigned char *word_starts = palette->word_starts + entry->start;
 
-	update_panels();
+		posting->first_score = palette_char_score(word_starts, posting->first, -2);
+		posting->preferred_score = palette_char_score(word_starts, posting->preferred, -2);
+		posting->score = max_int(posting->first_score, posting->preferred_score) * 16 - entry->nkeys;
+	}
+
+	free(last_entry);
+	free(next);
 }
 
 /*
- * Returns active item and info about selecting of active item
+ * Build index of menu tree again, and search current query
  */
-ST_MENU_ITEM *
-st_menu_selected_item(bool *activated)
+static void
+palette_build(ST_MENU_PALETTE *palette, struct ST_MENU *menu)
 {
-	/*
-	 * Activated can be true only when selected_item is valid
-	 */
-	if (selected_item)
-		*activated = press_accelerator || press_enter || button1_clicked;
-	else
-		*activated = false;
+	int		n;
 
-	return selected_item;
+	palette->nentries = 0;
+	palette->nkeys = 0;
+	palette->nwords = 0;
+	palette->max_nkeys = 0;
+	palette->paths_size = 0;
+	palette->nids = 128;
+
+	if (palette->id_keys)
+		memset(palette->id_keys, 0, sizeof(unsigned int) * palette->id_table_size);
+
+	palette_collect(palette, menu, -1);
+	palette_build_postings(palette);
+
+	free(palette->positions);
+	palette->positions = safe_malloc(sizeof(bool) * (palette->max_nkeys + 1));
+
+	/* ids are assigned again */
+	for (n = 0; n < palette->query_length; n++)
+		palette->query_ids[n] = palette_id(palette,
+										   palette_key(menu->config, palette->query + palette->query_offsets[n]),
+										   false);
+
+	for (n = 1; n <= palette->query_length; n++)
+		palette_search(palette, n);
+
+	palette_select(palette);
+
+	palette->is_valid = true;
 }
 
 /*
- * Set flag of first menu item specified by code
+ * Append typed char to query, or remove last char (when c is 0)
  */
-bool
-st_menu_enable_option(struct ST_MENU *menu, int code, int option)
+static void
+palette_query_change(ST_MENU_PALETTE *palette, ST_MENU_CONFIG *config, int c)
 {
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
+	int		n = palette->query_length;
 
-	while (menu_items->text)
+	if (c)
 	{
-		if (menu_items->code == code)
-		{
-			menu->options[i] |= option;
-			return true;
-		}
+		char   *str = palette->query + palette->query_offsets[n];
 
-		if (menu->submenus[i])
-			if (st_menu_enable_option(menu->submenus[i], code, option))
-				return true;
+		if (n == ST_MENU_PALETTE_MAX_QUERY)
+			return;
 
-		menu_items += 1;
-		i += 1;
+		palette->query_offsets[n + 1] = palette->query_offsets[n] +
+									wchar_to_utf8(config, str, 4, (wchar_t) c);
+		palette->query[palette->query_offsets[n + 1]] = '\0';
+
+		palette->query_ids[n] = palette_id(palette, palette_key(config, str), false);
+		palette->query_length = n + 1;
+
+		palette_search(palette, n + 1);
+	}
+	else
+	{
+		if (n == 0)
+			return;
+
+		palette->query_length = n - 1;
+		palette->query[palette->query_offsets[n - 1]] = '\0';
 	}
 
-	return false;
+	palette_select(palette);
 }
 
 /*
- * Reset flag of first menu item specified by code
+ * Draw command palette - query line and best results with breadcrumbs.
+ * The window is created again, when size of screen was changed.
  */
-bool
-st_menu_reset_option(struct ST_MENU *menu, int code, int option)
+static void
+palette_draw(struct ST_MENU *menu)
 {
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
+	ST_MENU_PALETTE *palette = menu->palette;
+	ST_MENU_CONFIG *config = menu->config;
+	bool	force_ascii_art = config->force_ascii_art;
+	WINDOW *window;
+	int		maxy, maxx;
+	int		text_max_x;
+	int		query_x, query_max_x;
+	char	buffer[32];
+	int		start;
+	int		r, i;
 
-	while (menu_items->text)
+	if (!palette->is_valid)
+		palette_build(palette, menu);
+
+	getmaxyx(stdscr, maxy, maxx);
+
+	if (!palette->window || maxy != palette->screen_rows || maxx != palette->screen_cols)
 	{
-		if (menu_items->code == code)
+		if (palette->window)
 		{
-			menu->options[i] &= ~option;
-			return true;
+			del_panel(palette->panel);
+			delwin(palette->window);
 		}
 
-		if (menu->submenus[i])
-			if (st_menu_reset_option(menu->submenus[i], code, option))
-				return true;
+		palette->screen_rows = maxy;
+		palette->screen_cols = maxx;
+		palette->rows = max_int(min_int(ST_MENU_PALETTE_MAX_RESULTS + 4, maxy), 5);
+		palette->cols = max_int(min_int(72, maxx - 4), 20);
 
-		menu_items += 1;
-		i += 1;
+		palette->window = newwin(palette->rows, palette->cols,
+								 max_int((maxy - palette->rows) / 3, 0),
+								 max_int((maxx - palette->cols) / 2, 0));
+		wbkgd(palette->window, COLOR_PAIR(config->menu_background_cpn) | config->menu_background_attr);
+
+		palette->panel = new_panel(palette->window);
+
+		TRACE_COUNT(allocations, 2);
+		TRACE_COUNT(windows, 1);
 	}
 
-	return false;
-}
+	window = palette->window;
 
-/*
- * Reset flag of first menu item specified by code
- */
-bool
-st_menu_reset_all_options(struct ST_MENU *menu, int option)
-{
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
+	show_panel(palette->panel);
+	top_panel(palette->panel);
 
-	while (menu_items->text)
+	traced_update_panels();
+
+	st_menu_backend->erase_window(window);
+
+	if (!force_ascii_art)
+		st_menu_backend->draw_border(window, 0, 0, 0, 0, 0, 0, 0, 0);
+	else
+		st_menu_backend->draw_border(window, '|', '|', '-', '-', '+', '+', '+', '+');
+
+	/* separator of query line */
+	wmove(window, 2, 0);
+	st_menu_backend->put_ch(window, force_ascii_art ? '|' : ACS_LTEE);
+	for (i = 1; i < palette->cols - 1; i++)
+		st_menu_backend->put_ch(window, force_ascii_art ? '-' : ACS_HLINE);
+	st_menu_backend->put_ch(window, force_ascii_art ? '|' : ACS_RTEE);
+
+	text_max_x = palette->cols - 2;
+
+	/* number of matched items */
+	snprintf(buffer, sizeof(buffer), "%d/%d",
+			 palette->query_length > 0 ? palette->levels[palette->query_length].count : palette->nentries,
+			 palette->nentries);
+
+	query_max_x = text_max_x - strlen(buffer) - 1;
+
+	wmove(window, 1, query_max_x + 1);
+	wattron(window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+	st_menu_backend->put_str(window, buffer, -1);
+	wattroff(window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+
+	wmove(window, 1, 2);
+	st_menu_backend->put_str(window, "> ", -1);
+	query_x = 4;
+
+	/* only end of long query is displayed */
+	for (start = 0; start < palette->query_length; start++)
 	{
-		menu->options[i] &= ~option;
+		int		width = str_width(config, palette->query + palette->query_offsets[start]);
+
+		if (query_x + width <= query_max_x)
+			break;
+	}
+
+	st_menu_backend->put_str(window, palette->query + palette->query_offsets[start], -1);
+
+	for (r = 0; r < palette->nresults && r < palette->rows - 4; r++)
+	{
+		ST_MENU_PALETTE_ENTRY *entry = &palette->entries[palette->results[r]];
+		ST_MENU_LABEL *label = &entry->menu->labels[entry->offset];
+		char   *text = entry->menu->menu_items[entry->offset].text;
+		bool	is_cursor_row = r == palette->cursor;
+		bool	is_disabled = !item_is_accessible(entry->menu, entry->offset);
+		bool   *positions = palette->positions;
+		int		label_max_x = text_max_x;
+		int		x = 2;
+		int		j, k;
+
+		palette_mark(palette, entry, positions);
+
+		if (is_cursor_row)
+		{
+			st_menu_backend->change_attr(window, r + 3, 1, palette->cols - 2,
+										 config->cursor_attr, config->cursor_cpn);
+			wattron(window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+		}
+
+		if (is_disabled)
+			wattron(window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+
+		/* breadcrumb is right aligned, the begin of long breadcrumb is cut */
+		if (entry->path != -1)
+		{
+			char   *path = palette->paths + entry->path;
+			int		path_width = str_width(config, path);
+			int		available = text_max_x - x - label->width - 2;
+			bool	is_cut = false;
+
+			if (path_width > available && available >= 8)
+			{
+				while (*path && path_width > available - 3)
+				{
+					path_width -= char_width(config, path);
+					path += char_length(config, path);
+				}
+
+				is_cut = true;
+			}
+
+			if (path_width <= available)
+			{
+				int		path_x = text_max_x - path_width - (is_cut ? 3 : 0);
+
+				if (!is_cursor_row && !is_disabled)
+					wattron(window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+
+				wmove(window, r + 3, path_x);
+
+				if (is_cut)
+					st_menu_backend->put_str(window, "...", -1);
+
+				st_menu_backend->put_str(window, path, -1);
+
+				if (!is_cursor_row && !is_disabled)
+					wattroff(window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
+
+				label_max_x = path_x - 2;
+			}
+		}
 
-		if (menu->submenus[i])
-			st_menu_reset_all_options(menu->submenus[i], option);
+		wmove(window, r + 3, x);
 
-		menu_items += 1;
-		i += 1;
-	}
+		for (j = 0; j < label->nchars; j = k)
+		{
+			int		bytes = label->lengths[j];
+			int		width = label->widths[j];
+
+			/* chars with same attributes, that are neighbours in text, are written together */
+			for (k = j + 1;
+				 k < label->nchars && positions[k] == positions[j] &&
+				 label->offsets[k] == label->offsets[k - 1] + label->lengths[k - 1] &&
+				 x + width + label->widths[k] <= label_max_x;
+				 k++)
+			{
+				bytes += label->lengths[k];
+				width += label->widths[k];
+			}
 
-	return false;
-}
+			if (x + width > label_max_x)
+				break;
 
+			if (positions[j] && !is_disabled)
+				wattron(window,
+					COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
+							   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
 
-/*
- * Reset flag of first menu item specified by code
- */
-bool
-st_menu_reset_all_submenu_options(struct ST_MENU *menu, int menu_code, int option)
-{
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
+			st_menu_backend->put_str(window, text + label->offsets[j], bytes);
 
-	while (menu_items->text)
-	{
-		if (menu->submenus[i])
-		{
-			if (menu_items->code == menu_code)
+			if (positions[j] && !is_disabled)
 			{
-				st_menu_reset_all_options(menu->submenus[i], option);
-				return true;
+				wattroff(window,
+					COLOR_PAIR(is_cursor_row ? config->cursor_accel_cpn : config->accelerator_cpn) |
+							   (is_cursor_row ? config->cursor_accel_attr : config->accelerator_attr));
+				if (is_cursor_row)
+					wattron(window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
 			}
 
-			if (st_menu_reset_all_submenu_options(menu->submenus[i], menu_code, option))
-				return true;
+			x += width;
 		}
 
-		menu_items += 1;
-		i += 1;
+		if (is_cursor_row)
+			wattroff(window, COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+
+		if (is_disabled)
+			wattroff(window, COLOR_PAIR(config->disabled_cpn) | config->disabled_attr);
 	}
 
-	return false;
+	st_menu_backend->flush(window);
+
+	stats_flush(ST_MENU_STATS_PULLDOWN);
 }
 
 /*
- * Set flag of first menu item specified by code
+ * Activate item under cursor of palette. Disabled items cannot be activated.
  */
-bool
-st_menu_set_option(struct ST_MENU *menu, int code, int option, bool value)
+static bool
+palette_activate(struct ST_MENU *menu, int r)
 {
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
+	ST_MENU_PALETTE *palette = menu->palette;
+	ST_MENU_PALETTE_ENTRY *entry;
 
-	while (menu_items->text)
-	{
-		if (menu_items->code == code)
-		{
-			if (value)
-				menu->options[i] |= option;
-			else
-				menu->options[i] &= ~option;
+	if (r < 0 || r >= palette->nresults)
+		return false;
 
-			return true;
-		}
+	entry = &palette->entries[palette->results[r]];
 
-		if (menu->submenus[i])
-			if (st_menu_set_option(menu->submenus[i], code, option, value))
-				return true;
+	if (!item_activate(entry->menu, entry->offset))
+		return false;
 
-		menu_items += 1;
-		i += 1;
-	}
+	selected_refval_update();
 
-	return false;
+	st_menu_palette_unpost(menu);
+
+	return true;
 }
 
 /*
- * Reduce string to expected display width. The buffer should be
- * preallocated on good enough length - size of src.
+ * Process events when palette is posted. The palette is modal, all events
+ * are processed.
  */
-static void
-reduce_string(ST_MENU_CONFIG *config, int display_width, char *dest, char *src)
+static bool
+palette_driver(struct ST_MENU *menu, int c, bool alt, MEVENT *mevent)
 {
-	int current_width = str_width(config, src);
-	int		char_count = 0;
+	ST_MENU_PALETTE *palette = menu->palette;
+	int		nvisible;
 
-	while (src && display_width > 0)
+	selected_item = NULL;
+	press_accelerator = false;
+	press_enter = false;
+	button1_clicked = false;
+	press_shortcut = false;
+
+	if (!palette->is_valid)
+		palette_build(palette, menu);
+
+	nvisible = min_int(palette->nresults, palette->rows - 4);
+
+	if (c == KEY_MOUSE)
 	{
-		if (current_width <= display_width)
+		int		by, bx;
+		int		r;
+
+		getbegyx(palette->window, by, bx);
+		r = mevent->y - by - 3;
+
+		if (mevent->bstate & BUTTON1_PRESSED && !wenclose(palette->window, mevent->y, mevent->x))
 		{
-			strcpy(dest, src);
-			return;
+			st_menu_palette_unpost(menu);
+			return true;
 		}
-		else
-		{
-			int		chrlen = char_length(config, src);
-			int		dw = char_width(config, src);
 
-			if (char_count < 2)
+		if (r >= 0 && r < nvisible && mevent->x > bx && mevent->x < bx + palette->cols - 1)
+		{
+			if (mevent->bstate & BUTTON1_PRESSED)
 			{
-				memcpy(dest, src, chrlen);
-				dest += chrlen;
-				display_width -= dw;
+				palette->cursor = r;
+				palette->mouse_row = r;
 			}
-			else if (char_count == 2)
+			else if (mevent->bstate & BUTTON1_RELEASED && palette->mouse_row == r)
 			{
-				*dest++ = '~';
-				display_width -= 1;
+				if (palette_activate(menu, r))
+					return true;
 			}
-
-			char_count += 1;
-			current_width -= dw;
-			src += chrlen;
 		}
-	}
-
-	*dest = '\0';
-}
-
-static void
-cmdbar_draw(struct ST_CMDBAR *cmdbar)
-{
-	ST_MENU_CONFIG *config = cmdbar->config;
-	int		i;
 
-	show_panel(cmdbar->panel);
-	top_panel(cmdbar->panel);
+#if NCURSES_MOUSE_VERSION > 1
 
-	update_panels();
+		if (mevent->bstate & BUTTON4_PRESSED)
+			palette->cursor = max_int(palette->cursor - 1, 0);
+		else if (mevent->bstate & BUTTON5_PRESSED)
+			palette->cursor = min_int(palette->cursor + 1, max_int(nvisible - 1, 0));
 
-	werase(cmdbar->window);
+#endif
 
-	if (config->funckey_bar_style)
+	}
+	else if (c == ST_MENU_ESCAPE)
 	{
-		for (i = 0; i < cmdbar->nitems; i++)
-		{
-			wmove(cmdbar->window, 0, cmdbar->positions[i]);
-			wattron(cmdbar->window,
-					  COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+		st_menu_palette_unpost(menu);
+		return true;
+	}
+	else if (c == 10 || c == 13 || c == KEY_ENTER)
+	{
+		if (palette_activate(menu, palette->cursor))
+			return true;
+	}
+	else if (c == KEY_UP)
+		palette->cursor = max_int(palette->cursor - 1, 0);
+	else if (c == KEY_DOWN)
+		palette->cursor = min_int(palette->cursor + 1, max_int(nvisible - 1, 0));
+	else if (c == KEY_HOME || c == KEY_PPAGE)
+		palette->cursor = 0;
+	else if (c == KEY_END || c == KEY_NPAGE)
+		palette->cursor = max_int(nvisible - 1, 0);
+	else if (c == KEY_BACKSPACE || c == 127 || c == 8)
+		palette_query_change(palette, menu->config, 0);
+	else if (is_typed_char(c, alt))
+		palette_query_change(palette, menu->config, c);
+
+	palette_draw(menu);
+
+	return true;
+}
 
-			wprintw(cmdbar->window, "%2d", i+1);
+static void
+palette_free(ST_MENU_PALETTE *palette)
+{
+	int		n;
 
-			wattroff(cmdbar->window,
-					  COLOR_PAIR(config->cursor_cpn) | config->cursor_attr);
+	if (palette->panel)
+		del_panel(palette->panel);
+	if (palette->window)
+		delwin(palette->window);
 
-			if (cmdbar->labels[i])
-				waddstr(cmdbar->window, cmdbar->labels[i]);
-		}
-	}
-	else
+	for (n = 0; n <= ST_MENU_PALETTE_MAX_QUERY; n++)
 	{
-		for (i = 0; i < cmdbar->nitems; i++)
-		{
-			bool	need_sep = false;
-			bool	marked = false;
-			int		accel_prop;
-			int		text_prop;
+		free(palette->levels[n].matches);
+	}
 
-			marked = &cmdbar->cmdbar_items[i] == selected_command && !command_was_activated;
+	free(palette->entries);
+	free(palette->ids);
+	free(palette->word_starts);
+	free(palette->words);
+	free(palette->id_keys);
+	free(palette->id_values);
+	free(palette->postings_start);
+	free(palette->postings);
+	free(palette->paths);
+	free(palette->positions);
+
+	free(palette);
+}
 
-			if (marked)
-			{
-				mvwchgat(cmdbar->window, 0,
-							cmdbar->positions[i] - 1,
-							cmdbar->positions[i+1] - config->text_space + 1 - cmdbar->positions[i] + 1,
-							config->cursor_attr,
-							config->cursor_cpn, NULL);
+/*
+ * Show command palette of menu tree. The index is built when palette is
+ * posted first time (or after change of items).
+ */
+void
+st_menu_palette_post(struct ST_MENU *menu)
+{
+	ST_MENU_PALETTE *palette;
 
-				accel_prop = COLOR_PAIR(config->cursor_accel_cpn) | config->cursor_accel_attr;
-				text_prop = COLOR_PAIR(config->cursor_cpn) | config->cursor_attr;
-			}
-			else
-			{
+	while (menu->parent_menu)
+		menu = menu->parent_menu;
 
-				accel_prop = COLOR_PAIR(config->accelerator_cpn) | config->accelerator_attr;
-				text_prop = COLOR_PAIR(config->menu_unfocused_cpn) | config->menu_unfocused_attr;
-			}
+	if (!menu->palette)
+		menu->palette = safe_malloc(sizeof(ST_MENU_PALETTE));
 
-			wmove(cmdbar->window, 0, cmdbar->positions[i]);
+	palette = menu->palette;
 
-			wattron(cmdbar->window, accel_prop);
+	curs_set(0);
+	noecho();
 
-			if (cmdbar->cmdbar_items[i].alt)
-			{
-				need_sep = true;
-				waddstr(cmdbar->window, "M-");
-			}
-			if (cmdbar->cmdbar_items[i].fkey > 0)
-			{
-				need_sep = true;
-				wprintw(cmdbar->window, "F%d", cmdbar->cmdbar_items[i].fkey);
-			}
+	palette->query_length = 0;
+	palette->query[0] = '\0';
+	palette->is_posted = true;
 
-			wattroff(cmdbar->window, accel_prop);
+	if (palette->is_valid)
+		palette_select(palette);
 
-			wattron(cmdbar->window, text_prop);
+	palette_draw(menu);
+}
 
-			if (need_sep)
-				waddstr(cmdbar->window, " ");
+/*
+ * Hide command palette. The index is not released.
+ */
+void
+st_menu_palette_unpost(struct ST_MENU *menu)
+{
+	while (menu->parent_menu)
+		menu = menu->parent_menu;
 
-			waddstr(cmdbar->window, cmdbar->cmdbar_items[i].text);
+	if (menu->palette && menu->palette->is_posted)
+	{
+		menu->palette->is_posted = false;
+		hide_panel(menu->palette->panel);
 
-			wattroff(cmdbar->window, text_prop);
-		}
+		traced_update_panels();
 	}
+}
+
+bool
+st_menu_palette_is_posted(struct ST_MENU *menu)
+{
+	while (menu->parent_menu)
+		menu = menu->parent_menu;
 
-	wnoutrefresh(cmdbar->window);
+	return menu->palette && menu->palette->is_posted;
 }
 
-static bool
-cmdbar_driver(struct ST_CMDBAR *cmdbar, int c, bool alt, MEVENT *mevent)
+static inline uint64_t
+filter_key_mask(unsigned int key)
 {
-	ST_CMDBAR_ITEM *cmdbar_item = cmdbar->cmdbar_items;
-	ST_MENU_CONFIG *config = cmdbar->config;
+	return (uint64_t) 1 << ((key * 2654435761u) >> 26);
+}
 
-	if (c == KEY_MOUSE &&
-		mevent->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED
+/*
+ * Fill level n of filter (query has n chars). Level 1 is created from all
+ * selectable items, next levels from previous level.
+ */
+static void
+filter_search(struct ST_MENU *menu, int n)
+{
+	ST_MENU_FILTER *filter = menu->filter;
+	ST_MENU_FILTER_LEVEL *prev = &filter->levels[n - 1];
+	ST_MENU_FILTER_LEVEL *level = &filter->levels[n];
+	unsigned int *query_keys = filter->query_keys;
+	unsigned int first_key = query_keys[0];
+	uint64_t query_mask = 0;
+	int		count;
+	int		i;
 
-#if NCURSES_MOUSE_VERSION > 1
+	for (i = 0; i < n; i++)
+		query_mask |= filter_key_mask(query_keys[i]);
 
-						  | REPORT_MOUSE_POSITION
+	count = n > 1 ? prev->count : menu->nitems;
 
-#endif
-	  ))
+	if (level->capacity < count)
 	{
-		int		y = mevent->y;
-		int		x = mevent->x;
-		int		i;
+		level->capacity = max_int(count, 64);
+		level->matches = safe_realloc(level->matches, sizeof(ST_MENU_FILTER_MATCH) * level->capacity);
+	}
 
-		if (!wenclose(cmdbar->window, y, x))
-		{
-			command_was_activated = true;
-			return false;
-		}
+	level->count = 0;
 
-		for (i = 0; i < cmdbar->nitems; i++)
-		{
-			int		begin_x = i > 0 ? cmdbar->positions[i] : 0;
-			int		next_begin_x = cmdbar->positions[i + 1];
+	for (i = 0; i < count; i++)
+	{
+		int		offset = n > 1 ? prev->matches[i].offset : i;
+		int		pos = n > 1 ? prev->matches[i].pos : 0;
+		unsigned int *keys = filter->keys + filter->starts[offset];
+		int		nkeys = filter->starts[offset + 1] - filter->starts[offset];
 
-			if (!config->funckey_bar_style)
-			{
-				begin_x -= 1;
-				next_begin_x -= 1;
-			}
+		if ((filter->masks[offset] & query_mask) != query_mask)
+			continue;
+
+		if (n == 1 && !is_selectable_item(&menu->menu_items[offset]))
+			continue;
 
-			if (begin_x <= x && x < next_begin_x)
+		/* longer query cannot be found before first occurrence of its prefix */
+		for (; pos + n <= nkeys; pos++)
+		{
+			if (keys[pos] == first_key)
 			{
-				if (config->funckey_bar_style)
-				{
-					if (cmdbar->labels[i])
-					{
-						/*
-						 * This design is not exact, but it is good enough.
-						 * The click is valid, when press and release is over same
-						 * object.
-						 */
-						if (mevent->bstate & BUTTON1_PRESSED)
-						{
-							command_was_activated = false;
-							selected_command = cmdbar->ordered_items[i];
-							return true;
-						}
-						else if (mevent->bstate & BUTTON1_RELEASED)
-						{
-							if (selected_command == cmdbar->ordered_items[i])
-							{
-								command_was_activated = true;
-								return true;
-							}
-						}
-					}
-				}
-				else
+				int		k;
+
+				for (k = 1; k < n && keys[pos + k] == query_keys[k]; k++)
+					;
+
+				if (k == n)
 				{
-					if (mevent->bstate & BUTTON1_PRESSED)
-					{
-						command_was_activated = false;
-						selected_command = &cmdbar->cmdbar_items[i];
-						return true;
-					}
-					else if (mevent->bstate & BUTTON1_RELEASED)
-					{
-						if (selected_command == &cmdbar->cmdbar_items[i])
-						{
-							command_was_activated = true;
-							return true;
-						}
-					}
+					level->matches[level->count].offset = offset;
+					level->matches[level->count++].pos = pos;
+					break;
 				}
 			}
 		}
+	}
+}
 
-		selected_command = NULL;
-		return true;
+/*
+ * Fold labels of menu to keys, and search all levels of current query
+ * again. It is used when filter is used first time, and after change
+ * of items.
+ */
+static void
+filter_build(struct ST_MENU *menu)
+{
+	ST_MENU_FILTER *filter = menu->filter;
+	int		nkeys = 0;
+	int		i, j;
+
+	for (i = 0; i < menu->nitems; i++)
+		nkeys += menu->labels[i].nchars;
+
+	if (filter->keys_capacity < nkeys)
+	{
+		filter->keys_capacity = max_int(nkeys, 64);
+		filter->keys = safe_realloc(filter->keys, sizeof(unsigned int) * filter->keys_capacity);
 	}
-	else
+
+	if (filter->starts_capacity < menu->nitems + 1)
 	{
-		while (cmdbar_item->text)
+		filter->starts_capacity = max_int(menu->nitems + 1, 16);
+		filter->starts = safe_realloc(filter->starts, sizeof(int) * filter->starts_capacity);
+		filter->masks = safe_realloc(filter->masks, sizeof(uint64_t) * filter->starts_capacity);
+	}
+
+	nkeys = 0;
+
+	for (i = 0; i < menu->nitems; i++)
+	{
+		ST_MENU_LABEL *label = &menu->labels[i];
+		char   *text = menu->menu_items[i].text;
+
+		filter->starts[i] = nkeys;
+		filter->masks[i] = 0;
+
+		for (j = 0; j < label->nchars; j++)
 		{
-			if (cmdbar_item->alt == alt && KEY_F(cmdbar_item->fkey) == c)
-			{
-				command_was_activated = true;
-				selected_command = cmdbar_item;
-				return true;
-			}
-			cmdbar_item += 1;
+			unsigned int key = palette_key(menu->config, text + label->offsets[j]);
+
+			filter->keys[nkeys++] = key;
+			filter->masks[i] |= filter_key_mask(key);
+		}
+	}
+
+	filter->starts[menu->nitems] = nkeys;
+	filter->is_valid = true;
+
+	for (i = 1; i <= filter->query_length; i++)
+		filter_search(menu, i);
+}
+
+/*
+ * Returns number of displayed rows of pulldown menu. When filter is active,
+ * then only matched items are displayed, and their offsets are returned
+ * in matches (ordered by offsets). Else matches is NULL, and rows are items.
+ */
+static int
+pulldownmenu_rows(struct ST_MENU *menu, ST_MENU_FILTER_MATCH **matches)
+{
+	ST_MENU_FILTER *filter = menu->filter;
+
+	if (filter && filter->query_length > 0)
+	{
+		/* after change of items the cursor can be on not matched item */
+		if (!filter->is_valid)
+		{
+			filter_build(menu);
+			filter_update_cursor(menu);
 		}
+
+		*matches = filter->levels[filter->query_length].matches;
+
+		return filter->levels[filter->query_length].count;
 	}
 
-	return false;
+	*matches = NULL;
+
+	return menu->nitems;
 }
 
-ST_CMDBAR_ITEM *
-st_menu_selected_command(bool *activated)
+/*
+ * Returns displayed row (from 1) of item on cursor_row, or -1,
+ * when the item is not matched.
+ */
+static int
+filter_find_row(ST_MENU_FILTER_MATCH *matches, int nrows, int cursor_row)
 {
-	*activated = selected_command != NULL && command_was_activated;
+	int		low = 0;
+	int		high = nrows - 1;
 
-	return selected_command;
+	while (low <= high)
+	{
+		int		middle = (low + high) / 2;
+
+		if (matches[middle].offset + 1 == cursor_row)
+			return middle + 1;
+		else if (matches[middle].offset + 1 < cursor_row)
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+
+	return -1;
 }
 
 /*
- * Create state variable for commandbar. It based on template - a array of ST_CMDBAR_ITEM fields.
+ * Returns row of first enabled item from displayed row v (from 0) in
+ * direction dir (1 or -1), or -1. Only separators and disabled items are
+ * skipped, so the cost doesn't depend on distance of move.
  */
-struct ST_CMDBAR *
-st_cmdbar_new(ST_MENU_CONFIG *config, ST_CMDBAR_ITEM *cmdbar_items)
+static int
+pulldownmenu_enabled_row(struct ST_MENU *menu, ST_MENU_FILTER_MATCH *matches, int nrows, int v, int dir)
 {
-	struct ST_CMDBAR *cmdbar;
-	ST_CMDBAR_ITEM *cmdbar_item;
-	int		maxy, maxx, tmpy;
-	int		i;
-	int		last_position;
-
-	cmdbar = safe_malloc(sizeof(struct ST_CMDBAR));
+	for (; v >= 0 && v < nrows; v += dir)
+	{
+		int		offset = matches ? matches[v].offset : v;
 
-	cmdbar->cmdbar_items = cmdbar_items;
-	cmdbar->config = config;
+		if (is_selectable_item(&menu->menu_items[offset]) &&
+			(menu->options[offset] & ST_MENU_OPTION_DISABLED) == 0)
+			return offset + 1;
+	}
 
-	getmaxyx(stdscr, maxy, maxx);
+	return -1;
+}
 
-	tmpy = 1;
-	cmdbar->window = newwin(tmpy, maxx, maxy - 1, 0);
-	cmdbar->panel = new_panel(cmdbar->window);
+/*
+ * Move cursor of multi-column pulldown menu to nearest enabled item of
+ * neighbour column in direction dir (1 or -1). Returns false, when there
+ * is not this column, or when cursor should be moved right and the item
+ * under cursor has submenu.
+ */
+static bool
+pulldownmenu_column_move(struct ST_MENU *menu, ST_MENU_FILTER_MATCH *matches, int nrows, int dir)
+{
+	int		column_rows = menu->column_rows;
+	int		current;
+	int		column_start, column_end;
+	int		target;
+	int		distance;
 
-	wbkgd(cmdbar->window,
-					  COLOR_PAIR(config->menu_unfocused_cpn) |
-					  config->menu_unfocused_attr);
+	if (menu->cursor_row == -1 ||
+		(dir == 1 && menu->submenus[menu->cursor_row - 1]))
+		return false;
 
-	werase(cmdbar->window);
+	current = matches ? filter_find_row(matches, nrows, menu->cursor_row) - 1 : menu->cursor_row - 1;
+	if (current < 0)
+		return false;
 
-	cmdbar->nitems = 0;
+	column_start = (current / column_rows + dir) * column_rows;
+	if (column_start < 0 || column_start >= nrows)
+		return false;
 
-	cmdbar_item = cmdbar_items;
+	column_end = min_int(column_start + column_rows, nrows) - 1;
+	target = min_int(column_start + current % column_rows, column_end);
 
-	if (!config->funckey_bar_style)
+	/*
+	 * Separators and disabled items are skipped, the nearest enabled item
+	 * of column is used (only row v is checked, when nrows is v + 1).
+	 */
+	for (distance = 0; distance < column_rows; distance++)
 	{
-		while (cmdbar_item->text)
+		int		above = target - distance;
+		int		below = target + distance;
+		int		row = -1;
+
+		if (above >= column_start)
+			row = pulldownmenu_enabled_row(menu, matches, above + 1, above, 1);
+
+		if (row == -1 && below <= column_end)
+			row = pulldownmenu_enabled_row(menu, matches, below + 1, below, 1);
+
+		if (row != -1)
 		{
-			cmdbar->nitems += 1;
-			cmdbar_item += 1;
+			menu->cursor_row = row;
+			return true;
 		}
 	}
-	else
-		cmdbar->nitems = 10;
 
-	cmdbar->positions = safe_malloc(sizeof(int) * (cmdbar->nitems + 1));
-	cmdbar->labels = safe_malloc(sizeof(char*) * cmdbar->nitems);
-	cmdbar->ordered_items = safe_malloc(sizeof(ST_CMDBAR_ITEM *) * cmdbar->nitems);
-	last_position = 0;
+	return false;
+}
 
-	if (config->funckey_bar_style)
-	{
-		int		width = maxx / 10;
-		double	extra_width = (maxx % 10) / 10.0;
-		double	extra_width_sum = 0;
+/*
+ * After change of query the cursor stays on same item, when this item is
+ * displayed. Else it is moved to first displayed enabled item.
+ */
+static void
+filter_update_cursor(struct ST_MENU *menu)
+{
+	ST_MENU_FILTER_MATCH *matches;
+	int		nrows;
 
-		if (width < 7)
-		{
-			/* when terminal is too thin, don't show all fields */
-			cmdbar->nitems = maxx / 7;
+	nrows = pulldownmenu_rows(menu, &matches);
+	menu->first_row = 1;
 
-			width = maxx / cmdbar->nitems;
-			extra_width = (maxx % cmdbar->nitems) / (cmdbar->nitems * 1.0);
-			extra_width_sum = 0;
-		}
+	if (menu->cursor_row != -1 &&
+		(!matches || filter_find_row(matches, nrows, menu->cursor_row) != -1))
+		return;
 
-		for (i = 0; i < cmdbar->nitems; i++)
-		{
-			cmdbar->positions[i] = last_position;
-			last_position += width;
-			extra_width_sum += extra_width;
-			if (extra_width_sum > 1.0)
-			{
-				last_position += 1;
-				extra_width_sum -= 1;
-			}
-		}
+	menu->cursor_row = pulldownmenu_enabled_row(menu, matches, nrows, 0, 1);
 
-		cmdbar->positions[cmdbar->nitems] = maxx + 1;
+	if (menu->active_submenu)
+	{
+		st_menu_unpost(menu->active_submenu, false);
+		menu->active_submenu = NULL;
+	}
+}
 
-		cmdbar_item = cmdbar_items;
-		while (cmdbar_item->text)
-		{
-			int		fkey = cmdbar_item->fkey;
-			int		display_width;
+/*
+ * Shorten query of filter to n chars. Shorter query uses previous level,
+ * so nothing is searched.
+ */
+static void
+filter_set_length(struct ST_MENU *menu, int n)
+{
+	ST_MENU_FILTER *filter = menu->filter;
 
-			if (cmdbar_item->alt)
-			{
-				endwin();
-				fprintf(stderr, "Alt is not supported in funckey bar style");
-				exit(1);
-			}
+	filter->query_length = n;
+	filter->query[filter->query_offsets[n]] = '\0';
 
-			if (fkey < 1 || fkey > 10)
-			{
-				endwin();
-				fprintf(stderr, "fkey code should be between 1 and 10");
-				exit(1);
-			}
+	filter_update_cursor(menu);
+}
 
-			/* don't display keys in reduced bar */
-			if (fkey > cmdbar->nitems)
-			{
-				cmdbar_item += 1;
-				continue;
-			}
+/*
+ * Process typed chars, backspace and escape by filter. Returns true,
+ * when the query was changed.
+ */
+static bool
+filter_driver(struct ST_MENU *menu, int c, bool alt)
+{
+	ST_MENU_FILTER *filter = menu->filter;
+	int		n = filter->query_length;
+
+	if (c == ST_MENU_ESCAPE && n > 0)
+		filter_set_length(menu, 0);
+	else if ((c == KEY_BACKSPACE || c == 127 || c == 8) && n > 0)
+		filter_set_length(menu, n - 1);
+	else if (is_typed_char(c, alt))
+	{
+		char   *str = filter->query + filter->query_offsets[n];
 
-			if (cmdbar->labels[fkey - 1])
-			{
-				endwin();
-				fprintf(stderr, "multiple assigned items inside funckey bar");
-				exit(1);
-			}
+		/* too long query is ignored */
+		if (n == ST_MENU_FILTER_MAX_QUERY)
+			return true;
 
-			cmdbar->ordered_items[fkey - 1] = cmdbar_item;
+		filter->query_offsets[n + 1] = filter->query_offsets[n] +
+									wchar_to_utf8(menu->config, str, 4, (wchar_t) c);
+		filter->query[filter->query_offsets[n + 1]] = '\0';
 
-			display_width = cmdbar->positions[fkey] - cmdbar->positions[fkey - 1] - 2;
-			cmdbar->labels[fkey - 1] = safe_malloc(strlen(cmdbar_item->text) + 1);
-			reduce_string(config, display_width, cmdbar->labels[fkey - 1], cmdbar_item->text);
+		filter->query_keys[n] = palette_key(menu->config, str);
+		filter->query_length = n + 1;
 
-			cmdbar_item += 1;
-		}
+		if (filter->is_valid)
+			filter_search(menu, n + 1);
+		else
+			filter_build(menu);
+
+		filter_update_cursor(menu);
 	}
 	else
-	{
-		last_position = config->init_text_space;
+		return false;
 
-		for (i = 0; i < cmdbar->nitems; i++)
-		{
-			cmdbar_item = &cmdbar_items[i];
+	return true;
+}
+
+static void
+filter_free(ST_MENU_FILTER *filter)
+{
+	int		n;
 
-			cmdbar->positions[i] = last_position;
+	for (n = 0; n <= ST_MENU_FILTER_MAX_QUERY; n++)
+		free(filter->levels[n].matches);
 
-			if (cmdbar_item->alt)
-				last_position += strlen("M-");
-			if (cmdbar_item->fkey > 0)
-				last_position += strlen("Fx");
-			if (cmdbar_item->fkey > 9)
-				last_position += strlen("0");
+	free(filter->keys);
+	free(filter->starts);
+	free(filter->masks);
 
-			if (cmdbar->positions[i] != last_position)
-				last_position += 1;
+	free(filter);
+}
 
-			last_position += str_width(config, cmdbar_item->text);
-			last_position += config->text_space != -1 ? config->text_space : 3;
-		}
+/*
+ * Enable or disable type-ahead filter of pulldown menu. When filter is
+ * enabled, then typed chars are not used as accelerators (Alt accelerators
+ * can be used), but they narrow displayed items to items, that contains
+ * typed text. Returns false for menubar.
+ */
+bool
+st_menu_set_filter(struct ST_MENU *menu, bool enabled)
+{
+	if (menu->is_menubar)
+		return false;
+
+	if (enabled && !menu->filter)
+		menu->filter = safe_malloc(sizeof(ST_MENU_FILTER));
+	else if (!enabled && menu->filter)
+	{
+		ST_MENU_FILTER *filter = menu->filter;
+
+		menu->filter = NULL;
+
+		if (filter->query_length > 0)
+			filter_update_cursor(menu);
 
-		cmdbar->positions[cmdbar->nitems] = last_position;
+		filter_free(filter);
 	}
 
-	return cmdbar;
+	return true;
 }
 
-void
-st_cmdbar_post(struct ST_CMDBAR *cmdbar)
+/*
+ * Returns type of focus of menu
+ */
+int
+st_menu_get_focus(struct ST_MENU *menu)
 {
-	active_cmdbar = cmdbar;
-	cmdbar_draw(cmdbar);
+	return menu->focus;
 }
 
+/*
+ * Enable output statistics. The counter should to return number of bytes
+ * written to terminal (by ncurses) until now. When counter is NULL, then
+ * statistics are disabled. Attention - when statistics are enabled, then
+ * doupdate is called after every draw function, so total output is
+ * higher than without statistics.
+ */
 void
-st_cmdbar_unpost(struct ST_CMDBAR *cmdbar)
+st_menu_stats_enable(long (*counter)(void *data), void *data)
 {
-	active_cmdbar = NULL;
+	stats_counter = counter;
+	stats_counter_data = data;
 
-	hide_panel(cmdbar->panel);
-	update_panels();
+	if (counter)
+		stats_last_bytes = counter(data);
 }
 
 void
-st_cmdbar_free(struct ST_CMDBAR *cmdbar)
+st_menu_stats_get(ST_MENU_STATS *result)
 {
-	int		i;
-
-	active_cmdbar = NULL;
-
-	del_panel(cmdbar->panel);
-	delwin(cmdbar->window);
-
-	for (i = 0; i < cmdbar->nitems; i++)
-		if (cmdbar->labels[i])
-			free(cmdbar->labels[i]);
+	*result = stats;
+}
 
-	free(cmdbar->labels);
-	free(cmdbar->positions);
-	free(cmdbar->ordered_items);
-	free(cmdbar);
+void
+st_menu_stats_reset(void)
+{
+	memset(&stats, 0, sizeof(ST_MENU_STATS));
+}
 
-	update_panels();
+/*
+ * Counter for output to regular file - the data is pointer to
+ * file descriptor.
+ */
+long
+st_menu_stats_fd_counter(void *data)
+{
+	return (long) lseek(*((int *) data), 0, SEEK_CUR);
 }
 
 /*
- * Set reference to some variable for menu's option
+ * Assign trace callback. Returns false, when tracing is not compiled.
  */
 bool
-st_menu_set_ref_option(struct ST_MENU *menu,
-					   int code,
-					   int option,
-					   int *refvalue)
+st_menu_trace_set_callback(void (*callback)(const ST_MENU_TRACE_RECORD *record, void *data), void *data)
 {
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
-
-	if (!IS_REF_OPTION(option))
-	{
-		endwin();
-		fprintf(stderr, "cannot assign reference value with not reference option");
-		exit(1);
-	}
+#ifndef ST_MENU_NO_TRACE
 
-	while (menu_items->text)
-	{
-		if (menu_items->code == code)
-		{
-			menu->options[i] |= option;
-			menu->refvals[i] = refvalue;
+	trace_callback = callback;
+	trace_callback_data = data;
+	trace_active = trace_callback || trace_buffer;
 
-			return true;
-		}
+	return true;
 
-		if (menu->submenus[i])
-			if (st_menu_set_ref_option(menu->submenus[i], code, option, refvalue))
-				return true;
+#else
 
-		menu_items += 1;
-		i += 1;
-	}
+	(void) callback;
+	(void) data;
 
 	return false;
+
+#endif
 }
 
 /*
- * Set shortcut for option specified by code
+ * Assign ring buffer for trace records. The buffer is owned by application,
+ * and it should be valid until tracing to buffer is disabled (buffer is NULL).
+ * Returns false, when tracing is not compiled.
  */
 bool
-st_menu_set_shortcut(struct ST_MENU *menu, int code, char *shortcut)
+st_menu_trace_set_buffer(ST_MENU_TRACE_RECORD *buffer, int size)
 {
-	ST_MENU_ITEM *menu_items = menu->menu_items;
-	int		i = 0;
+#ifndef ST_MENU_NO_TRACE
 
-	while (menu_items->text)
-	{
-		if (menu_items->code == code)
-		{
-			menu_items->shortcut = shortcut;
-			return true;
-		}
+	trace_buffer = size > 0 ? buffer : NULL;
+	trace_buffer_size = size;
+	trace_write_pos = 0;
+	trace_read_pos = 0;
+	trace_active = trace_callback || trace_buffer;
 
-		if (menu->submenus[i])
-			if (st_menu_set_shortcut(menu->submenus[i], code, shortcut))
-				return true;
+	return true;
 
-		menu_items += 1;
-		i += 1;
-	}
+#else
+
+	(void) buffer;
+	(void) size;
 
 	return false;
+
+#endif
 }
 
 /*
- * Returns type of focus of menu
+ * Copy oldest records from ring buffer (max records) to records. Returns
+ * number of copied records. The copied records are removed from buffer.
  */
 int
-st_menu_get_focus(struct ST_MENU *menu)
+st_menu_trace_read(ST_MENU_TRACE_RECORD *records, int max)
 {
-	return menu->focus;
+	int		n = 0;
+
+#ifndef ST_MENU_NO_TRACE
+
+	while (n < max && trace_read_pos < trace_write_pos)
+		records[n++] = trace_buffer[trace_read_pos++ % trace_buffer_size];
+
+#else
+
+	(void) records;
+	(void) max;
+
+#endif
+
+	return n;
+}
+
+void
+st_menu_trace_get_counters(ST_MENU_TRACE_COUNTERS *counters)
+{
+#ifndef ST_MENU_NO_TRACE
+
+	*counters = trace_counters;
+
+#else
+
+	memset(counters, 0, sizeof(ST_MENU_TRACE_COUNTERS));
+
+#endif
+}
+
+void
+st_menu_trace_reset_counters(void)
+{
+#ifndef ST_MENU_NO_TRACE
+
+	memset(&trace_counters, 0, sizeof(ST_MENU_TRACE_COUNTERS));
+
+#endif
 }
@@ -0,0 +1,713 @@
+#include "st_menu.h"
+#include "st_menu_backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/*
+ * ncurses backend - thin wrappers of ncurses functions
+ */
+static void
+nc_addnstr(WINDOW *win, const char *str, int n)
+{
+	waddnstr(win, str, n);
+}
+
+static void
+nc_addch(WINDOW *win, chtype ch)
+{
+	waddch(win, ch);
+}
+
+static void
+nc_add_wch(WINDOW *win, wchar_t wch)
+{
+	wprintw(win, "%lc", (wint_t) wch);
+}
+
+static void
+nc_chgat(WINDOW *win, int y, int x, int n, attr_t attr, short cpn)
+{
+	mvwchgat(win, y, x, n, attr, cpn, NULL);
+}
+
+static chtype
+nc_inch(WINDOW *win, int y, int x)
+{
+	return mvwinch(win, y, x);
+}
+
+static void
+nc_border(WINDOW *win,
+		  chtype ls, chtype rs, chtype ts, chtype bs,
+		  chtype tl, chtype tr, chtype bl, chtype br)
+{
+	wborder(win, ls, rs, ts, bs, tl, tr, bl, br);
+}
+
+static void
+nc_erase(WINDOW *win)
+{
+	werase(win);
+}
+
+/*
+ * The shadow is drawn over copy of content of desktop and command bar.
+ */
+static void
+nc_shadow_background(WINDOW *shadow, WINDOW *desktop, WINDOW *cmdbar)
+{
+	werase(shadow);
+
+	if (desktop)
+		overwrite(desktop, shadow);
+	if (cmdbar)
+		overwrite(cmdbar, shadow);
+}
+
+static void
+nc_noutrefresh(WINDOW *win)
+{
+	wnoutrefresh(win);
+}
+
+static const ST_MENU_BACKEND_OPS ncurses_backend = {
+	nc_addnstr,
+	nc_addch,
+	nc_add_wch,
+	nc_chgat,
+	nc_inch,
+	nc_border,
+	nc_erase,
+	nc_shadow_background,
+	nc_noutrefresh
+};
+
+/*
+ * Grid backend - the output is written to in-memory array of cells,
+ * that has size of screen. The positions and sizes of windows, cursor
+ * positions and attributes are taken from ncurses windows, so ncurses
+ * should be initialized (the terminal can be /dev/null). The content
+ * of windows is not changed, and nothing is sent to terminal. The cells
+ * are written in painter's order - the application should clean grid
+ * and draw all visible objects (menubar, command bar) for every frame.
+ */
+#if (defined(NCURSES_WIDECHAR) && NCURSES_WIDECHAR) || defined(PDC_WIDE)
+
+#define ST_MENU_GRID_WIDE
+
+#ifndef CCHARW_MAX
+#define CCHARW_MAX		5
+#endif
+
+#endif
+
+static ST_MENU_CELL *grid = NULL;
+static WINDOW **grid_owners = NULL;		/* top level windows of cells */
+static int		grid_rows = 0;
+static int		grid_cols = 0;
+
+/*
+ * Returns screen position of window. ncurses doesn't update position
+ * of derived windows, when parent window is moved, so the position is
+ * calculated from position of parent.
+ */
+static void
+grid_begyx(WINDOW *win, int *y, int *x)
+{
+	WINDOW	   *parent = wgetparent(win);
+
+	if (parent)
+	{
+		int		py, px;
+
+		grid_begyx(parent, y, x);
+		getparyx(win, py, px);
+
+		*y += py;
+		*x += px;
+	}
+	else
+		getbegyx(win, *y, *x);
+}
+
+static ST_MENU_CELL *
+grid_cell(WINDOW *win, int y, int x)
+{
+	int		by, bx;
+
+	grid_begyx(win, &by, &bx);
+
+	y += by;
+	x += bx;
+
+	if (y < 0 || y >= grid_rows || x < 0 || x >= grid_cols)
+		return NULL;
+
+	return &grid[y * grid_cols + x];
+}
+
+/*
+ * Write cell of grid by window. Like ncurses (when windows are composed
+ * on screen), the wide char of other window, that is partially overwritten,
+ * is replaced by space.
+ */
+static void
+grid_set(WINDOW *win, ST_MENU_CELL *cell, wchar_t wch, attr_t attr, short cpn)
+{
+	int		offset = cell - grid;
+	int		x = offset % grid_cols;
+	WINDOW	   *owner = win;
+
+	while (wgetparent(owner))
+		owner = wgetparent(owner);
+
+	/* right half of wide char is overwritten */
+	if (wch != 0 && cell->ch == 0 && x > 0 && grid_owners[offset - 1] != owner)
+	{
+		cell[-1].ch = L' ';
+		cell[-1].attr = A_NORMAL;
+		cell[-1].cpn = 0;
+	}
+
+	/* left half of wide char is overwritten */
+	if (cell->ch != 0 && wcwidth(cell->ch) == 2 && x + 1 < grid_cols &&
+		cell[1].ch == 0 && grid_owners[offset + 1] != owner)
+	{
+		cell[1].ch = L' ';
+		cell[1].attr = A_NORMAL;
+		cell[1].cpn = 0;
+	}
+
+	cell->ch = wch;
+	cell->attr = attr;
+	cell->cpn = cpn;
+
+	grid_owners[offset] = owner;
+}
+
+/*
+ * Returns background of window. The wide background is preferred, because
+ * ncurses returns zero by getbkgd for derived windows (but it uses right
+ * background for output).
+ */
+static void
+grid_background(WINDOW *win, wchar_t *wch, attr_t *attr, short *cpn)
+{
+	chtype	bkgd;
+
+#ifdef ST_MENU_GRID_WIDE
+
+	cchar_t	cch;
+	wchar_t	wchs[CCHARW_MAX + 1];
+
+	memset(&cch, 0, sizeof(cch));
+
+	if (wgetbkgrnd(win, &cch) != ERR &&
+		getcchar(&cch, wchs, attr, cpn, NULL) != ERR)
+	{
+		*wch = wchs[0];
+		*attr &= ~A_COLOR;
+
+		return;
+	}
+
+#endif
+
+	bkgd = getbkgd(win);
+
+	*wch = (wchar_t) (bkgd & A_CHARTEXT);
+	*attr = bkgd & A_ATTRIBUTES & ~A_COLOR;
+	*cpn = PAIR_NUMBER(bkgd);
+}
+
+/*
+ * Returns attributes used for new char - like ncurses, the window's
+ * attributes are merged with attributes of background.
+ */
+static void
+grid_attr(WINDOW *win, attr_t *attr, short *cpn)
+{
+	wchar_t	bkgd_ch;
+	attr_t	bkgd_attr;
+	short	bkgd_cpn;
+	attr_t	a;
+	short	pair;
+
+	grid_background(win, &bkgd_ch, &bkgd_attr, &bkgd_cpn);
+
+	wattr_get(win, &a, &pair, NULL);
+
+	if (pair == 0)
+		pair = bkgd_cpn;
+
+	*attr = (a | bkgd_attr) & ~A_COLOR;
+	*cpn = pair;
+}
+
+/*
+ * Translate line drawing chars to unicode. The comparison is done
+ * at runtime, because ACS values are known after terminal initialization.
+ */
+static wchar_t
+acs_to_wchar(chtype ch)
+{
+	chtype	c = ch & (A_CHARTEXT | A_ALTCHARSET);
+
+#define ACS_CHAR(acs, wch)	if (c == ((acs) & (A_CHARTEXT | A_ALTCHARSET))) return wch
+
+	ACS_CHAR(ACS_HLINE, 0x2500);
+	ACS_CHAR(ACS_VLINE, 0x2502);
+	ACS_CHAR(ACS_ULCORNER, 0x250C);
+	ACS_CHAR(ACS_URCORNER, 0x2510);
+	ACS_CHAR(ACS_LLCORNER, 0x2514);
+	ACS_CHAR(ACS_LRCORNER, 0x2518);
+	ACS_CHAR(ACS_LTEE, 0x251C);
+	ACS_CHAR(ACS_RTEE, 0x2524);
+
+#undef ACS_CHAR
+
+	return (wchar_t) (ch & A_CHARTEXT);
+}
+
+/*
+ * Write one char on cursor position, and move cursor. The text is
+ * clipped on right border of window. Second cell of wide char
+ * has code 0. Returns false, when the cursor cannot be moved (like
+ * ncurses, the rest of string is not written).
+ */
+static bool
+grid_put(WINDOW *win, wchar_t wch, int width, attr_t attr, short cpn)
+{
+	ST_MENU_CELL *cell;
+	int		y, x, maxx;
+	int		i;
+
+	getyx(win, y, x);
+	maxx = getmaxx(win);
+
+	if (x + width > maxx)
+		return false;
+
+	for (i = 0; i < width; i++)
+	{
+		cell = grid_cell(win, y, x + i);
+		if (cell)
+		{
+			grid_set(win, cell, i == 0 ? wch : 0, attr, cpn);
+		}
+	}
+
+	x += width;
+	wmove(win, y, x < maxx ? x : maxx - 1);
+
+	return x < maxx;
+}
+
+static void
+grid_addnstr(WINDOW *win, const char *str, int n)
+{
+	mbstate_t	mbstate;
+	attr_t	attr;
+	short	cpn;
+	size_t	len;
+
+	grid_attr(win, &attr, &cpn);
+
+	len = n < 0 ? strlen(str) : strnlen(str, n);
+	memset(&mbstate, 0, sizeof(mbstate));
+
+	while (len > 0)
+	{
+		wchar_t		wch;
+		size_t		bytes;
+		int			width;
+
+		bytes = mbrtowc(&wch, str, len, &mbstate);
+		if (bytes == (size_t) -1 || bytes == (size_t) -2)
+		{
+			/* broken char is displayed as one cell */
+			memset(&mbstate, 0, sizeof(mbstate));
+			wch = (unsigned char) *str;
+			bytes = 1;
+		}
+
+		width = wcwidth(wch);
+
+		/* combining chars are ignored */
+		if (width != 0 &&
+			!grid_put(win, wch, width > 0 ? width : 1, attr, cpn))
+			break;
+
+		str += bytes;
+		len -= bytes;
+	}
+}
+
+static void
+grid_addch(WINDOW *win, chtype ch)
+{
+	attr_t	attr;
+	short	cpn;
+
+	grid_attr(win, &attr, &cpn);
+
+	/* like waddch, color of char has priority over color of window */
+	if (PAIR_NUMBER(ch) != 0)
+		cpn = PAIR_NUMBER(ch);
+
+	grid_put(win,
+			 ch & A_ALTCHARSET ? acs_to_wchar(ch) : (wchar_t) (ch & A_CHARTEXT), 1,
+			 attr | (ch & A_ATTRIBUTES & ~A_COLOR), cpn);
+}
+
+static void
+grid_add_wch(WINDOW *win, wchar_t wch)
+{
+	attr_t	attr;
+	short	cpn;
+	int		width;
+
+	grid_attr(win, &attr, &cpn);
+
+	width = wcwidth(wch);
+	grid_put(win, wch, width > 0 ? width : 1, attr, cpn);
+}
+
+static void
+grid_chgat(WINDOW *win, int y, int x, int n, attr_t attr, short cpn)
+{
+	int		maxx;
+	int		i;
+
+	if (wmove(win, y, x) == ERR)
+		return;
+
+	maxx = getmaxx(win);
+	if (n < 0 || x + n > maxx)
+		n = maxx - x;
+
+	for (i = 0; i < n; i++)
+	{
+		ST_MENU_CELL *cell = grid_cell(win, y, x + i);
+
+		if (cell)
+		{
+			cell->attr = attr;
+			cell->cpn = cpn;
+		}
+	}
+}
+
+static chtype
+grid_inch(WINDOW *win, int y, int x)
+{
+	ST_MENU_CELL *cell;
+
+	if (wmove(win, y, x) == ERR)
+		return (chtype) ERR;
+
+	cell = grid_cell(win, y, x);
+	if (!cell)
+		return (chtype) ERR;
+
+	return (cell->ch < 256 ? (chtype) cell->ch : ' ') | cell->attr | COLOR_PAIR(cell->cpn);
+}
+
+static void
+grid_border(WINDOW *win,
+			chtype ls, chtype rs, chtype ts, chtype bs,
+			chtype tl, chtype tr, chtype bl, chtype br)
+{
+	int		maxy, maxx;
+	int		i;
+
+	getmaxyx(win, maxy, maxx);
+
+	/* zero is default like wborder */
+	ls = ls ? ls : ACS_VLINE;
+	rs = rs ? rs : ACS_VLINE;
+	ts = ts ? ts : ACS_HLINE;
+	bs = bs ? bs : ACS_HLINE;
+	tl = tl ? tl : ACS_ULCORNER;
+	tr = tr ? tr : ACS_URCORNER;
+	bl = bl ? bl : ACS_LLCORNER;
+	br = br ? br : ACS_LRCORNER;
+
+	for (i = 1; i < maxy - 1; i++)
+	{
+		wmove(win, i, 0);
+		grid_addch(win, ls);
+		wmove(win, i, maxx - 1);
+		grid_addch(win, rs);
+	}
+
+	for (i = 1; i < maxx - 1; i++)
+	{
+		wmove(win, 0, i);
+		grid_addch(win, ts);
+		wmove(win, maxy - 1, i);
+		grid_addch(win, bs);
+	}
+
+	wmove(win, 0, 0);
+	grid_addch(win, tl);
+	wmove(win, 0, maxx - 1);
+	grid_addch(win, tr);
+	wmove(win, maxy - 1, 0);
+	grid_addch(win, bl);
+	wmove(win, maxy - 1, maxx - 1);
+	grid_addch(win, br);
+
+	wmove(win, 0, 0);
+}
+
+static void
+grid_erase(WINDOW *win)
+{
+	wchar_t	bkgd_ch;
+	attr_t	bkgd_attr;
+	short	bkgd_cpn;
+	int		maxy, maxx;
+	int		i, j;
+
+	grid_background(win, &bkgd_ch, &bkgd_attr, &bkgd_cpn);
+
+	getmaxyx(win, maxy, maxx);
+
+	for (i = 0; i < maxy; i++)
+		for (j = 0; j < maxx; j++)
+		{
+			ST_MENU_CELL *cell = grid_cell(win, i, j);
+
+			if (cell)
+			{
+				grid_set(win, cell, bkgd_ch ? bkgd_ch : L' ', bkgd_attr, bkgd_cpn);
+			}
+		}
+
+	wmove(win, 0, 0);
+}
+
+/*
+ * Copy cell of window (relative position) to grid cell of window dest.
+ * The cursor of window is not changed.
+ */
+static void
+grid_copy_cell(WINDOW *win, int y, int x, WINDOW *dest, ST_MENU_CELL *cell)
+{
+	int		cy, cx;
+
+#ifdef ST_MENU_GRID_WIDE
+
+	cchar_t	cch;
+	wchar_t	wch[CCHARW_MAX + 1];
+	attr_t	attr;
+	short	cpn;
+
+	getyx(win, cy, cx);
+
+	if (mvwin_wch(win, y, x, &cch) != ERR &&
+		getcchar(&cch, wch, &attr, &cpn, NULL) != ERR)
+	{
+		grid_set(dest, cell,
+				 attr & A_ALTCHARSET ? acs_to_wchar((chtype) wch[0] | A_ALTCHARSET) : wch[0],
+				 attr & ~A_COLOR, cpn);
+	}
+
+#else
+
+	chtype	ch;
+
+	getyx(win, cy, cx);
+
+	ch = mvwinch(win, y, x);
+	if (ch != (chtype) ERR)
+	{
+		grid_set(dest, cell,
+				 ch & A_ALTCHARSET ? acs_to_wchar(ch) : (wchar_t) (ch & A_CHARTEXT),
+				 ch & A_ATTRIBUTES & ~A_COLOR, PAIR_NUMBER(ch));
+	}
+
+#endif
+
+	wmove(win, cy, cx);
+}
+
+/*
+ * Returns true, when the screen position is inside window
+ */
+static bool
+grid_window_contains(WINDOW *win, int y, int x)
+{
+	int		by, bx, maxy, maxx;
+
+	grid_begyx(win, &by, &bx);
+	getmaxyx(win, maxy, maxx);
+
+	return y >= by && y < by + maxy && x >= bx && x < bx + maxx;
+}
+
+/*
+ * Like ncurses backend, the shadow shows content of desktop and command
+ * bar (not the menus below shadow). The content is taken from ncurses
+ * windows, because the application draws desktop by ncurses.
+ */
+static void
+grid_shadow_background(WINDOW *shadow, WINDOW *desktop, WINDOW *cmdbar)
+{
+	int		sy, sx;
+	int		maxy, maxx;
+	int		i, j;
+
+	grid_erase(shadow);
+
+	grid_begyx(shadow, &sy, &sx);
+	getmaxyx(shadow, maxy, maxx);
+
+	for (i = 0; i < maxy; i++)
+		for (j = 0; j < maxx; j++)
+		{
+			ST_MENU_CELL *cell = grid_cell(shadow, i, j);
+			WINDOW	   *src = NULL;
+			int			by, bx;
+
+			if (!cell)
+				continue;
+
+			if (cmdbar && grid_window_contains(cmdbar, sy + i, sx + j))
+				src = cmdbar;
+			else if (desktop && grid_window_contains(desktop, sy + i, sx + j))
+				src = desktop;
+
+			if (!src)
+				continue;
+
+			grid_begyx(src, &by, &bx);
+			grid_copy_cell(src, sy + i - by, sx + j - bx, shadow, cell);
+
+			/* second cell of wide char has code 0 */
+			if (wcwidth(cell->ch) == 2 && j + 1 < maxx)
+			{
+				ST_MENU_CELL *next = grid_cell(shadow, i, j + 1);
+
+				if (next)
+					grid_set(shadow, next, 0, cell->attr, cell->cpn);
+
+				j += 1;
+			}
+		}
+}
+
+static void
+grid_noutrefresh(WINDOW *win)
+{
+	(void) win;
+}
+
+static const ST_MENU_BACKEND_OPS grid_backend = {
+	grid_addnstr,
+	grid_addch,
+	grid_add_wch,
+	grid_chgat,
+	grid_inch,
+	grid_border,
+	grid_erase,
+	grid_shadow_background,
+	grid_noutrefresh
+};
+
+const ST_MENU_BACKEND_OPS *st_menu_backend = &ncurses_backend;
+
+/*
+ * Set output backend. When grid is not initialized yet, then
+ * it is initialized with size of stdscr.
+ */
+void
+st_menu_set_backend(int backend)
+{
+	if (backend == ST_MENU_BACKEND_GRID)
+	{
+		if (!grid)
+			st_menu_grid_init(0, 0);
+
+		st_menu_backend = &grid_backend;
+	}
+	else
+		st_menu_backend = &ncurses_backend;
+}
+
+/*
+ * Allocate (or reallocate) grid. When rows or cols are not positive,
+ * then the size of stdscr is used.
+ */
+void
+st_menu_grid_init(int rows, int cols)
+{
+	if (rows <= 0 || cols <= 0)
+		getmaxyx(stdscr, rows, cols);
+
+	free(grid);
+	free(grid_owners);
+
+	grid = malloc(sizeof(ST_MENU_CELL) * rows * cols);
+	grid_owners = malloc(sizeof(WINDOW *) * rows * cols);
+	if (!grid || !grid_owners)
+	{
+		endwin();
+		printf("FATAL: out of memory\n");
+		exit(1);
+	}
+
+	grid_rows = rows;
+	grid_cols = cols;
+
+	st_menu_grid_clear();
+}
+
+/*
+ * Fill grid by spaces with default attributes
+ */
+void
+st_menu_grid_clear(void)
+{
+	int		i;
+
+	for (i = 0; i < grid_rows * grid_cols; i++)
+	{
+		grid[i].ch = L' ';
+		grid[i].attr = A_NORMAL;
+		grid[i].cpn = 0;
+		grid_owners[i] = NULL;
+	}
+}
+
+/*
+ * Returns cells of grid (rows * cols fields, row after row)
+ */
+ST_MENU_CELL *
+st_menu_grid_cells(int *rows, int *cols)
+{
+	if (rows)
+		*rows = grid_rows;
+	if (cols)
+		*cols = grid_cols;
+
+	return grid;
+}
+
+void
+st_menu_grid_free(void)
+{
+	if (st_menu_backend == &grid_backend)
+		st_menu_backend = &ncurses_backend;
+
+	free(grid);
+	free(grid_owners);
+	grid = NULL;
+	grid_owners = NULL;
+	grid_rows = 0;
+	grid_cols = 0;
+}
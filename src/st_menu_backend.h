@@ -0,0 +1,34 @@
+/*
+ * st_menu_backend.h
+ *
+ * Internal interface of output backends. The drawing routines of menubar,
+ * pulldown menu, shadow and command bar don't call ncurses output functions
+ * directly, but these operations. The state of windows (position, size,
+ * cursor, attributes, background) is still held by ncurses windows, only
+ * the output goes through the backend.
+ */
+#ifndef _ST_MENU_BACKEND_H
+
+#define _ST_MENU_BACKEND_H
+
+#include <wchar.h>
+#include "st_curses.h"
+
+typedef struct
+{
+	void	(*put_str)(WINDOW *win, const char *str, int n);
+	void	(*put_ch)(WINDOW *win, chtype ch);
+	void	(*put_wch)(WINDOW *win, wchar_t wch);
+	void	(*change_attr)(WINDOW *win, int y, int x, int n, attr_t attr, short cpn);
+	chtype	(*get_ch)(WINDOW *win, int y, int x);
+	void	(*draw_border)(WINDOW *win,
+					  chtype ls, chtype rs, chtype ts, chtype bs,
+					  chtype tl, chtype tr, chtype bl, chtype br);
+	void	(*erase_window)(WINDOW *win);
+	void	(*shadow_background)(WINDOW *shadow, WINDOW *desktop, WINDOW *cmdbar);
+	void	(*flush)(WINDOW *win);
+} ST_MENU_BACKEND_OPS;
+
+extern const ST_MENU_BACKEND_OPS *st_menu_backend;
+
+#endif
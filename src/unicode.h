@@ -27,6 +27,38 @@ extern const char *utf8_nstrstr(const char *haystack, const char *needle);
 extern const char *utf8_nstrstr_ignore_lower_case(const char *haystack, const char *needle);
 extern bool utf8_isupper(const char *s);
 extern unsigned char *unicode_to_utf8(wchar_t c, unsigned char *utf8string, int *size);
+extern wchar_t utf8_to_unicode(const unsigned char *c);
 extern int utf8_tofold(const char *s);
 
+#define UTF8_NEEDLE_INLINE_CHARS		32
+
+/*
+ * Prepared needle for case insensitive searching. The needle is folded
+ * only once, and it can be used for searching in any number of strings.
+ * Short needles don't need any allocation.
+ */
+typedef struct
+{
+	int			nchars;			/* length of needle in chars */
+	int			nexact;			/* number of case sensitive chars */
+	wchar_t	   *folded;			/* folded chars of needle */
+	wchar_t	   *exact;			/* case sensitive chars, or 0 */
+	int		   *next;			/* KMP failure function */
+	const char **starts;		/* ring of positions of last haystack chars */
+	wchar_t	   *chars;			/* ring of last haystack chars */
+	void	   *allocated;		/* used for long needles */
+	const char *inline_starts[UTF8_NEEDLE_INLINE_CHARS];
+	wchar_t		inline_folded[UTF8_NEEDLE_INLINE_CHARS];
+	wchar_t		inline_exact[UTF8_NEEDLE_INLINE_CHARS];
+	wchar_t		inline_chars[UTF8_NEEDLE_INLINE_CHARS];
+	int			inline_next[UTF8_NEEDLE_INLINE_CHARS];
+} utf8_needle;
+
+extern void utf8_needle_init(utf8_needle *n, const char *needle, bool ignore_lower_case);
+extern void utf8_needle_free(utf8_needle *n);
+extern const char *utf8_needle_search(utf8_needle *n, const char *haystack);
+extern int utf8_nstrstr_batch(const char *needle, bool ignore_lower_case,
+							  const char **haystacks, int nhaystacks,
+							  const char **results);
+
 #endif
@@ -0,0 +1,135 @@
+/*-------------------------------------------------------------------------
+ *
+ * unicode_ascii.h
+ *	  fast scanning of ascii runs inside utf8 strings
+ *
+ * Almost all menu labels are pure ascii strings. The display width of
+ * printable ascii char is 1, so the width of printable ascii run is
+ * same as its length in bytes, and the expensive decoding of utf8 is
+ * necessary only from first non ascii (or control) char. These routines
+ * scan 16 bytes (SSE2) or 8 bytes (other architectures) at once. The
+ * compiler builtins are used only by gcc compatible compilers, other
+ * compilers use portable loops.
+ *
+ * The routines never read more than len bytes, so the caller should
+ * to know the length of string.
+ *
+ * IDENTIFICATION
+ *	  src/unicode_ascii.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PSPG_UNICODE_ASCII_H
+#define PSPG_UNICODE_ASCII_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define ST_MENU_ASCII_SSE2
+#include <emmintrin.h>
+#endif
+
+#define ASCII_WORD_ONES		((uint64_t) 0x0101010101010101ULL)
+#define ASCII_WORD_HIGHS	((uint64_t) 0x8080808080808080ULL)
+
+/*
+ * Returns number of leading bytes of s, that are printable ascii
+ * chars (0x20 .. 0x7e). The scanning stops on any control char (including
+ * '\0'), on DEL and on first byte of multibyte char.
+ */
+static inline size_t
+utf8_ascii_prefix(const char *s, size_t len)
+{
+	const unsigned char *ptr = (const unsigned char *) s;
+	size_t		n = 0;
+
+#if defined(ST_MENU_ASCII_SSE2)
+
+	const __m128i	space = _mm_set1_epi8(0x20);
+	const __m128i	del = _mm_set1_epi8(0x7f);
+
+	while (n + 16 <= len)
+	{
+		__m128i		v = _mm_loadu_si128((const __m128i *) (ptr + n));
+		int			mask;
+
+		/*
+		 * comparation is signed, so bytes with high bit are
+		 * lower than space too.
+		 */
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space),
+											  _mm_cmpeq_epi8(v, del)));
+		if (mask != 0)
+			return n + __builtin_ctz(mask);
+
+		n += 16;
+	}
+
+#else
+
+	while (n + 8 <= len)
+	{
+		uint64_t	w;
+		uint64_t	x;
+
+		memcpy(&w, ptr + n, 8);
+
+		x = w ^ (ASCII_WORD_ONES * 0x7f);
+
+		/* high bit, some byte < 0x20, some byte == 0x7f */
+		if ((w & ASCII_WORD_HIGHS) ||
+			((w - ASCII_WORD_ONES * 0x20) & ~w & ASCII_WORD_HIGHS) ||
+			((x - ASCII_WORD_ONES) & ~x & ASCII_WORD_HIGHS))
+			break;
+
+		n += 8;
+	}
+
+#endif
+
+	while (n < len && ptr[n] >= 0x20 && ptr[n] < 0x7f)
+		n++;
+
+	return n;
+}
+
+/*
+ * Returns number of chars (not bytes) of utf8 string of len bytes.
+ * Every byte that is not continuation byte (10xxxxxx) starts new char.
+ */
+static inline size_t
+utf8_count_chars(const char *s, size_t len)
+{
+	const unsigned char *ptr = (const unsigned char *) s;
+	size_t		continuation = 0;
+	size_t		n = 0;
+
+#if defined(__GNUC__)
+
+	while (n + 8 <= len)
+	{
+		uint64_t	w;
+
+		memcpy(&w, ptr + n, 8);
+
+		/* continuation byte has bit 7 set and bit 6 cleared */
+		w = w & ~(w << 1) & ASCII_WORD_HIGHS;
+		if (w)
+			continuation += __builtin_popcountll(w);
+
+		n += 8;
+	}
+
+#endif
+
+	for (; n < len; n++)
+		if ((ptr[n] & 0xC0) == 0x80)
+			continuation++;
+
+	return len - continuation;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#!/bin/sh
+#
+# Generate single translation unit of st_menu library (st_menu_all.c),
+# and header-only variant (st_menu_all.h). Local includes (searched in
+# include, src and current directory) are inlined, every file only once.
+#
+# st_menu_all.c can be compiled together with application, st_menu.h is
+# not necessary. In header-only mode, exactly one source file of
+# application should to define ST_MENU_IMPLEMENTATION before including
+# st_menu_all.h.
+#
+# Usage: $0 [outdir]
+#
+# unicode_tables.h should be generated before (it is part of usual build).
+#
+
+set -e
+
+outdir="${1:-.}"
+
+inline()
+{
+	awk '
+		function find(name,   dirs, n, i, path, line)
+		{
+			n = split("include src .", dirs, " ");
+			for (i = 1; i <= n; i++)
+			{
+				path = dirs[i] "/" name;
+				if ((getline line < path) >= 0)
+				{
+					close(path);
+					return path;
+				}
+			}
+			return "";
+		}
+
+		function emit(file,   line, name, path)
+		{
+			while ((getline line < file) > 0)
+			{
+				if (line ~ /^#include "/)
+				{
+					name = line;
+					sub(/^#include "/, "", name);
+					sub(/".*$/, "", name);
+
+					path = find(name);
+					if (path != "")
+					{
+						if (!(path in done))
+						{
+							done[path] = 1;
+							print "/* begin of " name " */";
+							emit(path);
+							print "/* end of " name " */";
+						}
+						continue;
+					}
+				}
+
+				print line;
+			}
+
+			close(file);
+		}
+
+		BEGIN {
+			for (i = 1; i < ARGC; i++)
+			{
+				if (ARGV[i] == "src/unicode.c")
+					print "#ifndef HAVE_LIBUNISTRING";
+
+				done[ARGV[i]] = 1;
+				print "/* begin of " ARGV[i] " */";
+				emit(ARGV[i]);
+				print "/* end of " ARGV[i] " */";
+
+				if (ARGV[i] == "src/unicode.c")
+					print "#endif";
+			}
+		}' "$@"
+}
+
+header()
+{
+	echo "/*"
+	echo " * $1"
+	echo " *"
+	echo " * Generated by tools/amalgamate.sh from st_menu sources. Don't edit."
+	echo " */"
+}
+
+# files are ordered so that includes used unconditionally are inlined
+# first, unicode.c is used only when libunistring is not used
+{
+	header "st_menu_all.c - st_menu library as one translation unit"
+	inline include/st_menu.h src/st_menu_styles.c src/st_menu_backend.c \
+		   src/st_menu.c src/unicode.c
+} > "$outdir/st_menu_all.c"
+
+{
+	header "st_menu_all.h - header-only st_menu library"
+	echo "#ifndef _ST_MENU_ALL_H"
+	echo "#define _ST_MENU_ALL_H"
+	inline include/st_menu.h
+	echo "#endif"
+	echo
+	echo "#ifdef ST_MENU_IMPLEMENTATION"
+	echo "#ifndef _ST_MENU_ALL_IMPLEMENTATION"
+	echo "#define _ST_MENU_ALL_IMPLEMENTATION"
+	inline include/st_menu.h src/st_menu_styles.c src/st_menu_backend.c \
+		   src/st_menu.c src/unicode.c
+	echo "#endif"
+	echo "#endif"
+} > "$outdir/st_menu_all.h"
@@ -0,0 +1,140 @@
+#!/usr/bin/perl
+#----------------------------------------------------------------------
+#
+# gen_case_ranges.pl
+#    generates src/unicode_case_ranges.h from Unicode Character Database
+#
+# The simple case folding (status C and S) is taken from CaseFolding.txt,
+# the uppercase chars are chars of general category Lu (UnicodeData.txt)
+# and chars with property Other_Uppercase (PropList.txt, optional).
+#
+# The result is compact list of ranges. Every range holds chars with
+# same fold offset, that have same distance (step) between them. These
+# ranges are source for two-stage lookup tables generated at build time
+# by tools/gen_unicode_tables.c.
+#
+# Usage: perl tools/gen_case_ranges.pl UnicodeData.txt CaseFolding.txt \
+#                [PropList.txt] > src/unicode_case_ranges.h
+#
+#----------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+die "Usage: $0 UnicodeData.txt CaseFolding.txt [PropList.txt]\n"
+	if @ARGV < 2;
+
+my ($unicode_data, $case_folding, $prop_list) = @ARGV;
+
+my %fold;
+my %upper;
+my $version = 'unknown';
+
+open(my $fh, '<', $case_folding) or die "cannot open $case_folding: $!\n";
+while (my $line = <$fh>)
+{
+	$version = $1 if $line =~ /^#\s*CaseFolding-(\d+\.\d+\.\d+)\.txt/;
+
+	$line =~ s/#.*//;
+	next unless $line =~ /\S/;
+
+	my ($code, $status, $mapping) = map { s/^\s+|\s+$//gr } split(/;/, $line);
+
+	# only simple folding - one char to one char
+	next unless $status eq 'C' || $status eq 'S';
+
+	$fold{hex($code)} = hex($mapping) - hex($code);
+}
+close($fh);
+
+open($fh, '<', $unicode_data) or die "cannot open $unicode_data: $!\n";
+while (my $line = <$fh>)
+{
+	my @fields = split(/;/, $line);
+
+	$upper{hex($fields[0])} = 1 if $fields[2] eq 'Lu';
+}
+close($fh);
+
+if (defined $prop_list)
+{
+	open($fh, '<', $prop_list) or die "cannot open $prop_list: $!\n";
+	while (my $line = <$fh>)
+	{
+		next unless $line =~ /^([0-9A-F]+)(?:\.\.([0-9A-F]+))?\s*;\s*Other_Uppercase\b/;
+
+		my ($first, $last) = (hex($1), hex(defined $2 ? $2 : $1));
+
+		$upper{$_} = 1 for ($first .. $last);
+	}
+	close($fh);
+}
+
+#
+# Merge sorted chars to ranges. The next char can be appended to
+# the range, when it has same value and the distance to the last char
+# of range is same as the step of range. Because only immediately
+# following chars are appended, the ranges are not overlapping.
+#
+sub make_ranges
+{
+	my ($map) = @_;
+	my @ranges;
+
+	for my $code (sort { $a <=> $b } keys %$map)
+	{
+		my $r = $ranges[-1];
+
+		if (defined $r && $r->{value} == $map->{$code} &&
+			($r->{first} == $r->{last} || $code - $r->{last} == $r->{step}))
+		{
+			$r->{step} = $code - $r->{first} if $r->{first} == $r->{last};
+			$r->{last} = $code;
+			next;
+		}
+
+		push @ranges, { first => $code, last => $code, step => 1,
+						value => $map->{$code} };
+	}
+
+	return @ranges;
+}
+
+sub print_ranges
+{
+	my ($name, $with_offset, @ranges) = @_;
+
+	printf("static const %s %s[] = {\n", $with_offset ? 'conv_table' : 'range_table', $name);
+
+	for (my $i = 0; $i < @ranges; $i++)
+	{
+		my $r = $ranges[$i];
+
+		print "\t" if $i % 3 == 0;
+
+		if ($with_offset)
+		{
+			printf("{ 0x%X, 0x%X, %d, %d }", $r->{first}, $r->{last}, $r->{step}, $r->{value});
+		}
+		else
+		{
+			printf("{ 0x%X, 0x%X, %d }", $r->{first}, $r->{last}, $r->{step});
+		}
+
+		print $i + 1 < @ranges ? ($i % 3 == 2 ? ",\n" : ", ") : "\n";
+	}
+
+	print "};\n\n";
+}
+
+print <<"EOF";
+/*
+ * unicode_case_ranges.h
+ *
+ * generated by tools/gen_case_ranges.pl from Unicode $version - don't edit
+ */
+
+EOF
+
+print_ranges('tofold_table', 1, make_ranges(\%fold));
+print_ranges('upper_table', 0, make_ranges(\%upper));
@@ -0,0 +1,159 @@
+/*-------------------------------------------------------------------------
+ *
+ * gen_unicode_tables.c
+ *	  generates two-stage lookup tables for unicode routines
+ *
+ * The reference (interval table based) functions from src/unicode_ref.h
+ * are evaluated for every code point, and the result is written as
+ * two-stage table - the first stage is indexed by page (high bits of
+ * code point), and holds a number of block. The second stage holds
+ * blocks of 256 values. Identical blocks are stored only once.
+ *
+ * The case folding table has three stages - the block holds an index
+ * to (small) table of case classes. The case class is pair of fold
+ * offset and uppercase flag.
+ *
+ * Usage: gen_unicode_tables > unicode_tables.h
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unicode_ref.h"
+
+#define UCS_MAX				0x10FFFF
+#define BLOCK_BITS			8
+#define BLOCK_SIZE			(1 << BLOCK_BITS)
+#define NPAGES				((UCS_MAX + 1) >> BLOCK_BITS)
+#define MAX_CASE_CLASSES	256
+
+typedef int (*ucs_property_fn)(wchar_t ucs);
+
+static int blocks[NPAGES][BLOCK_SIZE];
+static int pages[NPAGES];
+
+static int case_class_offsets[MAX_CASE_CLASSES];
+static int case_class_upper[MAX_CASE_CLASSES];
+static int ncase_classes = 0;
+
+/*
+ * Returns index of case class of char. New classes are registered
+ * when they are found.
+ */
+static int
+ucs_case_class(wchar_t ucs)
+{
+	int		offset = ucs_tofold_ref(ucs) - ucs;
+	int		upper = ucs_isupper_ref(ucs);
+	int		i;
+
+	for (i = 0; i < ncase_classes; i++)
+		if (case_class_offsets[i] == offset && case_class_upper[i] == upper)
+			return i;
+
+	if (ncase_classes == MAX_CASE_CLASSES)
+	{
+		fprintf(stderr, "too much different case classes\n");
+		exit(1);
+	}
+
+	case_class_offsets[ncase_classes] = offset;
+	case_class_upper[ncase_classes] = upper;
+
+	return ncase_classes++;
+}
+
+/*
+ * Evaluate property for all code points, and write deduplicated
+ * page and block tables.
+ */
+static void
+write_two_stage_table(const char *name, const char *type, ucs_property_fn fn)
+{
+	int		nblocks = 0;
+	int		page;
+	int		i;
+
+	for (page = 0; page < NPAGES; page++)
+	{
+		int		block[BLOCK_SIZE];
+
+		for (i = 0; i < BLOCK_SIZE; i++)
+			block[i] = fn((wchar_t) ((page << BLOCK_BITS) + i));
+
+		for (i = 0; i < nblocks; i++)
+			if (memcmp(blocks[i], block, sizeof(block)) == 0)
+				break;
+
+		if (i == nblocks)
+			memcpy(blocks[nblocks++], block, sizeof(block));
+
+		pages[page] = i;
+	}
+
+	if (nblocks > 256)
+	{
+		fprintf(stderr, "too much different blocks (%d) for table %s\n", nblocks, name);
+		exit(1);
+	}
+
+	printf("static const unsigned char %s_pages[%d] = {", name, NPAGES);
+	for (page = 0; page < NPAGES; page++)
+		printf("%s%d%s", page % 16 == 0 ? "\n\t" : "",
+						 pages[page],
+						 page + 1 < NPAGES ? ", " : "\n");
+	printf("};\n\n");
+
+	printf("static const %s %s_blocks[%d][%d] = {\n", type, name, nblocks, BLOCK_SIZE);
+	for (i = 0; i < nblocks; i++)
+	{
+		int		j;
+
+		printf("\t{");
+		for (j = 0; j < BLOCK_SIZE; j++)
+			printf("%s%d%s", j % 32 == 0 ? "\n\t\t" : "",
+							 blocks[i][j],
+							 j + 1 < BLOCK_SIZE ? ", " : "\n");
+		printf("\t}%s\n", i + 1 < nblocks ? "," : "");
+	}
+	printf("};\n\n");
+}
+
+int
+main()
+{
+	int		i;
+
+	printf("/*\n"
+		   " * unicode_tables.h\n"
+		   " *\n"
+		   " * generated by tools/gen_unicode_tables.c - don't edit\n"
+		   " */\n\n");
+
+	printf("#define UCS_TABLE_BLOCK_BITS\t\t%d\n", BLOCK_BITS);
+	printf("#define UCS_TABLE_BLOCK_MASK\t\t0x%x\n\n", BLOCK_SIZE - 1);
+
+	/* display width of char: -1, 0, 1, 2 */
+	write_two_stage_table("ucs_width", "signed char", ucs_wcwidth_ref);
+
+	/* index to case classes */
+	write_two_stage_table("ucs_case", "unsigned char", ucs_case_class);
+
+	printf("static const int ucs_case_fold_offsets[%d] = {", ncase_classes);
+	for (i = 0; i < ncase_classes; i++)
+		printf("%s%d%s", i % 16 == 0 ? "\n\t" : "",
+						 case_class_offsets[i],
+						 i + 1 < ncase_classes ? ", " : "\n");
+	printf("};\n\n");
+
+	printf("static const unsigned char ucs_case_upper[%d] = {", ncase_classes);
+	for (i = 0; i < ncase_classes; i++)
+		printf("%s%d%s", i % 16 == 0 ? "\n\t" : "",
+						 case_class_upper[i],
+						 i + 1 < ncase_classes ? ", " : "\n");
+	printf("};\n");
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Workload for profile guided optimization of st_menu library, and
+# report of speedup of optimized build. It is used by "make pgo".
+#
+# Usage: $0 train bench_menu
+#        $0 compare bench_menu_base bench_menu
+#
+
+set -e
+
+# navigation, accelerators and mouse clicks in different styles, sizes
+# of terminal and shapes of menu, wide chars and emoji, and resize of
+# terminal with change of style (menu is created again)
+WORKLOADS="
+-n 20000 -S 1
+-n 20000 -S 3 -c 30 -e 10
+-n 20000 -S 8 -R 12 -C 60
+-n 20000 -S 5 -d 4 -f 12 -g
+-n 20000 -x 500
+"
+
+# number of runs of every workload, the fastest run is used
+RUNS=3
+
+# returns p50 of driver and total latency (ns) of fastest run
+measure()
+{
+	bench="$1"
+	shift
+
+	for run in $(seq $RUNS)
+	do
+		"$bench" -j "$@" | tr -d '\n' |
+			sed 's/.*"driver_ns": { "p50": \([0-9]*\).*"total_ns": { "p50": \([0-9]*\).*/\1 \2/'
+		echo
+	done | sort -n -k2 | head -1
+}
+
+case "$1" in
+	train)
+		echo "$WORKLOADS" | while read args
+		do
+			if [ -n "$args" ]; then
+				echo "training: $args"
+				"$2" $args > /dev/null
+			fi
+		done
+		;;
+
+	compare)
+		printf "%-32s %12s %12s %12s %12s %8s\n" "workload" "base driver" "pgo driver" "base total" "pgo total" "speedup"
+
+		echo "$WORKLOADS" | while read args
+		do
+			if [ -n "$args" ]; then
+				base=$(measure "$2" $args)
+				pgo=$(measure "$3" $args)
+
+				printf "%s %s %s\n" "$args" "$base" "$pgo"
+			fi
+		done | awk '
+			{
+				n = NF;
+				args = $1;
+				for (i = 2; i <= n - 4; i++)
+					args = args " " $i;
+
+				base_driver = $(n - 3); base_total = $(n - 2);
+				pgo_driver = $(n - 1); pgo_total = $n;
+
+				printf "%-32s %10.2fus %10.2fus %10.2fus %10.2fus %7.2fx\n", args,
+					   base_driver / 1000, pgo_driver / 1000,
+					   base_total / 1000, pgo_total / 1000,
+					   (pgo_total > 0 ? base_total / pgo_total : 0);
+
+				sum_base += base_total; sum_pgo += pgo_total;
+			}
+			END {
+				if (sum_pgo > 0)
+					printf "total speedup (sum of p50 of driver and doupdate): %.2fx\n", sum_base / sum_pgo;
+			}'
+		;;
+
+	*)
+		echo "Usage: $0 train bench_menu" >&2
+		echo "       $0 compare bench_menu_base bench_menu" >&2
+		exit 1
+		;;
+esac